@@ -0,0 +1,99 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "bench/benchmark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+namespace icl {
+
+namespace {
+
+// If |arg| is "<flag>=<positive number>", sets |*value| and returns true.
+bool ParseIntFlag(const char* arg, const char* flag, int* value) {
+  size_t length = strlen(flag);
+  if (strncmp(arg, flag, length) != 0 || arg[length] != '=')
+    return false;
+  char* end = nullptr;
+  long parsed = strtol(arg + length + 1, &end, 10);
+  if (*end != '\0' || parsed <= 0 || parsed > 1000000000)
+    return false;
+  *value = static_cast<int>(parsed);
+  return true;
+}
+
+}  // namespace
+
+BenchmarkOptions::BenchmarkOptions() : iterations(0) {}
+
+BenchmarkOptions::~BenchmarkOptions() = default;
+
+bool BenchmarkOptions::Parse(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    int seed = 0;
+    if (ParseIntFlag(argv[i], "--iterations", &iterations) ||
+        ParseIntFlag(argv[i], "--roots", &corpus_options.root_count))
+      continue;
+    if (ParseIntFlag(argv[i], "--seed", &seed)) {
+      corpus_options.seed = static_cast<uint32_t>(seed);
+      continue;
+    }
+    fprintf(stderr,
+            "Unknown or invalid argument: %s\n"
+            "Usage: %s [--iterations=N] [--roots=N] [--seed=N]\n",
+            argv[i], argv[0]);
+    return false;
+  }
+  return true;
+}
+
+int BenchmarkOptions::GetIterations(int default_iterations) const {
+  return iterations > 0 ? iterations : default_iterations;
+}
+
+Benchmark::Benchmark(const std::string& name)
+    : name_(name), bytes_per_iteration_(0), items_per_iteration_(0) {}
+
+Benchmark::~Benchmark() = default;
+
+void Benchmark::Run(int iterations,
+                    const std::function<void()>& setup,
+                    const std::function<void()>& run) {
+  setup();
+  run();
+
+  std::chrono::steady_clock::duration total =
+      std::chrono::steady_clock::duration::zero();
+  for (int i = 0; i < iterations; i++) {
+    setup();
+    auto start = std::chrono::steady_clock::now();
+    run();
+    total += std::chrono::steady_clock::now() - start;
+  }
+
+  double seconds = std::chrono::duration<double>(total).count();
+  printf("{\"benchmark\":\"%s\",\"iterations\":%d,\"seconds\":%.6f,"
+         "\"us_per_iteration\":%.3f",
+         name_.c_str(), iterations, seconds, seconds * 1e6 / iterations);
+  if (bytes_per_iteration_ > 0 && seconds > 0) {
+    printf(",\"bytes_per_second\":%.6g",
+           static_cast<double>(bytes_per_iteration_) * iterations / seconds);
+  }
+  if (items_per_iteration_ > 0 && seconds > 0) {
+    printf(",\"items_per_second\":%.6g",
+           static_cast<double>(items_per_iteration_) * iterations / seconds);
+  }
+  printf("}\n");
+  fflush(stdout);
+}
+
+void Benchmark::Run(int iterations, const std::function<void()>& run) {
+  Run(iterations, []() {}, run);
+}
+
+}  // namespace icl
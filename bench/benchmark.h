@@ -0,0 +1,69 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BENCH_BENCHMARK_H_
+#define BENCH_BENCHMARK_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+
+#include "bench/corpus.h"
+
+namespace icl {
+
+// Options common to the benchmark drivers, from their command lines:
+//   --iterations=N  Runs each benchmark N times (instead of its default).
+//   --roots=N       Generates a corpus with N root files.
+//   --seed=N        Generates the corpus with the given seed.
+struct BenchmarkOptions {
+  BenchmarkOptions();
+  ~BenchmarkOptions();
+
+  // Returns false (after printing a message) if the command line is invalid.
+  bool Parse(int argc, char** argv);
+
+  // Returns |iterations| if set, and otherwise |default_iterations|.
+  int GetIterations(int default_iterations) const;
+
+  // Zero if not set.
+  int iterations;
+  Corpus::Options corpus_options;
+};
+
+// Runs benchmarks a fixed number of times (so that runs are comparable) and
+// prints each result as a line of JSON, e.g.:
+//   {"benchmark":"tokenize","iterations":20,"seconds":1.5,
+//    "us_per_iteration":75000,"bytes_per_second":1.2e+08}
+// (on one line). Throughput is included if the amount of work per iteration is
+// given.
+class Benchmark {
+ public:
+  explicit Benchmark(const std::string& name);
+  ~Benchmark();
+
+  Benchmark(const Benchmark&) = delete;
+  Benchmark& operator=(const Benchmark&) = delete;
+
+  // The amount of work done by each iteration.
+  void set_bytes_per_iteration(uint64_t bytes) { bytes_per_iteration_ = bytes; }
+  void set_items_per_iteration(uint64_t items) { items_per_iteration_ = items; }
+
+  // Calls |setup|, which isn't timed, and then |run|, |iterations| times (after
+  // a first, untimed, warm-up call of each), then prints the result.
+  void Run(int iterations,
+           const std::function<void()>& setup,
+           const std::function<void()>& run);
+  void Run(int iterations, const std::function<void()>& run);
+
+ private:
+  const std::string name_;
+  uint64_t bytes_per_iteration_;
+  uint64_t items_per_iteration_;
+};
+
+}  // namespace icl
+
+#endif  // BENCH_BENCHMARK_H_
@@ -0,0 +1,203 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "bench/corpus.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <utility>
+
+#include "icl/binary_io.h"
+
+namespace icl {
+
+const char kCorpusItemFunction[] = "bag";
+
+namespace {
+
+const char* const kWords[] = {
+    "base",   "net",    "socket", "cache", "file",   "stream", "pool",
+    "url",    "http",   "render", "view",  "layout", "paint",  "audio",
+    "video",  "codec",  "sync",   "task",  "queue",  "thread", "timer",
+    "string", "buffer", "proto",  "mojo",  "gpu",    "skia",   "font",
+};
+const size_t kWordCount = sizeof(kWords) / sizeof(kWords[0]);
+
+// A small, fast generator whose output doesn't depend on the standard library
+// (unlike the <random> distributions), so that corpora are the same
+// everywhere.
+class Random {
+ public:
+  explicit Random(uint32_t seed) : state_(seed ? seed : 1) {}
+
+  // Returns a number in [0, |bound|).
+  uint32_t Next(uint32_t bound) {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 17;
+    state_ ^= state_ << 5;
+    return state_ % bound;
+  }
+
+  const char* Word() { return kWords[Next(kWordCount)]; }
+
+ private:
+  uint32_t state_;
+};
+
+std::string ConfigName(int level) {
+  return "//build/config/level" + std::to_string(level) + ".gni";
+}
+
+// Each level of config imports the next, and builds on its values.
+std::string GenerateConfig(const Corpus::Options& options,
+                           int level,
+                           Random* random) {
+  std::string prefix = "level" + std::to_string(level);
+  std::string contents;
+  if (level + 1 < options.import_depth) {
+    std::string next = "level" + std::to_string(level + 1);
+    contents += "import(\"" + ConfigName(level + 1) + "\")\n\n";
+    contents += prefix + "_name = \"" + prefix + "_${" + next + "_name}\"\n";
+    contents += prefix + "_defines = " + next + "_defines + [\n";
+  } else {
+    contents += prefix + "_name = \"" + prefix + "\"\n";
+    contents += prefix + "_defines = [\n";
+  }
+  for (int i = 0; i < 4; i++) {
+    contents += "  \"ENABLE_" + std::string(random->Word()) + "_" +
+                std::to_string(i) + "=${" + prefix + "_name}\",\n";
+  }
+  contents += "]\n";
+  contents += prefix + "_cflags = [\n";
+  for (int i = 0; i < 4; i++) {
+    contents += "  \"-W" + std::string(random->Word()) + "-" +
+                std::to_string(level) + "\",\n";
+  }
+  contents += "]\n";
+  return contents;
+}
+
+std::string GenerateTemplates() {
+  return "import(\"" + ConfigName(0) + "\")\n"
+         "\n"
+         "template(\"component\") {\n"
+         "  " + kCorpusItemFunction + "(item_name) {\n"
+         "    sources = []\n"
+         "    foreach(source, invoker.sources) {\n"
+         "      sources += [ \"${invoker.dir}/$source\" ]\n"
+         "    }\n"
+         "    defines = level0_defines + [ \"COMPONENT=${item_name}\" ]\n"
+         "    cflags = level0_cflags\n"
+         "    output = \"${invoker.dir}/lib${item_name}.a\"\n"
+         "  }\n"
+         "}\n"
+         "\n"
+         "template(\"test_component\") {\n"
+         "  component(item_name) {\n"
+         "    dir = invoker.dir\n"
+         "    sources = invoker.sources + [ \"test_main.cc\" ]\n"
+         "  }\n"
+         "}\n";
+}
+
+std::string SourceName(Random* random, const std::string& suffix) {
+  return std::string(random->Word()) + "_" + random->Word() + "_" +
+         std::to_string(random->Next(1000)) + suffix;
+}
+
+std::string GenerateRoot(const Corpus::Options& options,
+                         const std::string& dir,
+                         Random* random) {
+  std::string contents = "import(\"//build/templates.gni\")\n\n";
+
+  // Sources shared by the items, one of which each item removes.
+  int common_count = options.sources_per_item / 2 + 1;
+  std::vector<std::string> common_sources;
+  contents += "common_sources = [\n";
+  for (int i = 0; i < common_count; i++) {
+    common_sources.push_back(SourceName(random, ".cc"));
+    contents += "  \"" + common_sources.back() + "\",\n";
+  }
+  contents += "]\n";
+
+  for (int i = 0; i < options.items_per_root; i++) {
+    std::string name = dir.substr(2) + "_" + random->Word() + std::to_string(i);
+    bool is_test = i % 2 == 1;
+    contents += "\n";
+    contents += is_test ? "test_component" : "component";
+    contents += "(\"" + name + "\") {\n";
+    contents += "  dir = \"" + dir + "\"\n";
+    contents += "  sources = common_sources + [\n";
+    for (int j = common_count; j < options.sources_per_item - 1; j++)
+      contents += "    \"" + SourceName(random, ".cc") + "\",\n";
+    contents += "  ]\n";
+    contents += "  sources += [ \"" + SourceName(random, ".h") + "\" ]\n";
+    contents += "  sources -= [ \"" +
+                common_sources[random->Next(common_sources.size())] + "\" ]\n";
+    contents += "}\n";
+  }
+  return contents;
+}
+
+bool CreateDirectory(const std::string& path) {
+  return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+}
+
+}  // namespace
+
+Corpus::Options::Options()
+    : root_count(2000),
+      items_per_root(4),
+      sources_per_item(40),
+      import_depth(10),
+      seed(1) {}
+
+Corpus::Options::~Options() = default;
+
+Corpus::Corpus() = default;
+Corpus::Corpus(Corpus&&) = default;
+Corpus::~Corpus() = default;
+Corpus& Corpus::operator=(Corpus&&) = default;
+
+// static
+Corpus Corpus::Generate(const Options& options) {
+  Random random(options.seed);
+  Corpus corpus;
+  for (int level = 0; level < options.import_depth; level++)
+    corpus.files[ConfigName(level)] = GenerateConfig(options, level, &random);
+  corpus.files["//build/templates.gni"] = GenerateTemplates();
+  for (int i = 0; i < options.root_count; i++) {
+    std::string dir = "//dir" + std::to_string(i);
+    std::string name = dir + "/BUILD.icl";
+    corpus.files[name] = GenerateRoot(options, dir, &random);
+    corpus.roots.push_back(SourceFile(std::move(name)));
+  }
+  for (const auto& file : corpus.files)
+    corpus.total_bytes += file.second.size();
+  corpus.item_count = static_cast<size_t>(options.root_count) *
+                      static_cast<size_t>(options.items_per_root);
+  return corpus;
+}
+
+bool Corpus::WriteTo(const std::string& directory) const {
+  for (const auto& file : files) {
+    // Create the file's directories (the name starts with "//").
+    std::string path = directory;
+    size_t begin = 2;
+    for (size_t slash = file.first.find('/', begin);
+         slash != std::string::npos;
+         begin = slash + 1, slash = file.first.find('/', begin)) {
+      path += "/" + file.first.substr(begin, slash - begin);
+      if (!CreateDirectory(path))
+        return false;
+    }
+    path += "/" + file.first.substr(begin);
+    if (!WriteFileAtomically(path, file.second))
+      return false;
+  }
+  return true;
+}
+
+}  // namespace icl
@@ -0,0 +1,62 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BENCH_CORPUS_H_
+#define BENCH_CORPUS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "icl/source_file.h"
+
+namespace icl {
+
+// The name of the item function used by generated files (see |BagItem|).
+extern const char kCorpusItemFunction[];
+
+// A generated set of files resembling a large build configuration: root
+// ("BUILD") files that invoke templates to define items with long lists of
+// sources (adjusted with += and -=) and lots of string interpolation, and
+// .gni files imported through a deep chain.
+struct Corpus {
+  struct Options {
+    Options();
+    ~Options();
+
+    int root_count;
+    int items_per_root;
+    int sources_per_item;
+    // The length of the chain of imported config files.
+    int import_depth;
+    // Corpora with the same options (including the seed) are identical.
+    uint32_t seed;
+  };
+
+  Corpus();
+  Corpus(Corpus&&);
+  ~Corpus();
+
+  Corpus& operator=(Corpus&&);
+
+  static Corpus Generate(const Options& options);
+
+  // Writes the files under |directory| (which must exist), returning false on
+  // failure.
+  bool WriteTo(const std::string& directory) const;
+
+  // The files, by name (e.g., "//dir12/BUILD.icl").
+  std::map<std::string, std::string> files;
+  std::vector<SourceFile> roots;
+  size_t total_bytes = 0;
+  // The number of items the roots define.
+  size_t item_count = 0;
+};
+
+}  // namespace icl
+
+#endif  // BENCH_CORPUS_H_
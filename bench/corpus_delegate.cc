@@ -0,0 +1,65 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "bench/corpus_delegate.h"
+
+#include "bench/corpus.h"
+#include "icl/function_impls.h"
+#include "icl/import_manager.h"
+#include "icl/item_impls.h"
+#include "icl/source_file.h"
+
+namespace icl {
+
+namespace {
+
+FunctionMap MakeFunctions() {
+  FunctionMap functions = function_impls::GetStandardFunctionsWithImport();
+  functions.insert(BagItem::Fn(kCorpusItemFunction));
+  return functions;
+}
+
+}  // namespace
+
+CorpusDelegate::CorpusDelegate(const Corpus* corpus)
+    : corpus_(corpus),
+      functions_(MakeFunctions()),
+      input_file_manager_(
+          [this](const SourceFile& name, std::string* contents) {
+            auto found = corpus_->files.find(name.value());
+            if (found == corpus_->files.end())
+              return false;
+            *contents = found->second;
+            return true;
+          }),
+      import_manager_(new ImportManager) {}
+
+CorpusDelegate::~CorpusDelegate() = default;
+
+void CorpusDelegate::ResetImports() {
+  // TODO(C++14): Use std::make_unique.
+  import_manager_.reset(new ImportManager);
+}
+
+const FunctionMap& CorpusDelegate::GetFunctions() const {
+  return functions_;
+}
+
+ImportManager* CorpusDelegate::GetImportManager() {
+  return import_manager_.get();
+}
+
+bool CorpusDelegate::GetInputFile(const LocationRange& origin,
+                                  const SourceFile& name,
+                                  const InputFile** file) {
+  return input_file_manager_.GetFile(origin, name, file);
+}
+
+StringPiece CorpusDelegate::GetSourceRoot() const {
+  return StringPiece();
+}
+
+void CorpusDelegate::Print(const std::string& s) {}
+
+}  // namespace icl
@@ -0,0 +1,52 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BENCH_CORPUS_DELEGATE_H_
+#define BENCH_CORPUS_DELEGATE_H_
+
+#include <memory>
+#include <string>
+
+#include "icl/delegate.h"
+#include "icl/function.h"
+#include "icl/input_file_manager.h"
+
+namespace icl {
+
+class ImportManager;
+struct Corpus;
+
+// A (thread-safe) delegate that reads files from a |Corpus|, which must
+// outlive it.
+class CorpusDelegate : public Delegate {
+ public:
+  explicit CorpusDelegate(const Corpus* corpus);
+  ~CorpusDelegate();
+
+  CorpusDelegate(const CorpusDelegate&) = delete;
+  CorpusDelegate& operator=(const CorpusDelegate&) = delete;
+
+  // Forgets all imports (but not the files that have been loaded), so that
+  // they're done again.
+  void ResetImports();
+
+  // |Delegate| methods:
+  const FunctionMap& GetFunctions() const override;
+  ImportManager* GetImportManager() override;
+  bool GetInputFile(const LocationRange& origin,
+                    const SourceFile& name,
+                    const InputFile** file) override;
+  StringPiece GetSourceRoot() const override;
+  void Print(const std::string& s) override;
+
+ private:
+  const Corpus* const corpus_;
+  const FunctionMap functions_;
+  InputFileManager input_file_manager_;
+  std::unique_ptr<ImportManager> import_manager_;
+};
+
+}  // namespace icl
+
+#endif  // BENCH_CORPUS_DELEGATE_H_
@@ -0,0 +1,41 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures executing the corpus's root files, once they (and the files they
+// import) are loaded and the imports are done.
+
+#include <stdio.h>
+
+#include <string>
+
+#include "bench/benchmark.h"
+#include "bench/corpus.h"
+#include "bench/corpus_delegate.h"
+#include "icl/runner.h"
+
+int main(int argc, char** argv) {
+  icl::BenchmarkOptions options;
+  if (!options.Parse(argc, argv))
+    return 1;
+  icl::Corpus corpus = icl::Corpus::Generate(options.corpus_options);
+  icl::CorpusDelegate delegate(&corpus);
+  icl::Runner runner(&delegate);
+
+  icl::Benchmark benchmark("execute");
+  benchmark.set_items_per_iteration(corpus.item_count);
+  std::string error_message;
+  benchmark.Run(options.GetIterations(5), [&corpus, &runner,
+                                           &error_message]() {
+    for (const auto& root : corpus.roots) {
+      icl::Runner::RunResult result = runner.Run(root);
+      if (!result.is_success())
+        error_message = result.error_message();
+    }
+  });
+  if (!error_message.empty()) {
+    fprintf(stderr, "%s", error_message.c_str());
+    return 1;
+  }
+  return 0;
+}
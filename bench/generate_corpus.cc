@@ -0,0 +1,33 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Writes the benchmark corpus to a directory, e.g., to profile other tools on
+// it. Usage: generate_corpus [--roots=N] [--seed=N] <directory>
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "bench/benchmark.h"
+#include "bench/corpus.h"
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s [--roots=N] [--seed=N] <directory>\n", argv[0]);
+    return 1;
+  }
+  // The last argument is the directory.
+  icl::BenchmarkOptions options;
+  if (!options.Parse(argc - 1, argv))
+    return 1;
+  icl::Corpus corpus = icl::Corpus::Generate(options.corpus_options);
+  if (!corpus.WriteTo(argv[argc - 1])) {
+    fprintf(stderr, "Failed to write to %s\n", argv[argc - 1]);
+    return 1;
+  }
+  printf("Wrote %zu files (%zu bytes).\n", corpus.files.size(),
+         corpus.total_bytes);
+  return 0;
+}
@@ -0,0 +1,68 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures importing the corpus's templates (and so its chain of configs) into
+// a scope per root file: with the imports done once per iteration ("cold"),
+// and already done ("warm").
+
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench/benchmark.h"
+#include "bench/corpus.h"
+#include "bench/corpus_delegate.h"
+#include "icl/err.h"
+#include "icl/input_file.h"
+#include "icl/parse_tree.h"
+#include "icl/parser.h"
+#include "icl/scope.h"
+#include "icl/source_file.h"
+#include "icl/tokenizer.h"
+
+int main(int argc, char** argv) {
+  icl::BenchmarkOptions options;
+  if (!options.Parse(argc, argv))
+    return 1;
+  icl::Corpus corpus = icl::Corpus::Generate(options.corpus_options);
+  icl::CorpusDelegate delegate(&corpus);
+
+  icl::InputFile file(icl::SourceFile("//import.icl"));
+  file.SetContents("import(\"//build/templates.gni\")\n");
+  icl::Err err;
+  std::vector<icl::Token> tokens = icl::Tokenizer::Tokenize(&file, &err);
+  std::unique_ptr<icl::ParseNode> root;
+  if (!err.has_error())
+    root = icl::Parser::Parse(tokens, &err);
+  if (err.has_error()) {
+    fprintf(stderr, "%s", err.GetErrorMessage().c_str());
+    return 1;
+  }
+
+  auto run = [&corpus, &delegate, &root, &err]() {
+    for (size_t i = 0; i < corpus.roots.size(); i++) {
+      icl::Scope scope(&delegate);
+      scope.set_source_dir(corpus.roots[i].GetDir());
+      root->Execute(&scope, &err);
+    }
+  };
+  int iterations = options.GetIterations(20);
+
+  icl::Benchmark cold_benchmark("import_cold");
+  cold_benchmark.set_items_per_iteration(corpus.roots.size());
+  cold_benchmark.Run(iterations, [&delegate]() { delegate.ResetImports(); },
+                     run);
+
+  icl::Benchmark warm_benchmark("import_warm");
+  warm_benchmark.set_items_per_iteration(corpus.roots.size());
+  warm_benchmark.Run(iterations, run);
+
+  if (err.has_error()) {
+    fprintf(stderr, "%s", err.GetErrorMessage().c_str());
+    return 1;
+  }
+  return 0;
+}
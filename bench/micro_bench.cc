@@ -0,0 +1,374 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Microbenchmarks of the core data structures and operations: scope lookups
+// and updates, value copies, list and string operators, template invocations,
+// tokenizing, parsing and merging scopes.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bench/benchmark.h"
+#include "bench/corpus.h"
+#include "icl/err.h"
+#include "icl/input_file.h"
+#include "icl/parse_tree.h"
+#include "icl/parser.h"
+#include "icl/scope.h"
+#include "icl/source_file.h"
+#include "icl/test_with_scope.h"
+#include "icl/tokenizer.h"
+#include "icl/value.h"
+
+namespace icl {
+namespace {
+
+// Results are accumulated here, so that the work isn't optimized away.
+volatile size_t g_sink = 0;
+
+// A provider with no values (which is still asked about each lookup).
+class EmptyProvider : public Scope::ProgrammaticProvider {
+ public:
+  explicit EmptyProvider(Scope* scope) : ProgrammaticProvider(scope) {}
+  ~EmptyProvider() override = default;
+
+  const Value* GetProgrammaticValue(const StringPiece& ident) override {
+    return nullptr;
+  }
+};
+
+Value MakeStringList(size_t size, const std::string& prefix) {
+  Value list(nullptr, Value::LIST);
+  list.list_value().reserve(size);
+  for (size_t i = 0; i < size; i++)
+    list.list_value().push_back(Value(nullptr, prefix + std::to_string(i)));
+  return list;
+}
+
+// Returns a scope value with |width| values, and nested scopes |depth| deep.
+Value MakeNestedScope(Delegate* delegate, int width, int depth) {
+  std::unique_ptr<Scope> scope(new Scope(delegate));
+  static std::vector<std::string> names;
+  while (names.size() < static_cast<size_t>(width) + 1)
+    names.push_back("value" + std::to_string(names.size()));
+  for (int i = 0; i < width; i++)
+    scope->SetValue(names[i], Value(nullptr, static_cast<int64_t>(i)), nullptr);
+  if (depth > 0) {
+    scope->SetValue(names[width], MakeNestedScope(delegate, width, depth - 1),
+                    nullptr);
+  }
+  return Value(nullptr, std::move(scope));
+}
+
+// Parses |input|, exiting on failure.
+std::unique_ptr<TestParseInput> Parse(std::string input) {
+  std::unique_ptr<TestParseInput> parsed(
+      new TestParseInput(std::move(input)));
+  if (parsed->has_error()) {
+    fprintf(stderr, "%s", parsed->parse_err().GetErrorMessage().c_str());
+    exit(1);
+  }
+  return parsed;
+}
+
+// Executes |parsed| in |scope|, exiting on failure.
+void Execute(const TestParseInput& parsed, Scope* scope) {
+  Err err;
+  parsed.parsed()->Execute(scope, &err);
+  if (err.has_error()) {
+    fprintf(stderr, "%s", err.GetErrorMessage().c_str());
+    exit(1);
+  }
+}
+
+void BenchmarkGetValue(int iterations) {
+  const int kLookups = 1000000;
+  for (int depth : {0, 4, 16}) {
+    TestWithScope setup;
+    setup.scope()->SetValue("x", Value(nullptr, static_cast<int64_t>(1)),
+                            nullptr);
+    std::vector<std::unique_ptr<Scope>> chain;
+    Scope* scope = setup.scope();
+    for (int i = 0; i < depth; i++) {
+      chain.emplace_back(new Scope(scope));
+      scope = chain.back().get();
+    }
+
+    Benchmark benchmark("scope_get_value_depth_" + std::to_string(depth));
+    benchmark.set_items_per_iteration(kLookups);
+    benchmark.Run(iterations, [scope]() {
+      size_t found = 0;
+      for (int i = 0; i < kLookups; i++)
+        found += scope->GetValue("x", true) != nullptr;
+      g_sink += found;
+    });
+  }
+
+  for (int provider_count : {1, 4}) {
+    TestWithScope setup;
+    setup.scope()->SetValue("x", Value(nullptr, static_cast<int64_t>(1)),
+                            nullptr);
+    std::vector<std::unique_ptr<EmptyProvider>> providers;
+    for (int i = 0; i < provider_count; i++)
+      providers.emplace_back(new EmptyProvider(setup.scope()));
+
+    Benchmark benchmark("scope_get_value_providers_" +
+                        std::to_string(provider_count));
+    benchmark.set_items_per_iteration(kLookups);
+    Scope* scope = setup.scope();
+    benchmark.Run(iterations, [scope]() {
+      size_t found = 0;
+      for (int i = 0; i < kLookups; i++)
+        found += scope->GetValue("x", true) != nullptr;
+      g_sink += found;
+    });
+  }
+}
+
+void BenchmarkSetValue(int iterations) {
+  const size_t kNames = 1000;
+  std::vector<std::string> names;
+  for (size_t i = 0; i < kNames; i++)
+    names.push_back("name" + std::to_string(i));
+  TestWithScope setup;
+
+  // Sets each value twice in a new scope.
+  Benchmark benchmark("scope_set_value_churn");
+  benchmark.set_items_per_iteration(100 * 2 * kNames);
+  benchmark.Run(iterations, [&names, &setup]() {
+    for (int i = 0; i < 100; i++) {
+      Scope scope(setup.scope());
+      for (int round = 0; round < 2; round++) {
+        for (const std::string& name : names) {
+          scope.SetValue(name, Value(nullptr, static_cast<int64_t>(round)),
+                         nullptr);
+        }
+      }
+      g_sink += scope.GetValue(names[0], false)->int_value();
+    }
+  });
+}
+
+void BenchmarkValues(int iterations) {
+  const size_t kListSize = 10000;
+  TestWithScope setup;
+  Value list = MakeStringList(kListSize, "//some/fairly/long/path/file");
+  Value same_list = list;
+
+  {
+    Benchmark benchmark("value_copy_list_10000");
+    benchmark.set_items_per_iteration(100 * kListSize);
+    benchmark.Run(iterations, [&list]() {
+      for (int i = 0; i < 100; i++) {
+        Value copy = list;
+        g_sink += copy.list_value().size();
+      }
+    });
+  }
+  {
+    Benchmark benchmark("value_move_list_10000");
+    benchmark.set_items_per_iteration(100000);
+    benchmark.Run(iterations, [&list]() {
+      for (int i = 0; i < 100000; i++) {
+        Value moved = std::move(list);
+        list = std::move(moved);
+      }
+      g_sink += list.list_value().size();
+    });
+  }
+  {
+    Benchmark benchmark("value_compare_list_10000");
+    benchmark.set_items_per_iteration(100 * kListSize);
+    benchmark.Run(iterations, [&list, &same_list]() {
+      for (int i = 0; i < 100; i++)
+        g_sink += list == same_list;
+    });
+  }
+
+  Value scope = MakeNestedScope(&setup, 100, 3);
+  Value same_scope = scope;
+  {
+    Benchmark benchmark("value_copy_nested_scope");
+    benchmark.Run(iterations, [&scope]() {
+      for (int i = 0; i < 100; i++) {
+        Value copy = scope;
+        g_sink += copy.scope_value() != nullptr;
+      }
+    });
+  }
+  {
+    Benchmark benchmark("value_compare_nested_scope");
+    benchmark.Run(iterations, [&scope, &same_scope]() {
+      for (int i = 0; i < 100; i++)
+        g_sink += scope == same_scope;
+    });
+  }
+}
+
+void BenchmarkOperators(int iterations) {
+  const size_t kListSize = 10000;
+  TestWithScope setup;
+  Value list = MakeStringList(kListSize, "file");
+  setup.scope()->SetValue("to_remove", MakeStringList(100, "file"), nullptr);
+  setup.scope()->SetValue("to_add", MakeStringList(1000, "file"), nullptr);
+  setup.scope()->SetValue("suffix", Value(nullptr, "_some_suffix"), nullptr);
+
+  // |RemoveMatchesFromList()|.
+  {
+    std::unique_ptr<TestParseInput> parsed = Parse("list -= to_remove\n");
+    Benchmark benchmark("list_minus_equals_100_from_10000");
+    benchmark.set_items_per_iteration(kListSize);
+    benchmark.Run(iterations,
+                  [&setup, &list]() {
+                    setup.scope()->SetValue("list", list, nullptr);
+                  },
+                  [&setup, &parsed]() { Execute(*parsed, setup.scope()); });
+  }
+
+  // |ExecutePlusEquals()|.
+  {
+    std::unique_ptr<TestParseInput> parsed = Parse(
+        "foreach(i, [0, 1, 2, 3, 4, 5, 6, 7, 8, 9]) {\n"
+        "  list += to_add\n"
+        "}\n");
+    Benchmark benchmark("list_plus_equals_1000");
+    benchmark.set_items_per_iteration(10 * 1000);
+    benchmark.Run(iterations,
+                  [&setup]() {
+                    setup.scope()->SetValue(
+                        "list", Value(nullptr, Value::LIST), nullptr);
+                  },
+                  [&setup, &parsed]() { Execute(*parsed, setup.scope()); });
+  }
+  {
+    std::string input;
+    for (int i = 0; i < 1000; i++)
+      input += "string += suffix\n";
+    std::unique_ptr<TestParseInput> parsed = Parse(std::move(input));
+    Benchmark benchmark("string_plus_equals");
+    benchmark.set_items_per_iteration(1000);
+    benchmark.Run(iterations,
+                  [&setup]() {
+                    setup.scope()->SetValue("string", Value(nullptr, ""),
+                                            nullptr);
+                  },
+                  [&setup, &parsed]() { Execute(*parsed, setup.scope()); });
+  }
+}
+
+void BenchmarkTemplates(int iterations) {
+  const size_t kInvocations = 1000;
+  TestWithScope setup;
+  std::unique_ptr<TestParseInput> definition = Parse(
+      "template(\"component\") {\n"
+      "  assert(item_name != \"\" && invoker.enabled)\n"
+      "}\n");
+  Execute(*definition, setup.scope());
+  setup.scope()->SetValue("l", MakeStringList(kInvocations, "item"), nullptr);
+  std::unique_ptr<TestParseInput> parsed = Parse(
+      "foreach(i, l) {\n"
+      "  component(i) {\n"
+      "    enabled = true\n"
+      "  }\n"
+      "}\n");
+
+  {
+    Benchmark benchmark("template_invoke");
+    benchmark.set_items_per_iteration(kInvocations);
+    benchmark.Run(iterations,
+                  [&setup, &parsed]() { Execute(*parsed, setup.scope()); });
+  }
+
+  // With (used) target defaults, which every invocation sees.
+  Scope* defaults = setup.scope()->MakeTargetDefaults("component");
+  defaults->SetValue("configs", MakeStringList(100, "config"), nullptr);
+  defaults->SetValue("defines", MakeStringList(100, "define"), nullptr);
+  defaults->MarkAllUsed();
+  {
+    Benchmark benchmark("template_invoke_with_defaults");
+    benchmark.set_items_per_iteration(kInvocations);
+    benchmark.Run(iterations,
+                  [&setup, &parsed]() { Execute(*parsed, setup.scope()); });
+  }
+}
+
+void BenchmarkTokenizeAndParse(int iterations) {
+  // About a megabyte of root files from the corpus.
+  Corpus::Options options;
+  options.root_count = 200;
+  Corpus corpus = Corpus::Generate(options);
+  std::string contents;
+  for (const SourceFile& root : corpus.roots) {
+    contents += corpus.files[root.value()];
+    if (contents.size() >= 1024 * 1024)
+      break;
+  }
+  InputFile file(SourceFile("//megabyte.icl"));
+  file.SetContents(std::move(contents));
+  Err err;
+  std::vector<Token> tokens = Tokenizer::Tokenize(&file, &err);
+  if (err.has_error()) {
+    fprintf(stderr, "%s", err.GetErrorMessage().c_str());
+    exit(1);
+  }
+
+  {
+    Benchmark benchmark("tokenize");
+    benchmark.set_bytes_per_iteration(file.contents().size());
+    benchmark.Run(iterations, [&file]() {
+      Err err;
+      g_sink += Tokenizer::Tokenize(&file, &err).size();
+    });
+  }
+  {
+    Benchmark benchmark("parse");
+    benchmark.set_bytes_per_iteration(file.contents().size());
+    benchmark.Run(iterations, [&tokens]() {
+      Err err;
+      g_sink += Parser::Parse(tokens, &err) != nullptr;
+    });
+  }
+}
+
+void BenchmarkMerge(int iterations) {
+  const size_t kValues = 1000;
+  TestWithScope setup;
+  Value source = MakeNestedScope(&setup, kValues, 0);
+  Scope::MergeOptions options;
+
+  Benchmark benchmark("non_recursive_merge_to_1000");
+  benchmark.set_items_per_iteration(100 * kValues);
+  benchmark.Run(iterations, [&setup, &source, &options]() {
+    for (int i = 0; i < 100; i++) {
+      Scope dest(setup.scope());
+      Err err;
+      source.scope_value()->NonRecursiveMergeTo(&dest, options, nullptr,
+                                                "merge", &err);
+      g_sink += !err.has_error();
+    }
+  });
+}
+
+}  // namespace
+}  // namespace icl
+
+int main(int argc, char** argv) {
+  icl::BenchmarkOptions options;
+  if (!options.Parse(argc, argv))
+    return 1;
+  int iterations = options.GetIterations(10);
+  icl::BenchmarkGetValue(iterations);
+  icl::BenchmarkSetValue(iterations);
+  icl::BenchmarkValues(iterations);
+  icl::BenchmarkOperators(iterations);
+  icl::BenchmarkTemplates(iterations);
+  icl::BenchmarkTokenizeAndParse(iterations);
+  icl::BenchmarkMerge(iterations);
+  return 0;
+}
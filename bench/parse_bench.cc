@@ -0,0 +1,58 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures parsing the (already tokenized) corpus.
+
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench/benchmark.h"
+#include "bench/corpus.h"
+#include "icl/err.h"
+#include "icl/input_file.h"
+#include "icl/parse_tree.h"
+#include "icl/parser.h"
+#include "icl/source_file.h"
+#include "icl/tokenizer.h"
+
+int main(int argc, char** argv) {
+  icl::BenchmarkOptions options;
+  if (!options.Parse(argc, argv))
+    return 1;
+  icl::Corpus corpus = icl::Corpus::Generate(options.corpus_options);
+
+  std::vector<std::unique_ptr<icl::InputFile>> files;
+  std::vector<std::vector<icl::Token>> tokens;
+  for (const auto& file : corpus.files) {
+    files.emplace_back(
+        new icl::InputFile(icl::SourceFile(std::string(file.first))));
+    files.back()->SetContents(std::string(file.second));
+    icl::Err err;
+    tokens.push_back(icl::Tokenizer::Tokenize(files.back().get(), &err));
+    if (err.has_error()) {
+      fprintf(stderr, "%s", err.GetErrorMessage().c_str());
+      return 1;
+    }
+  }
+
+  icl::Benchmark benchmark("parse");
+  benchmark.set_bytes_per_iteration(corpus.total_bytes);
+  bool ok = true;
+  benchmark.Run(options.GetIterations(20), [&tokens, &ok]() {
+    for (const auto& file_tokens : tokens) {
+      icl::Err err;
+      std::unique_ptr<icl::ParseNode> root =
+          icl::Parser::Parse(file_tokens, &err);
+      ok &= !err.has_error() && root;
+    }
+  });
+  if (!ok) {
+    fprintf(stderr, "Parsing failed.\n");
+    return 1;
+  }
+  return 0;
+}
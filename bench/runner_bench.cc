@@ -0,0 +1,65 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures running the corpus's root files from scratch (loading, importing
+// and executing everything), serially and with |Runner::RunMany()|.
+
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench/benchmark.h"
+#include "bench/corpus.h"
+#include "bench/corpus_delegate.h"
+#include "icl/runner.h"
+#include "icl/thread_pool.h"
+
+int main(int argc, char** argv) {
+  icl::BenchmarkOptions options;
+  if (!options.Parse(argc, argv))
+    return 1;
+  icl::Corpus corpus = icl::Corpus::Generate(options.corpus_options);
+  int iterations = options.GetIterations(5);
+
+  std::unique_ptr<icl::CorpusDelegate> delegate;
+  auto setup = [&corpus, &delegate]() {
+    // TODO(C++14): Use std::make_unique.
+    delegate.reset(new icl::CorpusDelegate(&corpus));
+  };
+  std::string error_message;
+
+  icl::Benchmark benchmark("runner");
+  benchmark.set_bytes_per_iteration(corpus.total_bytes);
+  benchmark.set_items_per_iteration(corpus.item_count);
+  benchmark.Run(iterations, setup, [&corpus, &delegate, &error_message]() {
+    icl::Runner runner(delegate.get());
+    for (const auto& root : corpus.roots) {
+      icl::Runner::RunResult result = runner.Run(root);
+      if (!result.is_success())
+        error_message = result.error_message();
+    }
+  });
+
+  icl::ThreadPool pool(icl::ThreadPool::GetHardwareThreadCount() - 1);
+  icl::Benchmark many_benchmark(
+      "runner_many_" + std::to_string(pool.thread_count() + 1) + "_threads");
+  many_benchmark.set_bytes_per_iteration(corpus.total_bytes);
+  many_benchmark.set_items_per_iteration(corpus.item_count);
+  many_benchmark.Run(iterations, setup, [&corpus, &delegate, &pool,
+                                         &error_message]() {
+    icl::Runner runner(delegate.get());
+    for (const auto& result : runner.RunMany(corpus.roots, &pool)) {
+      if (!result.is_success())
+        error_message = result.error_message();
+    }
+  });
+
+  if (!error_message.empty()) {
+    fprintf(stderr, "%s", error_message.c_str());
+    return 1;
+  }
+  return 0;
+}
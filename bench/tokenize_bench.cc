@@ -0,0 +1,49 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures tokenizing the corpus.
+
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench/benchmark.h"
+#include "bench/corpus.h"
+#include "icl/err.h"
+#include "icl/input_file.h"
+#include "icl/source_file.h"
+#include "icl/tokenizer.h"
+
+int main(int argc, char** argv) {
+  icl::BenchmarkOptions options;
+  if (!options.Parse(argc, argv))
+    return 1;
+  icl::Corpus corpus = icl::Corpus::Generate(options.corpus_options);
+
+  std::vector<std::unique_ptr<icl::InputFile>> files;
+  for (const auto& file : corpus.files) {
+    files.emplace_back(
+        new icl::InputFile(icl::SourceFile(std::string(file.first))));
+    files.back()->SetContents(std::string(file.second));
+  }
+
+  icl::Benchmark benchmark("tokenize");
+  benchmark.set_bytes_per_iteration(corpus.total_bytes);
+  bool ok = true;
+  benchmark.Run(options.GetIterations(20), [&files, &ok]() {
+    for (const auto& file : files) {
+      icl::Err err;
+      std::vector<icl::Token> tokens =
+          icl::Tokenizer::Tokenize(file.get(), &err);
+      ok &= !err.has_error() && !tokens.empty();
+    }
+  });
+  if (!ok) {
+    fprintf(stderr, "Tokenizing failed.\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,136 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/allocator.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+
+#include "icl/evaluation_stats.h"
+
+namespace icl {
+
+namespace {
+
+// Precedes an object from an |Allocator|, naming the allocator and where the
+// memory it returned starts.
+struct Header {
+  size_t offset;
+  Allocator* allocator;
+};
+
+// What's allocated beyond an object from an |Allocator|: the header, and room
+// to place the object at |kObjectAlignment| past a multiple of
+// alignof(max_align_t), whatever the alignment of the memory returned.
+const size_t kOverhead = sizeof(Header) + alignof(max_align_t) - 1;
+
+// Returns true if |ptr| is an object from an |Allocator|, rather than the
+// global operator new.
+bool HasHeader(const void* ptr) {
+  return reinterpret_cast<uintptr_t>(ptr) % alignof(max_align_t) != 0;
+}
+
+// Allocates with the global operator new, for objects that need a header
+// because it returned memory that looks like it has one (see
+// |Allocator::AllocateObject()|).
+class GlobalAllocator : public Allocator {
+ public:
+  GlobalAllocator() = default;
+  ~GlobalAllocator() override = default;
+
+  // |Allocator| methods:
+  void* Allocate(size_t size, Category category) override {
+    return ::operator new(size);
+  }
+  void Free(void* ptr, size_t size, Category category) override {
+    ::operator delete(ptr);
+  }
+};
+
+Allocator* GetGlobalAllocator() {
+  // Never destroyed, since objects may outlive static destruction.
+  static GlobalAllocator* allocator = new GlobalAllocator;
+  return allocator;
+}
+
+}  // namespace
+
+// static
+const size_t Allocator::kObjectAlignment;
+
+Allocator::Allocator() = default;
+
+Allocator::~Allocator() = default;
+
+// static
+const char* Allocator::GetCategoryName(Category category) {
+  switch (category) {
+    case SCOPE:
+      return "scope";
+    case PARSE_NODE:
+      return "parse_node";
+    case INPUT_FILE:
+      return "input_file";
+    case VALUE_LIST:
+      return "value_list";
+    case VALUE_STRING:
+      return "value_string";
+    case INPUT_FILE_CONTENTS:
+      return "input_file_contents";
+    case CATEGORY_COUNT:
+      break;
+  }
+  assert(false);
+  return "";
+}
+
+// static
+void* Allocator::AllocateObject(size_t size, Category category) {
+  StatsRecorder::CountAllocation(category, size);
+  Allocator* allocator = current();
+  if (!allocator) {
+    void* ptr = ::operator new(size);
+    if (!HasHeader(ptr))
+      return ptr;
+    // A replaced operator new that doesn't align to alignof(max_align_t) would
+    // have the object freed as if it had a header, so give it one.
+    ::operator delete(ptr);
+    allocator = GetGlobalAllocator();
+  }
+  char* memory =
+      static_cast<char*>(allocator->Allocate(kOverhead + size, category));
+  // The object goes at the first address past the header that's
+  // |kObjectAlignment| past a multiple of alignof(max_align_t), so that it's
+  // recognized as having a header (whatever the alignment of |memory|).
+  uintptr_t address = reinterpret_cast<uintptr_t>(memory) + sizeof(Header);
+  address += (kObjectAlignment - address % alignof(max_align_t) +
+              alignof(max_align_t)) %
+             alignof(max_align_t);
+  char* object = reinterpret_cast<char*>(address);
+  assert(HasHeader(object));
+  assert(object + size <= memory + kOverhead + size);
+  Header* header = reinterpret_cast<Header*>(object - sizeof(Header));
+  header->offset = object - memory;
+  header->allocator = allocator;
+  return object;
+}
+
+// static
+void Allocator::FreeObject(void* ptr, size_t size, Category category) {
+  if (!ptr)
+    return;
+  if (!HasHeader(ptr)) {
+    ::operator delete(ptr);
+    return;
+  }
+  char* object = static_cast<char*>(ptr);
+  const Header* header =
+      reinterpret_cast<const Header*>(object - sizeof(Header));
+  header->allocator->Free(object - header->offset, kOverhead + size, category);
+}
+
+}  // namespace icl
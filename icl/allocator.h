@@ -0,0 +1,85 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_ALLOCATOR_H_
+#define ICL_ALLOCATOR_H_
+
+#include <stddef.h>
+
+#include "icl/evaluation_context.h"
+
+namespace icl {
+
+// Allocates the interpreter's objects: scopes, parse nodes and input files. An
+// embedder may plug in its own allocator (e.g., an arena or pool) for a thread
+// with an |EvaluationContext| (see also |Delegate::GetAllocator()|); otherwise,
+// objects are allocated with the global operator new. Either way, allocations
+// are counted by the current |StatsRecorder|, if any, by |Category|.
+//
+// Only those objects come from an allocator. The storage of values' strings
+// and lists and of input files' contents and tokens is held in standard
+// containers, so it's allocated with the global operator new and only
+// counted; other storage (e.g., errors) isn't counted at all. So an allocator
+// sees a fraction of the interpreter's memory, not all of it.
+//
+// Each object remembers the allocator it came from, and is freed with it, even
+// on another thread or after the allocator is no longer current. So an
+// allocator must be thread-safe, and outlive all the objects allocated with it
+// (including ones the delegate keeps, such as loaded files and imports).
+// Objects allocated with the global operator new don't need to remember
+// anything, so they cost nothing extra.
+class Allocator {
+ public:
+  enum Category {
+    SCOPE,
+    PARSE_NODE,
+    INPUT_FILE,
+    // The storage of values' lists and strings, and of input files' contents
+    // and tokens, is only counted (since it's allocated by standard containers,
+    // and so not with an |Allocator|).
+    VALUE_LIST,
+    VALUE_STRING,
+    INPUT_FILE_CONTENTS,
+
+    CATEGORY_COUNT
+  };
+
+  virtual ~Allocator();
+
+  // Returns memory of at least |size| bytes, with any alignment (objects are
+  // aligned within it). May be called on any thread.
+  virtual void* Allocate(size_t size, Category category) = 0;
+  // Frees memory returned by |Allocate()| (with the same |size| and
+  // |category|). May be called on any thread.
+  virtual void Free(void* ptr, size_t size, Category category) = 0;
+
+  // The current thread's allocator, or null.
+  static Allocator* current() {
+    return EvaluationContext::current().allocator;
+  }
+
+  // Returns a name for |category|, e.g., "parse_node".
+  static const char* GetCategoryName(Category category);
+
+  // Allocate and free an object of the given size and category with the
+  // current allocator, for use by class-specific operators new and (sized)
+  // delete. The object's alignment must be at most |kObjectAlignment|.
+  static void* AllocateObject(size_t size, Category category);
+  static void FreeObject(void* ptr, size_t size, Category category);
+
+  // An object from an |Allocator| is preceded by a header naming it, and is
+  // placed so that it's only aligned to half of what operator new guarantees
+  // (whatever the alignment of the memory the allocator returned), which
+  // distinguishes it from an object allocated with the global operator new.
+  // (If a replaced global operator new returns memory that isn't aligned that
+  // much, the object is given a header too.)
+  static const size_t kObjectAlignment = alignof(max_align_t) / 2;
+
+ protected:
+  Allocator();
+};
+
+}  // namespace icl
+
+#endif  // ICL_ALLOCATOR_H_
@@ -0,0 +1,211 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/allocator.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "icl/evaluation_context.h"
+#include "icl/evaluation_stats.h"
+#include "icl/input_file.h"
+#include "icl/parse_tree.h"
+#include "icl/scope.h"
+#include "icl/source_file.h"
+#include "icl/test_with_scope.h"
+
+namespace icl {
+namespace {
+
+static_assert(alignof(Scope) <= Allocator::kObjectAlignment,
+              "Scopes are allocated with an Allocator");
+static_assert(alignof(InputFile) <= Allocator::kObjectAlignment,
+              "Input files are allocated with an Allocator");
+static_assert(alignof(ParseNode) <= Allocator::kObjectAlignment,
+              "Parse nodes are allocated with an Allocator");
+
+// Keeps track of the memory it has allocated.
+class TrackingAllocator : public Allocator {
+ public:
+  TrackingAllocator() = default;
+  ~TrackingAllocator() override { EXPECT_TRUE(live_.empty()); }
+
+  size_t allocations(Category category) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return allocations_[category];
+  }
+  size_t live_count() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return live_.size();
+  }
+
+  // |Allocator| methods:
+  void* Allocate(size_t size, Category category) override {
+    void* ptr = ::operator new(size);
+    std::lock_guard<std::mutex> lock(mutex_);
+    allocations_[category]++;
+    live_[ptr] = size;
+    return ptr;
+  }
+  void Free(void* ptr, size_t size, Category category) override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto found = live_.find(ptr);
+      ASSERT_TRUE(found != live_.end());
+      // Freed with the size it was allocated with.
+      EXPECT_EQ(found->second, size);
+      live_.erase(found);
+    }
+    ::operator delete(ptr);
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  size_t allocations_[CATEGORY_COUNT] = {};
+  std::map<void*, size_t> live_;
+};
+
+TEST(Allocator, Default) {
+  EXPECT_EQ(nullptr, Allocator::current());
+  TestWithScope setup;
+  std::unique_ptr<Scope> scope(new Scope(setup.scope()));
+  scope->SetValue("x", Value(nullptr, static_cast<int64_t>(1)), nullptr);
+  EXPECT_EQ(1, scope->GetValue("x")->int_value());
+  // It's allocated as is, without a header naming its allocator.
+  EXPECT_EQ(0u,
+            reinterpret_cast<uintptr_t>(scope.get()) % alignof(max_align_t));
+}
+
+TEST(Allocator, Scoped) {
+  TrackingAllocator allocator;
+  TestWithScope setup;
+  std::unique_ptr<Scope> scope;
+  std::unique_ptr<InputFile> file;
+  std::unique_ptr<ParseNode> node;
+  {
+    EvaluationContext context = {};
+    context.allocator = &allocator;
+    EvaluationContext::Scoped scoped_context(context);
+    EXPECT_EQ(&allocator, Allocator::current());
+    // TODO(C++14): Use std::make_unique.
+    scope.reset(new Scope(setup.scope()));
+    file.reset(new InputFile(SourceFile("//foo.icl")));
+    node.reset(new IdentifierNode());
+    {
+      EvaluationContext nested_context = EvaluationContext::current();
+      nested_context.allocator = nullptr;
+      EvaluationContext::Scoped scoped_nested_context(nested_context);
+      EXPECT_EQ(nullptr, Allocator::current());
+      std::unique_ptr<Scope> other_scope(new Scope(setup.scope()));
+    }
+    EXPECT_EQ(&allocator, Allocator::current());
+  }
+  EXPECT_EQ(nullptr, Allocator::current());
+  EXPECT_EQ(1u, allocator.allocations(Allocator::SCOPE));
+  EXPECT_EQ(1u, allocator.allocations(Allocator::INPUT_FILE));
+  EXPECT_EQ(1u, allocator.allocations(Allocator::PARSE_NODE));
+  EXPECT_EQ(3u, allocator.live_count());
+
+  // The objects go back to the allocator they came from, even when it's no
+  // longer current, and on other threads.
+  scope.reset();
+  std::thread([&file]() { file.reset(); }).join();
+  EXPECT_EQ(1u, allocator.live_count());
+  {
+    TrackingAllocator other_allocator;
+    EvaluationContext context = {};
+    context.allocator = &other_allocator;
+    EvaluationContext::Scoped scoped_context(context);
+    node.reset();
+  }
+  EXPECT_EQ(0u, allocator.live_count());
+}
+
+// Hands out memory from a buffer at a given offset from alignof(max_align_t),
+// like an arena that only aligns to 8 bytes (or not at all).
+class MisalignedAllocator : public Allocator {
+ public:
+  explicit MisalignedAllocator(size_t offset) : offset_(offset) {}
+  ~MisalignedAllocator() override { EXPECT_EQ(0u, live_count_); }
+
+  // |Allocator| methods:
+  void* Allocate(size_t size, Category category) override {
+    EXPECT_LE(size, sizeof(buffers_[0].bytes) - offset_);
+    live_count_++;
+    return buffers_[next_++].bytes + offset_;
+  }
+  void Free(void* ptr, size_t size, Category category) override {
+    bool found = false;
+    for (size_t i = 0; i < next_; i++)
+      found |= ptr == buffers_[i].bytes + offset_;
+    EXPECT_TRUE(found);
+    live_count_--;
+  }
+
+ private:
+  struct Buffer {
+    alignas(max_align_t) char bytes[1024];
+  };
+
+  const size_t offset_;
+  Buffer buffers_[4];
+  size_t next_ = 0;
+  size_t live_count_ = 0;
+};
+
+// Objects are freed with the allocator they came from, whatever the alignment
+// of the memory it returns.
+TEST(Allocator, Misaligned) {
+  TestWithScope setup;
+  for (size_t offset : {0, 1, 8, 9}) {
+    MisalignedAllocator allocator(offset);
+    EvaluationContext context = {};
+    context.allocator = &allocator;
+    EvaluationContext::Scoped scoped_context(context);
+    std::unique_ptr<Scope> scope(new Scope(setup.scope()));
+    std::unique_ptr<ParseNode> node(new IdentifierNode());
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(scope.get()) % alignof(Scope));
+    EXPECT_EQ(0u,
+              reinterpret_cast<uintptr_t>(node.get()) % alignof(ParseNode));
+  }
+}
+
+TEST(Allocator, Stats) {
+  StatsRecorder recorder;
+  TestWithScope setup;
+  {
+    EvaluationContext context = {};
+    context.stats_recorder = &recorder;
+    EvaluationContext::Scoped scoped_context(context);
+    Scope scope(setup.scope());
+    std::unique_ptr<Scope> allocated_scope(new Scope(setup.scope()));
+    Value string(nullptr, "12345");
+    Value list(nullptr, Value::LIST);
+    list.list_value().push_back(string);
+    Value list_copy = list;
+  }
+  EvaluationStats stats = recorder.GetStats();
+  // Only the scope that was allocated is counted.
+  EXPECT_EQ(1u, stats.allocations(Allocator::SCOPE));
+  EXPECT_EQ(sizeof(Scope), stats.allocated_bytes(Allocator::SCOPE));
+  // The string, its copy in the list, and that copy's copy.
+  EXPECT_EQ(3u, stats.allocations(Allocator::VALUE_STRING));
+  EXPECT_EQ(15u, stats.allocated_bytes(Allocator::VALUE_STRING));
+  EXPECT_EQ(1u, stats.allocations(Allocator::VALUE_LIST));
+  EXPECT_EQ(sizeof(Value), stats.allocated_bytes(Allocator::VALUE_LIST));
+  EXPECT_EQ(sizeof(Scope) + 15 + sizeof(Value), stats.total_allocated_bytes());
+  EXPECT_NE(std::string::npos,
+            stats.ToString().find("allocations_scope 1\n"))
+      << stats.ToString();
+}
+
+}  // namespace
+}  // namespace icl
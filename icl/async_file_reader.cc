@@ -0,0 +1,104 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/async_file_reader.h"
+
+#include <assert.h>
+
+#include <utility>
+
+#include "icl/binary_io.h"
+
+#if defined(__linux__)
+#include "icl/io_uring_file_reader.h"
+#endif
+
+namespace icl {
+
+bool AsyncFileReader::ReadSync(const SourceFile& name, std::string* contents) {
+  std::mutex mutex;
+  std::condition_variable done_condition;
+  bool done = false;
+  bool result = false;
+  std::vector<Request> requests;
+  requests.push_back({name, [&](bool success, std::string&& read_contents) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        result = success;
+                        *contents = std::move(read_contents);
+                        done = true;
+                        done_condition.notify_one();
+                      }});
+  Read(std::move(requests));
+
+  std::unique_lock<std::mutex> lock(mutex);
+  done_condition.wait(lock, [&done]() { return done; });
+  return result;
+}
+
+// static
+std::unique_ptr<AsyncFileReader> AsyncFileReader::Create(
+    const std::string& source_root,
+    int thread_count) {
+#if defined(__linux__)
+  std::unique_ptr<AsyncFileReader> io_uring_reader =
+      IoUringFileReader::Create(source_root);
+  if (io_uring_reader)
+    return io_uring_reader;
+#endif
+  // TODO(C++14): Use std::make_unique.
+  return std::unique_ptr<AsyncFileReader>(
+      new ThreadPoolFileReader(source_root, thread_count));
+}
+
+ThreadPoolFileReader::ThreadPoolFileReader(const std::string& source_root,
+                                           int thread_count)
+    : source_root_(source_root), stopping_(false) {
+  assert(thread_count > 0);
+  for (int i = 0; i < thread_count; i++)
+    workers_.emplace_back(&ThreadPoolFileReader::RunWorker, this);
+}
+
+ThreadPoolFileReader::~ThreadPoolFileReader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  requests_available_.notify_all();
+  for (std::thread& worker : workers_)
+    worker.join();
+}
+
+void ThreadPoolFileReader::Read(std::vector<Request> requests) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Request& request : requests)
+      requests_.push_back(std::move(request));
+  }
+  requests_available_.notify_all();
+}
+
+void ThreadPoolFileReader::RunWorker() {
+  for (;;) {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      requests_available_.wait(
+          lock, [this]() { return stopping_ || !requests_.empty(); });
+      // Finish the outstanding requests before stopping.
+      if (requests_.empty())
+        return;
+      request = std::move(requests_.front());
+      requests_.pop_front();
+    }
+
+    std::string contents;
+    bool success =
+        ReadFileToString(request.name.Resolve(source_root_), &contents);
+    if (!success)
+      contents.clear();
+    request.callback(success, std::move(contents));
+  }
+}
+
+}  // namespace icl
@@ -0,0 +1,81 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_ASYNC_FILE_READER_H_
+#define ICL_ASYNC_FILE_READER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "icl/source_file.h"
+
+namespace icl {
+
+// Reads files asynchronously, so that many reads may be in flight at once
+// (which matters for cold reads, e.g., from network-backed disks).
+//
+// Thread safety: All methods may be called on any thread.
+class AsyncFileReader {
+ public:
+  // Called when a read completes, on an arbitrary thread (possibly before
+  // |Read()| returns), which may be the one that completes all the reads, so
+  // it should return quickly. On failure, |contents| is empty.
+  using Callback = std::function<void(bool success, std::string&& contents)>;
+
+  struct Request {
+    SourceFile name;
+    Callback callback;
+  };
+
+  virtual ~AsyncFileReader() {}
+
+  // Starts the given reads. Their callbacks will be called exactly once, even
+  // if the reader is destroyed first (its destructor waits for them).
+  virtual void Read(std::vector<Request> requests) = 0;
+
+  // Reads the given file, waiting for the result.
+  bool ReadSync(const SourceFile& name, std::string* contents);
+
+  // Creates a reader for the files under |source_root| (see
+  // |SourceFile::Resolve()|), preferring io_uring if it's available and
+  // otherwise falling back to a thread pool with |thread_count| threads.
+  static std::unique_ptr<AsyncFileReader> Create(const std::string& source_root,
+                                                 int thread_count);
+};
+
+// Reads files synchronously on a pool of threads.
+class ThreadPoolFileReader : public AsyncFileReader {
+ public:
+  ThreadPoolFileReader(const std::string& source_root, int thread_count);
+  ~ThreadPoolFileReader() override;
+
+  ThreadPoolFileReader(const ThreadPoolFileReader&) = delete;
+  ThreadPoolFileReader& operator=(const ThreadPoolFileReader&) = delete;
+
+  // |AsyncFileReader| methods:
+  void Read(std::vector<Request> requests) override;
+
+ private:
+  void RunWorker();
+
+  const std::string source_root_;
+
+  // Protects the following.
+  std::mutex mutex_;
+  std::condition_variable requests_available_;
+  std::deque<Request> requests_;
+  bool stopping_;
+
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_ASYNC_FILE_READER_H_
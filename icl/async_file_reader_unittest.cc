@@ -0,0 +1,127 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/async_file_reader.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "icl/binary_io.h"
+#include "icl/scoped_temp_dir.h"
+#include "icl/source_file.h"
+
+#if defined(__linux__)
+#include "icl/io_uring_file_reader.h"
+#endif
+
+namespace icl {
+namespace {
+
+// A temporary source root with some files in it.
+class TempSourceRoot {
+ public:
+  TempSourceRoot() = default;
+  ~TempSourceRoot() = default;
+
+  TempSourceRoot(const TempSourceRoot&) = delete;
+  TempSourceRoot& operator=(const TempSourceRoot&) = delete;
+
+  const std::string& path() const { return dir_.path(); }
+
+  void AddFile(const std::string& name, const std::string& contents) {
+    EXPECT_TRUE(WriteFileAtomically(path() + "/" + name, contents));
+  }
+
+ private:
+  ScopedTempDir dir_;
+};
+
+struct Result {
+  int count = 0;
+  bool success = false;
+  std::string contents;
+};
+
+// Reads some files (in one batch) with |reader|, and checks the results.
+void TestReader(std::unique_ptr<AsyncFileReader> reader,
+                const TempSourceRoot& root) {
+  std::mutex mutex;
+  std::map<std::string, Result> results;
+  const char* const kNames[] = {"//empty.icl", "//small.icl", "//large.icl",
+                                "//missing.icl"};
+  std::vector<AsyncFileReader::Request> requests;
+  for (const char* name : kNames) {
+    std::string key = name;
+    requests.push_back(
+        {SourceFile(name), [&mutex, &results, key](bool success,
+                                                   std::string&& contents) {
+           std::lock_guard<std::mutex> lock(mutex);
+           Result& result = results[key];
+           result.count++;
+           result.success = success;
+           result.contents = std::move(contents);
+         }});
+  }
+  reader->Read(std::move(requests));
+
+  std::string contents;
+  EXPECT_TRUE(reader->ReadSync(SourceFile("//small.icl"), &contents));
+  EXPECT_EQ("a = 1\n", contents);
+  EXPECT_FALSE(reader->ReadSync(SourceFile("//missing.icl"), &contents));
+  EXPECT_EQ("", contents);
+
+  // Destroying the reader waits for the callbacks.
+  reader.reset();
+  ASSERT_EQ(4u, results.size());
+  for (const auto& pair : results)
+    EXPECT_EQ(1, pair.second.count) << pair.first;
+  EXPECT_TRUE(results["//empty.icl"].success);
+  EXPECT_EQ("", results["//empty.icl"].contents);
+  EXPECT_TRUE(results["//small.icl"].success);
+  EXPECT_EQ("a = 1\n", results["//small.icl"].contents);
+  EXPECT_TRUE(results["//large.icl"].success);
+  EXPECT_EQ(std::string(300000, 'x'), results["//large.icl"].contents);
+  EXPECT_FALSE(results["//missing.icl"].success);
+  EXPECT_EQ("", results["//missing.icl"].contents);
+}
+
+class AsyncFileReaderTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    root_.AddFile("empty.icl", "");
+    root_.AddFile("small.icl", "a = 1\n");
+    root_.AddFile("large.icl", std::string(300000, 'x'));
+  }
+
+  TempSourceRoot root_;
+};
+
+TEST_F(AsyncFileReaderTest, ThreadPool) {
+  TestReader(std::unique_ptr<AsyncFileReader>(
+                 new ThreadPoolFileReader(root_.path(), 3)),
+             root_);
+}
+
+#if defined(__linux__)
+TEST_F(AsyncFileReaderTest, IoUring) {
+  std::unique_ptr<IoUringFileReader> reader =
+      IoUringFileReader::Create(root_.path());
+  // io_uring may not be available (e.g., in some sandboxes).
+  if (!reader)
+    return;
+  TestReader(std::move(reader), root_);
+}
+#endif
+
+TEST_F(AsyncFileReaderTest, Create) {
+  TestReader(AsyncFileReader::Create(root_.path(), 2), root_);
+}
+
+}  // namespace
+}  // namespace icl
@@ -0,0 +1,64 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/base_config.h"
+
+#include <assert.h>
+
+#include <utility>
+
+#include "icl/delegate.h"
+#include "icl/err.h"
+#include "icl/import_manager.h"
+#include "icl/input_file.h"
+#include "icl/location.h"
+#include "icl/parse_tree.h"
+#include "icl/scope.h"
+#include "icl/tracer.h"
+
+namespace icl {
+
+BaseConfig::BaseConfig(const SourceFile& name, std::unique_ptr<Scope> scope)
+    : name_(name), scope_(std::move(scope)) {}
+
+BaseConfig::~BaseConfig() = default;
+
+// static
+std::unique_ptr<BaseConfig> BaseConfig::Prepare(Delegate* delegate,
+                                                const SourceFile& name,
+                                                Err* err) {
+  Tracer::Span span("base_config", name.value(), name);
+
+  LocationRange no_origin;
+  const InputFile* file = nullptr;
+  if (!delegate->GetInputFile(no_origin, name, &file)) {
+    assert(file);
+    assert(file->err().has_error());
+    *err = file->err();
+    return nullptr;
+  }
+  assert(file);
+  assert(!file->err().has_error());
+
+  // TODO(C++14): Use std::make_unique.
+  std::unique_ptr<Scope> scope(new Scope(delegate));
+  scope->set_source_dir(name.GetDir());
+  std::set<SourceFile> deps;
+  {
+    ImportManager::Recorder recorder(scope.get());
+    file->root_parse_node()->Execute(scope.get(), err);
+    deps = recorder.deps();
+  }
+  if (err->has_error())
+    return nullptr;
+
+  // Shared (read-only) by all the runs.
+  scope->Freeze();
+  std::unique_ptr<BaseConfig> base_config(
+      new BaseConfig(name, std::move(scope)));
+  base_config->deps_ = std::move(deps);
+  return base_config;
+}
+
+}  // namespace icl
@@ -0,0 +1,57 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_BASE_CONFIG_H_
+#define ICL_BASE_CONFIG_H_
+
+#include <memory>
+#include <set>
+
+#include "icl/source_file.h"
+
+namespace icl {
+
+class Delegate;
+class Err;
+class Scope;
+
+// The settings shared by all the root files of a build (like a BUILDCONFIG
+// file, e.g., the target platform and its flags): a base file that is executed
+// once, and whose frozen scope is then the const containing scope of each run
+// (see |Runner::set_base_config()|), so that roots needn't each import it.
+//
+// Lifetime: Must outlive the runs that use it, and must not outlive its
+// delegate (whose files and imports it refers to).
+//
+// Thread safety: Once prepared, it may be used by any number of threads.
+class BaseConfig {
+ public:
+  ~BaseConfig();
+
+  BaseConfig(const BaseConfig&) = delete;
+  BaseConfig& operator=(const BaseConfig&) = delete;
+
+  // Executes the file |name| (which can't define items). Returns null (setting
+  // |*err|) on failure.
+  static std::unique_ptr<BaseConfig> Prepare(Delegate* delegate,
+                                             const SourceFile& name,
+                                             Err* err);
+
+  const SourceFile& name() const { return name_; }
+  // The frozen scope that was built.
+  const Scope* scope() const { return scope_.get(); }
+  // The files that were (transitively) imported.
+  const std::set<SourceFile>& deps() const { return deps_; }
+
+ private:
+  BaseConfig(const SourceFile& name, std::unique_ptr<Scope> scope);
+
+  const SourceFile name_;
+  const std::unique_ptr<Scope> scope_;
+  std::set<SourceFile> deps_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_BASE_CONFIG_H_
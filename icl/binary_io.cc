@@ -0,0 +1,171 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/binary_io.h"
+
+#include <stdio.h>
+
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <thread>
+
+namespace icl {
+
+uint64_t HashBytes(const StringPiece& data) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < data.size(); i++) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+void WriteFixed64(uint64_t value, std::string* out) {
+  for (int i = 0; i < 8; i++)
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+void WriteVarint(uint64_t value, std::string* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+void WriteSignedVarint(int64_t value, std::string* out) {
+  WriteVarint((static_cast<uint64_t>(value) << 1) ^
+                  static_cast<uint64_t>(value >> 63),
+              out);
+}
+
+void WriteString(const StringPiece& value, std::string* out) {
+  WriteVarint(value.size(), out);
+  out->append(value.data(), value.size());
+}
+
+void AppendChecksum(std::string* data) {
+  WriteFixed64(HashBytes(*data), data);
+}
+
+BinaryReader::BinaryReader(const StringPiece& data) : data_(data), pos_(0) {}
+
+BinaryReader::~BinaryReader() {}
+
+// static
+bool BinaryReader::StripChecksum(const StringPiece& data, StringPiece* body) {
+  if (data.size() < 8)
+    return false;
+  *body = data.substr(0, data.size() - 8);
+  BinaryReader reader(data.substr(body->size()));
+  uint64_t checksum;
+  return reader.ReadFixed64(&checksum) && checksum == HashBytes(*body);
+}
+
+bool BinaryReader::ReadBytes(size_t size, StringPiece* bytes) {
+  if (data_.size() - pos_ < size)
+    return false;
+  *bytes = data_.substr(pos_, size);
+  pos_ += size;
+  return true;
+}
+
+bool BinaryReader::ReadFixed64(uint64_t* value) {
+  StringPiece bytes;
+  if (!ReadBytes(8, &bytes))
+    return false;
+  *value = 0;
+  for (int i = 0; i < 8; i++) {
+    *value |= static_cast<uint64_t>(static_cast<unsigned char>(bytes[i]))
+              << (8 * i);
+  }
+  return true;
+}
+
+bool BinaryReader::ReadVarint(uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (pos_ >= data_.size())
+      return false;
+    unsigned char byte = static_cast<unsigned char>(data_[pos_++]);
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool BinaryReader::ReadVarint(uint64_t max, uint64_t* value) {
+  return ReadVarint(value) && *value <= max;
+}
+
+bool BinaryReader::ReadSignedVarint(int64_t* value) {
+  uint64_t v;
+  if (!ReadVarint(&v))
+    return false;
+  *value = static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+  return true;
+}
+
+bool BinaryReader::ReadInt(int* value) {
+  uint64_t v;
+  if (!ReadVarint(static_cast<uint64_t>(INT32_MAX), &v))
+    return false;
+  *value = static_cast<int>(v);
+  return true;
+}
+
+bool BinaryReader::ReadIntDelta(int* value) {
+  int64_t delta;
+  if (!ReadSignedVarint(&delta) || delta < -static_cast<int64_t>(*value) ||
+      delta > static_cast<int64_t>(INT32_MAX - *value))
+    return false;
+  *value += static_cast<int>(delta);
+  return true;
+}
+
+bool BinaryReader::ReadString(StringPiece* value) {
+  uint64_t size;
+  return ReadVarint(data_.size() - pos_, &size) &&
+         ReadBytes(static_cast<size_t>(size), value);
+}
+
+bool ReadFileToString(const std::string& path, std::string* contents) {
+  std::ifstream in(path, std::ios::in | std::ios::binary);
+  if (!in)
+    return false;
+  contents->assign(std::istreambuf_iterator<char>(in),
+                   std::istreambuf_iterator<char>());
+  return !in.bad();
+}
+
+bool WriteFileAtomically(const std::string& path, const StringPiece& data) {
+  std::ostringstream temp_path_stream;
+  temp_path_stream << path << ".tmp-"
+                   << std::hash<std::thread::id>()(std::this_thread::get_id())
+                   << "-" << std::random_device()();
+  std::string temp_path = temp_path_stream.str();
+  {
+    std::ofstream out(temp_path,
+                      std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out)
+      return false;
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    out.close();
+    if (!out) {
+      remove(temp_path.c_str());
+      return false;
+    }
+  }
+  if (rename(temp_path.c_str(), path.c_str()) != 0) {
+    remove(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace icl
@@ -0,0 +1,79 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Helpers for the compact binary formats of on-disk caches (see |ParseCache|
+// and |ImportCache|). Integers are written as little-endian fixed-width
+// values or as (unsigned LEB128 or zigzag-encoded signed) varints.
+
+#ifndef ICL_BINARY_IO_H_
+#define ICL_BINARY_IO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "icl/string_piece.h"
+
+namespace icl {
+
+// Returns the 64-bit FNV-1a hash of |data|. This is fast and good enough for
+// naming and validating cache entries, but is not cryptographic.
+uint64_t HashBytes(const StringPiece& data);
+
+void WriteFixed64(uint64_t value, std::string* out);
+void WriteVarint(uint64_t value, std::string* out);
+void WriteSignedVarint(int64_t value, std::string* out);
+// Writes the size (as a varint) and then the bytes.
+void WriteString(const StringPiece& value, std::string* out);
+
+// Appends a checksum of |*data| to it. See |BinaryReader::StripChecksum()|.
+void AppendChecksum(std::string* data);
+
+// Reads the above from a buffer. All methods return false if the data is
+// truncated or invalid (in which case the reader should be discarded).
+class BinaryReader {
+ public:
+  explicit BinaryReader(const StringPiece& data);
+  ~BinaryReader();
+
+  BinaryReader(const BinaryReader&) = delete;
+  BinaryReader& operator=(const BinaryReader&) = delete;
+
+  // Verifies the checksum at the end of |data| (appended by |AppendChecksum()|)
+  // and sets |*body| to the data before it.
+  static bool StripChecksum(const StringPiece& data, StringPiece* body);
+
+  bool at_end() const { return pos_ == data_.size(); }
+
+  bool ReadBytes(size_t size, StringPiece* bytes);
+  bool ReadFixed64(uint64_t* value);
+  bool ReadVarint(uint64_t* value);
+  // Reads a varint that must be at most |max|.
+  bool ReadVarint(uint64_t max, uint64_t* value);
+  bool ReadSignedVarint(int64_t* value);
+  // Reads a nonnegative int.
+  bool ReadInt(int* value);
+  // Reads a nonnegative int, written as the (signed) difference from |*value|,
+  // into |*value|.
+  bool ReadIntDelta(int* value);
+  // The result points into the data.
+  bool ReadString(StringPiece* value);
+
+ private:
+  const StringPiece data_;
+  size_t pos_;
+};
+
+// Reads the entire file at |path| into |*contents|.
+bool ReadFileToString(const std::string& path, std::string* contents);
+
+// Writes |data| to the file at |path| by writing a temporary file (with a
+// random name) and renaming it into place, so that readers (even in other
+// processes) never see a partially-written file.
+bool WriteFileAtomically(const std::string& path, const StringPiece& data);
+
+}  // namespace icl
+
+#endif  // ICL_BINARY_IO_H_
@@ -0,0 +1,208 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_CONCURRENT_MAP_H_
+#define ICL_CONCURRENT_MAP_H_
+
+#include <assert.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace icl {
+
+// A hash map for caches that are read far more often than they're added to,
+// from many threads: lookups are lock-free (a few acquire loads), while
+// insertions take a lock. Values are allocated separately, so pointers to them
+// are stable, and are default-constructed on insertion (so they'd typically
+// contain their own synchronization for initialization; e.g., an atomic
+// pointer to the result that's set, with release semantics, once it's ready).
+//
+// Implementation: Each bucket is a singly-linked list of immutable nodes, and
+// new nodes are published at the head with a release store. When the table
+// grows, a new one (with new nodes) is published and the old one is retired,
+// since readers may still be using it. Retired tables are only freed by
+// |EraseIf()| and on destruction.
+//
+// Thread safety: |Find()|, |GetOrInsert()| and |ForEach()| may be called
+// concurrently. |EraseIf()| must not be called concurrently with anything
+// (including readers).
+template <typename Key, typename T, typename Hash = std::hash<Key>>
+class ConcurrentMap {
+ public:
+  ConcurrentMap()
+      : hash_(), table_(new Table(kInitialBucketCount)), size_(0) {}
+  ~ConcurrentMap() {
+    Table* table = table_.load(std::memory_order_relaxed);
+    for (const auto& node : table->nodes)
+      delete node->entry;
+    delete table;
+  }
+
+  ConcurrentMap(const ConcurrentMap&) = delete;
+  ConcurrentMap& operator=(const ConcurrentMap&) = delete;
+
+  // Returns the value for |key|, or null if there's none. This is lock-free.
+  T* Find(const Key& key) const {
+    return Find(table_.load(std::memory_order_acquire), key, hash_(key));
+  }
+
+  // Returns the value for |key|, inserting a default-constructed one if there's
+  // none (in which case |*inserted|, if non-null, is set to true). This is
+  // lock-free if the key is present.
+  T* GetOrInsert(const Key& key, bool* inserted = nullptr) {
+    size_t hash = hash_(key);
+    if (inserted)
+      *inserted = false;
+    if (T* value = Find(table_.load(std::memory_order_acquire), key, hash))
+      return value;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Check again, since another thread may have inserted it.
+    Table* table = table_.load(std::memory_order_relaxed);
+    if (T* value = Find(table, key, hash))
+      return value;
+
+    Entry* entry = new Entry(key, hash);
+    size_++;
+    if (size_ > table->bucket_count() * kMaxLoadFactor)
+      table = Grow(table);
+    table->Add(entry);
+    if (inserted)
+      *inserted = true;
+    return entry->value.get();
+  }
+
+  // Calls |f(key, value)| for each entry (in no particular order). Entries
+  // inserted concurrently may or may not be visited.
+  template <typename F>
+  void ForEach(F f) const {
+    const Table* table = table_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < table->bucket_count(); i++) {
+      for (const Node* node =
+               table->buckets[i].load(std::memory_order_acquire);
+           node; node = node->next)
+        f(node->entry->key, *node->entry->value);
+    }
+  }
+
+  // Removes the entries for which |pred(key, value)| returns true, and returns
+  // their values.
+  template <typename Predicate>
+  std::vector<std::unique_ptr<T>> EraseIf(Predicate pred) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Table* table = table_.load(std::memory_order_relaxed);
+    std::vector<std::unique_ptr<T>> erased;
+    std::unique_ptr<Table> new_table(new Table(table->bucket_count()));
+    for (const auto& node : table->nodes) {
+      Entry* entry = node->entry;
+      if (pred(entry->key, *entry->value)) {
+        erased.push_back(std::move(entry->value));
+        delete entry;
+        size_--;
+      } else {
+        new_table->Add(entry);
+      }
+    }
+    // Nothing can be using the old table (or the ones it retired).
+    table_.store(new_table.release(), std::memory_order_release);
+    delete table;
+    return erased;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return size_;
+  }
+
+ private:
+  static const size_t kInitialBucketCount = 64;
+  static const size_t kMaxLoadFactor = 2;
+
+  struct Entry {
+    Entry(const Key& key, size_t hash)
+        : key(key), hash(hash), value(new T()) {}
+
+    const Key key;
+    const size_t hash;
+    std::unique_ptr<T> value;
+  };
+
+  // Nodes are immutable once published.
+  struct Node {
+    Node(Entry* entry, const Node* next) : entry(entry), next(next) {}
+
+    Entry* const entry;
+    const Node* const next;
+  };
+
+  struct Table {
+    // |bucket_count| must be a power of 2.
+    explicit Table(size_t bucket_count)
+        : buckets(new std::atomic<const Node*>[bucket_count]),
+          mask(bucket_count - 1) {
+      assert((bucket_count & mask) == 0);
+      for (size_t i = 0; i < bucket_count; i++)
+        buckets[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    size_t bucket_count() const { return mask + 1; }
+
+    // Adds a node for |entry| (which must not already be present), publishing
+    // it to readers. Only called with the lock held (or before the table is
+    // published).
+    void Add(Entry* entry) {
+      std::atomic<const Node*>& bucket = buckets[entry->hash & mask];
+      nodes.emplace_back(
+          new Node(entry, bucket.load(std::memory_order_relaxed)));
+      bucket.store(nodes.back().get(), std::memory_order_release);
+    }
+
+    const std::unique_ptr<std::atomic<const Node*>[]> buckets;
+    const size_t mask;
+    // All the nodes, for iteration by writers and for deletion.
+    std::vector<std::unique_ptr<const Node>> nodes;
+    // The table this one replaced (which readers may still be using).
+    std::unique_ptr<Table> retired;
+  };
+
+  static T* Find(const Table* table, const Key& key, size_t hash) {
+    for (const Node* node =
+             table->buckets[hash & table->mask].load(std::memory_order_acquire);
+         node; node = node->next) {
+      if (node->entry->hash == hash && node->entry->key == key)
+        return node->entry->value.get();
+    }
+    return nullptr;
+  }
+
+  // Replaces |table| with one with more buckets, and returns the new one.
+  // Called with the lock held.
+  Table* Grow(Table* table) {
+    Table* new_table = new Table(table->bucket_count() * 2);
+    for (const auto& node : table->nodes)
+      new_table->Add(node->entry);
+    new_table->retired.reset(table);
+    table_.store(new_table, std::memory_order_release);
+    return new_table;
+  }
+
+  const Hash hash_;
+
+  // Protects writes (insertions and |size_|).
+  mutable std::mutex mutex_;
+
+  // Owned (along with the tables it retired).
+  std::atomic<Table*> table_;
+  size_t size_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_CONCURRENT_MAP_H_
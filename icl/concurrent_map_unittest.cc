@@ -0,0 +1,113 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/concurrent_map.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace icl {
+namespace {
+
+struct Counter {
+  Counter() : value(0) {}
+
+  std::atomic<int> value;
+};
+
+TEST(ConcurrentMap, Basic) {
+  ConcurrentMap<std::string, int> map;
+  EXPECT_EQ(nullptr, map.Find("a"));
+
+  bool inserted = false;
+  int* a = map.GetOrInsert("a", &inserted);
+  ASSERT_TRUE(a);
+  EXPECT_TRUE(inserted);
+  EXPECT_EQ(0, *a);
+  *a = 1;
+  EXPECT_EQ(a, map.Find("a"));
+  EXPECT_EQ(a, map.GetOrInsert("a", &inserted));
+  EXPECT_FALSE(inserted);
+  EXPECT_EQ(1u, map.size());
+
+  // Values keep their addresses as the map grows.
+  for (int i = 0; i < 1000; i++)
+    *map.GetOrInsert(std::to_string(i)) = i;
+  EXPECT_EQ(1001u, map.size());
+  EXPECT_EQ(a, map.Find("a"));
+  for (int i = 0; i < 1000; i++) {
+    const int* value = map.Find(std::to_string(i));
+    ASSERT_TRUE(value);
+    EXPECT_EQ(i, *value);
+  }
+
+  std::set<std::string> keys;
+  map.ForEach([&keys](const std::string& key, const int& value) {
+    keys.insert(key);
+  });
+  EXPECT_EQ(1001u, keys.size());
+
+  // Erase the odd numbers.
+  std::vector<std::unique_ptr<int>> erased =
+      map.EraseIf([](const std::string& key, const int& value) {
+        return value % 2 == 1;
+      });
+  EXPECT_EQ(501u, erased.size());  // Including "a".
+  EXPECT_EQ(500u, map.size());
+  bool erased_a = false;
+  for (const auto& value : erased)
+    erased_a |= value.get() == a;
+  EXPECT_TRUE(erased_a);
+  EXPECT_EQ(nullptr, map.Find("a"));
+  EXPECT_EQ(nullptr, map.Find("1"));
+  ASSERT_TRUE(map.Find("2"));
+  EXPECT_EQ(2, *map.Find("2"));
+
+  // Erased keys can be reinserted.
+  EXPECT_EQ(0, *map.GetOrInsert("1", &inserted));
+  EXPECT_TRUE(inserted);
+}
+
+TEST(ConcurrentMap, Threads) {
+  const int kThreads = 8;
+  const int kKeys = 2000;
+  ConcurrentMap<int, Counter> map;
+
+  // All threads get (inserting as needed) all the keys, in different orders,
+  // while the map grows.
+  std::vector<std::thread> threads;
+  std::atomic<int> inserted_count(0);
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&map, &inserted_count, t]() {
+      for (int i = 0; i < kKeys; i++) {
+        int key = (i * 7 + t * 13) % kKeys;
+        bool inserted = false;
+        Counter* counter = map.GetOrInsert(key, &inserted);
+        counter->value++;
+        if (inserted)
+          inserted_count++;
+        EXPECT_EQ(counter, map.Find(key));
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+
+  EXPECT_EQ(kKeys, inserted_count.load());
+  EXPECT_EQ(static_cast<size_t>(kKeys), map.size());
+  for (int i = 0; i < kKeys; i++) {
+    const Counter* counter = map.Find(i);
+    ASSERT_TRUE(counter);
+    EXPECT_EQ(kThreads, counter->value.load());
+  }
+}
+
+}  // namespace
+}  // namespace icl
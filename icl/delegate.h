@@ -12,11 +12,14 @@
 
 namespace icl {
 
+class Allocator;
 class Err;
 class ImportManager;
 class InputFile;
 class LocationRange;
 class SourceFile;
+class ThreadPool;
+class Tracer;
 
 // Interface for the user to provide various required functionality/settings.
 //
@@ -54,6 +57,27 @@ class Delegate {
   // TODO(vtl): Should this take a |StringPiece| instead?
   virtual void Print(const std::string& s) = 0;
 
+  // Returns false to skip checking for variables that are set but never used
+  // (see |Scope::CheckForUnusedVars()|). This is a little faster and may be
+  // appropriate for trusted input that has already been validated.
+  virtual bool ShouldCheckForUnusedVars() const { return true; }
+
+  // Returns true to collect |EvaluationStats| for each run (see
+  // |Runner::RunResult::stats()|). This is cheap, but not free.
+  virtual bool ShouldCollectStats() const { return false; }
+
+  // Returns the thread pool to run the iterations of |parallel_foreach()|
+  // loops on, or null to run them serially (the default).
+  virtual ThreadPool* GetThreadPool() { return nullptr; }
+
+  // Returns the tracer to record runs (see |Runner|) with, or null to not
+  // trace them (the default). A tracer set on the |Runner| takes precedence.
+  virtual Tracer* GetTracer() { return nullptr; }
+
+  // Returns the allocator for the objects created by runs (see |Runner| and
+  // |Allocator|), or null to use the global operator new (the default).
+  virtual Allocator* GetAllocator() { return nullptr; }
+
  protected:
   Delegate() = default;
   ~Delegate() = default;
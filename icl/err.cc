@@ -184,8 +184,8 @@ void Err::AppendErrorMessageInternal(bool is_sub_err, std::string* out) const {
   out->append(message_);
   out->push_back('\n');
 
-  // Quoted line.
-  if (input_file) {
+  // Quoted line (unless the file was compacted).
+  if (input_file && input_file->has_contents()) {
     std::string line = GetNthLine(input_file->contents(),
                                   location_.line_number());
     if (line.find_first_not_of(" \t\n\r\x0c") != std::string::npos) {
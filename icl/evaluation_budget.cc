@@ -0,0 +1,93 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/evaluation_budget.h"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <string>
+
+#include "icl/err.h"
+#include "icl/evaluation_stats.h"
+
+namespace icl {
+
+namespace {
+
+// The number of steps between checks of the memory, deadline and cancellation.
+const uint64_t kCheckInterval = 1024;
+
+}  // namespace
+
+EvaluationBudget::Limits::Limits()
+    : max_steps(std::numeric_limits<uint64_t>::max()),
+      max_cumulative_allocated_bytes(std::numeric_limits<uint64_t>::max()),
+      timeout(std::chrono::steady_clock::duration::max()),
+      cancellation_token(nullptr) {}
+
+EvaluationBudget::Limits::~Limits() = default;
+
+bool EvaluationBudget::Limits::is_unlimited() const {
+  return max_steps == std::numeric_limits<uint64_t>::max() &&
+         max_cumulative_allocated_bytes ==
+             std::numeric_limits<uint64_t>::max() &&
+         timeout == std::chrono::steady_clock::duration::max() &&
+         !cancellation_token;
+}
+
+EvaluationBudget::EvaluationBudget(const Limits& limits)
+    : limits_(limits),
+      deadline_(
+          limits.timeout == std::chrono::steady_clock::duration::max()
+              ? std::chrono::steady_clock::time_point::max()
+              : std::chrono::steady_clock::now() + limits.timeout),
+      steps_(0),
+      // Check on the first step, so that evaluation doesn't start if the
+      // budget is already exhausted.
+      next_check_(1),
+      exhausted_(false) {}
+
+EvaluationBudget::~EvaluationBudget() = default;
+
+bool EvaluationBudget::Check(uint64_t steps, const ParseNode* node, Err* err) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (reason_.empty()) {
+    StatsRecorder* stats_recorder = StatsRecorder::current();
+    if (steps > limits_.max_steps) {
+      reason_ = "it exceeded the limit of " +
+                std::to_string(limits_.max_steps) + " steps";
+    } else if (limits_.max_cumulative_allocated_bytes !=
+                   std::numeric_limits<uint64_t>::max() &&
+               stats_recorder &&
+               stats_recorder->GetStats().total_allocated_bytes() >
+                   limits_.max_cumulative_allocated_bytes) {
+      reason_ = "it exceeded the limit of " +
+                std::to_string(limits_.max_cumulative_allocated_bytes) +
+                " bytes allocated in total";
+    } else if (limits_.cancellation_token &&
+               limits_.cancellation_token->IsCancelled()) {
+      reason_ = "it was cancelled";
+    } else if (deadline_ != std::chrono::steady_clock::time_point::max() &&
+               std::chrono::steady_clock::now() >= deadline_) {
+      reason_ = "it passed its deadline";
+    } else {
+      // Other threads may have moved it on already. Without a step limit,
+      // |max_steps + 1| would wrap around to zero (checking every step).
+      uint64_t next_check = steps + kCheckInterval;
+      if (limits_.max_steps != std::numeric_limits<uint64_t>::max())
+        next_check = std::min(next_check, limits_.max_steps + 1);
+      if (next_check > next_check_.load(std::memory_order_relaxed))
+        next_check_.store(next_check, std::memory_order_relaxed);
+      return true;
+    }
+    exhausted_.store(true, std::memory_order_relaxed);
+    next_check_.store(0, std::memory_order_relaxed);
+  }
+
+  *err = Err(node, "Evaluation stopped here, since " + reason_ + ".");
+  return false;
+}
+
+}  // namespace icl
@@ -0,0 +1,122 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_EVALUATION_BUDGET_H_
+#define ICL_EVALUATION_BUDGET_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include "icl/evaluation_context.h"
+
+namespace icl {
+
+class Err;
+class ParseNode;
+
+// Lets another thread stop an evaluation (see |EvaluationBudget|).
+//
+// Thread safety: All methods may be called on any thread.
+class CancellationToken {
+ public:
+  CancellationToken() : cancelled_(false) {}
+  ~CancellationToken() {}
+
+  CancellationToken(const CancellationToken&) = delete;
+  CancellationToken& operator=(const CancellationToken&) = delete;
+
+  void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+  bool IsCancelled() const {
+    return cancelled_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<bool> cancelled_;
+};
+
+// Bounds the work done evaluating a file (e.g., a runaway loop): the number of
+// steps (statements executed and functions called), the memory allocated, a
+// deadline, and cancellation. Evaluation on a thread is charged to the thread's
+// current budget (see |EvaluationContext|), if any, and stops with an error
+// describing where once the budget is exhausted. The memory, deadline and
+// cancellation are only checked every so many steps, so that counting a step
+// is cheap.
+//
+// Thread safety: A budget may be shared by several threads (e.g., evaluating
+// the iterations of a parallel loop).
+class EvaluationBudget {
+ public:
+  struct Limits {
+    Limits();
+    ~Limits();
+
+    bool is_unlimited() const;
+
+    // The default is unlimited.
+    uint64_t max_steps;
+    // The total bytes allocated over the evaluation (see |Allocator|), as
+    // counted by the current thread's |StatsRecorder| (so this has no effect
+    // without one; |Runner| sets one up when this is limited). This is not a
+    // cap on live memory: memory that's been freed still counts, so an
+    // evaluation that churns through memory may be stopped while holding
+    // little. Memory that's not counted (e.g., errors) isn't limited. The
+    // default is unlimited.
+    uint64_t max_cumulative_allocated_bytes;
+    // The deadline is this long after the budget is created. The default is
+    // unlimited.
+    std::chrono::steady_clock::duration timeout;
+    // If non-null, must outlive the budget.
+    const CancellationToken* cancellation_token;
+  };
+
+  explicit EvaluationBudget(const Limits& limits);
+  ~EvaluationBudget();
+
+  EvaluationBudget(const EvaluationBudget&) = delete;
+  EvaluationBudget& operator=(const EvaluationBudget&) = delete;
+
+  // The current thread's budget, or null.
+  static EvaluationBudget* current() {
+    return EvaluationContext::current().budget;
+  }
+
+  uint64_t steps() const { return steps_.load(std::memory_order_relaxed); }
+  bool is_exhausted() const {
+    return exhausted_.load(std::memory_order_relaxed);
+  }
+
+  // Counts a step of evaluation, at |node|. Returns false (setting |*err|,
+  // blaming |node|) if the budget is exhausted.
+  bool Step(const ParseNode* node, Err* err) {
+    uint64_t steps = steps_.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (steps < next_check_.load(std::memory_order_relaxed))
+      return true;
+    return Check(steps, node, err);
+  }
+
+ private:
+  // The slow path of |Step()|.
+  bool Check(uint64_t steps, const ParseNode* node, Err* err);
+
+  const Limits limits_;
+  const std::chrono::steady_clock::time_point deadline_;
+  std::atomic<uint64_t> steps_;
+  // The step at which to next check the limits (zero once exhausted, so that
+  // every step is checked).
+  std::atomic<uint64_t> next_check_;
+  std::atomic<bool> exhausted_;
+
+  // Protects the following (and changes to the above, other than |steps_|).
+  std::mutex mutex_;
+  // Why the budget is exhausted, once it is.
+  std::string reason_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_EVALUATION_BUDGET_H_
@@ -0,0 +1,53 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/evaluation_budget.h"
+
+#include <gtest/gtest.h>
+
+#include "icl/err.h"
+
+namespace icl {
+namespace {
+
+TEST(EvaluationBudget, MaxSteps) {
+  EvaluationBudget::Limits limits;
+  limits.max_steps = 10;
+  EvaluationBudget budget(limits);
+  Err err;
+  for (int i = 0; i < 10; i++)
+    EXPECT_TRUE(budget.Step(nullptr, &err));
+  EXPECT_FALSE(err.has_error());
+  EXPECT_FALSE(budget.is_exhausted());
+
+  EXPECT_FALSE(budget.Step(nullptr, &err));
+  EXPECT_TRUE(budget.is_exhausted());
+  EXPECT_EQ("Evaluation stopped here, since it exceeded the limit of 10 steps.",
+            err.message());
+}
+
+// Without a step limit, the other limits are still only checked every so many
+// steps, rather than on every step.
+TEST(EvaluationBudget, CheckInterval) {
+  CancellationToken cancellation_token;
+  EvaluationBudget::Limits limits;
+  limits.cancellation_token = &cancellation_token;
+  EvaluationBudget budget(limits);
+
+  // The first step is checked.
+  Err err;
+  EXPECT_TRUE(budget.Step(nullptr, &err));
+  cancellation_token.Cancel();
+
+  // So the cancellation isn't noticed until the next check.
+  uint64_t steps = 1;
+  while (budget.Step(nullptr, &err))
+    steps++;
+  EXPECT_EQ(1024u, steps);
+  EXPECT_TRUE(budget.is_exhausted());
+  EXPECT_EQ("Evaluation stopped here, since it was cancelled.", err.message());
+}
+
+}  // namespace
+}  // namespace icl
@@ -0,0 +1,25 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/evaluation_context.h"
+
+#include "icl/evaluation_stats.h"
+
+namespace icl {
+
+// static
+thread_local EvaluationContext EvaluationContext::current_ = {};
+
+EvaluationContext::Scoped::Scoped(const EvaluationContext& context)
+    : previous_(current_) {
+  current_ = context;
+  StatsRecorder::SetCurrent(context.stats_recorder);
+}
+
+EvaluationContext::Scoped::~Scoped() {
+  current_ = previous_;
+  StatsRecorder::SetCurrent(previous_.stats_recorder);
+}
+
+}  // namespace icl
@@ -0,0 +1,56 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_EVALUATION_CONTEXT_H_
+#define ICL_EVALUATION_CONTEXT_H_
+
+namespace icl {
+
+class Allocator;
+class EvaluationBudget;
+class StatsRecorder;
+class TemplateCache;
+class Tracer;
+
+// The objects evaluation on a thread reports to and draws on, any of which may
+// be null. Each thread has a current context (see |Scoped|), which starts out
+// all null; the objects' |current()| methods read it. Work that's handed to
+// other threads (e.g., the iterations of a parallel loop) copies the current
+// context and installs it on them.
+//
+// A default-initialized context is uninitialized, so start from |current()| or
+// from |{}| (all null).
+struct EvaluationContext {
+  class Scoped;
+
+  static const EvaluationContext& current() { return current_; }
+
+  EvaluationBudget* budget;
+  Tracer* tracer;
+  StatsRecorder* stats_recorder;
+  Allocator* allocator;
+  TemplateCache* template_cache;
+
+ private:
+  // Trivial, so that reading it is a plain thread-local load.
+  static thread_local EvaluationContext current_;
+};
+
+// Makes a context the current thread's while it exists (restoring the previous
+// one afterwards).
+class EvaluationContext::Scoped {
+ public:
+  explicit Scoped(const EvaluationContext& context);
+  ~Scoped();
+
+  Scoped(const Scoped&) = delete;
+  Scoped& operator=(const Scoped&) = delete;
+
+ private:
+  const EvaluationContext previous_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_EVALUATION_CONTEXT_H_
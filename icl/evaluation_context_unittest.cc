@@ -0,0 +1,88 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/evaluation_context.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "icl/evaluation_budget.h"
+#include "icl/evaluation_stats.h"
+#include "icl/template_cache.h"
+#include "icl/tracer.h"
+
+namespace icl {
+namespace {
+
+TEST(EvaluationContext, Scoped) {
+  EXPECT_EQ(nullptr, EvaluationContext::current().budget);
+  EXPECT_EQ(nullptr, Tracer::current());
+
+  EvaluationBudget budget{EvaluationBudget::Limits()};
+  Tracer tracer;
+  TemplateCache cache;
+  EvaluationContext context = {};
+  context.budget = &budget;
+  context.tracer = &tracer;
+  context.template_cache = &cache;
+  {
+    EvaluationContext::Scoped scoped_context(context);
+    EXPECT_EQ(&budget, EvaluationBudget::current());
+    EXPECT_EQ(&tracer, Tracer::current());
+    EXPECT_EQ(&cache, TemplateCache::current());
+    {
+      // A nested context replaces the whole context.
+      EvaluationContext nested_context = {};
+      nested_context.tracer = &tracer;
+      EvaluationContext::Scoped scoped_nested_context(nested_context);
+      EXPECT_EQ(nullptr, EvaluationBudget::current());
+      EXPECT_EQ(&tracer, Tracer::current());
+      EXPECT_EQ(nullptr, TemplateCache::current());
+    }
+    EXPECT_EQ(&budget, EvaluationBudget::current());
+    EXPECT_EQ(&cache, TemplateCache::current());
+
+    // Another thread starts out without a context, until it installs one.
+    std::thread([&context, &tracer]() {
+      EXPECT_EQ(nullptr, Tracer::current());
+      EvaluationContext::Scoped scoped_context(context);
+      EXPECT_EQ(&tracer, Tracer::current());
+    }).join();
+  }
+  EXPECT_EQ(nullptr, EvaluationBudget::current());
+  EXPECT_EQ(nullptr, Tracer::current());
+  EXPECT_EQ(nullptr, TemplateCache::current());
+}
+
+// Counting goes back to the outer recorder once a nested context with another
+// one is gone.
+TEST(EvaluationContext, NestedStatsRecorder) {
+  StatsRecorder recorder;
+  StatsRecorder other_recorder;
+  EvaluationContext context = {};
+  context.stats_recorder = &recorder;
+  EvaluationContext::Scoped scoped_context(context);
+  StatsRecorder::Count(EvaluationStats::CLOSURES, 1);
+  {
+    EvaluationContext other_context = {};
+    other_context.stats_recorder = &other_recorder;
+    EvaluationContext::Scoped scoped_other_context(other_context);
+    StatsRecorder::Count(EvaluationStats::CLOSURES, 10);
+    {
+      EvaluationContext empty_context = {};
+      EvaluationContext::Scoped scoped_empty_context(empty_context);
+      StatsRecorder::Count(EvaluationStats::CLOSURES, 100);
+    }
+    StatsRecorder::Count(EvaluationStats::CLOSURES, 10);
+  }
+  StatsRecorder::Count(EvaluationStats::CLOSURES, 1);
+
+  EXPECT_EQ(2u, recorder.GetStats().counter(EvaluationStats::CLOSURES));
+  EXPECT_EQ(20u, other_recorder.GetStats().counter(EvaluationStats::CLOSURES));
+  EXPECT_EQ(1u, recorder.thread_count());
+}
+
+}  // namespace
+}  // namespace icl
@@ -0,0 +1,199 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/evaluation_stats.h"
+
+#include <assert.h>
+
+#include <algorithm>
+
+#include "icl/string_number_conversions.h"
+
+namespace icl {
+
+// static
+const size_t EvaluationStats::kLookupDepthBucketCount;
+
+EvaluationStats::EvaluationStats()
+    : counters_(), lookup_depths_(), allocations_(), allocated_bytes_() {}
+
+EvaluationStats::~EvaluationStats() = default;
+
+EvaluationStats& EvaluationStats::operator+=(const EvaluationStats& other) {
+  for (size_t i = 0; i < COUNTER_COUNT; i++)
+    counters_[i] += other.counters_[i];
+  for (size_t i = 0; i < kLookupDepthBucketCount; i++)
+    lookup_depths_[i] += other.lookup_depths_[i];
+  for (size_t i = 0; i < Allocator::CATEGORY_COUNT; i++) {
+    allocations_[i] += other.allocations_[i];
+    allocated_bytes_[i] += other.allocated_bytes_[i];
+  }
+  return *this;
+}
+
+uint64_t EvaluationStats::total_allocated_bytes() const {
+  uint64_t total = 0;
+  for (uint64_t bytes : allocated_bytes_)
+    total += bytes;
+  return total;
+}
+
+// static
+const char* EvaluationStats::GetCounterName(Counter counter) {
+  switch (counter) {
+    case VALUE_DEEP_COPIES:
+      return "value_deep_copies";
+    case VALUE_DEEP_COPY_ELEMENTS:
+      return "value_deep_copy_elements";
+    case CLOSURES:
+      return "closures";
+    case CLOSURE_RECORDS:
+      return "closure_records";
+    case MERGED_RECORDS:
+      return "merged_records";
+    case STRING_EXPRESSION_PARSES:
+      return "string_expression_parses";
+    case BYTES_TOKENIZED:
+      return "bytes_tokenized";
+    case BYTES_PARSED:
+      return "bytes_parsed";
+    case TEMPLATE_CACHE_HITS:
+      return "template_cache_hits";
+    case TEMPLATE_CACHE_MISSES:
+      return "template_cache_misses";
+    case COUNTER_COUNT:
+      break;
+  }
+  assert(false);
+  return "";
+}
+
+std::string EvaluationStats::ToString() const {
+  std::string result;
+  for (size_t i = 0; i < COUNTER_COUNT; i++) {
+    result += GetCounterName(static_cast<Counter>(i));
+    result += " ";
+    result += NumberToString<uint64_t>(counters_[i]);
+    result += "\n";
+  }
+  for (size_t i = 0; i < kLookupDepthBucketCount; i++) {
+    result += "lookup_depth_";
+    result += NumberToString<uint64_t>(i);
+    if (i == kLookupDepthBucketCount - 1)
+      result += "+";
+    result += " ";
+    result += NumberToString<uint64_t>(lookup_depths_[i]);
+    result += "\n";
+  }
+  for (size_t i = 0; i < Allocator::CATEGORY_COUNT; i++) {
+    const char* name =
+        Allocator::GetCategoryName(static_cast<Allocator::Category>(i));
+    result += "allocations_";
+    result += name;
+    result += " ";
+    result += NumberToString<uint64_t>(allocations_[i]);
+    result += "\nallocated_bytes_";
+    result += name;
+    result += " ";
+    result += NumberToString<uint64_t>(allocated_bytes_[i]);
+    result += "\n";
+  }
+  return result;
+}
+
+namespace {
+
+std::atomic<uint64_t> g_next_recorder_id(1);
+
+}  // namespace
+
+// static
+thread_local StatsRecorder::ThreadCounters* StatsRecorder::current_ = nullptr;
+
+// static
+const size_t StatsRecorder::kCachedThreadCountersCount;
+
+// static
+thread_local StatsRecorder::CachedThreadCounters
+    StatsRecorder::cached_thread_counters_[kCachedThreadCountersCount] = {};
+
+StatsRecorder::ThreadCounters::ThreadCounters(StatsRecorder* recorder)
+    : recorder(recorder) {
+  for (auto& counter : counters)
+    counter.store(0, std::memory_order_relaxed);
+  for (auto& lookup_depth : lookup_depths)
+    lookup_depth.store(0, std::memory_order_relaxed);
+  for (size_t i = 0; i < Allocator::CATEGORY_COUNT; i++) {
+    allocations[i].store(0, std::memory_order_relaxed);
+    allocated_bytes[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+StatsRecorder::StatsRecorder() : id_(g_next_recorder_id.fetch_add(1)) {}
+
+StatsRecorder::~StatsRecorder() = default;
+
+EvaluationStats StatsRecorder::GetStats() const {
+  EvaluationStats stats;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& thread_counters : thread_counters_) {
+    for (size_t i = 0; i < EvaluationStats::COUNTER_COUNT; i++) {
+      stats.counters_[i] +=
+          thread_counters->counters[i].load(std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < EvaluationStats::kLookupDepthBucketCount; i++) {
+      stats.lookup_depths_[i] +=
+          thread_counters->lookup_depths[i].load(std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < Allocator::CATEGORY_COUNT; i++) {
+      stats.allocations_[i] +=
+          thread_counters->allocations[i].load(std::memory_order_relaxed);
+      stats.allocated_bytes_[i] +=
+          thread_counters->allocated_bytes[i].load(std::memory_order_relaxed);
+    }
+  }
+  return stats;
+}
+
+size_t StatsRecorder::thread_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return thread_counters_.size();
+}
+
+// static
+void StatsRecorder::SetCurrent(StatsRecorder* recorder) {
+  // A thread keeps using its counters for nested contexts (e.g., a parallel
+  // loop running some of its iterations on the calling thread).
+  if (!recorder)
+    current_ = nullptr;
+  else if (!current_ || current_->recorder != recorder)
+    current_ = recorder->GetThreadCounters();
+}
+
+StatsRecorder::ThreadCounters* StatsRecorder::GetThreadCounters() {
+  CachedThreadCounters* cache = cached_thread_counters_;
+  // If this recorder isn't cached, the least recently used one is replaced.
+  size_t i = 0;
+  while (i < kCachedThreadCountersCount - 1 && cache[i].recorder_id != id_)
+    i++;
+  CachedThreadCounters found = cache[i];
+  if (found.recorder_id != id_) {
+    found.recorder_id = id_;
+    found.thread_counters = AddThreadCounters();
+  }
+  std::copy_backward(cache, cache + i, cache + i + 1);
+  cache[0] = found;
+  return found.thread_counters;
+}
+
+StatsRecorder::ThreadCounters* StatsRecorder::AddThreadCounters() {
+  // TODO(C++14): Use std::make_unique.
+  std::unique_ptr<ThreadCounters> thread_counters(new ThreadCounters(this));
+  ThreadCounters* result = thread_counters.get();
+  std::lock_guard<std::mutex> lock(mutex_);
+  thread_counters_.push_back(std::move(thread_counters));
+  return result;
+}
+
+}  // namespace icl
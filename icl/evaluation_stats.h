@@ -0,0 +1,197 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_EVALUATION_STATS_H_
+#define ICL_EVALUATION_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "icl/allocator.h"
+#include "icl/evaluation_context.h"
+
+namespace icl {
+
+// Counts of the interpreter's expensive operations (see |StatsRecorder|).
+class EvaluationStats {
+ public:
+  enum Counter {
+    // Copies of list and scope values (which copy their contents), and the
+    // list elements copied by them.
+    VALUE_DEEP_COPIES,
+    VALUE_DEEP_COPY_ELEMENTS,
+    // |Scope::MakeClosure()| calls, and the records they copied.
+    CLOSURES,
+    CLOSURE_RECORDS,
+    // Records merged by |Scope::NonRecursiveMergeTo()| (e.g., by imports).
+    MERGED_RECORDS,
+    // Expressions in strings (e.g., "${foo.bar}"), which are parsed each time
+    // the string is evaluated.
+    STRING_EXPRESSION_PARSES,
+    // Bytes of files (and string expressions) tokenized and parsed.
+    BYTES_TOKENIZED,
+    BYTES_PARSED,
+    // Invocations of pure templates that were replayed from, or missing from,
+    // the current |TemplateCache|.
+    TEMPLATE_CACHE_HITS,
+    TEMPLATE_CACHE_MISSES,
+
+    COUNTER_COUNT
+  };
+
+  // Variable lookups are counted by the number of scopes up the chain they
+  // went (for ones that weren't found, the whole chain). The last bucket
+  // includes deeper lookups.
+  static const size_t kLookupDepthBucketCount = 8;
+
+  EvaluationStats();
+  ~EvaluationStats();
+
+  uint64_t counter(Counter counter) const { return counters_[counter]; }
+  uint64_t lookups_at_depth(size_t depth) const {
+    return lookup_depths_[depth];
+  }
+  // The number and total size of allocations of each category (see
+  // |Allocator|).
+  uint64_t allocations(Allocator::Category category) const {
+    return allocations_[category];
+  }
+  uint64_t allocated_bytes(Allocator::Category category) const {
+    return allocated_bytes_[category];
+  }
+  uint64_t total_allocated_bytes() const;
+
+  EvaluationStats& operator+=(const EvaluationStats& other);
+
+  // Returns a name for |counter|, e.g., "closure_records".
+  static const char* GetCounterName(Counter counter);
+
+  // Returns the stats as lines of "<name> <count>", with lookups named like
+  // "lookup_depth_2" (and "lookup_depth_7+"), and allocations like
+  // "allocations_scope" and "allocated_bytes_scope".
+  std::string ToString() const;
+
+ private:
+  friend class StatsRecorder;
+
+  uint64_t counters_[COUNTER_COUNT];
+  uint64_t lookup_depths_[kLookupDepthBucketCount];
+  uint64_t allocations_[Allocator::CATEGORY_COUNT];
+  uint64_t allocated_bytes_[Allocator::CATEGORY_COUNT];
+};
+
+// Collects |EvaluationStats| for evaluation on the threads it's current on (see
+// |EvaluationContext|). Each thread counts into its own counters, which are
+// only added up when the stats are requested, so counting is cheap (and, when
+// there's no current recorder, a single branch).
+//
+// Thread safety: A recorder may be shared by several threads.
+class StatsRecorder {
+ private:
+  struct ThreadCounters;
+
+ public:
+  StatsRecorder();
+  ~StatsRecorder();
+
+  StatsRecorder(const StatsRecorder&) = delete;
+  StatsRecorder& operator=(const StatsRecorder&) = delete;
+
+  // The current thread's recorder, or null.
+  static StatsRecorder* current() {
+    return EvaluationContext::current().stats_recorder;
+  }
+
+  // Counts |count| of |counter| (or a lookup |depth| scopes up the chain) for
+  // the current thread's recorder, if any.
+  static void Count(EvaluationStats::Counter counter, uint64_t count) {
+    ThreadCounters* thread_counters = current_;
+    if (thread_counters)
+      Add(&thread_counters->counters[counter], count);
+  }
+  static void CountLookup(size_t depth) {
+    ThreadCounters* thread_counters = current_;
+    if (thread_counters) {
+      if (depth >= EvaluationStats::kLookupDepthBucketCount)
+        depth = EvaluationStats::kLookupDepthBucketCount - 1;
+      Add(&thread_counters->lookup_depths[depth], 1);
+    }
+  }
+  static void CountAllocation(Allocator::Category category, uint64_t size) {
+    ThreadCounters* thread_counters = current_;
+    if (thread_counters) {
+      Add(&thread_counters->allocations[category], 1);
+      Add(&thread_counters->allocated_bytes[category], size);
+    }
+  }
+
+  // Adds up the counts from all threads so far.
+  EvaluationStats GetStats() const;
+
+  // The number of threads that have counted for this recorder.
+  size_t thread_count() const;
+
+ private:
+  struct ThreadCounters {
+    explicit ThreadCounters(StatsRecorder* recorder);
+
+    StatsRecorder* const recorder;
+    // Only written by the thread, but may be read by others.
+    std::atomic<uint64_t> counters[EvaluationStats::COUNTER_COUNT];
+    std::atomic<uint64_t>
+        lookup_depths[EvaluationStats::kLookupDepthBucketCount];
+    std::atomic<uint64_t> allocations[Allocator::CATEGORY_COUNT];
+    std::atomic<uint64_t> allocated_bytes[Allocator::CATEGORY_COUNT];
+  };
+
+  // Only one thread writes a counter, so this needn't be an atomic add.
+  static void Add(std::atomic<uint64_t>* counter, uint64_t count) {
+    counter->store(counter->load(std::memory_order_relaxed) + count,
+                   std::memory_order_relaxed);
+  }
+
+  // Returns the current thread's counters for this recorder, adding them the
+  // first time.
+  ThreadCounters* GetThreadCounters();
+  ThreadCounters* AddThreadCounters();
+
+  // Points |current_| at the current thread's counters for |recorder| (or
+  // null), as its context changes.
+  friend class EvaluationContext::Scoped;
+  static void SetCurrent(StatsRecorder* recorder);
+
+  // The current thread's counters for its current recorder, kept alongside
+  // its context so that counting needn't look them up.
+  static thread_local ThreadCounters* current_;
+
+  // The counters each thread most recently used for a few recorders, most
+  // recent first, so that a thread that repeatedly counts for a recorder
+  // (e.g., a pool thread running the iterations of a parallel loop) reuses
+  // its counters. They're identified by |id_| rather than by address, since a
+  // destroyed recorder's address may be reused.
+  struct CachedThreadCounters {
+    uint64_t recorder_id;  // Zero if unused.
+    ThreadCounters* thread_counters;
+  };
+  static const size_t kCachedThreadCountersCount = 4;
+  static thread_local CachedThreadCounters
+      cached_thread_counters_[kCachedThreadCountersCount];
+
+  // Unique among all recorders (and nonzero).
+  const uint64_t id_;
+
+  // Protects the following.
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadCounters>> thread_counters_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_EVALUATION_STATS_H_
@@ -0,0 +1,121 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/evaluation_stats.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "icl/evaluation_context.h"
+
+namespace icl {
+namespace {
+
+TEST(EvaluationStats, NoRecorder) {
+  StatsRecorder recorder;
+  EXPECT_EQ(nullptr, StatsRecorder::current());
+  StatsRecorder::Count(EvaluationStats::CLOSURES, 1);
+  StatsRecorder::CountLookup(0);
+  EvaluationStats stats = recorder.GetStats();
+  EXPECT_EQ(0u, stats.counter(EvaluationStats::CLOSURES));
+  EXPECT_EQ(0u, stats.lookups_at_depth(0));
+}
+
+TEST(EvaluationStats, Count) {
+  StatsRecorder recorder;
+  {
+    EvaluationContext context = {};
+    context.stats_recorder = &recorder;
+    EvaluationContext::Scoped scoped_context(context);
+    EXPECT_EQ(&recorder, StatsRecorder::current());
+    StatsRecorder::Count(EvaluationStats::CLOSURES, 1);
+    StatsRecorder::Count(EvaluationStats::BYTES_PARSED, 100);
+    StatsRecorder::CountLookup(0);
+    StatsRecorder::CountLookup(2);
+    // Deep lookups go in the last bucket.
+    StatsRecorder::CountLookup(100);
+    {
+      EvaluationContext nested_context = EvaluationContext::current();
+      nested_context.stats_recorder = &recorder;
+      EvaluationContext::Scoped scoped_nested_context(nested_context);
+      StatsRecorder::Count(EvaluationStats::CLOSURES, 2);
+    }
+  }
+  EXPECT_EQ(nullptr, StatsRecorder::current());
+  StatsRecorder::Count(EvaluationStats::CLOSURES, 1);
+
+  EvaluationStats stats = recorder.GetStats();
+  EXPECT_EQ(3u, stats.counter(EvaluationStats::CLOSURES));
+  EXPECT_EQ(100u, stats.counter(EvaluationStats::BYTES_PARSED));
+  EXPECT_EQ(0u, stats.counter(EvaluationStats::MERGED_RECORDS));
+  EXPECT_EQ(1u, stats.lookups_at_depth(0));
+  EXPECT_EQ(0u, stats.lookups_at_depth(1));
+  EXPECT_EQ(1u, stats.lookups_at_depth(2));
+  EXPECT_EQ(1u, stats.lookups_at_depth(
+                    EvaluationStats::kLookupDepthBucketCount - 1));
+
+  std::string string = stats.ToString();
+  EXPECT_NE(std::string::npos, string.find("closures 3\n")) << string;
+  EXPECT_NE(std::string::npos, string.find("bytes_parsed 100\n")) << string;
+  EXPECT_NE(std::string::npos, string.find("lookup_depth_2 1\n")) << string;
+  EXPECT_NE(std::string::npos, string.find("lookup_depth_7+ 1\n")) << string;
+
+  EvaluationStats sum;
+  sum += stats;
+  sum += stats;
+  EXPECT_EQ(6u, sum.counter(EvaluationStats::CLOSURES));
+  EXPECT_EQ(2u, sum.lookups_at_depth(0));
+}
+
+TEST(EvaluationStats, Threads) {
+  StatsRecorder recorder;
+  auto run = [&recorder]() {
+    EvaluationContext context = {};
+    context.stats_recorder = &recorder;
+    EvaluationContext::Scoped scoped_context(context);
+    for (int i = 0; i < 1000; i++)
+      StatsRecorder::Count(EvaluationStats::MERGED_RECORDS, 1);
+  };
+  std::thread thread1(run);
+  std::thread thread2(run);
+  thread1.join();
+  thread2.join();
+  EXPECT_EQ(2000u,
+            recorder.GetStats().counter(EvaluationStats::MERGED_RECORDS));
+}
+
+// A thread keeps its counters for a recorder across scopes (e.g., one for each
+// iteration of a parallel loop), even when it uses other recorders in between.
+TEST(EvaluationStats, ReuseThreadCounters) {
+  StatsRecorder recorder;
+  for (int i = 0; i < 100; i++) {
+    EvaluationContext context = {};
+    context.stats_recorder = &recorder;
+    EvaluationContext::Scoped scoped_context(context);
+    StatsRecorder::Count(EvaluationStats::CLOSURES, 1);
+    StatsRecorder other_recorder;
+    EvaluationContext other_context = EvaluationContext::current();
+    other_context.stats_recorder = &other_recorder;
+    EvaluationContext::Scoped scoped_other_context(other_context);
+    StatsRecorder::Count(EvaluationStats::CLOSURES, 1);
+  }
+  EXPECT_EQ(1u, recorder.thread_count());
+  EXPECT_EQ(100u, recorder.GetStats().counter(EvaluationStats::CLOSURES));
+
+  std::thread thread([&recorder]() {
+    for (int i = 0; i < 100; i++) {
+      EvaluationContext context = {};
+      context.stats_recorder = &recorder;
+      EvaluationContext::Scoped scoped_context(context);
+      StatsRecorder::Count(EvaluationStats::CLOSURES, 1);
+    }
+  });
+  thread.join();
+  EXPECT_EQ(2u, recorder.thread_count());
+  EXPECT_EQ(200u, recorder.GetStats().counter(EvaluationStats::CLOSURES));
+}
+
+}  // namespace
+}  // namespace icl
@@ -0,0 +1,72 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/fake_file_reader.h"
+
+#include <utility>
+
+namespace icl {
+
+FakeFileReader::FakeFileReader() : hold_reads_(false), read_call_count_(0) {}
+
+FakeFileReader::~FakeFileReader() {
+  CompleteHeldReads();
+}
+
+void FakeFileReader::set_hold_reads(bool hold_reads) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  hold_reads_ = hold_reads;
+}
+
+size_t FakeFileReader::held_read_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return held_requests_.size();
+}
+
+void FakeFileReader::CompleteHeldReads() {
+  std::vector<Request> requests;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    requests.swap(held_requests_);
+  }
+  Complete(std::move(requests));
+}
+
+int FakeFileReader::read_call_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return read_call_count_;
+}
+
+int FakeFileReader::request_count(const std::string& name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = request_counts_.find(name);
+  return found != request_counts_.end() ? found->second : 0;
+}
+
+void FakeFileReader::Read(std::vector<Request> requests) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    read_call_count_++;
+    for (const Request& request : requests)
+      request_counts_[request.name.value()]++;
+    if (hold_reads_) {
+      for (Request& request : requests)
+        held_requests_.push_back(std::move(request));
+      return;
+    }
+  }
+  Complete(std::move(requests));
+}
+
+void FakeFileReader::Complete(std::vector<Request> requests) {
+  for (Request& request : requests) {
+    auto found = files_.find(request.name.value());
+    if (found == files_.end())
+      request.callback(false, std::string());
+    else
+      request.callback(true, std::string(found->second));
+  }
+}
+
+}  // namespace icl
@@ -0,0 +1,60 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_FAKE_FILE_READER_H_
+#define ICL_FAKE_FILE_READER_H_
+
+#include <stddef.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "icl/async_file_reader.h"
+
+namespace icl {
+
+// An |AsyncFileReader| that reads files from a map, for tests. Reads complete
+// immediately (i.e., in |Read()|), unless they're being held, in which case
+// they complete when |CompleteHeldReads()| is called.
+class FakeFileReader : public AsyncFileReader {
+ public:
+  FakeFileReader();
+  ~FakeFileReader() override;
+
+  FakeFileReader(const FakeFileReader&) = delete;
+  FakeFileReader& operator=(const FakeFileReader&) = delete;
+
+  // The files, by name (e.g., "//foo.icl"). Must not be changed while reads
+  // are in progress.
+  std::map<std::string, std::string>& files() { return files_; }
+
+  void set_hold_reads(bool hold_reads);
+  size_t held_read_count() const;
+  void CompleteHeldReads();
+
+  // The number of calls to |Read()|, and of requests for the given file.
+  int read_call_count() const;
+  int request_count(const std::string& name) const;
+
+  // |AsyncFileReader| methods:
+  void Read(std::vector<Request> requests) override;
+
+ private:
+  void Complete(std::vector<Request> requests);
+
+  std::map<std::string, std::string> files_;
+
+  // Protects the following.
+  mutable std::mutex mutex_;
+  bool hold_reads_;
+  std::vector<Request> held_requests_;
+  int read_call_count_;
+  std::map<std::string, int> request_counts_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_FAKE_FILE_READER_H_
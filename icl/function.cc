@@ -13,10 +13,12 @@
 
 #include "icl/delegate.h"
 #include "icl/err.h"
+#include "icl/evaluation_budget.h"
 #include "icl/parse_tree.h"
 #include "icl/scope.h"
 #include "icl/template.h"
 #include "icl/token.h"
+#include "icl/tracer.h"
 #include "icl/value.h"
 #include "icl/variables.h"
 /*
@@ -104,6 +106,10 @@ Value Function::Run(Scope* scope,
   return GenericNoBlockFn(scope, function, args.list_value(), err);
 }
 
+bool Function::IsPure() const {
+  return false;
+}
+
 Value Function::SelfEvaluatingArgsBlockFn(Scope* scope,
                                           const FunctionCallNode* function,
                                           const ListNode* args_list,
@@ -150,6 +156,10 @@ Value RunFunction(Scope* scope,
                   const ListNode* args_list,
                   BlockNode* block,
                   Err* err) {
+  EvaluationBudget* budget = EvaluationBudget::current();
+  if (budget && !budget->Step(function, err))
+    return Value();
+
   const Token& name = function->function();
 
   const FunctionMap& function_map = scope->delegate()->GetFunctions();
@@ -170,6 +180,7 @@ Value RunFunction(Scope* scope,
     return Value();
   }
 
+  Tracer::Span span("function", name.value(), function);
   return found_function->second->Run(scope, function, args_list, block, err);
 }
 
@@ -197,16 +208,13 @@ bool FillTargetBlockScope(const Scope* scope,
     return false;
   }
 
-  // Copy the target defaults, if any, into the scope we're going to execute
-  // the block in.
+  // Make the target defaults, if any, visible in the scope we're going to
+  // execute the block in (they're only copied into it if they're modified).
   const Scope* default_scope = scope->GetTargetDefaults(target_type);
-  if (default_scope) {
-    Scope::MergeOptions merge_options;
-    merge_options.skip_private_vars = true;
-    if (!default_scope->NonRecursiveMergeTo(block_scope, merge_options,
-                                            function, "target defaults", err))
-      return false;
-  }
+  if (default_scope &&
+      !block_scope->AttachTargetDefaults(default_scope, function,
+                                         "target defaults", err))
+    return false;
 
   // The name is the single argument to the target function.
   if (!EnsureSingleStringArg(function, args, err))
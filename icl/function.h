@@ -56,6 +56,13 @@ class Function {
 
   virtual Type GetType() const = 0;
 
+  // Returns true if the function is pure: it only reads its arguments, its
+  // block and the scope it's called in, and has no effects other than its
+  // result, the values it sets in that scope and the items it defines (which
+  // must support |Item::Clone()|). Templates that only call pure functions may
+  // be memoized (see |Template::is_pure()|). The default is false.
+  virtual bool IsPure() const;
+
   // Exactly one of the following should be overridden, depending on the |Type|
   // (as returned by |GetType()|).
   virtual Value SelfEvaluatingArgsBlockFn(Scope* scope,
@@ -24,6 +24,7 @@ void AddStandardFunctions(FunctionMap* functions) {
   functions->insert(function_impls::DefinedFn());
   functions->insert(function_impls::PrintFn());
   functions->insert(function_impls::ForEachFn());
+  functions->insert(function_impls::ParallelForEachFn());
   functions->insert(function_impls::TemplateFn());
 }
 
@@ -49,6 +50,7 @@ class AssertImpl : public Function {
   AssertImpl() = default;
   ~AssertImpl() override = default;
   Type GetType() const override { return Type::GENERIC_NO_BLOCK; }
+  bool IsPure() const override { return true; }
   Value GenericNoBlockFn(Scope* scope,
                          const FunctionCallNode* function,
                          const std::vector<Value>& args,
@@ -112,6 +114,7 @@ class DefinedImpl : public Function {
   DefinedImpl() = default;
   ~DefinedImpl() override = default;
   Type GetType() const override { return Type::SELF_EVALUATING_ARGS_NO_BLOCK; }
+  bool IsPure() const override { return true; }
   Value SelfEvaluatingArgsNoBlockFn(Scope* scope,
                                     const FunctionCallNode* function,
                                     const ListNode* args_list,
@@ -28,6 +28,8 @@ FunctionMapEntry DefinedFn();   // * "defined"
 FunctionMapEntry ImportFn();    // * "defined"
 FunctionMapEntry PrintFn();     // * "print"
 FunctionMapEntry ForEachFn();   // * "foreach" (function_impls_foreach.cc)
+// * "parallel_foreach" (function_impls_foreach.cc)
+FunctionMapEntry ParallelForEachFn();
 FunctionMapEntry TemplateFn();  // * "template" (function_impls_template.cc)
 
 }  // namespace function_impls
@@ -2,56 +2,88 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "icl/delegate.h"
 #include "icl/err.h"
+#include "icl/evaluation_context.h"
 #include "icl/function_impls.h"  // Where |ForEachFn()| is declared.
+#include "icl/import_manager.h"
+#include "icl/location.h"
 #include "icl/parse_node_value_adapter.h"
 #include "icl/parse_tree.h"
 #include "icl/scope.h"
+#include "icl/string_piece.h"
+#include "icl/thread_pool.h"
 
 namespace icl {
 namespace function_impls {
 
 namespace {
 
+// Gets the loop variable, list, and block of a |foreach()|-like call. Returns
+// false (setting |*err|) on failure.
+bool GetLoopArgs(Scope* scope,
+                 const FunctionCallNode* function,
+                 const ListNode* args_list,
+                 StringPiece* loop_var,
+                 ParseNodeValueAdapter* list_adapter,
+                 const BlockNode** block,
+                 Err* err) {
+  const auto& args_vector = args_list->contents();
+  if (args_vector.size() != 2) {
+    *err = Err(function, "Wrong number of arguments to " +
+                             function->function().value().as_string() + "().",
+               "Expecting exactly two.");
+    return false;
+  }
+
+  // Extract the loop variable.
+  const IdentifierNode* identifier = args_vector[0]->AsIdentifier();
+  if (!identifier) {
+    *err =
+        Err(args_vector[0].get(), "Expected an identifier for the loop var.");
+    return false;
+  }
+  *loop_var = identifier->value().value();
+
+  // Extract the list to iterate over.
+  if (!list_adapter->InitForType(scope, args_vector[1].get(), Value::LIST,
+                                 err))
+    return false;
+
+  // Block to execute.
+  *block = function->block();
+  if (!*block) {
+    *err = Err(function, "Expected { after " +
+                             function->function().value().as_string() + ".");
+    return false;
+  }
+  return true;
+}
+
 class ForEachImpl : public Function {
  public:
   ForEachImpl() = default;
   ~ForEachImpl() override = default;
   Type GetType() const override { return Type::SELF_EVALUATING_ARGS_BLOCK; }
+  bool IsPure() const override { return true; }
   Value SelfEvaluatingArgsBlockFn(Scope* scope,
                                   const FunctionCallNode* function,
                                   const ListNode* args_list,
                                   Err* err) const override {
-    const auto& args_vector = args_list->contents();
-    if (args_vector.size() != 2) {
-      *err = Err(function, "Wrong number of arguments to foreach().",
-                 "Expecting exactly two.");
-      return Value();
-    }
-
-    // Extract the loop variable.
-    const IdentifierNode* identifier = args_vector[0]->AsIdentifier();
-    if (!identifier) {
-      *err =
-          Err(args_vector[0].get(), "Expected an identifier for the loop var.");
-      return Value();
-    }
-    StringPiece loop_var(identifier->value().value());
-
-    // Extract the list to iterate over.
+    StringPiece loop_var;
     ParseNodeValueAdapter list_adapter;
-    if (!list_adapter.InitForType(scope, args_vector[1].get(), Value::LIST,
-                                  err))
+    const BlockNode* block = nullptr;
+    if (!GetLoopArgs(scope, function, args_list, &loop_var, &list_adapter,
+                     &block, err))
       return Value();
     const std::vector<Value>& list = list_adapter.get().list_value();
 
-    // Block to execute.
-    const BlockNode* block = function->block();
-    if (!block) {
-      *err = Err(function, "Expected { after foreach.");
-      return Value();
-    }
-
     // If the loop variable was previously defined in this scope, save it so we
     // can put it back after the loop is done.
     const Value* old_loop_value_ptr = scope->GetValue(loop_var);
@@ -81,6 +113,136 @@ class ForEachImpl : public Function {
   }
 };
 
+// Like |foreach()|, but each iteration runs in a scope of its own, whose
+// containing scope is a frozen snapshot of the calling scope, so iterations
+// can run in parallel (on the delegate's thread pool, if any). Iterations
+// can't assign to variables from outside the loop (since the changes would
+// be lost), but may make items, which are collected and passed on in the order
+// of the list once the loop is done (as are errors: the first iteration's error
+// is reported).
+class ParallelForEachImpl : public Function {
+ public:
+  ParallelForEachImpl() = default;
+  ~ParallelForEachImpl() override = default;
+  Type GetType() const override { return Type::SELF_EVALUATING_ARGS_BLOCK; }
+  bool IsPure() const override { return true; }
+  Value SelfEvaluatingArgsBlockFn(Scope* scope,
+                                  const FunctionCallNode* function,
+                                  const ListNode* args_list,
+                                  Err* err) const override {
+    StringPiece loop_var;
+    ParseNodeValueAdapter list_adapter;
+    const BlockNode* block = nullptr;
+    if (!GetLoopArgs(scope, function, args_list, &loop_var, &list_adapter,
+                     &block, err))
+      return Value();
+    const std::vector<Value>& list = list_adapter.get().list_value();
+
+    std::unique_ptr<Scope> closure = scope->MakeClosure();
+    closure->Freeze();
+    // Const, so that the iterations' scopes have it as their const containing
+    // scope.
+    const std::unique_ptr<const Scope> snapshot(std::move(closure));
+    const SourceDir& source_dir = scope->GetSourceDir();
+    bool is_processing_import = scope->IsProcessingImport();
+    ItemSink* collector = scope->GetItemCollector();
+    ImportManager::Recorder* recorder = ImportManager::Recorder::Find(scope);
+    std::mutex recorder_mutex;
+    const EvaluationContext context = EvaluationContext::current();
+
+    std::vector<Err> errs(list.size());
+    std::vector<Scope::ItemVector> items(list.size());
+    std::vector<std::unordered_set<StringPiece, StringPieceHash>> reads(
+        list.size());
+    auto run_iteration = [&](size_t i) {
+      EvaluationContext::Scoped scoped_context(context);
+      ItemVectorSink iteration_sink(&items[i]);
+      Scope iteration_scope(snapshot.get());
+      iteration_scope.set_closure_reads(&reads[i]);
+      iteration_scope.set_source_dir(source_dir);
+      if (is_processing_import)
+        iteration_scope.SetProcessingImport();
+      if (collector)
+        iteration_scope.set_item_collector(&iteration_sink);
+      std::unique_ptr<ImportManager::Recorder> iteration_recorder;
+      if (recorder)
+        iteration_recorder.reset(new ImportManager::Recorder(&iteration_scope));
+
+      iteration_scope.SetValue(loop_var, list[i], function);
+      iteration_scope.MarkUsed(loop_var);
+      block->Execute(&iteration_scope, &errs[i]);
+      if (!errs[i].has_error())
+        CheckIteration(*snapshot, iteration_scope, loop_var, &errs[i]);
+
+      if (recorder) {
+        std::lock_guard<std::mutex> lock(recorder_mutex);
+        recorder->AddNested(*iteration_recorder);
+      }
+    };
+    if (ThreadPool* pool = scope->delegate()->GetThreadPool()) {
+      pool->ParallelFor(list.size(), run_iteration);
+    } else {
+      for (size_t i = 0; i < list.size(); i++)
+        run_iteration(i);
+    }
+
+    // Lookups in the snapshot don't mark anything, so mark the values the
+    // iterations read where the snapshot took them from.
+    for (const auto& iteration_reads : reads)
+      scope->MarkUsedFromClosure(iteration_reads);
+
+    for (const Err& iteration_err : errs) {
+      if (iteration_err.has_error()) {
+        *err = iteration_err;
+        return Value();
+      }
+    }
+    if (collector) {
+      for (Scope::ItemVector& iteration_items : items) {
+        for (auto& item : iteration_items)
+          collector->AddItem(std::move(item));
+      }
+    }
+    return Value();
+  }
+
+ private:
+  // Checks that the iteration didn't assign to variables from outside the
+  // loop, and used the variables it set.
+  static void CheckIteration(const Scope& snapshot,
+                             const Scope& iteration_scope,
+                             const StringPiece& loop_var,
+                             Err* err) {
+    Scope::KeyValueMap values;
+    iteration_scope.GetCurrentScopeValues(&values);
+    // Report the one set first in the file, so that which one is reported
+    // doesn't depend on hashing.
+    const Value* first = nullptr;
+    StringPiece first_name;
+    Location first_location;
+    for (const auto& pair : values) {
+      if (pair.first == loop_var || !snapshot.GetValue(pair.first))
+        continue;
+      Location location;
+      if (pair.second.origin())
+        location = pair.second.origin()->GetRange().begin();
+      if (!first || location < first_location) {
+        first = &pair.second;
+        first_name = pair.first;
+        first_location = location;
+      }
+    }
+    if (first) {
+      *err = Err(*first, "Can't assign to \"" + first_name.as_string() +
+                             "\" in parallel_foreach.",
+                 "Each iteration runs in a scope of its own, so changes to "
+                 "variables from outside the loop would be lost.");
+      return;
+    }
+    iteration_scope.CheckForUnusedVars(err);
+  }
+};
+
 }  // namespace
 
 FunctionMapEntry ForEachFn() {
@@ -88,5 +250,11 @@ FunctionMapEntry ForEachFn() {
   return {"foreach", std::unique_ptr<Function>(new ForEachImpl())};
 }
 
+FunctionMapEntry ParallelForEachFn() {
+  // TODO(C++14): Use std::make_unique.
+  return {"parallel_foreach",
+          std::unique_ptr<Function>(new ParallelForEachImpl())};
+}
+
 }  // namespace function_impls
 }  // namespace icl
@@ -79,5 +79,87 @@ TEST(FunctionForeach, MarksIdentAsUsed) {
   EXPECT_FALSE(err.has_error());
 }
 
+TEST(FunctionForeach, Parallel) {
+  TestWithScope setup;
+  TestParseInput input(
+      "a = 5\n"
+      "i = 6\n"
+      "parallel_foreach(i, [1, 2, 3]) {\n"
+      "  b = a + i\n"
+      "  print(\"$b\")\n"
+      "}\n"
+      "print(\"$a $i\")");  // The loop var is untouched.
+  ASSERT_FALSE(input.has_error());
+
+  Err err;
+  input.parsed()->Execute(setup.scope(), &err);
+  ASSERT_FALSE(err.has_error()) << err.message();
+  EXPECT_EQ("6\n7\n8\n5 6\n", setup.print_output());
+
+  // Locals don't outlive their iteration, and the outer variables the loop
+  // read count as used.
+  EXPECT_FALSE(setup.scope()->GetValue("b"));
+  EXPECT_TRUE(setup.scope()->CheckForUnusedVars(&err));
+}
+
+TEST(FunctionForeach, ParallelMarksReadsAsUsed) {
+  TestWithScope setup;
+  TestParseInput input(
+      "b = 6\n"
+      "c = 7\n"
+      "parallel_foreach(i, [1, 2]) {\n"
+      "  if (i == 1) {\n"
+      "    print(a)\n"
+      "  } else {\n"
+      "    print(c)\n"
+      "  }\n"
+      "}\n");
+  ASSERT_FALSE(input.has_error());
+
+  // Run the loop in a nested scope, to check that values are marked in the
+  // scope they were set in.
+  setup.scope()->SetValue("a", Value(nullptr, static_cast<int64_t>(5)),
+                          nullptr);
+  Scope nested(setup.scope());
+  Err err;
+  input.parsed()->Execute(&nested, &err);
+  ASSERT_FALSE(err.has_error()) << err.message();
+  EXPECT_EQ("5\n7\n", setup.print_output());
+
+  // Only the variable the loop didn't read is unused.
+  EXPECT_FALSE(setup.scope()->IsSetButUnused("a"));
+  EXPECT_TRUE(nested.IsSetButUnused("b"));
+  EXPECT_FALSE(nested.IsSetButUnused("c"));
+  EXPECT_FALSE(nested.CheckForUnusedVars(&err));
+  EXPECT_TRUE(err.has_error());
+}
+
+TEST(FunctionForeach, ParallelRejectsOuterWrites) {
+  TestWithScope setup;
+  TestParseInput input(
+      "a = 5\n"
+      "parallel_foreach(i, [1, 2, 3]) {\n"
+      "  a = a + i\n"
+      "}\n");
+  ASSERT_FALSE(input.has_error());
+
+  Err err;
+  input.parsed()->Execute(setup.scope(), &err);
+  ASSERT_TRUE(err.has_error());
+  EXPECT_EQ("Can't assign to \"a\" in parallel_foreach.", err.message());
+  EXPECT_EQ(3, err.location().line_number());
+
+  // Variables set (and not used) in an iteration are reported.
+  TestWithScope unused_setup;
+  TestParseInput unused_input(
+      "parallel_foreach(i, [1, 2, 3]) {\n"
+      "  b = i\n"
+      "}\n");
+  ASSERT_FALSE(unused_input.has_error());
+  err = Err();
+  unused_input.parsed()->Execute(unused_setup.scope(), &err);
+  EXPECT_TRUE(err.has_error());
+}
+
 }  // namespace
 }  // namespace icl
@@ -0,0 +1,762 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/import_cache.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+#include "icl/binary_io.h"
+#include "icl/delegate.h"
+#include "icl/err.h"
+#include "icl/input_file.h"
+#include "icl/location.h"
+#include "icl/parse_tree.h"
+#include "icl/ref_ptr.h"
+#include "icl/scope.h"
+#include "icl/sha256.h"
+#include "icl/string_piece.h"
+#include "icl/template.h"
+#include "icl/value.h"
+
+namespace icl {
+
+namespace {
+
+// Entries start with this and the format version, and the version is also part
+// of their names. Bump the version whenever the format (or anything that
+// affects the order of parse nodes; see |CollectNodes()|) changes.
+const char kMagic[4] = {'I', 'C', 'L', 'I'};
+const uint64_t kFormatVersion = 2;
+
+const char kEntrySuffix[] = ".iclimport";
+
+// Objects (closure bases and templates) are written before anything that
+// refers to them, and referred to by (one more than) their index.
+enum ObjectKind {
+  OBJECT_CLOSURE_BASE,
+  OBJECT_TEMPLATE,
+
+  NUM_OBJECT_KINDS
+};
+
+// Appends |node| (if non-null) and its descendants, in preorder, to |*nodes|.
+// Parse nodes are referred to by file and index in this order.
+void CollectNodes(const ParseNode* node, std::vector<const ParseNode*>* nodes) {
+  if (!node)
+    return;
+  nodes->push_back(node);
+
+  if (const AccessorNode* accessor = node->AsAccessor()) {
+    CollectNodes(accessor->index(), nodes);
+    CollectNodes(accessor->member(), nodes);
+  } else if (const BinaryOpNode* binary_op = node->AsBinaryOp()) {
+    CollectNodes(binary_op->left(), nodes);
+    CollectNodes(binary_op->right(), nodes);
+  } else if (const BlockNode* block = node->AsBlock()) {
+    CollectNodes(block->End(), nodes);
+    for (const auto& statement : block->statements())
+      CollectNodes(statement.get(), nodes);
+  } else if (const ConditionNode* condition = node->AsConditionNode()) {
+    CollectNodes(condition->condition(), nodes);
+    CollectNodes(condition->if_true(), nodes);
+    CollectNodes(condition->if_false(), nodes);
+  } else if (const FunctionCallNode* function_call = node->AsFunctionCall()) {
+    CollectNodes(function_call->args(), nodes);
+    CollectNodes(function_call->block(), nodes);
+  } else if (const ListNode* list = node->AsList()) {
+    CollectNodes(list->End(), nodes);
+    for (const auto& item : list->contents())
+      CollectNodes(item.get(), nodes);
+  } else if (const UnaryOpNode* unary_op = node->AsUnaryOp()) {
+    CollectNodes(unary_op->operand(), nodes);
+  }
+}
+
+// Same as |IsPrivateVar()| in scope.cc.
+bool IsPrivateName(const StringPiece& name) {
+  return name.empty() || name[0] == '_';
+}
+
+// Returns the values of |scope| (not counting containing scopes), sorted by
+// name so that the output is deterministic.
+std::vector<std::pair<StringPiece, Value>> GetSortedValues(const Scope& scope) {
+  Scope::KeyValueMap values;
+  scope.GetCurrentScopeValues(&values);
+  std::vector<std::pair<StringPiece, Value>> result(values.begin(),
+                                                    values.end());
+  std::sort(result.begin(), result.end(),
+            [](const std::pair<StringPiece, Value>& a,
+               const std::pair<StringPiece, Value>& b) {
+              return a.first < b.first;
+            });
+  return result;
+}
+
+// Writes the parts of an entry following the header and dependencies: the
+// direct imports, the objects, and finally the contents of the import's scope.
+//
+// The contents of a scope are written as its values, templates and target
+// defaults. The contents of the import's scope omit what will be provided by
+// redoing its direct imports; other scopes are written in full (except that
+// templates that are provided by the direct imports are written as references
+// to them). Scopes in values and target defaults must only contain values.
+class Serializer {
+ public:
+  // |files| are the import's file followed by its dependencies.
+  Serializer(const std::vector<const InputFile*>& files,
+             const Scope& scope,
+             const std::vector<ImportCache::DirectImport>& direct_imports)
+      : scope_(scope), direct_imports_(direct_imports), object_count_(0) {
+    for (size_t i = 0; i < files.size(); i++) {
+      std::vector<const ParseNode*> nodes;
+      CollectNodes(files[i]->root_parse_node(), &nodes);
+      for (size_t j = 0; j < nodes.size(); j++)
+        node_refs_[nodes[j]] = std::make_pair(i, j);
+    }
+  }
+  ~Serializer() {}
+
+  Serializer(const Serializer&) = delete;
+  Serializer& operator=(const Serializer&) = delete;
+
+  bool Write(std::string* out) {
+    WriteVarint(direct_imports_.size(), out);
+    for (const auto& direct_import : direct_imports_) {
+      WriteString(direct_import.name.value(), out);
+      if (!direct_import.node || !WriteNodeRef(direct_import.node, out))
+        return false;
+    }
+
+    std::string content;
+    if (!WriteContent(scope_, true, &content))
+      return false;
+    WriteVarint(object_count_, out);
+    out->append(objects_);
+    out->append(content);
+    return true;
+  }
+
+ private:
+  bool WriteNodeRef(const ParseNode* node, std::string* out) {
+    if (!node) {
+      WriteVarint(0, out);
+      return true;
+    }
+    auto found = node_refs_.find(node);
+    if (found == node_refs_.end())
+      return false;  // Not from one of the files.
+    WriteVarint(found->second.first + 1, out);
+    WriteVarint(found->second.second, out);
+    return true;
+  }
+
+  bool WriteValue(const Value& value, std::string* out) {
+    WriteVarint(value.type(), out);
+    if (!WriteNodeRef(value.origin(), out))
+      return false;
+    switch (value.type()) {
+      case Value::NONE:
+        return true;
+      case Value::BOOLEAN:
+        WriteVarint(value.boolean_value() ? 1 : 0, out);
+        return true;
+      case Value::INTEGER:
+        WriteSignedVarint(value.int_value(), out);
+        return true;
+      case Value::STRING:
+        WriteString(value.string_value(), out);
+        return true;
+      case Value::LIST:
+        WriteVarint(value.list_value().size(), out);
+        for (const auto& item : value.list_value()) {
+          if (!WriteValue(item, out))
+            return false;
+        }
+        return true;
+      case Value::SCOPE:
+        WriteVarint(value.scope_value() ? 1 : 0, out);
+        return !value.scope_value() || WriteValues(*value.scope_value(), out);
+    }
+    assert(false);  // Unknown value type.
+    return false;
+  }
+
+  // Writes the values of a scope that has only values.
+  bool WriteValues(const Scope& scope, std::string* out) {
+    std::map<std::string, const Template*> templates;
+    scope.GetCurrentScopeTemplates(&templates);
+    std::map<std::string, const Scope*> target_defaults;
+    scope.GetCurrentScopeTargetDefaults(&target_defaults);
+    if (scope.containing() || !templates.empty() || !target_defaults.empty())
+      return false;
+
+    std::vector<std::pair<StringPiece, Value>> values = GetSortedValues(scope);
+    WriteVarint(values.size(), out);
+    for (const auto& pair : values) {
+      WriteString(pair.first, out);
+      if (!WriteValue(pair.second, out))
+        return false;
+    }
+    return true;
+  }
+
+  // Writes the values, templates and target defaults of |scope| (not counting
+  // containing scopes). If |omit_imported|, those that will be provided by
+  // redoing the direct imports are omitted.
+  bool WriteContent(const Scope& scope, bool omit_imported, std::string* out) {
+    std::vector<std::pair<StringPiece, Value>> values = GetSortedValues(scope);
+    std::string values_data;
+    size_t value_count = 0;
+    for (const auto& pair : values) {
+      if (omit_imported) {
+        const Value* imported = GetImportedValue(pair.first);
+        if (imported && *imported == pair.second &&
+            imported->origin() == pair.second.origin())
+          continue;
+      }
+      WriteString(pair.first, &values_data);
+      if (!WriteValue(pair.second, &values_data))
+        return false;
+      value_count++;
+    }
+    WriteVarint(value_count, out);
+    out->append(values_data);
+
+    std::map<std::string, const Template*> templates;
+    scope.GetCurrentScopeTemplates(&templates);
+    std::string templates_data;
+    size_t template_count = 0;
+    for (const auto& pair : templates) {
+      if (omit_imported && GetImportedTemplate(pair.first) == pair.second)
+        continue;
+      WriteString(pair.first, &templates_data);
+      if (!WriteTemplateRef(pair.first, pair.second, &templates_data))
+        return false;
+      template_count++;
+    }
+    WriteVarint(template_count, out);
+    out->append(templates_data);
+
+    std::map<std::string, const Scope*> target_defaults;
+    scope.GetCurrentScopeTargetDefaults(&target_defaults);
+    std::string target_defaults_data;
+    size_t target_defaults_count = 0;
+    for (const auto& pair : target_defaults) {
+      if (omit_imported &&
+          GetImportedTargetDefaults(pair.first) == pair.second)
+        continue;
+      WriteString(pair.first, &target_defaults_data);
+      if (!WriteValues(*pair.second, &target_defaults_data))
+        return false;
+      target_defaults_count++;
+    }
+    WriteVarint(target_defaults_count, out);
+    out->append(target_defaults_data);
+    return true;
+  }
+
+  // Templates provided by the direct imports are written as 0 (and looked up
+  // by name when loading); others must have been defined by the import.
+  bool WriteTemplateRef(const std::string& name,
+                        const Template* templ,
+                        std::string* out) {
+    if (GetImportedTemplate(name) == templ) {
+      WriteVarint(0, out);
+      return true;
+    }
+    auto found = node_refs_.find(templ->definition());
+    if (found == node_refs_.end() || found->second.first != 0)
+      return false;  // Not defined by the import.
+    size_t index;
+    if (!AddTemplate(templ, &index))
+      return false;
+    WriteVarint(index + 1, out);
+    return true;
+  }
+
+  bool AddTemplate(const Template* templ, size_t* index) {
+    auto found = object_indices_.find(templ);
+    if (found != object_indices_.end()) {
+      *index = found->second;
+      return true;
+    }
+
+    // Write the closure (and anything it refers to) first.
+    const Scope* closure = templ->closure();
+    const Scope* base = closure->containing();
+    size_t base_index = 0;
+    if (base && !AddClosureBase(base, &base_index))
+      return false;
+    std::string content;
+    if (!WriteContent(*closure, false, &content))
+      return false;
+
+    WriteVarint(OBJECT_TEMPLATE, &objects_);
+    if (!WriteNodeRef(templ->definition(), &objects_))
+      return false;
+    WriteVarint(base ? base_index + 1 : 0, &objects_);
+    objects_.append(content);
+    *index = object_indices_[templ] = object_count_++;
+    return true;
+  }
+
+  // Closure bases are the (shared and frozen) snapshots that template closures
+  // are based on (see |Scope::MakeSharedClosure()|).
+  bool AddClosureBase(const Scope* base, size_t* index) {
+    auto found = object_indices_.find(base);
+    if (found != object_indices_.end()) {
+      *index = found->second;
+      return true;
+    }
+
+    if (!base->is_frozen() || base->containing())
+      return false;
+    std::string content;
+    if (!WriteContent(*base, false, &content))
+      return false;
+
+    WriteVarint(OBJECT_CLOSURE_BASE, &objects_);
+    objects_.append(content);
+    *index = object_indices_[base] = object_count_++;
+    return true;
+  }
+
+  // Look up what will be provided by redoing the direct imports. Private values
+  // are never imported.
+  const Value* GetImportedValue(const StringPiece& name) const {
+    if (IsPrivateName(name))
+      return nullptr;
+    for (const auto& direct_import : direct_imports_) {
+      if (const Value* value = direct_import.scope->GetValue(name))
+        return value;
+    }
+    return nullptr;
+  }
+  const Template* GetImportedTemplate(const std::string& name) const {
+    if (IsPrivateName(name))
+      return nullptr;
+    for (const auto& direct_import : direct_imports_) {
+      if (const Template* templ = direct_import.scope->GetTemplate(name))
+        return templ;
+    }
+    return nullptr;
+  }
+  const Scope* GetImportedTargetDefaults(const std::string& name) const {
+    for (const auto& direct_import : direct_imports_) {
+      if (const Scope* defaults = direct_import.scope->GetTargetDefaults(name))
+        return defaults;
+    }
+    return nullptr;
+  }
+
+  const Scope& scope_;
+  const std::vector<ImportCache::DirectImport>& direct_imports_;
+
+  // Maps each parse node in the files to its file and index.
+  std::unordered_map<const ParseNode*, std::pair<size_t, size_t>> node_refs_;
+
+  // Maps templates and closure bases to their indices.
+  std::unordered_map<const void*, size_t> object_indices_;
+  size_t object_count_;
+  std::string objects_;
+};
+
+class Deserializer {
+ public:
+  // |files| are the import's file followed by its dependencies. The contents
+  // are read into |scope|, which must be new. |names| and |closure_bases| are
+  // from the |ImportCache::Storage|.
+  Deserializer(BinaryReader* reader,
+               Delegate* delegate,
+               const std::vector<const InputFile*>& files,
+               const ImportCache::ImportFunction& import_function,
+               Scope* scope,
+               std::deque<std::string>* names,
+               std::vector<std::unique_ptr<Scope>>* closure_bases)
+      : reader_(reader),
+        delegate_(delegate),
+        import_function_(import_function),
+        scope_(scope),
+        names_(names),
+        closure_bases_(closure_bases) {
+    nodes_.resize(files.size());
+    for (size_t i = 0; i < files.size(); i++)
+      CollectNodes(files[i]->root_parse_node(), &nodes_[i]);
+  }
+  ~Deserializer() {}
+
+  Deserializer(const Deserializer&) = delete;
+  Deserializer& operator=(const Deserializer&) = delete;
+
+  bool Read() {
+    // Redo the direct imports first, since the rest may refer to them.
+    uint64_t count;
+    if (!reader_->ReadVarint(&count))
+      return false;
+    for (uint64_t i = 0; i < count; i++) {
+      StringPiece name;
+      const ParseNode* node;
+      if (!reader_->ReadString(&name) || !ReadNodeRef(&node) || !node)
+        return false;
+      Err err;
+      if (!import_function_(SourceFile(name.as_string()), node, scope_, &err))
+        return false;
+    }
+
+    if (!reader_->ReadVarint(&count))
+      return false;
+    for (uint64_t i = 0; i < count; i++) {
+      if (!ReadObject())
+        return false;
+    }
+
+    return ReadContent(scope_);
+  }
+
+ private:
+  struct Object {
+    ObjectKind kind;
+    const Scope* closure_base;
+    RefPtr<const Template> templ;
+  };
+
+  bool ReadNodeRef(const ParseNode** node) {
+    uint64_t file_index;
+    if (!reader_->ReadVarint(nodes_.size(), &file_index))
+      return false;
+    if (file_index == 0) {
+      *node = nullptr;
+      return true;
+    }
+    const std::vector<const ParseNode*>& nodes = nodes_[file_index - 1];
+    uint64_t index;
+    if (nodes.empty() || !reader_->ReadVarint(nodes.size() - 1, &index))
+      return false;
+    *node = nodes[static_cast<size_t>(index)];
+    return true;
+  }
+
+  // Copies |name| to storage, since scopes don't own their values' names.
+  StringPiece StoreName(const StringPiece& name) {
+    names_->push_back(name.as_string());
+    return names_->back();
+  }
+
+  bool ReadValue(Value* value) {
+    uint64_t type;
+    const ParseNode* origin;
+    if (!reader_->ReadVarint(Value::SCOPE, &type) || !ReadNodeRef(&origin))
+      return false;
+    switch (static_cast<Value::Type>(type)) {
+      case Value::NONE:
+        *value = Value();
+        value->set_origin(origin);
+        return true;
+      case Value::BOOLEAN: {
+        uint64_t boolean_value;
+        if (!reader_->ReadVarint(1, &boolean_value))
+          return false;
+        *value = Value(origin, boolean_value != 0);
+        return true;
+      }
+      case Value::INTEGER: {
+        int64_t int_value;
+        if (!reader_->ReadSignedVarint(&int_value))
+          return false;
+        *value = Value(origin, int_value);
+        return true;
+      }
+      case Value::STRING: {
+        StringPiece string_value;
+        if (!reader_->ReadString(&string_value))
+          return false;
+        *value = Value(origin, string_value.as_string());
+        return true;
+      }
+      case Value::LIST: {
+        uint64_t count;
+        if (!reader_->ReadVarint(&count))
+          return false;
+        *value = Value(origin, Value::LIST);
+        for (uint64_t i = 0; i < count; i++) {
+          Value item;
+          if (!ReadValue(&item))
+            return false;
+          value->list_value().push_back(std::move(item));
+        }
+        return true;
+      }
+      case Value::SCOPE: {
+        uint64_t has_scope;
+        if (!reader_->ReadVarint(1, &has_scope))
+          return false;
+        if (!has_scope) {
+          *value = Value(origin, Value::SCOPE);
+          return true;
+        }
+        std::unique_ptr<Scope> scope(new Scope(delegate_));
+        if (!ReadValues(scope.get()))
+          return false;
+        *value = Value(origin, std::move(scope));
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool ReadValues(Scope* scope) {
+    uint64_t count;
+    if (!reader_->ReadVarint(&count))
+      return false;
+    for (uint64_t i = 0; i < count; i++) {
+      StringPiece name;
+      Value value;
+      if (!reader_->ReadString(&name) || !ReadValue(&value))
+        return false;
+      const ParseNode* origin = value.origin();
+      scope->SetValue(StoreName(name), std::move(value), origin);
+    }
+    return true;
+  }
+
+  bool ReadContent(Scope* scope) {
+    if (!ReadValues(scope))
+      return false;
+
+    uint64_t count;
+    if (!reader_->ReadVarint(&count))
+      return false;
+    for (uint64_t i = 0; i < count; i++) {
+      StringPiece name;
+      RefPtr<const Template> templ;
+      if (!reader_->ReadString(&name) ||
+          !ReadTemplateRef(name.as_string(), &templ) ||
+          !scope->AddTemplate(name.as_string(), std::move(templ)))
+        return false;
+    }
+
+    if (!reader_->ReadVarint(&count))
+      return false;
+    for (uint64_t i = 0; i < count; i++) {
+      StringPiece name;
+      if (!reader_->ReadString(&name) ||
+          !ReadValues(scope->MakeTargetDefaults(name.as_string())))
+        return false;
+    }
+    return true;
+  }
+
+  bool ReadTemplateRef(const std::string& name, RefPtr<const Template>* templ) {
+    uint64_t index;
+    if (!reader_->ReadVarint(objects_.size(), &index))
+      return false;
+    if (index == 0) {
+      // Provided by the direct imports (and the import's scope doesn't have
+      // any templates of its own yet).
+      const Template* imported = scope_->GetTemplate(name);
+      if (!imported)
+        return false;
+      *templ = RefPtr<const Template>(imported);
+      return true;
+    }
+    const Object& object = objects_[static_cast<size_t>(index - 1)];
+    if (object.kind != OBJECT_TEMPLATE)
+      return false;
+    *templ = object.templ.Clone();
+    return true;
+  }
+
+  bool ReadObject() {
+    uint64_t kind;
+    if (!reader_->ReadVarint(NUM_OBJECT_KINDS - 1, &kind))
+      return false;
+    Object object;
+    object.kind = static_cast<ObjectKind>(kind);
+    object.closure_base = nullptr;
+
+    switch (object.kind) {
+      case OBJECT_CLOSURE_BASE: {
+        std::unique_ptr<Scope> base(new Scope(delegate_));
+        if (!ReadContent(base.get()))
+          return false;
+        base->Freeze();
+        object.closure_base = base.get();
+        closure_bases_->push_back(std::move(base));
+        break;
+      }
+      case OBJECT_TEMPLATE: {
+        const ParseNode* definition;
+        uint64_t base_index;
+        if (!ReadNodeRef(&definition) || !definition ||
+            !definition->AsFunctionCall() ||
+            !reader_->ReadVarint(objects_.size(), &base_index))
+          return false;
+        std::unique_ptr<Scope> closure;
+        if (base_index == 0) {
+          closure.reset(new Scope(delegate_));
+        } else {
+          const Object& base = objects_[static_cast<size_t>(base_index - 1)];
+          if (base.kind != OBJECT_CLOSURE_BASE)
+            return false;
+          closure.reset(new Scope(base.closure_base));
+        }
+        if (!ReadContent(closure.get()))
+          return false;
+        object.templ = MakeRefCounted<Template>(std::move(closure),
+                                                definition->AsFunctionCall());
+        break;
+      }
+      case NUM_OBJECT_KINDS:
+        return false;
+    }
+    objects_.push_back(std::move(object));
+    return true;
+  }
+
+  BinaryReader* const reader_;
+  Delegate* const delegate_;
+  const ImportCache::ImportFunction& import_function_;
+  Scope* const scope_;
+  std::deque<std::string>* const names_;
+  std::vector<std::unique_ptr<Scope>>* const closure_bases_;
+
+  // The parse nodes of each file, in the order given by |CollectNodes()|.
+  std::vector<std::vector<const ParseNode*>> nodes_;
+
+  std::vector<Object> objects_;
+};
+
+}  // namespace
+
+ImportCache::Storage::Storage() {}
+
+ImportCache::Storage::~Storage() {}
+
+ImportCache::ImportCache(const std::string& dir, const std::string& key_salt)
+    : dir_(dir), key_salt_(key_salt) {}
+
+ImportCache::~ImportCache() {}
+
+std::unique_ptr<Scope> ImportCache::Load(
+    Delegate* delegate,
+    const InputFile& file,
+    const ImportFunction& import_function,
+    std::set<SourceFile>* deps,
+    std::unique_ptr<Storage>* storage) const {
+  std::string data;
+  StringPiece body;
+  if (!ReadFileToString(GetPath(file), &data) ||
+      !BinaryReader::StripChecksum(data, &body))
+    return nullptr;
+  BinaryReader reader(body);
+
+  // Header.
+  StringPiece magic;
+  uint64_t version;
+  StringPiece key_salt;
+  StringPiece name;
+  StringPiece contents_digest;
+  if (!reader.ReadBytes(sizeof(kMagic), &magic) ||
+      magic != StringPiece(kMagic, sizeof(kMagic)) ||
+      !reader.ReadVarint(&version) || version != kFormatVersion ||
+      !reader.ReadString(&key_salt) || key_salt != key_salt_ ||
+      !reader.ReadString(&name) || name != file.name().value() ||
+      !reader.ReadBytes(kSha256Length, &contents_digest) ||
+      contents_digest != file.GetContentsDigest())
+    return nullptr;
+
+  // Dependencies, which must all be unchanged.
+  std::vector<const InputFile*> files(1, &file);
+  std::set<SourceFile> result_deps;
+  uint64_t count;
+  if (!reader.ReadVarint(body.size(), &count))
+    return nullptr;
+  for (uint64_t i = 0; i < count; i++) {
+    StringPiece dep_name;
+    StringPiece dep_digest;
+    if (!reader.ReadString(&dep_name) ||
+        !reader.ReadBytes(kSha256Length, &dep_digest))
+      return nullptr;
+    SourceFile dep(dep_name.as_string());
+    const InputFile* dep_file = nullptr;
+    if (!delegate->GetInputFile(LocationRange(), dep, &dep_file) ||
+        dep_file->GetContentsDigest() != dep_digest)
+      return nullptr;
+    files.push_back(dep_file);
+    result_deps.insert(std::move(dep));
+  }
+
+  // Note: |scope| must be destroyed before |result_storage|.
+  std::unique_ptr<Storage> result_storage(new Storage);
+  std::unique_ptr<Scope> scope(new Scope(delegate));
+  scope->set_source_dir(file.name().GetDir());
+  Deserializer deserializer(&reader, delegate, files, import_function,
+                            scope.get(), &result_storage->names_,
+                            &result_storage->closure_bases_);
+  if (!deserializer.Read() || !reader.at_end())
+    return nullptr;
+  scope->Freeze();
+
+  deps->swap(result_deps);
+  *storage = std::move(result_storage);
+  return scope;
+}
+
+void ImportCache::Store(Delegate* delegate,
+                        const InputFile& file,
+                        const Scope& scope,
+                        const std::vector<DirectImport>& direct_imports,
+                        const std::set<SourceFile>& deps) const {
+  assert(scope.is_frozen());
+
+  // Header.
+  std::string data(kMagic, sizeof(kMagic));
+  WriteVarint(kFormatVersion, &data);
+  WriteString(key_salt_, &data);
+  WriteString(file.name().value(), &data);
+  data += file.GetContentsDigest();
+
+  // Dependencies (which have already been loaded).
+  std::vector<const InputFile*> files(1, &file);
+  WriteVarint(deps.size(), &data);
+  for (const SourceFile& dep : deps) {
+    const InputFile* dep_file = nullptr;
+    if (!delegate->GetInputFile(LocationRange(), dep, &dep_file))
+      return;
+    WriteString(dep.value(), &data);
+    data += dep_file->GetContentsDigest();
+    files.push_back(dep_file);
+  }
+
+  Serializer serializer(files, scope, direct_imports);
+  if (!serializer.Write(&data))
+    return;
+  AppendChecksum(&data);
+  WriteFileAtomically(GetPath(file), data);
+}
+
+std::string ImportCache::GetPath(const InputFile& file) const {
+  // The name, salt and contents (by digest) are all checked when loading, so a
+  // collision just results in a miss.
+  std::string key;
+  WriteString(key_salt_, &key);
+  WriteString(file.name().value(), &key);
+  WriteFixed64(file.GetContentsHash(), &key);
+
+  char name[64];
+  snprintf(name, sizeof(name), "%016llx-v%llu",
+           static_cast<unsigned long long>(HashBytes(key)),
+           static_cast<unsigned long long>(kFormatVersion));
+  return dir_ + "/" + name + kEntrySuffix;
+}
+
+}  // namespace icl
@@ -0,0 +1,123 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_IMPORT_CACHE_H_
+#define ICL_IMPORT_CACHE_H_
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "icl/source_file.h"
+
+namespace icl {
+
+class Delegate;
+class Err;
+class InputFile;
+class ParseNode;
+class Scope;
+
+// An on-disk cache of the results of imports, so that later runs needn't
+// execute imported files that (along with everything they import) haven't
+// changed.
+//
+// Each entry holds the values, templates and target defaults of an import's
+// resulting scope, and is named by a hash of the imported file's name and
+// contents, the format version, and a caller-supplied "key salt". It also
+// records the |Sha256()| digests of the imported file's contents and the names
+// and digests of the files the import (transitively) imported, which are
+// checked when it's loaded. Values and templates refer to
+// parse nodes (e.g., their origins and template definitions) by position in
+// the parse trees of these files, which are loaded (see
+// |Delegate::GetInputFile()|) and so needn't be stored.
+//
+// The imports done directly by an import are redone (via the |ImportFunction|)
+// when it's loaded, so imports shared by several files are still shared
+// (which matters for, e.g., template collisions), and may themselves be loaded
+// from the cache.
+//
+// Limitations: Only the resulting scope is cached, so side effects (e.g., of
+// print()) are not repeated when an entry is loaded. The results of functions
+// that depend on more than the input files (e.g., the environment) should be
+// accounted for in the key salt. Imports whose results refer to things that
+// can't be stored (e.g., values originating from files that weren't imported)
+// simply aren't stored.
+//
+// Thread safety: This class is thread-safe. Entries are written to a
+// temporary file which is then renamed, so concurrent writers are safe.
+class ImportCache {
+ public:
+  // Does an import (see |ImportManager::DoImport()|).
+  using ImportFunction = std::function<bool(const SourceFile& name,
+                                            const ParseNode* node_for_err,
+                                            Scope* scope,
+                                            Err* err)>;
+
+  // An import done directly into an import's scope (i.e., not into a nested
+  // scope), in order.
+  struct DirectImport {
+    SourceFile name;
+    // The import() call.
+    const ParseNode* node;
+    // The (shared) result of the import.
+    const Scope* scope;
+  };
+
+  // Holds data (e.g., identifier names) that loaded scopes (and values and
+  // templates copied from them) refer to, so must outlive them.
+  class Storage {
+   public:
+    Storage();
+    ~Storage();
+
+    Storage(const Storage&) = delete;
+    Storage& operator=(const Storage&) = delete;
+
+   private:
+    friend class ImportCache;
+
+    std::deque<std::string> names_;
+    std::vector<std::unique_ptr<Scope>> closure_bases_;
+  };
+
+  // |dir| must be an existing directory.
+  ImportCache(const std::string& dir, const std::string& key_salt);
+  ~ImportCache();
+
+  ImportCache(const ImportCache&) = delete;
+  ImportCache& operator=(const ImportCache&) = delete;
+
+  // Loads the result of importing |file| from the cache. On success, returns
+  // the (frozen) scope, sets |*deps| to the files it (transitively) imported
+  // and |*storage| to its storage. Returns null if there's no valid entry.
+  std::unique_ptr<Scope> Load(Delegate* delegate,
+                              const InputFile& file,
+                              const ImportFunction& import_function,
+                              std::set<SourceFile>* deps,
+                              std::unique_ptr<Storage>* storage) const;
+
+  // Stores the result of importing |file|, which is |scope| (which must be
+  // frozen). Failures (e.g., to serialize the scope or write the entry) are
+  // ignored.
+  void Store(Delegate* delegate,
+             const InputFile& file,
+             const Scope& scope,
+             const std::vector<DirectImport>& direct_imports,
+             const std::set<SourceFile>& deps) const;
+
+ private:
+  // Gets the path of the entry for the given file.
+  std::string GetPath(const InputFile& file) const;
+
+  const std::string dir_;
+  const std::string key_salt_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_IMPORT_CACHE_H_
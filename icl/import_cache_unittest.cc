@@ -0,0 +1,122 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/import_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <string>
+
+#include "icl/import_manager.h"
+#include "icl/runner.h"
+#include "icl/scoped_temp_dir.h"
+#include "icl/source_file.h"
+#include "icl/test_delegate.h"
+
+namespace icl {
+namespace {
+
+using FileMap = std::map<std::string, std::string>;
+
+// Runs the given file with a delegate that uses the given import cache (which
+// is what a later run would do), returning the output (or error).
+std::string Run(const FileMap& files,
+                ImportManager::Mode mode,
+                const std::string& cache_dir,
+                const std::string& key_salt,
+                const char* name) {
+  TestDelegate delegate(mode, cache_dir, key_salt);
+  delegate.files() = files;
+  Runner runner(&delegate);
+  Runner::RunResult result = runner.Run(SourceFile(name));
+  if (!result.is_success())
+    return "error: " + result.error_message();
+  return delegate.print_output();
+}
+
+void TestImports(ImportManager::Mode mode) {
+  FileMap files;
+  files["//common.gni"] =
+      "prefix = \"common\"\n"
+      "_private = \"private\"\n"
+      "template(\"say\") {\n"
+      "  print(item_name + \": \" + prefix + \" \" + invoker.message + \" \" +\n"
+      "        _private)\n"
+      "}\n";
+  files["//a.gni"] =
+      "print(\"executing a\")\n"
+      "import(\"//common.gni\")\n"
+      "a = \"a\"\n"
+      "a_list = [ 1, true, \"x\" ]\n"
+      "_a_scope = {\n"
+      "  y = a\n"
+      "}\n"
+      "_a_private = \"a private\"\n"
+      "template(\"say_a\") {\n"
+      "  say(item_name) {\n"
+      "    message = a + \" \" + _a_private + \" \" + a_list[2] +\n"
+      "        _a_scope.y + invoker.suffix\n"
+      "  }\n"
+      "}\n";
+  // Also imports common.gni, which should still be shared with a.gni (else
+  // there'd be a template collision).
+  files["//b.gni"] =
+      "print(\"executing b\")\n"
+      "import(\"//common.gni\")\n"
+      "import(\"//a.gni\")\n"
+      "b = a + \"b\"\n";
+  files["//BUILD.gn"] =
+      "import(\"//a.gni\")\n"
+      "import(\"//b.gni\")\n"
+      "say(\"x\") {\n"
+      "  message = b\n"
+      "}\n"
+      "say_a(\"y\") {\n"
+      "  suffix = \"!\"\n"
+      "}\n"
+      "assert(!defined(_a_private))\n";
+
+  ScopedTempDir cache_dir;
+  const std::string key_salt = "salt";
+  const char kOutput[] =
+      "x: common ab private\n"
+      "y: common a a private xa! private\n";
+
+  // The first run executes the imports, and stores them.
+  EXPECT_EQ(std::string("executing a\nexecuting b\n") + kOutput,
+            Run(files, mode, cache_dir.path(), key_salt, "//BUILD.gn"));
+
+  // The second loads them.
+  EXPECT_EQ(kOutput,
+            Run(files, mode, cache_dir.path(), key_salt, "//BUILD.gn"));
+
+  // Changing an import invalidates everything that (transitively) imports it.
+  files["//common.gni"] += "# Changed.\n";
+  EXPECT_EQ(std::string("executing a\nexecuting b\n") + kOutput,
+            Run(files, mode, cache_dir.path(), key_salt, "//BUILD.gn"));
+  files["//a.gni"] += "a2 = 2\n";
+  EXPECT_EQ(std::string("executing a\nexecuting b\n") + kOutput,
+            Run(files, mode, cache_dir.path(), key_salt, "//BUILD.gn"));
+
+  // But not the other way around.
+  files["//b.gni"] += "b2 = 2\n";
+  EXPECT_EQ(std::string("executing b\n") + kOutput,
+            Run(files, mode, cache_dir.path(), key_salt, "//BUILD.gn"));
+
+  // A different key salt doesn't use the same entries.
+  EXPECT_EQ(std::string("executing a\nexecuting b\n") + kOutput,
+            Run(files, mode, cache_dir.path(), key_salt + "2", "//BUILD.gn"));
+}
+
+TEST(ImportCache, Attach) {
+  TestImports(ImportManager::Mode::ATTACH);
+}
+
+TEST(ImportCache, Merge) {
+  TestImports(ImportManager::Mode::MERGE);
+}
+
+}  // namespace
+}  // namespace icl
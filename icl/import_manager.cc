@@ -7,15 +7,21 @@
 #include <assert.h>
 
 #include <algorithm>
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <set>
+#include <utility>
 
 #include "icl/delegate.h"
 #include "icl/err.h"
+#include "icl/evaluation_budget.h"
+#include "icl/import_cache.h"
 #include "icl/input_file.h"
 #include "icl/load_file.h"
 #include "icl/parse_tree.h"
 #include "icl/scope.h"
+#include "icl/tracer.h"
 //FIXME
 //#include "tools/gn/scope_per_file_provider.h"
 
@@ -23,11 +29,20 @@ namespace icl {
 
 namespace {
 
-// Returns a newly-allocated scope on success, null on failure.
-std::unique_ptr<Scope> UncachedImport(Delegate* delegate,
-                                      const SourceFile& name,
-                                      const ParseNode* node_for_err,
-                                      Err* err) {
+const int kRecorderKey = 0;
+
+// Returns a newly-allocated scope on success, null on failure. Sets |*deps| to
+// the files that were (transitively) imported, even on failure. If the result
+// was loaded from |import_cache| (which may be null), sets |*cache_storage|.
+std::unique_ptr<Scope> UncachedImport(
+    Delegate* delegate,
+    const SourceFile& name,
+    const ParseNode* node_for_err,
+    const ImportCache* import_cache,
+    const ImportCache::ImportFunction& import_function,
+    std::set<SourceFile>* deps,
+    std::unique_ptr<ImportCache::Storage>* cache_storage,
+    Err* err) {
   const InputFile* file = nullptr;
   if (!delegate->GetInputFile(node_for_err->GetRange(), name, &file)) {
     assert(file);
@@ -39,6 +54,17 @@ std::unique_ptr<Scope> UncachedImport(Delegate* delegate,
   assert(!file->err().has_error());
   assert(file->root_parse_node());
 
+  if (import_cache) {
+    Tracer::Span span("import", "import cache load", name);
+    std::unique_ptr<Scope> cached = import_cache->Load(
+        delegate, *file, import_function, deps, cache_storage);
+    span.AddArg("hit", cached ? "true" : "false");
+    if (cached)
+      return cached;
+  }
+
+  Tracer::Span span("import", "execute", name);
+
   std::unique_ptr<Scope> scope(new Scope(delegate));
   scope->set_source_dir(name.GetDir());
 
@@ -48,38 +74,91 @@ std::unique_ptr<Scope> UncachedImport(Delegate* delegate,
 //FIXME
 //  ScopePerFileProvider per_file_provider(scope.get(), false);
 
-  scope->SetProcessingImport();
-  file->root_parse_node()->Execute(scope.get(), err);
-  if (err->has_error()) {
-    // If there was an error, append the caller location so the error message
-    // displays a why the file was imported (esp. useful for failed asserts).
-    err->AppendSubErr(Err(node_for_err, "whence it was imported."));
-    return nullptr;
+  std::vector<ImportCache::DirectImport> direct_imports;
+  bool can_cache;
+  {
+    ImportManager::Recorder recorder(scope.get());
+    scope->SetProcessingImport();
+    file->root_parse_node()->Execute(scope.get(), err);
+    *deps = recorder.deps();
+    if (err->has_error()) {
+      // If there was an error, append the caller location so the error message
+      // displays a why the file was imported (esp. useful for failed asserts).
+      err->AppendSubErr(Err(node_for_err, "whence it was imported."));
+      return nullptr;
+    }
+    scope->ClearProcessingImport();
+    direct_imports = recorder.direct_imports();
+    can_cache = !recorder.has_nested_imports();
   }
-  scope->ClearProcessingImport();
 
+  // The result is cached and shared (read-only) by all importers.
+  scope->Freeze();
+  if (import_cache && can_cache)
+    import_cache->Store(delegate, *file, *scope, direct_imports, *deps);
   return scope;
 }
 
 }  // namespace
 
 struct ImportManager::ImportInfo {
-  ImportInfo() = default;
+  ImportInfo() : loaded_scope(nullptr) {}
   ~ImportInfo() = default;
 
   // This lock protects the unique_ptr. Once the scope is computed,
   // it is const and can be accessed read-only outside of the lock.
   std::mutex load_mutex;
 
+  // Set if the scope was loaded from the import cache. Must outlive |scope|.
+  std::unique_ptr<ImportCache::Storage> cache_storage;
+
   std::unique_ptr<const Scope> scope;
 
+  // The files that were (transitively) imported by the import.
+  std::set<SourceFile> deps;
+
   // The result of loading the import. If the load failed, the scope will be
   // null but this will be set to error. In this case the thread should not
   // attempt to load the file, even if the scope is null.
   Err load_result;
+
+  // Set to |scope| (with release semantics) once it's successfully computed,
+  // so that importing it again needn't take |load_mutex|.
+  std::atomic<const Scope*> loaded_scope;
 };
 
-ImportManager::ImportManager() = default;
+ImportManager::Recorder::Recorder(Scope* scope)
+    : scope_(scope), has_nested_imports_(false) {
+  scope_->SetProperty(&kRecorderKey, this);
+}
+
+ImportManager::Recorder::~Recorder() {
+  scope_->SetProperty(&kRecorderKey, nullptr);
+}
+
+// static
+ImportManager::Recorder* ImportManager::Recorder::Find(const Scope* scope) {
+  return static_cast<Recorder*>(scope->GetProperty(&kRecorderKey, nullptr));
+}
+
+void ImportManager::Recorder::AddNested(const Recorder& nested) {
+  deps_.insert(nested.deps_.begin(), nested.deps_.end());
+  if (!nested.deps_.empty())
+    has_nested_imports_ = true;
+}
+
+ImportManager::Evicted::Evicted() = default;
+
+ImportManager::Evicted::~Evicted() = default;
+
+ImportManager::ImportManager() : ImportManager(Mode::ATTACH) {}
+
+ImportManager::ImportManager(Mode mode) : mode_(mode) {}
+
+ImportManager::ImportManager(Mode mode,
+                             const std::string& import_cache_dir,
+                             const std::string& key_salt)
+    : mode_(mode), import_cache_(new ImportCache(import_cache_dir, key_salt)) {}
 
 ImportManager::~ImportManager() = default;
 
@@ -87,53 +166,115 @@ bool ImportManager::DoImport(const SourceFile& name,
                              const ParseNode* node_for_err,
                              Scope* scope,
                              Err* err) {
-  // See if we have a cached import, but be careful to actually do the scope
-  // copying outside of the lock.
-  ImportInfo* import_info = nullptr;
-  {
-    std::lock_guard<std::mutex> lock(imports_mutex_);
-    std::unique_ptr<ImportInfo>& info_ptr = imports_[name];
-    if (!info_ptr)
-      info_ptr.reset(new ImportInfo);
+  Tracer::Span span("import", name.value(), node_for_err);
 
-    // Promote the ImportInfo to outside of the imports lock.
-    import_info = info_ptr.get();
-  }
+  // See if we have a cached import. This is lock-free if the import was
+  // already done.
+  ImportInfo* import_info = imports_.GetOrInsert(name);
 
-  // Now use the per-import-file lock to block this thread if another thread
-  // is already processing the import.
-  const Scope* import_scope = nullptr;
-  {
+  // If |scope| is (in) a scope whose imports are being recorded (e.g., an
+  // import that's being executed), record this import (even if it fails).
+  const Scope* recorder_scope = nullptr;
+  Recorder* recorder = static_cast<Recorder*>(
+      scope->GetProperty(&kRecorderKey, &recorder_scope));
+  if (recorder)
+    recorder->deps_.insert(name);
+
+  // If the import isn't done yet, use the per-import-file lock to block this
+  // thread if another thread is already processing it.
+  const Scope* import_scope =
+      import_info->loaded_scope.load(std::memory_order_acquire);
+  if (!import_scope) {
     std::lock_guard<std::mutex> lock(import_info->load_mutex);
+    span.AddArg("cached",
+                import_info->scope || import_info->load_result.has_error()
+                    ? "true"
+                    : "false");
 
     if (!import_info->scope) {
       // Only load if the import hasn't already failed.
       if (!import_info->load_result.has_error()) {
         import_info->scope = UncachedImport(
-            scope->delegate(), name, node_for_err, &import_info->load_result);
+            scope->delegate(), name, node_for_err, import_cache_.get(),
+            [this](const SourceFile& import_name,
+                   const ParseNode* import_node_for_err, Scope* import_scope,
+                   Err* import_err) {
+              return DoImport(import_name, import_node_for_err, import_scope,
+                              import_err);
+            },
+            &import_info->deps, &import_info->cache_storage,
+            &import_info->load_result);
       }
       if (import_info->load_result.has_error()) {
+        if (recorder) {
+          recorder->deps_.insert(import_info->deps.begin(),
+                                 import_info->deps.end());
+        }
         *err = import_info->load_result;
+        // Don't keep a failure due to the evaluation budget, which isn't the
+        // import's fault (see |EvaluationBudget|).
+        EvaluationBudget* budget = EvaluationBudget::current();
+        if (budget && budget->is_exhausted())
+          import_info->load_result = Err();
         return false;
       }
     }
 
     // Promote the now-read-only scope to outside the load lock.
     import_scope = import_info->scope.get();
+    import_info->loaded_scope.store(import_scope, std::memory_order_release);
+  } else {
+    span.AddArg("cached", "true");
+  }
+
+  if (recorder) {
+    recorder->deps_.insert(import_info->deps.begin(), import_info->deps.end());
+    if (recorder_scope == scope) {
+      recorder->direct_imports_.push_back({name, node_for_err, import_scope});
+    } else {
+      recorder->has_nested_imports_ = true;
+    }
   }
 
-  Scope::MergeOptions options;
-  options.skip_private_vars = true;
-  options.mark_dest_used = true;  // Don't require all imported values be used.
-  return import_scope->NonRecursiveMergeTo(scope, options, node_for_err,
+  if (mode_ == Mode::ATTACH)
+    return scope->AttachImport(import_scope, node_for_err, "import", err);
+
+  static const Scope::MergeFilter filter([]() {
+    Scope::MergeOptions options;
+    options.skip_private_vars = true;
+    // Don't require all imported values be used.
+    options.mark_dest_used = true;
+    return options;
+  }());
+  return import_scope->NonRecursiveMergeTo(scope, filter, node_for_err,
                                            "import", err);
 }
 
+std::unique_ptr<ImportManager::Evicted> ImportManager::Invalidate(
+    const std::set<SourceFile>& changed) {
+  // TODO(C++14): Use std::make_unique.
+  std::unique_ptr<Evicted> evicted(new Evicted);
+  std::vector<std::unique_ptr<ImportInfo>> erased = imports_.EraseIf(
+      [&changed, &evicted](const SourceFile& name, const ImportInfo& info) {
+        bool affected = changed.count(name) > 0;
+        for (std::set<SourceFile>::const_iterator dep = info.deps.begin();
+             !affected && dep != info.deps.end(); ++dep)
+          affected = changed.count(*dep) > 0;
+        if (affected)
+          evicted->names_.insert(name);
+        return affected;
+      });
+  evicted->import_infos_ = std::move(erased);
+  return evicted;
+}
+
 std::vector<SourceFile> ImportManager::GetImportedFiles() const {
   std::vector<SourceFile> imported_files;
-  imported_files.resize(imports_.size());
-  std::transform(imports_.begin(), imports_.end(), imported_files.begin(),
-                 [](const ImportMap::value_type& val) { return val.first; });
+  imports_.ForEach([&imported_files](const SourceFile& name,
+                                     const ImportInfo& info) {
+    imported_files.push_back(name);
+  });
+  std::sort(imported_files.begin(), imported_files.end());
   return imported_files;
 }
 
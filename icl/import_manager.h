@@ -5,23 +5,87 @@
 #ifndef ICL_IMPORT_MANAGER_H_
 #define ICL_IMPORT_MANAGER_H_
 
-#include <map>
 #include <memory>
-#include <mutex>
+#include <set>
+#include <string>
 #include <vector>
 
+#include "icl/concurrent_map.h"
+#include "icl/import_cache.h"  // For |ImportCache::DirectImport|.
+#include "icl/source_file.h"
+
 namespace icl {
 
 class Err;
 class ParseNode;
 class Scope;
-class SourceFile;
 
 // Provides a cache of the results of importing scopes so the results can
 // be re-used rather than running the imported files multiple times.
 class ImportManager {
  public:
+  // How the (cached) result of an import is brought into the importing scope.
+  enum class Mode {
+    // The result is attached to the importing scope as a read-only layer (see
+    // |Scope::AttachImport()|), so nothing is copied.
+    ATTACH,
+    // The result's values, templates, etc. are copied into the importing scope
+    // (see |Scope::NonRecursiveMergeTo()|).
+    MERGE,
+  };
+
+  // Records the imports done into a scope (or scopes nested in it) while it
+  // exists, using a property of the scope (see |Scope::SetProperty()|).
+  class Recorder {
+   public:
+    explicit Recorder(Scope* scope);
+    ~Recorder();
+
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+
+    // The files that were imported, including transitively (and including
+    // ones that failed to import).
+    const std::set<SourceFile>& deps() const { return deps_; }
+
+    // The imports done directly into the scope (i.e., not into a nested
+    // scope), in order.
+    const std::vector<ImportCache::DirectImport>& direct_imports() const {
+      return direct_imports_;
+    }
+
+    // Whether anything was imported into a nested scope.
+    bool has_nested_imports() const { return has_nested_imports_; }
+
+    // Returns the recorder for |scope| (or a scope containing it), or null.
+    static Recorder* Find(const Scope* scope);
+
+    // Adds what |nested| recorded, for a scope that's nested in this one's
+    // but doesn't contain it (e.g., an iteration of a parallel loop, which
+    // runs in a scope of its own).
+    void AddNested(const Recorder& nested);
+
+   private:
+    friend class ImportManager;
+
+    Scope* const scope_;
+    std::set<SourceFile> deps_;
+    std::vector<ImportCache::DirectImport> direct_imports_;
+    bool has_nested_imports_;
+  };
+
+  // The results of imports evicted by |Invalidate()|.
+  class Evicted;
+
   ImportManager();
+  explicit ImportManager(Mode mode);
+  // Also uses the given directory (which must exist) as a persistent cache of
+  // import results (see |ImportCache|). |key_salt| should identify anything
+  // other than the input files that may affect the results (e.g., the
+  // environment, if getenv() is used).
+  ImportManager(Mode mode,
+                const std::string& import_cache_dir,
+                const std::string& key_salt);
   ~ImportManager();
 
   ImportManager(const ImportManager&) = delete;
@@ -36,17 +100,45 @@ class ImportManager {
 
   std::vector<SourceFile> GetImportedFiles() const;
 
+  // Evicts the results of importing any of the |changed| files, and of any
+  // imports that (transitively) imported them, so that they'll be redone.
+  // The evicted results are returned, and must be kept alive as long as
+  // anything may refer to them (e.g., scopes or items from files that imported
+  // them). Must not be called while imports are being done.
+  std::unique_ptr<Evicted> Invalidate(const std::set<SourceFile>& changed);
+
  private:
   struct ImportInfo;
 
-  // Protects access to imports_. Do not hold when actually executing imports.
-  std::mutex imports_mutex_;
+  const Mode mode_;
+
+  // May be null.
+  const std::unique_ptr<const ImportCache> import_cache_;
 
-  // Owning pointers to the scopes.
-  using ImportMap = std::map<SourceFile, std::unique_ptr<ImportInfo>>;
+  // Getting an already-done import is lock-free (see |ImportInfo|).
+  using ImportMap = ConcurrentMap<SourceFile, ImportInfo>;
   ImportMap imports_;
 };
 
+// The results of imports evicted by |Invalidate()|.
+class ImportManager::Evicted {
+ public:
+  Evicted();
+  ~Evicted();
+
+  Evicted(const Evicted&) = delete;
+  Evicted& operator=(const Evicted&) = delete;
+
+  // The names of the evicted imports.
+  const std::set<SourceFile>& names() const { return names_; }
+
+ private:
+  friend class ImportManager;
+
+  std::set<SourceFile> names_;
+  std::vector<std::unique_ptr<ImportInfo>> import_infos_;
+};
+
 }  // namespace icl
 
 #endif  // ICL_IMPORT_MANAGER_H_
@@ -0,0 +1,202 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/incremental_runner.h"
+
+#include <assert.h>
+
+#include <utility>
+
+#include "icl/base_config.h"
+#include "icl/err.h"
+#include "icl/input_file.h"
+#include "icl/input_file_manager.h"
+#include "icl/item.h"
+
+namespace icl {
+
+namespace {
+
+// Returns true if the file |name| or any of its |deps| is in |changed|.
+bool IsAffected(const SourceFile& name,
+                const std::set<SourceFile>& deps,
+                const std::set<SourceFile>& changed) {
+  if (changed.count(name))
+    return true;
+  for (const SourceFile& dep : deps) {
+    if (changed.count(dep))
+      return true;
+  }
+  return false;
+}
+
+// Appends the items in |old_items| with no equivalent in |new_items| to
+// |*removed|, and vice versa to |*added|. Items are usually in the same order,
+// so the search for an equivalent starts after the previous match.
+void DiffItems(const Runner::RunResult::ItemVector& old_items,
+               const Runner::RunResult::ItemVector& new_items,
+               std::vector<const Item*>* removed,
+               std::vector<const Item*>* added) {
+  std::vector<bool> matched(old_items.size(), false);
+  size_t next = 0;
+  for (const auto& item : new_items) {
+    bool found = false;
+    for (size_t n = 0; n < old_items.size() && !found; n++) {
+      size_t i = (next + n) % old_items.size();
+      if (!matched[i] && item->Equals(*old_items[i])) {
+        matched[i] = true;
+        next = i + 1;
+        found = true;
+      }
+    }
+    if (!found)
+      added->push_back(item.get());
+  }
+  for (size_t i = 0; i < old_items.size(); i++) {
+    if (!matched[i])
+      removed->push_back(old_items[i].get());
+  }
+}
+
+}  // namespace
+
+IncrementalRunner::Delta::Delta() = default;
+IncrementalRunner::Delta::Delta(Delta&&) = default;
+IncrementalRunner::Delta::~Delta() = default;
+IncrementalRunner::Delta& IncrementalRunner::Delta::operator=(Delta&&) =
+    default;
+
+IncrementalRunner::IncrementalRunner(Delegate* delegate,
+                                     InputFileManager* input_file_manager,
+                                     ImportManager* import_manager)
+    : delegate_(delegate),
+      runner_(delegate),
+      input_file_manager_(input_file_manager),
+      import_manager_(import_manager) {}
+
+IncrementalRunner::~IncrementalRunner() = default;
+
+bool IncrementalRunner::SetBaseConfig(const SourceFile& name, Err* err) {
+  assert(results_.empty());
+  base_config_ = BaseConfig::Prepare(delegate_, name, err);
+  runner_.set_base_config(base_config_.get());
+  if (!base_config_) {
+    base_config_name_ = SourceFile();
+    base_config_deps_.clear();
+    return false;
+  }
+  base_config_name_ = name;
+  base_config_deps_ = base_config_->deps();
+  return true;
+}
+
+const Runner::RunResult& IncrementalRunner::AddRoot(const SourceFile& name) {
+  auto found = results_.find(name);
+  if (found != results_.end())
+    return found->second;
+  return results_.insert(std::make_pair(name, Run(name))).first->second;
+}
+
+void IncrementalRunner::RemoveRoot(const SourceFile& name) {
+  auto found = results_.find(name);
+  if (found == results_.end())
+    return;
+  std::set<SourceFile> unused = found->second.deps();
+  unused.insert(name);
+  results_.erase(found);
+  for (const auto& pair : results_) {
+    unused.erase(pair.first);
+    for (const SourceFile& dep : pair.second.deps())
+      unused.erase(dep);
+  }
+
+  // The base config keeps using its files.
+  if (!base_config_name_.is_null()) {
+    unused.erase(base_config_name_);
+    for (const SourceFile& dep : base_config_deps_)
+      unused.erase(dep);
+  }
+
+  // Drop the imports' results before their files may be evicted.
+  if (import_manager_)
+    import_manager_->Invalidate(unused);
+  input_file_manager_->Release(unused);
+}
+
+const Runner::RunResult* IncrementalRunner::GetResult(
+    const SourceFile& name) const {
+  auto found = results_.find(name);
+  return found != results_.end() ? &found->second : nullptr;
+}
+
+IncrementalRunner::Delta IncrementalRunner::Invalidate(
+    const std::set<SourceFile>& changed) {
+  Delta delta;
+  delta.evicted_files_ = input_file_manager_->Invalidate(changed);
+  if (import_manager_)
+    delta.evicted_imports_ = import_manager_->Invalidate(changed);
+
+  // Start reading the changed files that the affected roots will need (or
+  // needed before) all at once, before rerunning them one by one.
+  std::set<SourceFile> to_prefetch;
+  for (auto& pair : results_) {
+    if (!IsAffected(pair.first, pair.second.deps(), changed))
+      continue;
+    if (changed.count(pair.first))
+      to_prefetch.insert(pair.first);
+    for (const SourceFile& dep : pair.second.deps()) {
+      if (changed.count(dep))
+        to_prefetch.insert(dep);
+    }
+  }
+  input_file_manager_->Prefetch(
+      std::vector<SourceFile>(to_prefetch.begin(), to_prefetch.end()));
+
+  // Every result depends on the base config's files (see
+  // |Runner::RunResult::deps()|), so all the roots are rerun if it changed.
+  if (!base_config_name_.is_null() &&
+      IsAffected(base_config_name_, base_config_deps_, changed)) {
+    delta.old_base_config_ = RebuildBaseConfig();
+  }
+
+  for (auto& pair : results_) {
+    if (!IsAffected(pair.first, pair.second.deps(), changed))
+      continue;
+    delta.rerun_roots_.push_back(pair.first);
+    delta.old_results_.push_back(std::move(pair.second));
+    pair.second = Run(pair.first);
+    DiffItems(delta.old_results_.back().items(), pair.second.items(),
+              &delta.removed_items_, &delta.added_items_);
+  }
+  return delta;
+}
+
+Runner::RunResult IncrementalRunner::Run(const SourceFile& name) {
+  if (base_config_name_.is_null() || base_config_)
+    return runner_.Run(name);
+
+  // Depend on the base config's files, so that fixing them reruns this root.
+  Runner::RunResult result;
+  result.error_message_ = base_config_error_;
+  result.deps_ = base_config_deps_;
+  result.deps_.insert(base_config_name_);
+  return result;
+}
+
+std::unique_ptr<BaseConfig> IncrementalRunner::RebuildBaseConfig() {
+  std::unique_ptr<BaseConfig> old_base_config = std::move(base_config_);
+  Err err;
+  base_config_ = BaseConfig::Prepare(delegate_, base_config_name_, &err);
+  if (base_config_) {
+    base_config_deps_ = base_config_->deps();
+    base_config_error_.clear();
+  } else {
+    // Its imports are unknown, so keep watching the previous ones.
+    base_config_error_ = err.GetErrorMessage();
+  }
+  runner_.set_base_config(base_config_.get());
+  return old_base_config;
+}
+
+}  // namespace icl
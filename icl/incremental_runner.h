@@ -0,0 +1,145 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_INCREMENTAL_RUNNER_H_
+#define ICL_INCREMENTAL_RUNNER_H_
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "icl/import_manager.h"
+#include "icl/runner.h"
+#include "icl/source_file.h"
+
+namespace icl {
+
+class BaseConfig;
+class Delegate;
+class Err;
+class InputFile;
+class InputFileManager;
+class Item;
+
+// Runs a set of "root" files and keeps their results, together with the files
+// each one (transitively) imported. When some input files change, only the
+// results that depend on them are thrown away: the changed files are evicted
+// from the |InputFileManager|, the results of imports that (transitively)
+// imported them are evicted from the |ImportManager|, and the affected roots
+// are rerun (see |Invalidate()|). The roots may share a base config (see
+// |SetBaseConfig()|), which is rebuilt when it's affected too.
+//
+// Thread safety: This class is not thread-safe, and nothing else may use the
+// given managers while it's running or invalidating.
+class IncrementalRunner {
+ public:
+  // The result of |Invalidate()|.
+  class Delta {
+   public:
+    Delta();
+    Delta(Delta&&);
+    ~Delta();
+
+    Delta& operator=(Delta&&);
+
+    Delta(const Delta&) = delete;
+    Delta& operator=(const Delta&) = delete;
+
+    // The roots that were rerun.
+    const std::vector<SourceFile>& rerun_roots() const { return rerun_roots_; }
+
+    // The items of the rerun roots that were removed (i.e., have no equivalent
+    // new item; see |Item::Equals()|) and added (have no equivalent old item).
+    // The removed items stay valid as long as this object.
+    const std::vector<const Item*>& removed_items() const {
+      return removed_items_;
+    }
+    const std::vector<const Item*>& added_items() const {
+      return added_items_;
+    }
+
+   private:
+    friend class IncrementalRunner;
+
+    std::vector<SourceFile> rerun_roots_;
+    std::vector<const Item*> removed_items_;
+    std::vector<const Item*> added_items_;
+
+    // The old results, and what they may refer to. (Declared in this order so
+    // that the results are destroyed first.)
+    std::vector<std::unique_ptr<const InputFile>> evicted_files_;
+    std::unique_ptr<ImportManager::Evicted> evicted_imports_;
+    std::unique_ptr<BaseConfig> old_base_config_;
+    std::vector<Runner::RunResult> old_results_;
+  };
+
+  // |import_manager| may be null if imports aren't supported. The delegate
+  // should get files from |input_file_manager|.
+  IncrementalRunner(Delegate* delegate,
+                    InputFileManager* input_file_manager,
+                    ImportManager* import_manager);
+  ~IncrementalRunner();
+
+  IncrementalRunner(const IncrementalRunner&) = delete;
+  IncrementalRunner& operator=(const IncrementalRunner&) = delete;
+
+  // The runner that runs the roots, to be configured (e.g., with
+  // |Runner::set_limits()| or |Runner::set_item_sink()|) before any are
+  // added. Its base config must be set with |SetBaseConfig()| instead of
+  // |Runner::set_base_config()|, so that it's rebuilt when it changes.
+  Runner* runner() { return &runner_; }
+
+  // Prepares the base config for all the roots from the given file (see
+  // |BaseConfig::Prepare()|). Must be called before any roots are added. On
+  // failure, returns false and sets |*err|, and no base config is used.
+  bool SetBaseConfig(const SourceFile& name, Err* err);
+
+  // Runs the given root file (unless it's already a root) and keeps the
+  // result.
+  const Runner::RunResult& AddRoot(const SourceFile& name);
+
+  // Removes the given root (if it is one), dropping its result. The files
+  // that no other root depends on are then released (see
+  // |InputFileManager::Release()|), after evicting any imports of them (since
+  // the imports' results refer to them).
+  void RemoveRoot(const SourceFile& name);
+
+  // Gets the current result for the given root, or null if it isn't one.
+  const Runner::RunResult* GetResult(const SourceFile& name) const;
+
+  // Notes that the given files have changed (or been added or removed), and
+  // reruns the roots that depend on them. If the base config's file or any of
+  // its imports changed, it's rebuilt first and all the roots are rerun; if
+  // rebuilding it fails, they all fail with its error until it's fixed.
+  Delta Invalidate(const std::set<SourceFile>& changed);
+
+ private:
+  // Runs the given root, or fails it if the base config couldn't be rebuilt.
+  Runner::RunResult Run(const SourceFile& name);
+
+  // Rebuilds the base config from |base_config_name_|, returning the old one
+  // (which the old results may refer to).
+  std::unique_ptr<BaseConfig> RebuildBaseConfig();
+
+  Delegate* const delegate_;
+  Runner runner_;
+  InputFileManager* const input_file_manager_;
+  ImportManager* const import_manager_;
+
+  // The base config's file (null if there's none), the files it imported the
+  // last time it was built successfully, and the error from rebuilding it,
+  // if that failed (in which case |base_config_| is null).
+  SourceFile base_config_name_;
+  std::set<SourceFile> base_config_deps_;
+  std::string base_config_error_;
+  std::unique_ptr<BaseConfig> base_config_;
+
+  std::map<SourceFile, Runner::RunResult> results_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_INCREMENTAL_RUNNER_H_
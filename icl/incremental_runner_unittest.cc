@@ -0,0 +1,283 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/incremental_runner.h"
+
+#include <gtest/gtest.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "icl/err.h"
+#include "icl/evaluation_budget.h"
+#include "icl/input_file_manager.h"
+#include "icl/item_impls.h"
+#include "icl/source_file.h"
+#include "icl/test_delegate.h"
+
+namespace icl {
+namespace {
+
+// Returns the names of the given (bag) items.
+std::set<std::string> GetNames(const std::vector<const Item*>& items) {
+  std::set<std::string> names;
+  for (const Item* item : items)
+    names.insert(static_cast<const BagItem*>(item)->name());
+  return names;
+}
+
+std::set<std::string> GetNames(const Runner::RunResult::ItemVector& items) {
+  std::vector<const Item*> item_ptrs;
+  for (const auto& item : items)
+    item_ptrs.push_back(item.get());
+  return GetNames(item_ptrs);
+}
+
+TEST(IncrementalRunner, Invalidate) {
+  TestDelegate delegate;
+  delegate.files()["//common.gni"] = "x = 1\n";
+  delegate.files()["//a.gni"] =
+      "import(\"//common.gni\")\n"
+      "y = x + 1\n";
+  delegate.files()["//one.icl"] =
+      "import(\"//a.gni\")\n"
+      "bag(\"one_x\") {\n"
+      "  value = x\n"
+      "}\n"
+      "bag(\"one_y\") {\n"
+      "  value = y\n"
+      "}\n";
+  delegate.files()["//two.icl"] =
+      "import(\"//common.gni\")\n"
+      "bag(\"two\") {\n"
+      "  value = x\n"
+      "}\n";
+  delegate.files()["//three.icl"] =
+      "bag(\"three\") {\n"
+      "  value = 3\n"
+      "}\n";
+
+  IncrementalRunner runner(&delegate, &delegate.input_file_manager(),
+                           &delegate.import_manager());
+  for (const char* root : {"//one.icl", "//two.icl", "//three.icl"}) {
+    const Runner::RunResult& result = runner.AddRoot(SourceFile(root));
+    EXPECT_TRUE(result.is_success()) << result.error_message();
+  }
+  EXPECT_EQ(std::set<SourceFile>({SourceFile("//a.gni"),
+                                  SourceFile("//common.gni")}),
+            runner.GetResult(SourceFile("//one.icl"))->deps());
+  EXPECT_TRUE(runner.GetResult(SourceFile("//three.icl"))->deps().empty());
+
+  // Changing a.gni only affects one.icl, and only changes one of its items.
+  delegate.files()["//a.gni"] =
+      "import(\"//common.gni\")\n"
+      "y = x + 2\n";
+  {
+    IncrementalRunner::Delta delta =
+        runner.Invalidate({SourceFile("//a.gni")});
+    EXPECT_EQ(std::vector<SourceFile>({SourceFile("//one.icl")}),
+              delta.rerun_roots());
+    EXPECT_EQ(std::set<std::string>({"one_y"}),
+              GetNames(delta.removed_items()));
+    EXPECT_EQ(std::set<std::string>({"one_y"}), GetNames(delta.added_items()));
+  }
+
+  // Changing common.gni affects both one.icl and two.icl (but nothing is added
+  // or removed if the values don't change).
+  delegate.files()["//common.gni"] = "# Just a comment.\nx = 1\n";
+  {
+    IncrementalRunner::Delta delta =
+        runner.Invalidate({SourceFile("//common.gni")});
+    EXPECT_EQ(std::vector<SourceFile>(
+                  {SourceFile("//one.icl"), SourceFile("//two.icl")}),
+              delta.rerun_roots());
+    EXPECT_TRUE(delta.removed_items().empty());
+    EXPECT_TRUE(delta.added_items().empty());
+  }
+
+  // Breaking an import makes its importers fail, and fixing it reruns them.
+  delegate.files().erase("//common.gni");
+  {
+    IncrementalRunner::Delta delta =
+        runner.Invalidate({SourceFile("//common.gni")});
+    EXPECT_EQ(2u, delta.rerun_roots().size());
+    EXPECT_EQ(std::set<std::string>({"one_x", "one_y", "two"}),
+              GetNames(delta.removed_items()));
+    EXPECT_FALSE(runner.GetResult(SourceFile("//one.icl"))->is_success());
+    EXPECT_FALSE(runner.GetResult(SourceFile("//two.icl"))->is_success());
+  }
+  delegate.files()["//common.gni"] = "x = 5\n";
+  {
+    IncrementalRunner::Delta delta =
+        runner.Invalidate({SourceFile("//common.gni")});
+    EXPECT_EQ(2u, delta.rerun_roots().size());
+    EXPECT_EQ(std::set<std::string>({"one_x", "one_y", "two"}),
+              GetNames(delta.added_items()));
+    EXPECT_EQ(std::set<std::string>({"one_x", "one_y"}),
+              GetNames(runner.GetResult(SourceFile("//one.icl"))->items()));
+  }
+
+  // Changing a root only reruns it.
+  delegate.files()["//three.icl"] += "bag(\"three_more\") {\n}\n";
+  {
+    IncrementalRunner::Delta delta =
+        runner.Invalidate({SourceFile("//three.icl")});
+    EXPECT_EQ(std::vector<SourceFile>({SourceFile("//three.icl")}),
+              delta.rerun_roots());
+    EXPECT_TRUE(delta.removed_items().empty());
+    EXPECT_EQ(std::set<std::string>({"three_more"}),
+              GetNames(delta.added_items()));
+  }
+
+  // Unrelated changes don't rerun anything.
+  EXPECT_TRUE(
+      runner.Invalidate({SourceFile("//other.gni")}).rerun_roots().empty());
+}
+
+TEST(IncrementalRunner, RemoveRoot) {
+  TestDelegate delegate;
+  delegate.files()["//common.gni"] = "x = 1\n";
+  delegate.files()["//a.gni"] =
+      "import(\"//common.gni\")\n"
+      "y = x + 1\n";
+  delegate.files()["//one.icl"] =
+      "import(\"//a.gni\")\n"
+      "bag(\"one\") {\n"
+      "  value = y\n"
+      "}\n";
+  delegate.files()["//two.icl"] =
+      "import(\"//common.gni\")\n"
+      "bag(\"two\") {\n"
+      "  value = x\n"
+      "}\n";
+
+  // Evict files as soon as they're released.
+  InputFileManager& input_file_manager = delegate.input_file_manager();
+  input_file_manager.set_compact_files(true);
+  input_file_manager.set_memory_budget(0);
+
+  IncrementalRunner runner(&delegate, &delegate.input_file_manager(),
+                           &delegate.import_manager());
+  EXPECT_TRUE(runner.AddRoot(SourceFile("//one.icl")).is_success());
+  EXPECT_TRUE(runner.AddRoot(SourceFile("//two.icl")).is_success());
+  size_t memory_usage = input_file_manager.memory_usage();
+
+  // Only the files that two.icl doesn't use are evicted.
+  runner.RemoveRoot(SourceFile("//one.icl"));
+  EXPECT_FALSE(runner.GetResult(SourceFile("//one.icl")));
+  EXPECT_LT(input_file_manager.memory_usage(), memory_usage);
+  EXPECT_TRUE(runner.GetResult(SourceFile("//two.icl"))->is_success());
+
+  // The evicted files (and imports of them) are reloaded if needed again.
+  delegate.files()["//a.gni"] =
+      "import(\"//common.gni\")\n"
+      "y = x + 2\n";
+  const Runner::RunResult& result = runner.AddRoot(SourceFile("//one.icl"));
+  EXPECT_TRUE(result.is_success()) << result.error_message();
+  EXPECT_EQ(memory_usage, input_file_manager.memory_usage());
+  ASSERT_EQ(1u, result.items().size());
+  const BagItem* item = static_cast<const BagItem*>(result.items()[0].get());
+  EXPECT_EQ(3, item->key_value_map().at("value").int_value());
+}
+
+TEST(IncrementalRunner, ConfigureRunner) {
+  TestDelegate delegate;
+  delegate.files()["//loop.icl"] =
+      "foreach(i, [1, 2, 3, 4, 5, 6, 7, 8, 9, 10]) {\n"
+      "  x = i\n"
+      "}\n";
+
+  IncrementalRunner runner(&delegate, &delegate.input_file_manager(),
+                           &delegate.import_manager());
+  EvaluationBudget::Limits limits;
+  limits.max_steps = 5;
+  runner.runner()->set_limits(limits);
+  const Runner::RunResult& result = runner.AddRoot(SourceFile("//loop.icl"));
+  EXPECT_FALSE(result.is_success());
+  EXPECT_NE(std::string::npos,
+            result.error_message().find("the limit of 5 steps"))
+      << result.error_message();
+}
+
+TEST(IncrementalRunner, BaseConfig) {
+  TestDelegate delegate;
+  delegate.files()["//build/config.icl"] =
+      "import(\"//build/platform.gni\")\n"
+      "y = x + 10\n";
+  delegate.files()["//build/platform.gni"] = "x = 1\n";
+  delegate.files()["//one.icl"] =
+      "bag(\"one\") {\n"
+      "  value = y\n"
+      "}\n";
+  delegate.files()["//two.icl"] =
+      "bag(\"two\") {\n"
+      "}\n";
+
+  // Evict files as soon as they're released.
+  InputFileManager& input_file_manager = delegate.input_file_manager();
+  input_file_manager.set_compact_files(true);
+  input_file_manager.set_memory_budget(0);
+
+  IncrementalRunner runner(&delegate, &delegate.input_file_manager(),
+                           &delegate.import_manager());
+  Err err;
+  ASSERT_TRUE(runner.SetBaseConfig(SourceFile("//build/config.icl"), &err))
+      << err.GetErrorMessage();
+  EXPECT_TRUE(runner.AddRoot(SourceFile("//one.icl")).is_success());
+  EXPECT_TRUE(runner.AddRoot(SourceFile("//two.icl")).is_success());
+
+  // The base config's files stay in use without any roots.
+  runner.RemoveRoot(SourceFile("//one.icl"));
+  runner.RemoveRoot(SourceFile("//two.icl"));
+  EXPECT_TRUE(runner.AddRoot(SourceFile("//one.icl")).is_success());
+  EXPECT_TRUE(runner.AddRoot(SourceFile("//two.icl")).is_success());
+
+  // Changing what the base config imports rebuilds it and reruns every root.
+  delegate.files()["//build/platform.gni"] = "x = 2\n";
+  {
+    IncrementalRunner::Delta delta =
+        runner.Invalidate({SourceFile("//build/platform.gni")});
+    EXPECT_EQ(std::vector<SourceFile>(
+                  {SourceFile("//one.icl"), SourceFile("//two.icl")}),
+              delta.rerun_roots());
+    EXPECT_EQ(std::set<std::string>({"one"}), GetNames(delta.removed_items()));
+    EXPECT_EQ(std::set<std::string>({"one"}), GetNames(delta.added_items()));
+    const Runner::RunResult* result = runner.GetResult(SourceFile("//one.icl"));
+    ASSERT_TRUE(result->is_success()) << result->error_message();
+    const BagItem* item =
+        static_cast<const BagItem*>(result->items()[0].get());
+    EXPECT_EQ(12, item->key_value_map().at("value").int_value());
+  }
+
+  // Breaking the base config fails every root, and fixing it reruns them.
+  delegate.files()["//build/config.icl"] = "y = \n";
+  {
+    IncrementalRunner::Delta delta =
+        runner.Invalidate({SourceFile("//build/config.icl")});
+    EXPECT_EQ(2u, delta.rerun_roots().size());
+    EXPECT_EQ(std::set<std::string>({"one", "two"}),
+              GetNames(delta.removed_items()));
+    const Runner::RunResult* result = runner.GetResult(SourceFile("//two.icl"));
+    EXPECT_FALSE(result->is_success());
+    EXPECT_FALSE(result->error_message().empty());
+  }
+  delegate.files()["//build/config.icl"] =
+      "import(\"//build/platform.gni\")\n"
+      "y = x + 100\n";
+  {
+    IncrementalRunner::Delta delta =
+        runner.Invalidate({SourceFile("//build/config.icl")});
+    EXPECT_EQ(std::set<std::string>({"one", "two"}),
+              GetNames(delta.added_items()));
+    const Runner::RunResult* result = runner.GetResult(SourceFile("//one.icl"));
+    ASSERT_TRUE(result->is_success()) << result->error_message();
+    const BagItem* item =
+        static_cast<const BagItem*>(result->items()[0].get());
+    EXPECT_EQ(102, item->key_value_map().at("value").int_value());
+  }
+}
+
+}  // namespace
+}  // namespace icl
@@ -5,13 +5,219 @@
 #include "icl/input_file.h"
 
 #include <assert.h>
+#include <string.h>
 
+#include <memory>
+#include <unordered_map>
 #include <utility>
 
+#include "icl/binary_io.h"
+#include "icl/evaluation_stats.h"
+#include "icl/location.h"
 #include "icl/parse_tree.h"
+#include "icl/sha256.h"
+#include "icl/string_piece.h"
 
 namespace icl {
 
+namespace {
+
+void AddCommentTokens(const Comments* comments, std::vector<Token*>* tokens) {
+  // The comment vectors are only exposed as const, but the tree is owned by
+  // the file (like in |Parser::AssignComments()|).
+  for (const std::vector<Token>* vector :
+       {&comments->before(), &comments->suffix(), &comments->after()}) {
+    for (const Token& token : *vector)
+      tokens->push_back(const_cast<Token*>(&token));
+  }
+}
+
+// Walks the tree rooted at |node|, appending (mutable) pointers to the tokens
+// in it to |*tokens| (if non-null) and adding the (approximate) size of the
+// nodes to |*size|.
+void WalkTree(const ParseNode* node,
+              std::vector<Token*>* tokens,
+              size_t* size) {
+  if (!node)
+    return;
+
+  std::vector<const ParseNode*> children;
+  const Token* token = nullptr;
+  if (const AccessorNode* accessor = node->AsAccessor()) {
+    *size += sizeof(AccessorNode);
+    token = &accessor->base();
+    children = {accessor->index(), accessor->member()};
+  } else if (const BinaryOpNode* binary_op = node->AsBinaryOp()) {
+    *size += sizeof(BinaryOpNode);
+    token = &binary_op->op();
+    children = {binary_op->left(), binary_op->right()};
+  } else if (const BlockNode* block = node->AsBlock()) {
+    *size += sizeof(BlockNode) +
+             block->statements().capacity() * sizeof(block->statements()[0]);
+    token = &block->begin_token();
+    for (const auto& statement : block->statements())
+      children.push_back(statement.get());
+    children.push_back(block->End());
+  } else if (const BlockCommentNode* block_comment = node->AsBlockComment()) {
+    *size += sizeof(BlockCommentNode);
+    token = &block_comment->comment();
+  } else if (const ConditionNode* condition = node->AsConditionNode()) {
+    *size += sizeof(ConditionNode);
+    token = &condition->if_token();
+    children = {condition->condition(), condition->if_true(),
+                condition->if_false()};
+  } else if (const EndNode* end = node->AsEnd()) {
+    *size += sizeof(EndNode);
+    token = &end->value();
+  } else if (const FunctionCallNode* function_call = node->AsFunctionCall()) {
+    *size += sizeof(FunctionCallNode);
+    token = &function_call->function();
+    children = {function_call->args(), function_call->block()};
+  } else if (const IdentifierNode* identifier = node->AsIdentifier()) {
+    *size += sizeof(IdentifierNode);
+    token = &identifier->value();
+  } else if (const ListNode* list = node->AsList()) {
+    *size += sizeof(ListNode) +
+             list->contents().capacity() * sizeof(list->contents()[0]);
+    token = &list->begin_token();
+    for (const auto& item : list->contents())
+      children.push_back(item.get());
+    children.push_back(list->End());
+  } else if (const LiteralNode* literal = node->AsLiteral()) {
+    *size += sizeof(LiteralNode);
+    token = &literal->value();
+  } else if (const UnaryOpNode* unary_op = node->AsUnaryOp()) {
+    *size += sizeof(UnaryOpNode);
+    token = &unary_op->op();
+    children = {unary_op->operand()};
+  } else {
+    assert(false);
+  }
+
+  if (const Comments* comments = node->comments()) {
+    *size += sizeof(Comments) +
+             (comments->before().capacity() + comments->suffix().capacity() +
+              comments->after().capacity()) *
+                 sizeof(Token);
+    if (tokens)
+      AddCommentTokens(comments, tokens);
+  }
+  if (tokens)
+    tokens->push_back(const_cast<Token*>(token));
+  for (const ParseNode* child : children)
+    WalkTree(child, tokens, size);
+}
+
+// Returns |token| with its location (if it's in |from|) moved to |to|.
+Token RebindToken(const Token& token, const InputFile* from,
+                  const InputFile* to) {
+  const Location& location = token.location();
+  if (location.file() != from)
+    return token;
+  return Token(Location(to, location.line_number(), location.column_number(),
+                        location.byte()),
+               token.type(), token.value());
+}
+
+// Returns a copy of the tree rooted at |node| (which may be null), with the
+// locations in |from| moved to |to| (see |RebindToken()|).
+std::unique_ptr<ParseNode> CopyTree(const ParseNode* node,
+                                    const InputFile* from,
+                                    const InputFile* to);
+
+// Like |CopyTree()|, for a node of the given type.
+template <typename NodeType>
+std::unique_ptr<NodeType> CopyTypedTree(const NodeType* node,
+                                        const InputFile* from,
+                                        const InputFile* to) {
+  return std::unique_ptr<NodeType>(
+      static_cast<NodeType*>(CopyTree(node, from, to).release()));
+}
+
+std::unique_ptr<ParseNode> CopyTree(const ParseNode* node,
+                                    const InputFile* from,
+                                    const InputFile* to) {
+  if (!node)
+    return nullptr;
+
+  std::unique_ptr<ParseNode> copy;
+  if (const AccessorNode* accessor = node->AsAccessor()) {
+    std::unique_ptr<AccessorNode> result(new AccessorNode);
+    result->set_base(RebindToken(accessor->base(), from, to));
+    result->set_index(CopyTree(accessor->index(), from, to));
+    result->set_member(CopyTypedTree(accessor->member(), from, to));
+    copy = std::move(result);
+  } else if (const BinaryOpNode* binary_op = node->AsBinaryOp()) {
+    std::unique_ptr<BinaryOpNode> result(new BinaryOpNode);
+    result->set_op(RebindToken(binary_op->op(), from, to));
+    result->set_left(CopyTree(binary_op->left(), from, to));
+    result->set_right(CopyTree(binary_op->right(), from, to));
+    copy = std::move(result);
+  } else if (const BlockNode* block = node->AsBlock()) {
+    std::unique_ptr<BlockNode> result(new BlockNode(block->result_mode()));
+    result->set_begin_token(RebindToken(block->begin_token(), from, to));
+    result->set_end(CopyTypedTree(block->End(), from, to));
+    for (const auto& statement : block->statements())
+      result->append_statement(CopyTree(statement.get(), from, to));
+    copy = std::move(result);
+  } else if (const BlockCommentNode* block_comment = node->AsBlockComment()) {
+    std::unique_ptr<BlockCommentNode> result(new BlockCommentNode);
+    result->set_comment(RebindToken(block_comment->comment(), from, to));
+    copy = std::move(result);
+  } else if (const ConditionNode* condition = node->AsConditionNode()) {
+    std::unique_ptr<ConditionNode> result(new ConditionNode);
+    result->set_if_token(RebindToken(condition->if_token(), from, to));
+    result->set_condition(CopyTree(condition->condition(), from, to));
+    result->set_if_true(CopyTypedTree(condition->if_true(), from, to));
+    result->set_if_false(CopyTree(condition->if_false(), from, to));
+    copy = std::move(result);
+  } else if (const EndNode* end = node->AsEnd()) {
+    // TODO(C++14): Use std::make_unique.
+    copy.reset(new EndNode(RebindToken(end->value(), from, to)));
+  } else if (const FunctionCallNode* function_call = node->AsFunctionCall()) {
+    std::unique_ptr<FunctionCallNode> result(new FunctionCallNode);
+    result->set_function(RebindToken(function_call->function(), from, to));
+    result->set_args(CopyTypedTree(function_call->args(), from, to));
+    result->set_block(CopyTypedTree(function_call->block(), from, to));
+    copy = std::move(result);
+  } else if (const IdentifierNode* identifier = node->AsIdentifier()) {
+    // TODO(C++14): Use std::make_unique.
+    copy.reset(new IdentifierNode(RebindToken(identifier->value(), from, to)));
+  } else if (const ListNode* list = node->AsList()) {
+    std::unique_ptr<ListNode> result(new ListNode);
+    result->set_begin_token(RebindToken(list->begin_token(), from, to));
+    result->set_prefer_multiline(list->prefer_multiline());
+    result->set_end(CopyTypedTree(list->End(), from, to));
+    for (const auto& item : list->contents())
+      result->append_item(CopyTree(item.get(), from, to));
+    copy = std::move(result);
+  } else if (const LiteralNode* literal = node->AsLiteral()) {
+    // TODO(C++14): Use std::make_unique.
+    copy.reset(new LiteralNode(RebindToken(literal->value(), from, to)));
+  } else if (const UnaryOpNode* unary_op = node->AsUnaryOp()) {
+    std::unique_ptr<UnaryOpNode> result(new UnaryOpNode);
+    result->set_op(RebindToken(unary_op->op(), from, to));
+    result->set_operand(CopyTree(unary_op->operand(), from, to));
+    copy = std::move(result);
+  } else {
+    assert(false);
+    return nullptr;
+  }
+
+  if (const Comments* comments = node->comments()) {
+    Comments* copy_comments = copy->comments_mutable();
+    for (const Token& token : comments->before())
+      copy_comments->append_before(RebindToken(token, from, to));
+    for (const Token& token : comments->suffix())
+      copy_comments->append_suffix(RebindToken(token, from, to));
+    for (const Token& token : comments->after())
+      copy_comments->append_after(RebindToken(token, from, to));
+  }
+  return copy;
+}
+
+}  // namespace
+
 InputFile::InputFile(const SourceFile& name)
     : name_(name), dir_(name_.GetDir()) {}
 
@@ -25,12 +231,30 @@ void InputFile::SetContents(std::string&& contents) {
   assert(!contents_loaded_);
   contents_loaded_ = true;
   contents_ = std::move(contents);
+  StatsRecorder::CountAllocation(Allocator::INPUT_FILE_CONTENTS,
+                                 contents_.size());
+}
+
+uint64_t InputFile::GetContentsHash() const {
+  if (original_)
+    return original_->GetContentsHash();
+  assert(contents_loaded_);
+  return compacted_ ? contents_hash_ : HashBytes(contents_);
+}
+
+std::string InputFile::GetContentsDigest() const {
+  if (original_)
+    return original_->GetContentsDigest();
+  assert(contents_loaded_);
+  return compacted_ ? contents_digest_ : Sha256(contents_);
 }
 
 void InputFile::SetTokens(std::vector<Token>&& tokens) {
   assert(!tokens_set_);
   tokens_set_ = true;
   tokens_ = std::move(tokens);
+  StatsRecorder::CountAllocation(Allocator::INPUT_FILE_CONTENTS,
+                                 tokens_.size() * sizeof(Token));
 }
 
 void InputFile::SetRootParseNode(std::unique_ptr<ParseNode> root_parse_node) {
@@ -39,4 +263,65 @@ void InputFile::SetRootParseNode(std::unique_ptr<ParseNode> root_parse_node) {
   root_parse_node_ = std::move(root_parse_node);
 }
 
+void InputFile::Compact() {
+  assert(root_parse_node_set_);
+  assert(!compacted_);
+
+  std::vector<Token*> tokens;
+  size_t tree_size = 0;  // Unused.
+  WalkTree(root_parse_node_.get(), &tokens, &tree_size);
+
+  // Lay out the distinct values that refer to the contents in the table.
+  const char* contents_begin = contents_.data();
+  const char* contents_end = contents_begin + contents_.size();
+  auto refers_to_contents = [contents_begin, contents_end](const Token* token) {
+    const StringPiece& value = token->value();
+    return !value.empty() && value.data() >= contents_begin &&
+           value.data() + value.size() <= contents_end;
+  };
+  std::unordered_map<StringPiece, size_t, StringPieceHash> offsets;
+  size_t table_size = 0;
+  for (const Token* token : tokens) {
+    if (refers_to_contents(token) &&
+        offsets.insert(std::make_pair(token->value(), table_size)).second)
+      table_size += token->value().size();
+  }
+
+  std::unique_ptr<char[]> table(new char[table_size > 0 ? table_size : 1]);
+  for (const auto& pair : offsets)
+    memcpy(table.get() + pair.second, pair.first.data(), pair.first.size());
+  for (Token* token : tokens) {
+    if (!refers_to_contents(token))
+      continue;
+    StringPiece value(table.get() + offsets[token->value()],
+                      token->value().size());
+    *token = Token(token->location(), token->type(), value);
+  }
+
+  contents_hash_ = HashBytes(contents_);
+  contents_digest_ = Sha256(contents_);
+  compacted_ = true;
+  string_table_ = std::move(table);
+  string_table_size_ = table_size;
+  std::string().swap(contents_);
+  std::vector<Token>().swap(tokens_);
+}
+
+void InputFile::SetOriginal(std::shared_ptr<const InputFile> original) {
+  assert(!contents_loaded_ && !tokens_set_ && !root_parse_node_set_);
+  assert(!original_ && original && !original->original());
+  assert(!original->err().has_error());
+  SetRootParseNode(
+      CopyTree(original->root_parse_node(), original.get(), this));
+  original_ = std::move(original);
+}
+
+size_t InputFile::GetMemoryUsage() const {
+  size_t size = sizeof(InputFile) + contents_.capacity() +
+                tokens_.capacity() * sizeof(Token) + string_table_size_;
+  if (root_parse_node_)
+    WalkTree(root_parse_node_.get(), nullptr, &size);
+  return size;
+}
+
 }  // namespace icl
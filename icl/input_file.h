@@ -6,11 +6,14 @@
 #define ICL_INPUT_FILE_H_
 
 #include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "icl/allocator.h"
 #include "icl/err.h"
 #include "icl/source_dir.h"
 #include "icl/source_file.h"
@@ -33,6 +36,14 @@ class InputFile {
   InputFile(const InputFile&) = delete;
   InputFile& operator=(const InputFile&) = delete;
 
+  // Allocated with the current |Allocator|.
+  static void* operator new(size_t size) {
+    return Allocator::AllocateObject(size, Allocator::INPUT_FILE);
+  }
+  static void operator delete(void* ptr, size_t size) {
+    Allocator::FreeObject(ptr, size, Allocator::INPUT_FILE);
+  }
+
   // The name passed into the constructor.
   const SourceFile& name() const { return name_; }
 
@@ -51,16 +62,37 @@ class InputFile {
   const Err& err() const { return err_; }
   void set_err(const Err& err) { err_ = err; }
 
+  // Whether the contents are available (i.e., they've been set and the file
+  // hasn't been compacted). The contents of a file with an original (see
+  // |SetOriginal()|) are the original's.
+  bool has_contents() const {
+    if (original_)
+      return original_->has_contents();
+    return contents_loaded_ && !compacted_;
+  }
+
   const std::string& contents() const {
-    assert(contents_loaded_);
+    if (original_)
+      return original_->contents();
+    assert(has_contents());
     return contents_;
   }
 
   // Sets the contents of the file; this may be called at most once.
   void SetContents(std::string&& contents);
 
+  // Returns |HashBytes()| of the contents. Unlike |contents()|, this may also
+  // be called after the file is compacted.
+  uint64_t GetContentsHash() const;
+
+  // Returns |Sha256()| of the contents, which (unlike |GetContentsHash()|)
+  // can stand in for them. This may also be called after the file is
+  // compacted.
+  std::string GetContentsDigest() const;
+
   const std::vector<Token>& tokens() const {
     assert(tokens_set_);
+    assert(!compacted_);
     return tokens_;
   }
 
@@ -75,6 +107,32 @@ class InputFile {
   // Sets the root parse node; this may be called at most once.
   void SetRootParseNode(std::unique_ptr<ParseNode> root_parse_node);
 
+  // Frees the contents and tokens, which the parse tree otherwise refers to:
+  // the token values it refers to are copied into a (deduplicated) string
+  // table first, and the tree is rebound to that. This must be done after the
+  // root parse node is set, and before anything else refers to the tree (or
+  // the values of its tokens, e.g., as scope keys). Afterwards, |contents()|
+  // and |tokens()| may not be called, so errors in the file won't quote the
+  // offending line.
+  void Compact();
+  bool is_compacted() const { return compacted_; }
+
+  // Loads this file from |original|, which was loaded successfully and whose
+  // contents are identical (e.g., the same file under another path), instead
+  // of tokenizing and parsing its own contents: the parse tree is copied, with
+  // its locations (and so errors in it) referring to this file, and the token
+  // values it refers to (and the contents) are shared with |original|, which
+  // this file keeps alive. This may be called instead of setting the contents
+  // (and anything else).
+  void SetOriginal(std::shared_ptr<const InputFile> original);
+
+  // The file this one was loaded from, or null.
+  const InputFile* original() const { return original_.get(); }
+
+  // Returns an estimate of the memory used by the file (its contents, tokens,
+  // parse tree, and string table; not counting an original's).
+  size_t GetMemoryUsage() const;
+
  private:
   SourceFile name_;
   SourceDir dir_;
@@ -91,8 +149,18 @@ class InputFile {
   bool tokens_set_ = false;
   std::vector<Token> tokens_;
 
+  // Set by |Compact()|, which replaces |contents_| and |tokens_| with
+  // |string_table_| (which must likewise outlive |root_parse_node_|).
+  bool compacted_ = false;
+  uint64_t contents_hash_ = 0;
+  std::string contents_digest_;
+  std::unique_ptr<char[]> string_table_;
+  size_t string_table_size_ = 0;
+
   bool root_parse_node_set_ = false;
   std::unique_ptr<ParseNode> root_parse_node_;
+
+  std::shared_ptr<const InputFile> original_;
 };
 
 }  // namespace icl
@@ -6,19 +6,38 @@
 
 #include <assert.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <utility>
 
+#include "icl/async_file_reader.h"
+#include "icl/binary_io.h"
 #include "icl/err.h"
 #include "icl/input_file.h"
 #include "icl/load_file.h"
+#include "icl/location.h"
+#include "icl/parse_cache.h"
+#include "icl/sha256.h"
 #include "icl/source_file.h"
 
 namespace icl {
 
+namespace {
+
+ReadFileFunction MakeReadFileFunction(AsyncFileReader* reader) {
+  return [reader](const SourceFile& name, std::string* contents) {
+    return reader->ReadSync(name, contents);
+  };
+}
+
+}  // namespace
+
 struct InputFileManager::InputFileInfo {
-  InputFileInfo() = default;
+  InputFileInfo() : loaded(nullptr) {}
   ~InputFileInfo() = default;
 
   // This lock protects the unique_ptr. Once the input file is loaded (i.e.,
@@ -28,46 +47,110 @@ struct InputFileManager::InputFileInfo {
 
   // Even if loading fails, this will be set (with an error).
   std::unique_ptr<const InputFile> input_file;
+
+  // Set to |input_file| (with release semantics) once it's loaded, so that
+  // getting it again needn't take |load_mutex|. Cleared while it's released,
+  // so that getting it takes |load_mutex| (to make it in use again).
+  std::atomic<const InputFile*> loaded;
+
+  // The estimated memory used by |input_file|, if it's set.
+  size_t memory_usage = 0;
+
+  // Whether the file is in |InputFileManager::released_| (at |position|).
+  bool released = false;
+  std::list<InputFileInfo*>::iterator position;
+
+  // Whether the file is being prefetched, in which case getting it waits for
+  // |prefetched| to be notified (and this to be cleared). Protected by
+  // |load_mutex|.
+  bool prefetching = false;
+  std::condition_variable prefetched;
+
+  // The contents read by a successful prefetch, until the file is gotten
+  // (which loads it from them). Protected by |load_mutex|.
+  bool has_prefetched_contents = false;
+  std::string prefetched_contents;
 };
 
 InputFileManager::InputFileManager(ReadFileFunction read_file_function)
-    : read_file_function_(std::move(read_file_function)) {}
+    : read_file_function_(std::move(read_file_function)),
+      compact_files_(false),
+      deduplicate_files_(false),
+      memory_budget_(std::numeric_limits<size_t>::max()),
+      memory_usage_(0) {}
+
+InputFileManager::InputFileManager(ReadFileFunction read_file_function,
+                                   const std::string& parse_cache_dir)
+    : read_file_function_(std::move(read_file_function)),
+      parse_cache_(new ParseCache(parse_cache_dir)),
+      compact_files_(false),
+      deduplicate_files_(false),
+      memory_budget_(std::numeric_limits<size_t>::max()),
+      memory_usage_(0) {}
+
+InputFileManager::InputFileManager(std::unique_ptr<AsyncFileReader> reader)
+    : read_file_function_(MakeReadFileFunction(reader.get())),
+      compact_files_(false),
+      deduplicate_files_(false),
+      memory_budget_(std::numeric_limits<size_t>::max()),
+      memory_usage_(0),
+      reader_(std::move(reader)) {}
 
 InputFileManager::~InputFileManager() = default;
 
 bool InputFileManager::GetFile(const LocationRange& origin,
                                const SourceFile& name,
                                const InputFile** file) {
-  // See if we have a cached load.
-  InputFileInfo* input_file_info = nullptr;
-  {
-    std::lock_guard<std::mutex> lock(input_files_mutex_);
-    std::unique_ptr<InputFileInfo>& info_ptr = input_files_[name];
-    if (!info_ptr)
-      info_ptr.reset(new InputFileInfo);
-
-    // Promote the InputFileInfo to outside of the input files lock.
-    input_file_info = info_ptr.get();
+  // See if we have a cached load. This is lock-free if the file was already
+  // gotten.
+  InputFileInfo* input_file_info = input_files_.GetOrInsert(name);
+  if (const InputFile* loaded =
+          input_file_info->loaded.load(std::memory_order_acquire)) {
+    *file = loaded;
+    return !loaded->err().has_error();
   }
 
   // Now use the per-input-file lock to block this thread if another thread is
   // already processing the input file.
   {
-    std::lock_guard<std::mutex> lock(input_file_info->load_mutex);
+    std::unique_lock<std::mutex> lock(input_file_info->load_mutex);
+    input_file_info->prefetched.wait(
+        lock, [input_file_info]() { return !input_file_info->prefetching; });
 
     if (input_file_info->input_file) {
+      // It may have been released (and not evicted), or another thread may
+      // have just loaded it.
+      {
+        std::lock_guard<std::mutex> released_lock(released_mutex_);
+        if (input_file_info->released) {
+          released_.erase(input_file_info->position);
+          input_file_info->released = false;
+        }
+      }
       *file = input_file_info->input_file.get();
-      return (*file)->err().has_error();
+      input_file_info->loaded.store(*file, std::memory_order_release);
+      return !(*file)->err().has_error();
     }
 
-    if (!input_file_info->input_file) {
-      InputFile* f = new InputFile(name);
-      *file = f;
-      input_file_info->input_file.reset(f);
-      if (!LoadFile(read_file_function_, origin, name, f)) {
-        assert(f->err().has_error());
-        return false;
-      }
+    bool success;
+    if (input_file_info->has_prefetched_contents) {
+      // Loading is done here rather than when the read completes, so that the
+      // reader's thread is free to complete other reads.
+      input_file_info->has_prefetched_contents = false;
+      std::string contents = std::move(input_file_info->prefetched_contents);
+      success = LoadLocked(
+          [&contents](const SourceFile&, std::string* read_contents) {
+            *read_contents = std::move(contents);
+            return true;
+          },
+          origin, name, input_file_info);
+    } else {
+      success = LoadLocked(read_file_function_, origin, name, input_file_info);
+    }
+    *file = input_file_info->input_file.get();
+    if (!success) {
+      assert((*file)->err().has_error());
+      return false;
     }
   }
 
@@ -77,4 +160,168 @@ bool InputFileManager::GetFile(const LocationRange& origin,
   return true;
 }
 
+void InputFileManager::Prefetch(const std::vector<SourceFile>& names) {
+  if (!reader_)
+    return;
+
+  std::vector<AsyncFileReader::Request> requests;
+  for (const SourceFile& name : names) {
+    InputFileInfo* info = input_files_.GetOrInsert(name);
+    if (info->loaded.load(std::memory_order_acquire))
+      continue;
+    {
+      std::lock_guard<std::mutex> lock(info->load_mutex);
+      if (info->input_file || info->prefetching ||
+          info->has_prefetched_contents)
+        continue;
+      info->prefetching = true;
+    }
+    requests.push_back(
+        {name, [this, name, info](bool success, std::string&& contents) {
+           FinishPrefetch(name, info, success, std::move(contents));
+         }});
+  }
+
+  // The callbacks may be called before this returns, so no lock may be held.
+  if (!requests.empty())
+    reader_->Read(std::move(requests));
+}
+
+bool InputFileManager::LoadLocked(const ReadFileFunction& read_file_function,
+                                  const LocationRange& origin,
+                                  const SourceFile& name,
+                                  InputFileInfo* info) {
+  InputFile* f = new InputFile(name);
+  info->input_file.reset(f);
+  bool success;
+  info->memory_usage = 0;
+  if (deduplicate_files_) {
+    success =
+        LoadDeduplicated(read_file_function, origin, f, &info->memory_usage);
+  } else {
+    success = LoadFile(read_file_function, origin, name, parse_cache_.get(), f);
+    if (success && compact_files_)
+      f->Compact();
+  }
+  info->memory_usage += f->GetMemoryUsage();
+  memory_usage_ += info->memory_usage;
+  info->loaded.store(f, std::memory_order_release);
+  return success;
+}
+
+bool InputFileManager::LoadDeduplicated(
+    const ReadFileFunction& read_file_function,
+    const LocationRange& origin,
+    InputFile* file,
+    size_t* memory_usage) {
+  std::string contents;
+  if (!ReadFile(read_file_function, origin, file->name(), file, &contents))
+    return false;
+
+  uint64_t hash = HashBytes(contents);
+  {
+    std::lock_guard<std::mutex> lock(originals_mutex_);
+    auto found = originals_.find(hash);
+    std::shared_ptr<const InputFile> original;
+    if (found != originals_.end())
+      original = found->second.lock();
+    // Hashes may collide, so compare the contents too (or, if they've been
+    // compacted away, their digests).
+    if (original &&
+        (original->has_contents()
+             ? original->contents() == contents
+             : original->GetContentsDigest() == Sha256(contents))) {
+      file->SetOriginal(std::move(original));
+      return true;
+    }
+  }
+
+  // Two threads may load the same contents at once, in which case the last
+  // one's representation is shared from then on.
+  std::shared_ptr<InputFile> original(new InputFile(file->name()));
+  if (!LoadFileContents(std::move(contents), parse_cache_.get(),
+                        original.get())) {
+    // Don't share failures. Load |file| itself instead, so that the error
+    // refers to it (failures are rare, so tokenizing again is fine).
+    return LoadFileContents(std::string(original->contents()), nullptr, file);
+  }
+  if (compact_files_)
+    original->Compact();
+  *memory_usage = original->GetMemoryUsage();
+  file->SetOriginal(original);
+  std::lock_guard<std::mutex> lock(originals_mutex_);
+  originals_[hash] = std::move(original);
+  return true;
+}
+
+void InputFileManager::FinishPrefetch(const SourceFile& name,
+                                      InputFileInfo* info,
+                                      bool success,
+                                      std::string&& contents) {
+  {
+    std::lock_guard<std::mutex> lock(info->load_mutex);
+    assert(info->prefetching);
+    // Only keep the contents: loading them would hold up the reader's thread
+    // (which may be completing all the reads). On failure, leave it to
+    // |GetFile()| to read it again.
+    if (success && !info->input_file) {
+      info->has_prefetched_contents = true;
+      info->prefetched_contents = std::move(contents);
+    }
+    info->prefetching = false;
+  }
+  info->prefetched.notify_all();
+}
+
+std::vector<std::unique_ptr<const InputFile>> InputFileManager::Invalidate(
+    const std::set<SourceFile>& names) {
+  std::vector<std::unique_ptr<const InputFile>> evicted;
+  std::vector<std::unique_ptr<InputFileInfo>> erased = input_files_.EraseIf(
+      [&names](const SourceFile& name, const InputFileInfo& info) {
+        return names.count(name) > 0;
+      });
+  {
+    std::lock_guard<std::mutex> lock(released_mutex_);
+    for (const auto& info : erased) {
+      if (info->released)
+        released_.erase(info->position);
+      if (info->input_file) {
+        memory_usage_ -= info->memory_usage;
+        evicted.push_back(std::move(info->input_file));
+      }
+    }
+  }
+
+  // Forget the shared representations no file uses any more.
+  std::lock_guard<std::mutex> lock(originals_mutex_);
+  for (auto it = originals_.begin(); it != originals_.end();) {
+    if (it->second.expired())
+      it = originals_.erase(it);
+    else
+      ++it;
+  }
+  return evicted;
+}
+
+void InputFileManager::Release(const std::set<SourceFile>& names) {
+  std::lock_guard<std::mutex> lock(released_mutex_);
+  for (const SourceFile& name : names) {
+    InputFileInfo* info = input_files_.Find(name);
+    if (!info || !info->input_file || info->released)
+      continue;
+    info->loaded.store(nullptr, std::memory_order_release);
+    info->released = true;
+    info->position = released_.insert(released_.begin(), info);
+  }
+
+  // Evict the least recently released files until within the budget.
+  while (memory_usage_ > memory_budget_ && !released_.empty()) {
+    InputFileInfo* info = released_.back();
+    released_.pop_back();
+    info->released = false;
+    info->input_file.reset();
+    memory_usage_ -= info->memory_usage;
+  }
+}
+
 }  // namespace icl
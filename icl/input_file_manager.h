@@ -5,28 +5,72 @@
 #ifndef ICL_INPUT_FILE_MANAGER_H_
 #define ICL_INPUT_FILE_MANAGER_H_
 
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
 #include <functional>
-#include <map>
+#include <list>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "icl/concurrent_map.h"
 #include "icl/load_file.h"  // For |ReadFileFunction|.
+#include "icl/source_file.h"
 
 namespace icl {
 
+class AsyncFileReader;
 class InputFile;
 class LocationRange;
-class SourceFile;
+class ParseCache;
 
 class InputFileManager {
  public:
   explicit InputFileManager(ReadFileFunction read_file_function);
+  // Also uses the given directory (which must exist) as a persistent cache of
+  // tokenized and parsed files (see |ParseCache|).
+  InputFileManager(ReadFileFunction read_file_function,
+                   const std::string& parse_cache_dir);
+  // Reads files using |reader|, which also allows them to be prefetched (see
+  // |Prefetch()|).
+  explicit InputFileManager(std::unique_ptr<AsyncFileReader> reader);
   ~InputFileManager();
 
   InputFileManager(const InputFileManager&) = delete;
   InputFileManager& operator=(const InputFileManager&) = delete;
 
+  // Whether to compact files once they're loaded (see |InputFile::Compact()|),
+  // which saves most of the memory used by their contents. The default is
+  // false. Must not be changed once files have been gotten.
+  void set_compact_files(bool compact_files) { compact_files_ = compact_files; }
+
+  // Whether files with identical contents (e.g., the same file vendored under
+  // several paths) are only tokenized and parsed once: the others copy the
+  // parse tree (see |InputFile::SetOriginal()|), so that errors still name
+  // their own path, and share its contents and token values. The default is
+  // false. Must not be changed once files have been gotten.
+  void set_deduplicate_files(bool deduplicate_files) {
+    deduplicate_files_ = deduplicate_files;
+  }
+
+  // Sets the budget for the memory used by loaded files (see
+  // |InputFile::GetMemoryUsage()|; an original shared by deduplicated files
+  // counts against the file that loaded it). Files stay loaded while they may
+  // be in use, but once they're released (see |Release()|), the least recently
+  // released ones are evicted as needed to keep within the budget. The
+  // default is unlimited.
+  void set_memory_budget(size_t memory_budget) {
+    memory_budget_ = memory_budget;
+  }
+
+  // The estimated memory used by the loaded files.
+  size_t memory_usage() const { return memory_usage_.load(); }
+
   // Gets (reading/loading/parsing) the file specified by |name| to |*file|
   // (|**file| will live as long as this object). Returns true on success and
   // false on failure, in which case |*file| will still be set (but with an
@@ -36,18 +80,82 @@ class InputFileManager {
                const SourceFile& name,
                const InputFile** file);
 
+  // Starts reading the given files, all at once, so that getting them later
+  // needn't wait for each read in turn. Their contents are kept until they're
+  // gotten, which loads (tokenizes and parses) them on the getting thread.
+  // Files that are loaded or already being prefetched are skipped. Getting a
+  // file that's being prefetched waits for the read; if it failed, the file
+  // is read again then (so that the error has the right origin). Does nothing
+  // unless there's a reader.
+  void Prefetch(const std::vector<SourceFile>& names);
+
+  // Evicts the given files (if loaded), so that they'll be reloaded the next
+  // time they're gotten. The evicted files are returned, and must be kept alive
+  // as long as anything may refer to them (e.g., parse nodes or values from
+  // them). Must not be called while files are being gotten or prefetched.
+  std::vector<std::unique_ptr<const InputFile>> Invalidate(
+      const std::set<SourceFile>& names);
+
+  // Notes that nothing refers to the given files (or parse nodes or values
+  // from them) any more, so they may be evicted (see |set_memory_budget()|),
+  // in which case they'll be reloaded the next time they're gotten. Getting a
+  // released file that hasn't been evicted makes it in use again. Must not be
+  // called while files are being gotten or prefetched.
+  void Release(const std::set<SourceFile>& names);
+
  private:
   struct InputFileInfo;
 
+  // Loads the file into |*info| (whose |load_mutex| must be held), using
+  // |read_file_function| to read it. Returns true on success.
+  bool LoadLocked(const ReadFileFunction& read_file_function,
+                  const LocationRange& origin,
+                  const SourceFile& name,
+                  InputFileInfo* info);
+
+  // Loads |*file| as a deduplicated file: it shares the parsed representation
+  // of any loaded file with the same contents, and otherwise gets a new one.
+  // Returns true on success, adding the memory used by a new representation to
+  // |*memory_usage|.
+  bool LoadDeduplicated(const ReadFileFunction& read_file_function,
+                        const LocationRange& origin,
+                        InputFile* file,
+                        size_t* memory_usage);
+
+  // Called when a prefetch's read completes, on the reader's thread.
+  void FinishPrefetch(const SourceFile& name,
+                      InputFileInfo* info,
+                      bool success,
+                      std::string&& contents);
+
   const ReadFileFunction read_file_function_;
 
-  // Protects access to input_files_. Do not hold when actually loading input
-  // files.
-  std::mutex input_files_mutex_;
+  // May be null.
+  const std::unique_ptr<const ParseCache> parse_cache_;
+
+  bool compact_files_;
+  bool deduplicate_files_;
+  size_t memory_budget_;
+  std::atomic<size_t> memory_usage_;
 
-  // Owning pointers to the scopes.
-  using InputFileMap = std::map<SourceFile, std::unique_ptr<InputFileInfo>>;
+  // The released files that are still loaded, most recently released first.
+  // Protected by |released_mutex_|, as is |InputFileInfo::released|.
+  std::mutex released_mutex_;
+  std::list<InputFileInfo*> released_;
+
+  // The files that deduplicated files are loaded from (see
+  // |InputFile::SetOriginal()|), by contents hash. They live as long as any
+  // file loaded from them. Protected by |originals_mutex_|.
+  std::mutex originals_mutex_;
+  std::unordered_map<uint64_t, std::weak_ptr<const InputFile>> originals_;
+
+  // Getting an already-loaded file is lock-free (see |InputFileInfo|).
+  using InputFileMap = ConcurrentMap<SourceFile, InputFileInfo>;
   InputFileMap input_files_;
+
+  // May be null. (Declared last, so that it's destroyed first, since its
+  // destructor waits for outstanding prefetches.)
+  const std::unique_ptr<AsyncFileReader> reader_;
 };
 
 }  // namespace icl
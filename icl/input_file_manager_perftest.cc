@@ -0,0 +1,125 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/input_file_manager.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "icl/input_file.h"
+#include "icl/location.h"
+#include "icl/source_file.h"
+
+namespace icl {
+namespace {
+
+const int kFileCount = 500;
+const int kGetsPerThread = 200000;
+
+// The previous scheme, for comparison: a global lock around a |std::map|,
+// then a per-entry lock (even if the entry is already loaded).
+class LockingFileMap {
+ public:
+  LockingFileMap() = default;
+  ~LockingFileMap() = default;
+
+  LockingFileMap(const LockingFileMap&) = delete;
+  LockingFileMap& operator=(const LockingFileMap&) = delete;
+
+  const InputFile* GetFile(const SourceFile& name) {
+    Info* info = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::unique_ptr<Info>& info_ptr = files_[name];
+      if (!info_ptr)
+        info_ptr.reset(new Info);
+      info = info_ptr.get();
+    }
+    std::lock_guard<std::mutex> lock(info->load_mutex);
+    if (!info->input_file)
+      info->input_file.reset(new InputFile(name));
+    return info->input_file.get();
+  }
+
+ private:
+  struct Info {
+    std::mutex load_mutex;
+    std::unique_ptr<const InputFile> input_file;
+  };
+
+  std::mutex mutex_;
+  std::map<SourceFile, std::unique_ptr<Info>> files_;
+};
+
+std::vector<SourceFile> MakeNames() {
+  std::vector<SourceFile> names;
+  for (int i = 0; i < kFileCount; i++) {
+    names.push_back(SourceFile("//some/fairly/long/directory/name/file" +
+                               std::to_string(i) + ".gni"));
+  }
+  return names;
+}
+
+// Calls |get(name)| |kGetsPerThread| times on each of |thread_count| threads,
+// cycling through |names|, and prints the time taken.
+void Measure(const char* label,
+             int thread_count,
+             const std::vector<SourceFile>& names,
+             const std::function<void(const SourceFile&)>& get) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; t++) {
+    threads.emplace_back([&names, &get, t]() {
+      for (int i = 0; i < kGetsPerThread; i++)
+        get(names[(i + t * 31) % names.size()]);
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start).count();
+  double total_gets = static_cast<double>(thread_count) * kGetsPerThread;
+  printf("%-20s %2d threads: %8.1f ns/get (wall), %8.2f M gets/s\n", label,
+         thread_count, seconds * 1e9 / total_gets, total_gets / seconds / 1e6);
+}
+
+TEST(InputFileManagerPerfTest, GetLoadedFile) {
+  const std::vector<SourceFile> names = MakeNames();
+
+  InputFileManager manager([](const SourceFile& name, std::string* contents) {
+    *contents = "x = 1\n";
+    return true;
+  });
+  LockingFileMap locking_map;
+  for (const SourceFile& name : names) {
+    const InputFile* file = nullptr;
+    ASSERT_TRUE(manager.GetFile(LocationRange(), name, &file));
+    locking_map.GetFile(name);
+  }
+
+  for (int thread_count : {1, 2, 4, 8}) {
+    Measure("locking std::map", thread_count, names,
+            [&locking_map](const SourceFile& name) {
+              locking_map.GetFile(name);
+            });
+    Measure("InputFileManager", thread_count, names,
+            [&manager](const SourceFile& name) {
+              const InputFile* file = nullptr;
+              manager.GetFile(LocationRange(), name, &file);
+            });
+  }
+}
+
+}  // namespace
+}  // namespace icl
@@ -0,0 +1,329 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/input_file_manager.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "icl/binary_io.h"
+#include "icl/err.h"
+#include "icl/fake_file_reader.h"
+#include "icl/input_file.h"
+#include "icl/location.h"
+#include "icl/parse_tree.h"
+#include "icl/sha256.h"
+#include "icl/source_file.h"
+#include "icl/test_with_scope.h"
+
+namespace icl {
+namespace {
+
+const char kInput[] =
+    "# Copyright header.\n"
+    "\n"
+    "a = 1  # Suffix comment.\n"
+    "b = [\n"
+    "  \"foo\",\n"
+    "  \"bar\",  # Another.\n"
+    "]\n"
+    "if (a == 1 && !false) {\n"
+    "  c = b[1]\n"
+    "} else {\n"
+    "  c = \"$a\"\n"
+    "}\n"
+    "print(c + \" \" + b[0])\n";
+
+// Reads files from a map, counting the reads.
+class TestFiles {
+ public:
+  TestFiles() = default;
+  ~TestFiles() = default;
+
+  TestFiles(const TestFiles&) = delete;
+  TestFiles& operator=(const TestFiles&) = delete;
+
+  std::map<std::string, std::string>& files() { return files_; }
+  int read_count(const std::string& name) { return read_counts_[name]; }
+
+  ReadFileFunction GetReadFileFunction() {
+    return [this](const SourceFile& name, std::string* contents) {
+      read_counts_[name.value()]++;
+      auto found = files_.find(name.value());
+      if (found == files_.end())
+        return false;
+      *contents = found->second;
+      return true;
+    };
+  }
+
+ private:
+  std::map<std::string, std::string> files_;
+  std::map<std::string, int> read_counts_;
+};
+
+std::string Print(const ParseNode* node) {
+  std::ostringstream out;
+  node->Print(out, 0);
+  return out.str();
+}
+
+const InputFile* GetFile(InputFileManager* manager, const char* name) {
+  const InputFile* file = nullptr;
+  EXPECT_TRUE(manager->GetFile(LocationRange(), SourceFile(name), &file));
+  return file;
+}
+
+// Getting a file that was already loaded gives the same result as loading it.
+TEST(InputFileManager, GetFileAgain) {
+  InputFileManager manager(
+      [](const SourceFile& name, std::string* contents) {
+        if (name.value() != "//a.icl")
+          return false;
+        *contents = "a = 1\n";
+        return true;
+      });
+
+  const InputFile* file = nullptr;
+  EXPECT_TRUE(manager.GetFile(LocationRange(), SourceFile("//a.icl"), &file));
+  const InputFile* again = nullptr;
+  EXPECT_TRUE(manager.GetFile(LocationRange(), SourceFile("//a.icl"), &again));
+  EXPECT_EQ(file, again);
+  EXPECT_FALSE(again->err().has_error());
+
+  const InputFile* missing = nullptr;
+  EXPECT_FALSE(
+      manager.GetFile(LocationRange(), SourceFile("//missing.icl"), &missing));
+  ASSERT_TRUE(missing);
+  EXPECT_TRUE(missing->err().has_error());
+  EXPECT_FALSE(
+      manager.GetFile(LocationRange(), SourceFile("//missing.icl"), &missing));
+  EXPECT_TRUE(missing->err().has_error());
+}
+
+TEST(InputFileManager, Compact) {
+  TestFiles files;
+  files.files()["//a.icl"] = kInput;
+  InputFileManager manager(files.GetReadFileFunction());
+  InputFileManager compacting_manager(files.GetReadFileFunction());
+  compacting_manager.set_compact_files(true);
+
+  const InputFile* file = GetFile(&manager, "//a.icl");
+  const InputFile* compacted = GetFile(&compacting_manager, "//a.icl");
+  ASSERT_TRUE(file && compacted);
+  EXPECT_TRUE(file->has_contents());
+  EXPECT_FALSE(compacted->has_contents());
+  EXPECT_TRUE(compacted->is_compacted());
+  EXPECT_EQ(HashBytes(kInput), compacted->GetContentsHash());
+  EXPECT_EQ(file->GetContentsHash(), compacted->GetContentsHash());
+  EXPECT_EQ(Sha256(kInput), compacted->GetContentsDigest());
+  EXPECT_EQ(file->GetContentsDigest(), compacted->GetContentsDigest());
+  EXPECT_LT(compacted->GetMemoryUsage(), file->GetMemoryUsage());
+  EXPECT_EQ(compacted->GetMemoryUsage(), compacting_manager.memory_usage());
+
+  // The tree is the same (including comments), and still runs.
+  EXPECT_EQ(Print(file->root_parse_node()),
+            Print(compacted->root_parse_node()));
+  TestWithScope setup;
+  Err err;
+  compacted->root_parse_node()->Execute(setup.scope(), &err);
+  EXPECT_FALSE(err.has_error()) << err.GetErrorMessage();
+  EXPECT_EQ("bar foo\n", setup.print_output());
+
+  // Errors in compacted files don't quote the line.
+  files.files()["//bad.icl"] = "a = 1\nb = a + \"x\" + c\n";
+  const InputFile* bad = GetFile(&compacting_manager, "//bad.icl");
+  ASSERT_TRUE(bad);
+  TestWithScope bad_setup;
+  bad->root_parse_node()->Execute(bad_setup.scope(), &err);
+  ASSERT_TRUE(err.has_error());
+  EXPECT_EQ(std::string::npos, err.GetErrorMessage().find("b = a"));
+}
+
+TEST(InputFileManager, MemoryBudget) {
+  TestFiles files;
+  files.files()["//a.icl"] = kInput;
+  files.files()["//b.icl"] = kInput;
+  files.files()["//c.icl"] = kInput;
+  InputFileManager manager(files.GetReadFileFunction());
+  manager.set_compact_files(true);
+
+  size_t file_usage = GetFile(&manager, "//a.icl")->GetMemoryUsage();
+  GetFile(&manager, "//b.icl");
+  GetFile(&manager, "//c.icl");
+  EXPECT_EQ(3 * file_usage, manager.memory_usage());
+
+  // Released files are kept while within the budget, and can be used again.
+  manager.set_memory_budget(3 * file_usage);
+  manager.Release({SourceFile("//a.icl")});
+  EXPECT_EQ(3 * file_usage, manager.memory_usage());
+  GetFile(&manager, "//a.icl");
+  EXPECT_EQ(1, files.read_count("//a.icl"));
+
+  // Beyond the budget, released files are evicted (and reloaded if needed),
+  // but files in use aren't.
+  manager.set_memory_budget(file_usage);
+  manager.Release({SourceFile("//b.icl")});
+  EXPECT_EQ(2 * file_usage, manager.memory_usage());
+  manager.Release({SourceFile("//c.icl")});
+  EXPECT_EQ(file_usage, manager.memory_usage());
+  GetFile(&manager, "//b.icl");
+  EXPECT_EQ(2, files.read_count("//b.icl"));
+  EXPECT_EQ(2 * file_usage, manager.memory_usage());
+
+  // The least recently released files are evicted first.
+  manager.set_memory_budget(2 * file_usage);
+  manager.Release({SourceFile("//a.icl")});
+  manager.Release({SourceFile("//b.icl")});
+  EXPECT_EQ(2 * file_usage, manager.memory_usage());
+  GetFile(&manager, "//c.icl");
+  EXPECT_EQ(3 * file_usage, manager.memory_usage());
+  manager.Release({SourceFile("//c.icl")});
+  EXPECT_EQ(2 * file_usage, manager.memory_usage());
+  GetFile(&manager, "//b.icl");
+  EXPECT_EQ(2, files.read_count("//b.icl"));
+  GetFile(&manager, "//a.icl");
+  EXPECT_EQ(2, files.read_count("//a.icl"));
+
+  // Invalidating a released file removes it.
+  manager.set_memory_budget(3 * file_usage);
+  manager.Release({SourceFile("//a.icl")});
+  EXPECT_EQ(1u, manager.Invalidate({SourceFile("//a.icl")}).size());
+  EXPECT_EQ(2 * file_usage, manager.memory_usage());
+  manager.Release({SourceFile("//b.icl")});
+  EXPECT_EQ(2 * file_usage, manager.memory_usage());
+}
+
+TEST(InputFileManager, Deduplicate) {
+  TestFiles files;
+  files.files()["//a/x.icl"] = kInput;
+  files.files()["//b/x.icl"] = kInput;
+  files.files()["//c/x.icl"] = kInput;
+  files.files()["//other.icl"] = "a = 2\n";
+  InputFileManager manager(files.GetReadFileFunction());
+  manager.set_deduplicate_files(true);
+
+  // Identical files are loaded from the same original, but keep their own
+  // names, and their own copies of the tree.
+  const InputFile* a = GetFile(&manager, "//a/x.icl");
+  const InputFile* b = GetFile(&manager, "//b/x.icl");
+  const InputFile* other = GetFile(&manager, "//other.icl");
+  ASSERT_TRUE(a && b && other);
+  EXPECT_EQ(a->original(), b->original());
+  EXPECT_NE(a->original(), other->original());
+  EXPECT_EQ("//b/x.icl", b->name().value());
+  EXPECT_EQ("//b/", b->dir().value());
+  EXPECT_EQ(HashBytes(kInput), b->GetContentsHash());
+  EXPECT_EQ(1, files.read_count("//b/x.icl"));
+  EXPECT_LT(b->GetMemoryUsage(), a->original()->GetMemoryUsage());
+  EXPECT_NE(a->root_parse_node(), b->root_parse_node());
+  EXPECT_EQ(Print(a->root_parse_node()), Print(b->root_parse_node()));
+
+  // So errors in the tree name the file.
+  Err err(b->root_parse_node(), "Oops.");
+  EXPECT_EQ(b, b->root_parse_node()->GetRange().begin().file());
+  EXPECT_NE(std::string::npos, err.GetErrorMessage().find("//b/x.icl:1:1"))
+      << err.GetErrorMessage();
+
+  // The original outlives the file that first loaded it.
+  const InputFile* original = a->original();
+  std::vector<std::unique_ptr<const InputFile>> evicted =
+      manager.Invalidate({SourceFile("//a/x.icl")});
+  EXPECT_EQ(1u, evicted.size());
+  evicted.clear();
+  const InputFile* c = GetFile(&manager, "//c/x.icl");
+  ASSERT_TRUE(c);
+  EXPECT_EQ(original, c->original());
+  EXPECT_EQ(Print(b->root_parse_node()), Print(c->root_parse_node()));
+
+  // Errors in files that fail to parse aren't shared.
+  files.files()["//bad1.icl"] = "a = (\n";
+  files.files()["//bad2.icl"] = "a = (\n";
+  const InputFile* bad1 = nullptr;
+  const InputFile* bad2 = nullptr;
+  EXPECT_FALSE(
+      manager.GetFile(LocationRange(), SourceFile("//bad1.icl"), &bad1));
+  EXPECT_FALSE(
+      manager.GetFile(LocationRange(), SourceFile("//bad2.icl"), &bad2));
+  ASSERT_TRUE(bad1 && bad2);
+  EXPECT_FALSE(bad2->original());
+  EXPECT_NE(std::string::npos,
+            bad2->err().GetErrorMessage().find("//bad2.icl"));
+}
+
+TEST(InputFileManager, DeduplicateCompacted) {
+  TestFiles files;
+  files.files()["//a/x.icl"] = kInput;
+  files.files()["//b/x.icl"] = kInput;
+  files.files()["//other.icl"] = "a = 2\n";
+  InputFileManager manager(files.GetReadFileFunction());
+  manager.set_compact_files(true);
+  manager.set_deduplicate_files(true);
+
+  // The original's contents are gone, so they're compared by digest.
+  const InputFile* a = GetFile(&manager, "//a/x.icl");
+  const InputFile* b = GetFile(&manager, "//b/x.icl");
+  const InputFile* other = GetFile(&manager, "//other.icl");
+  ASSERT_TRUE(a && b && other);
+  EXPECT_FALSE(b->has_contents());
+  EXPECT_EQ(a->original(), b->original());
+  EXPECT_NE(a->original(), other->original());
+  EXPECT_EQ(Print(a->root_parse_node()), Print(b->root_parse_node()));
+}
+
+TEST(InputFileManager, Prefetch) {
+  FakeFileReader* reader = new FakeFileReader;
+  reader->files()["//a.icl"] = kInput;
+  reader->files()["//b.icl"] = kInput;
+  reader->set_hold_reads(true);
+  InputFileManager manager{std::unique_ptr<AsyncFileReader>(reader)};
+
+  // The reads are submitted together (and only once).
+  manager.Prefetch({SourceFile("//a.icl"), SourceFile("//b.icl"),
+                    SourceFile("//missing.icl")});
+  manager.Prefetch({SourceFile("//a.icl")});
+  EXPECT_EQ(1, reader->read_call_count());
+  EXPECT_EQ(3u, reader->held_read_count());
+
+  // Getting a file waits for its prefetch, and doesn't read it again.
+  const InputFile* file = nullptr;
+  std::thread getter([&manager, &file]() {
+    file = GetFile(&manager, "//a.icl");
+  });
+  reader->CompleteHeldReads();
+  getter.join();
+  ASSERT_TRUE(file);
+  EXPECT_EQ(1, reader->request_count("//a.icl"));
+  EXPECT_EQ(file, GetFile(&manager, "//a.icl"));
+  // A prefetched file is only loaded once it's gotten.
+  EXPECT_EQ(file->GetMemoryUsage(), manager.memory_usage());
+  manager.Prefetch({SourceFile("//b.icl")});
+  EXPECT_EQ(1, reader->read_call_count());
+  const InputFile* b = GetFile(&manager, "//b.icl");
+  ASSERT_TRUE(b);
+  EXPECT_FALSE(b->err().has_error());
+  EXPECT_EQ(1, reader->request_count("//b.icl"));
+
+  // Loaded files aren't prefetched again.
+  manager.Prefetch({SourceFile("//a.icl")});
+  EXPECT_EQ(1, reader->read_call_count());
+
+  // Failed reads are retried when gotten, and report the origin.
+  reader->set_hold_reads(false);
+  const InputFile* missing = nullptr;
+  EXPECT_FALSE(manager.GetFile(LocationRange(), SourceFile("//missing.icl"),
+                               &missing));
+  ASSERT_TRUE(missing);
+  EXPECT_TRUE(missing->err().has_error());
+  EXPECT_EQ(2, reader->request_count("//missing.icl"));
+}
+
+}  // namespace
+}  // namespace icl
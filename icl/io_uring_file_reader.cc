@@ -0,0 +1,312 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/io_uring_file_reader.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace icl {
+
+namespace {
+
+// The number of submission queue entries, which is also the maximum number of
+// reads in flight.
+const unsigned kRingEntries = 64;
+
+// The size of each read of a file whose size isn't known (e.g., a pipe).
+const size_t kUnknownSizeReadSize = 64 * 1024;
+
+// The |user_data| of the no-op used to stop the completion thread (operations
+// use their address).
+const uint64_t kStopUserData = 0;
+
+int IoUringSetup(unsigned entries, io_uring_params* params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int IoUringEnter(int ring_fd,
+                 unsigned to_submit,
+                 unsigned min_complete,
+                 unsigned flags) {
+  int result;
+  do {
+    result = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                                      min_complete, flags, nullptr, 0));
+  } while (result < 0 && errno == EINTR);
+  return result;
+}
+
+}  // namespace
+
+struct IoUringFileReader::Operation {
+  Callback callback;
+  int fd = -1;
+  // Whether the file's size is known, in which case |contents| has that size.
+  bool size_known = false;
+  std::string contents;
+  // The number of bytes read so far.
+  size_t done = 0;
+  // The buffer for the current read (which must stay valid while it's in
+  // flight).
+  iovec iov;
+  bool success = false;
+};
+
+IoUringFileReader::IoUringFileReader(const std::string& source_root,
+                                     int ring_fd)
+    : source_root_(source_root),
+      ring_fd_(ring_fd),
+      sq_ring_(MAP_FAILED),
+      sq_ring_size_(0),
+      cq_ring_(MAP_FAILED),
+      cq_ring_size_(0),
+      sqes_(nullptr),
+      sqes_size_(0),
+      sq_tail_(nullptr),
+      sq_mask_(0),
+      sq_array_(nullptr),
+      sq_entries_(0),
+      cq_head_(nullptr),
+      cq_tail_(nullptr),
+      cq_mask_(0),
+      cqes_(nullptr),
+      in_flight_(0) {}
+
+IoUringFileReader::~IoUringFileReader() {
+  if (completion_thread_.joinable()) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      idle_.wait(lock,
+                 [this]() { return in_flight_ == 0 && queued_.empty(); });
+      unsigned tail = *sq_tail_;
+      unsigned index = tail & sq_mask_;
+      io_uring_sqe* sqe = &sqes_[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_NOP;
+      sqe->user_data = kStopUserData;
+      sq_array_[index] = index;
+      __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+      IoUringEnter(ring_fd_, 1, 0, 0);
+    }
+    completion_thread_.join();
+  }
+
+  if (sqes_)
+    munmap(sqes_, sqes_size_);
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+    munmap(cq_ring_, cq_ring_size_);
+  if (sq_ring_ != MAP_FAILED)
+    munmap(sq_ring_, sq_ring_size_);
+  close(ring_fd_);
+}
+
+// static
+std::unique_ptr<IoUringFileReader> IoUringFileReader::Create(
+    const std::string& source_root) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int ring_fd = IoUringSetup(kRingEntries, &params);
+  if (ring_fd < 0)
+    return nullptr;
+
+  std::unique_ptr<IoUringFileReader> reader(
+      new IoUringFileReader(source_root, ring_fd));
+  if (!reader->Map(params))
+    return nullptr;
+  reader->completion_thread_ =
+      std::thread(&IoUringFileReader::RunCompletionThread, reader.get());
+  return reader;
+}
+
+bool IoUringFileReader::Map(const io_uring_params& params) {
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap)
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED)
+    return false;
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED)
+      return false;
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    return false;
+  sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+  char* sq = static_cast<char*>(sq_ring_);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  sq_entries_ = params.sq_entries;
+  char* cq = static_cast<char*>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  return true;
+}
+
+void IoUringFileReader::Read(std::vector<Request> requests) {
+  // Open the files before taking the lock.
+  std::vector<std::unique_ptr<Operation>> operations;
+  for (Request& request : requests) {
+    std::unique_ptr<Operation> operation = Open(std::move(request));
+    if (operation)
+      operations.push_back(std::move(operation));
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& operation : operations)
+    queued_.push_back(std::move(operation));
+  SubmitLocked();
+}
+
+std::unique_ptr<IoUringFileReader::Operation> IoUringFileReader::Open(
+    Request&& request) {
+  std::string path = request.name.Resolve(source_root_);
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    if (fd >= 0)
+      close(fd);
+    request.callback(false, std::string());
+    return nullptr;
+  }
+
+  std::unique_ptr<Operation> operation(new Operation);
+  operation->callback = std::move(request.callback);
+  operation->fd = fd;
+  operation->size_known = S_ISREG(info.st_mode) && info.st_size > 0;
+  if (operation->size_known)
+    operation->contents.resize(static_cast<size_t>(info.st_size));
+  else
+    operation->contents.resize(kUnknownSizeReadSize);
+  return operation;
+}
+
+void IoUringFileReader::SubmitLocked() {
+  unsigned tail = *sq_tail_;
+  unsigned count = 0;
+  while (!queued_.empty() && in_flight_ < sq_entries_) {
+    std::unique_ptr<Operation> operation = std::move(queued_.front());
+    queued_.pop_front();
+    operation->iov.iov_base = &operation->contents[operation->done];
+    operation->iov.iov_len = operation->contents.size() - operation->done;
+
+    unsigned index = (tail + count) & sq_mask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = operation->fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&operation->iov);
+    sqe->len = 1;
+    // Files of unknown size may not be seekable, so read those from the
+    // current position.
+    sqe->off = operation->size_known ? operation->done
+                                     : static_cast<uint64_t>(-1);
+    sqe->user_data = reinterpret_cast<uint64_t>(operation.release());
+    sq_array_[index] = index;
+    count++;
+    in_flight_++;
+  }
+  if (count == 0)
+    return;
+  __atomic_store_n(sq_tail_, tail + count, __ATOMIC_RELEASE);
+  IoUringEnter(ring_fd_, count, 0, 0);
+}
+
+void IoUringFileReader::HandleResultLocked(
+    std::unique_ptr<Operation> operation,
+    int result,
+    std::vector<std::unique_ptr<Operation>>* completed) {
+  if (result == -EINTR || result == -EAGAIN) {
+    queued_.push_back(std::move(operation));
+    return;
+  }
+
+  if (result > 0) {
+    operation->done += static_cast<size_t>(result);
+    if (operation->done < operation->contents.size()) {
+      queued_.push_back(std::move(operation));
+      return;
+    }
+    if (!operation->size_known) {
+      // Keep reading until the end of the file.
+      operation->contents.resize(operation->done + kUnknownSizeReadSize);
+      queued_.push_back(std::move(operation));
+      return;
+    }
+  }
+
+  // Done (at the end of the file, possibly early if it shrank) or failed.
+  operation->success = result >= 0;
+  if (operation->success)
+    operation->contents.resize(operation->done);
+  else
+    operation->contents.clear();
+  close(operation->fd);
+  completed->push_back(std::move(operation));
+}
+
+void IoUringFileReader::RunCompletionThread() {
+  for (;;) {
+    IoUringEnter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS);
+
+    bool stopping = false;
+    std::vector<std::unique_ptr<Operation>> completed;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      unsigned head = *cq_head_;
+      unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      for (; head != tail; head++) {
+        const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+        if (cqe.user_data == kStopUserData) {
+          stopping = true;
+          continue;
+        }
+        in_flight_--;
+        HandleResultLocked(std::unique_ptr<Operation>(
+                               reinterpret_cast<Operation*>(cqe.user_data)),
+                           cqe.res, &completed);
+      }
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+      SubmitLocked();
+      if (in_flight_ == 0 && queued_.empty())
+        idle_.notify_all();
+    }
+
+    // Call the callbacks outside the lock, since they may start more reads.
+    for (auto& operation : completed)
+      operation->callback(operation->success, std::move(operation->contents));
+    if (stopping)
+      return;
+  }
+}
+
+}  // namespace icl
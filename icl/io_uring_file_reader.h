@@ -0,0 +1,99 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_IO_URING_FILE_READER_H_
+#define ICL_IO_URING_FILE_READER_H_
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "icl/async_file_reader.h"
+
+struct io_uring_cqe;
+struct io_uring_params;
+struct io_uring_sqe;
+
+namespace icl {
+
+// Reads files using Linux's io_uring (directly, using the system calls), so
+// that many reads are in flight at once without a thread for each. Files are
+// opened synchronously, and then read with as many reads as needed.
+// Completions (and so callbacks) happen on a dedicated thread.
+class IoUringFileReader : public AsyncFileReader {
+ public:
+  ~IoUringFileReader() override;
+
+  IoUringFileReader(const IoUringFileReader&) = delete;
+  IoUringFileReader& operator=(const IoUringFileReader&) = delete;
+
+  // Returns null if io_uring isn't available (e.g., on old kernels, or if
+  // it's disabled).
+  static std::unique_ptr<IoUringFileReader> Create(
+      const std::string& source_root);
+
+  // |AsyncFileReader| methods:
+  void Read(std::vector<Request> requests) override;
+
+ private:
+  struct Operation;
+
+  IoUringFileReader(const std::string& source_root, int ring_fd);
+
+  // Sets up the ring's memory mappings. Returns false on failure.
+  bool Map(const io_uring_params& params);
+
+  // Opens the file for the request. Returns the operation to read it, or
+  // null if that failed (in which case the callback has been called).
+  std::unique_ptr<Operation> Open(Request&& request);
+  // Submits queued reads while there's room. Called with |mutex_| held.
+  void SubmitLocked();
+  // Handles a read's result, queuing the next read if there's more to read
+  // and otherwise adding the operation to |*completed|. Called with |mutex_|
+  // held.
+  void HandleResultLocked(std::unique_ptr<Operation> operation,
+                          int result,
+                          std::vector<std::unique_ptr<Operation>>* completed);
+
+  void RunCompletionThread();
+
+  const std::string source_root_;
+  const int ring_fd_;
+
+  // The ring's memory mappings.
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  io_uring_sqe* sqes_;
+  size_t sqes_size_;
+  unsigned* sq_tail_;
+  unsigned sq_mask_;
+  unsigned* sq_array_;
+  unsigned sq_entries_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  io_uring_cqe* cqes_;
+
+  // Protects the following (and submission).
+  std::mutex mutex_;
+  std::condition_variable idle_;
+  // Reads waiting for room in the ring.
+  std::deque<std::unique_ptr<Operation>> queued_;
+  // The number of reads submitted but not completed.
+  unsigned in_flight_;
+
+  std::thread completion_thread_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_IO_URING_FILE_READER_H_
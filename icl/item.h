@@ -5,7 +5,10 @@
 #ifndef ICL_ITEM_H_
 #define ICL_ITEM_H_
 
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace icl {
 
@@ -23,6 +26,16 @@ class Item {
   const ParseNode* defined_from() const { return defined_from_; }
   void set_defined_from(const ParseNode* df) { defined_from_ = df; }
 
+  // Returns true if this item is equivalent to |other| (ignoring where they
+  // were defined), e.g., so that rerunning a file can tell which items changed
+  // (see |IncrementalRunner|). The default conservatively returns false.
+  virtual bool Equals(const Item& other) const { return false; }
+
+  // Returns a copy of this item, e.g., so that the items defined by a template
+  // invocation can be replayed (see |TemplateCache|), or null if it can't be
+  // copied. The default returns null.
+  virtual std::unique_ptr<Item> Clone() const { return nullptr; }
+
  protected:
   // Note: |type| (the pointer value, not just the string value!) should
   // identify the implementing subclass, since it may be used for manually RTTI
@@ -31,7 +44,8 @@ class Item {
   Item(const char* type, Delegate* delegate)
       : type_(type), delegate_(delegate) {}
 
-  Item(const Item&) = delete;
+  // For |Clone()|.
+  Item(const Item&) = default;
   Item& operator=(const Item&) = delete;
 
  private:
@@ -40,6 +54,39 @@ class Item {
   const ParseNode* defined_from_ = nullptr;
 };
 
+// Receives items as they're defined (i.e., as soon as the statement defining
+// each one completes), so that they can be processed while evaluation goes on
+// (see |Scope::set_item_collector()| and |Runner::set_item_sink()|).
+class ItemSink {
+ public:
+  virtual ~ItemSink() = default;
+
+  // Takes an item that was just defined. This is called on the thread that
+  // evaluated the item's definition.
+  virtual void AddItem(std::unique_ptr<Item> item) = 0;
+
+ protected:
+  ItemSink() = default;
+
+  ItemSink(const ItemSink&) = delete;
+  ItemSink& operator=(const ItemSink&) = delete;
+};
+
+// Collects items in a vector, in the order they're defined.
+class ItemVectorSink : public ItemSink {
+ public:
+  explicit ItemVectorSink(std::vector<std::unique_ptr<Item>>* items)
+      : items_(items) {}
+  ~ItemVectorSink() override = default;
+
+  void AddItem(std::unique_ptr<Item> item) override {
+    items_->push_back(std::move(item));
+  }
+
+ private:
+  std::vector<std::unique_ptr<Item>>* const items_;
+};
+
 }  // namespace icl
 
 #endif  // ICL_ITEM_H_
@@ -13,6 +13,7 @@
 #include "icl/item.h"
 #include "icl/parse_tree.h"
 #include "icl/scope.h"
+#include "icl/tracer.h"
 
 namespace icl {
 
@@ -21,6 +22,7 @@ class BagImpl : public Function {
   explicit BagImpl(const char* type) : type_(type) {}
   ~BagImpl() override = default;
   Type GetType() const override { return Type::GENERIC_BLOCK; }
+  bool IsPure() const override { return true; }
   Value GenericBlockFn(Scope* scope,
                        const FunctionCallNode* function,
                        const std::vector<Value>& args,
@@ -34,6 +36,8 @@ class BagImpl : public Function {
         !EnsureNotProcessingImport(function, scope, err))
       return Value();
 
+    Tracer::Span span("item", args[0].string_value(), function);
+    span.AddArg("type", type_);
     Scope block_scope(scope);
     block->Execute(&block_scope, err);
     if (err->has_error())
@@ -50,7 +54,7 @@ class BagImpl : public Function {
                                type_ + " in this context.");
       return Value();
     }
-    collector->push_back(std::move(bag_item));
+    collector->AddItem(std::move(bag_item));
 
     return Value();
   }
@@ -70,4 +74,19 @@ BagItem::BagItem(const char* type, Delegate* delegate, const std::string& name)
 
 BagItem::~BagItem() = default;
 
+bool BagItem::Equals(const Item& other) const {
+  // Items of the same type are of the same class (see |Item::type()|).
+  if (other.type() != type())
+    return false;
+  const BagItem& other_bag = static_cast<const BagItem&>(other);
+  // Note: Values compare their contents, but not their origins.
+  return other_bag.name_ == name_ &&
+         other_bag.key_value_map_ == key_value_map_;
+}
+
+std::unique_ptr<Item> BagItem::Clone() const {
+  // TODO(C++14): Use std::make_unique.
+  return std::unique_ptr<Item>(new BagItem(*this));
+}
+
 }  // namespace icl
@@ -5,6 +5,7 @@
 #ifndef ICL_ITEM_IMPLS_H_
 #define ICL_ITEM_IMPLS_H_
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 
@@ -27,16 +28,21 @@ class BagItem : public Item {
 
   ~BagItem() override;
 
-  BagItem(const BagItem&) = delete;
   BagItem& operator=(const BagItem&) = delete;
 
   const std::string& name() const { return name_; }
   const KeyValueMap& key_value_map() const { return key_value_map_; }
 
+  // |Item| methods:
+  bool Equals(const Item& other) const override;
+  std::unique_ptr<Item> Clone() const override;
+
  private:
   friend class BagImpl;
 
   BagItem(const char* type, Delegate* delegate, const std::string& name);
+  // For |Clone()|.
+  BagItem(const BagItem&) = default;
 
   const std::string name_;
   KeyValueMap key_value_map_;
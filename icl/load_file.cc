@@ -9,30 +9,56 @@
 #include <vector>
 
 #include "icl/err.h"
+#include "icl/evaluation_stats.h"
 #include "icl/input_file.h"
 #include "icl/location.h"
+#include "icl/parse_cache.h"
 #include "icl/parse_tree.h"
 #include "icl/parser.h"
 #include "icl/token.h"
 #include "icl/tokenizer.h"
+#include "icl/tracer.h"
 
 namespace icl {
 
 bool LoadFile(ReadFileFunction read_file_function,
               const LocationRange& origin,
               const SourceFile& name,
+              const ParseCache* parse_cache,
               InputFile* file) {
-  {
-    std::string contents;
-    if (!read_file_function(name, &contents)) {
-      file->set_err(Err(origin, "Unable to load \"" + name.value() + "\"."));
-      return false;
-    }
-    assert(file->name() == name);
-    file->SetContents(std::move(contents));
+  std::string contents;
+  if (!ReadFile(read_file_function, origin, name, file, &contents))
+    return false;
+  return LoadFileContents(std::move(contents), parse_cache, file);
+}
+
+bool ReadFile(const ReadFileFunction& read_file_function,
+              const LocationRange& origin,
+              const SourceFile& name,
+              InputFile* file,
+              std::string* contents) {
+  assert(file->name() == name);
+  Tracer::Span span("file", "read", name);
+  if (!read_file_function(name, contents)) {
+    file->set_err(Err(origin, "Unable to load \"" + name.value() + "\"."));
+    return false;
+  }
+  return true;
+}
+
+bool LoadFileContents(std::string&& contents,
+                      const ParseCache* parse_cache,
+                      InputFile* file) {
+  file->SetContents(std::move(contents));
+
+  if (parse_cache) {
+    Tracer::Span span("file", "parse cache load", file->name());
+    if (parse_cache->Load(file))
+      return true;
   }
 
   {
+    Tracer::Span span("file", "tokenize", file->name());
     Err err;
     std::vector<Token> tokens = Tokenizer::Tokenize(file, &err);
     if (err.has_error()) {
@@ -43,6 +69,9 @@ bool LoadFile(ReadFileFunction read_file_function,
   }
 
   {
+    Tracer::Span span("file", "parse", file->name());
+    StatsRecorder::Count(EvaluationStats::BYTES_PARSED,
+                         file->contents().size());
     Err err;
     std::unique_ptr<ParseNode> root_parse_node =
         Parser::Parse(file->tokens(), &err);
@@ -53,6 +82,8 @@ bool LoadFile(ReadFileFunction read_file_function,
     file->SetRootParseNode(std::move(root_parse_node));
   }
 
+  if (parse_cache)
+    parse_cache->Store(*file);
   return true;
 }
 
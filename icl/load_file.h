@@ -6,21 +6,49 @@
 #define ICL_LOAD_FILE_H_
 
 #include <functional>
+#include <string>
+#include <utility>
 
 namespace icl {
 
 class InputFile;
 class LocationRange;
+class ParseCache;
 class SourceFile;
 
 //FIXME make this take an std::string (or StringPiece?) instead of a SourceFile
 using ReadFileFunction = std::function<bool(const SourceFile&, std::string*)>;
 
+// Reads, tokenizes, and parses the file specified by |name| into |*file|.
+// Returns false (and sets an error on |*file|) on failure. If |parse_cache| is
+// non-null, the tokens and parse tree are loaded from it if possible instead
+// (and stored in it otherwise).
 bool LoadFile(ReadFileFunction read_file_function,
               const LocationRange& origin,
               const SourceFile& name,
+              const ParseCache* parse_cache,
               InputFile* file);
 
+// Reads the file specified by |name| into |*contents|. Returns false (and sets
+// an error on |*file|, whose name it is) on failure.
+bool ReadFile(const ReadFileFunction& read_file_function,
+              const LocationRange& origin,
+              const SourceFile& name,
+              InputFile* file,
+              std::string* contents);
+
+// Like |LoadFile()|, but with the file's contents already read.
+bool LoadFileContents(std::string&& contents,
+                      const ParseCache* parse_cache,
+                      InputFile* file);
+
+inline bool LoadFile(ReadFileFunction read_file_function,
+                     const LocationRange& origin,
+                     const SourceFile& name,
+                     InputFile* file) {
+  return LoadFile(std::move(read_file_function), origin, name, nullptr, file);
+}
+
 }  // namespace icl
 
 #endif  // ICL_LOAD_FILE_H_
@@ -0,0 +1,656 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/parse_cache.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "icl/binary_io.h"
+#include "icl/input_file.h"
+#include "icl/location.h"
+#include "icl/parse_tree.h"
+#include "icl/token.h"
+
+namespace icl {
+
+namespace {
+
+// Entries start with this and the format version, and the version is also part
+// of their names. Bump the version whenever the format (or the tokenizer or
+// parser output) changes.
+const char kMagic[4] = {'I', 'C', 'L', 'P'};
+const uint64_t kFormatVersion = 2;
+
+const char kEntrySuffix[] = ".iclparse";
+
+enum NodeKind {
+  NODE_NULL,
+  NODE_ACCESSOR,
+  NODE_BINARY_OP,
+  NODE_BLOCK,
+  NODE_BLOCK_COMMENT,
+  NODE_CONDITION,
+  NODE_END,
+  NODE_FUNCTION_CALL,
+  NODE_IDENTIFIER,
+  NODE_LIST,
+  NODE_LITERAL,
+  NODE_UNARY_OP,
+
+  NUM_NODE_KINDS
+};
+
+// Token flags, which are stored in the low bits along with the type.
+const uint64_t kTokenHasLocation = 1 << 0;
+// The value starts at the location's byte (which is almost always the case).
+const uint64_t kTokenValueAtLocation = 1 << 1;
+const int kTokenFlagBits = 2;
+
+class Serializer {
+ public:
+  Serializer(const InputFile& file, std::string* out)
+      : file_(file),
+        contents_(file.contents()),
+        out_(out),
+        last_line_number_(0),
+        last_byte_(0) {}
+  ~Serializer() {}
+
+  Serializer(const Serializer&) = delete;
+  Serializer& operator=(const Serializer&) = delete;
+
+  bool WriteTokens() {
+    const std::vector<Token>& tokens = file_.tokens();
+    WriteVarint(tokens.size(), out_);
+    for (size_t i = 0; i < tokens.size(); i++) {
+      if (!WriteToken(tokens[i]))
+        return false;
+      if (!tokens[i].value().empty())
+        token_indices_[tokens[i].value().data()] = i;
+    }
+    return true;
+  }
+
+  bool WriteNode(const ParseNode* node) {
+    if (!node) {
+      WriteVarint(NODE_NULL, out_);
+      return true;
+    }
+
+    if (const AccessorNode* accessor = node->AsAccessor()) {
+      WriteVarint(NODE_ACCESSOR, out_);
+      return WriteComments(node) && WriteTokenRef(accessor->base()) &&
+             WriteNode(accessor->index()) && WriteNode(accessor->member());
+    }
+    if (const BinaryOpNode* binary_op = node->AsBinaryOp()) {
+      WriteVarint(NODE_BINARY_OP, out_);
+      return WriteComments(node) && WriteTokenRef(binary_op->op()) &&
+             WriteNode(binary_op->left()) && WriteNode(binary_op->right());
+    }
+    if (const BlockNode* block = node->AsBlock()) {
+      WriteVarint(NODE_BLOCK, out_);
+      if (!WriteComments(node))
+        return false;
+      WriteVarint(block->result_mode(), out_);
+      if (!WriteTokenRef(block->begin_token()) || !WriteNode(block->End()))
+        return false;
+      WriteVarint(block->statements().size(), out_);
+      for (const auto& statement : block->statements()) {
+        if (!WriteNode(statement.get()))
+          return false;
+      }
+      return true;
+    }
+    if (const BlockCommentNode* block_comment = node->AsBlockComment()) {
+      WriteVarint(NODE_BLOCK_COMMENT, out_);
+      return WriteComments(node) && WriteTokenRef(block_comment->comment());
+    }
+    if (const ConditionNode* condition = node->AsConditionNode()) {
+      WriteVarint(NODE_CONDITION, out_);
+      return WriteComments(node) && WriteTokenRef(condition->if_token()) &&
+             WriteNode(condition->condition()) &&
+             WriteNode(condition->if_true()) &&
+             WriteNode(condition->if_false());
+    }
+    if (const EndNode* end = node->AsEnd()) {
+      WriteVarint(NODE_END, out_);
+      return WriteComments(node) && WriteTokenRef(end->value());
+    }
+    if (const FunctionCallNode* function_call = node->AsFunctionCall()) {
+      WriteVarint(NODE_FUNCTION_CALL, out_);
+      return WriteComments(node) && WriteTokenRef(function_call->function()) &&
+             WriteNode(function_call->args()) &&
+             WriteNode(function_call->block());
+    }
+    if (const IdentifierNode* identifier = node->AsIdentifier()) {
+      WriteVarint(NODE_IDENTIFIER, out_);
+      return WriteComments(node) && WriteTokenRef(identifier->value());
+    }
+    if (const ListNode* list = node->AsList()) {
+      WriteVarint(NODE_LIST, out_);
+      if (!WriteComments(node) || !WriteTokenRef(list->begin_token()))
+        return false;
+      WriteVarint(list->prefer_multiline() ? 1 : 0, out_);
+      if (!WriteNode(list->End()))
+        return false;
+      WriteVarint(list->contents().size(), out_);
+      for (const auto& item : list->contents()) {
+        if (!WriteNode(item.get()))
+          return false;
+      }
+      return true;
+    }
+    if (const LiteralNode* literal = node->AsLiteral()) {
+      WriteVarint(NODE_LITERAL, out_);
+      return WriteComments(node) && WriteTokenRef(literal->value());
+    }
+    if (const UnaryOpNode* unary_op = node->AsUnaryOp()) {
+      WriteVarint(NODE_UNARY_OP, out_);
+      return WriteComments(node) && WriteTokenRef(unary_op->op()) &&
+             WriteNode(unary_op->operand());
+    }
+
+    assert(false);  // Unknown node type.
+    return false;
+  }
+
+ private:
+  bool WriteToken(const Token& token) {
+    const Location& location = token.location();
+    const StringPiece& value = token.value();
+
+    uint64_t flags = 0;
+    if (!location.is_null()) {
+      if (location.file() != &file_ || location.line_number() < 0 ||
+          location.column_number() < 0 || location.byte() < 0)
+        return false;
+      flags |= kTokenHasLocation;
+    }
+    size_t offset = 0;
+    if (!value.empty()) {
+      // The value must be part of the contents.
+      if (value.data() < contents_.data() ||
+          value.data() + value.size() > contents_.data() + contents_.size())
+        return false;
+      offset = static_cast<size_t>(value.data() - contents_.data());
+      if ((flags & kTokenHasLocation) &&
+          offset == static_cast<size_t>(location.byte()))
+        flags |= kTokenValueAtLocation;
+    }
+
+    WriteVarint((static_cast<uint64_t>(token.type()) << kTokenFlagBits) | flags,
+                out_);
+    if (flags & kTokenHasLocation) {
+      // Lines and bytes are written relative to the previous location, which
+      // is usually close by.
+      WriteSignedVarint(location.line_number() - last_line_number_, out_);
+      WriteVarint(location.column_number(), out_);
+      WriteSignedVarint(location.byte() - last_byte_, out_);
+      last_line_number_ = location.line_number();
+      last_byte_ = location.byte();
+    }
+    WriteVarint(value.size(), out_);
+    if (!value.empty() && !(flags & kTokenValueAtLocation))
+      WriteVarint(offset, out_);
+    return true;
+  }
+
+  // Tokens in the parse tree are nearly always copies of ones in the token
+  // stream, so are written as (one more than) their index if possible.
+  bool WriteTokenRef(const Token& token) {
+    if (!token.value().empty()) {
+      auto found = token_indices_.find(token.value().data());
+      if (found != token_indices_.end()) {
+        const Token& other = file_.tokens()[found->second];
+        if (other.type() == token.type() &&
+            other.value().size() == token.value().size() &&
+            other.location() == token.location()) {
+          WriteVarint(found->second + 1, out_);
+          return true;
+        }
+      }
+    }
+    WriteVarint(0, out_);
+    return WriteToken(token);
+  }
+
+  bool WriteTokenRefs(const std::vector<Token>& tokens) {
+    WriteVarint(tokens.size(), out_);
+    for (const auto& token : tokens) {
+      if (!WriteTokenRef(token))
+        return false;
+    }
+    return true;
+  }
+
+  bool WriteComments(const ParseNode* node) {
+    const Comments* comments = node->comments();
+    if (!comments) {
+      WriteVarint(0, out_);
+      return true;
+    }
+    WriteVarint(1, out_);
+    return WriteTokenRefs(comments->before()) &&
+           WriteTokenRefs(comments->suffix()) &&
+           WriteTokenRefs(comments->after());
+  }
+
+  const InputFile& file_;
+  const std::string& contents_;
+  std::string* const out_;
+
+  // The previous location written.
+  int last_line_number_;
+  int last_byte_;
+
+  // Maps the start of each (nonempty) token's value to its index.
+  std::unordered_map<const char*, size_t> token_indices_;
+};
+
+class Deserializer {
+ public:
+  Deserializer(BinaryReader* reader, const InputFile* file)
+      : reader_(reader),
+        file_(file),
+        contents_(file->contents()),
+        last_line_number_(0),
+        last_byte_(0) {}
+  ~Deserializer() {}
+
+  Deserializer(const Deserializer&) = delete;
+  Deserializer& operator=(const Deserializer&) = delete;
+
+  bool ReadTokens() {
+    uint64_t count;
+    // Tokens are nonempty, so there can't be more of them than bytes.
+    if (!reader_->ReadVarint(contents_.size(), &count))
+      return false;
+    tokens_.reserve(static_cast<size_t>(count));
+    for (uint64_t i = 0; i < count; i++) {
+      Token token;
+      if (!ReadToken(&token))
+        return false;
+      tokens_.push_back(token);
+    }
+    return true;
+  }
+
+  std::vector<Token> TakeTokens() { return std::move(tokens_); }
+
+  // Reads a node, which must be of the given kind or null (if |allow_null|).
+  template <typename NodeType>
+  bool ReadNode(NodeKind kind,
+                bool allow_null,
+                std::unique_ptr<NodeType>* node) {
+    std::unique_ptr<ParseNode> generic_node;
+    NodeKind actual_kind;
+    if (!ReadNode(&actual_kind, &generic_node))
+      return false;
+    if (actual_kind == NODE_NULL)
+      return allow_null;
+    if (actual_kind != kind)
+      return false;
+    node->reset(static_cast<NodeType*>(generic_node.release()));
+    return true;
+  }
+
+  // Reads a node of any kind, which must not be null.
+  bool ReadNode(std::unique_ptr<ParseNode>* node) {
+    NodeKind kind;
+    return ReadNode(&kind, node) && kind != NODE_NULL;
+  }
+
+  // Reads a node of any kind, which may be null.
+  bool ReadOptionalNode(std::unique_ptr<ParseNode>* node) {
+    NodeKind kind;
+    return ReadNode(&kind, node);
+  }
+
+ private:
+  bool ReadNode(NodeKind* kind, std::unique_ptr<ParseNode>* node) {
+    uint64_t kind_value;
+    if (!reader_->ReadVarint(NUM_NODE_KINDS - 1, &kind_value))
+      return false;
+    *kind = static_cast<NodeKind>(kind_value);
+    if (*kind == NODE_NULL)
+      return true;
+
+    // Read the comments first, but attach them once the node is created.
+    bool has_comments;
+    std::vector<Token> before;
+    std::vector<Token> suffix;
+    std::vector<Token> after;
+    if (!ReadComments(&has_comments, &before, &suffix, &after))
+      return false;
+
+    Token token;
+    switch (*kind) {
+      case NODE_ACCESSOR: {
+        std::unique_ptr<AccessorNode> accessor(new AccessorNode);
+        std::unique_ptr<ParseNode> index;
+        std::unique_ptr<IdentifierNode> member;
+        if (!ReadTokenRef(&token) || !ReadOptionalNode(&index) ||
+            !ReadNode(NODE_IDENTIFIER, true, &member))
+          return false;
+        accessor->set_base(token);
+        accessor->set_index(std::move(index));
+        accessor->set_member(std::move(member));
+        *node = std::move(accessor);
+        break;
+      }
+      case NODE_BINARY_OP: {
+        std::unique_ptr<BinaryOpNode> binary_op(new BinaryOpNode);
+        std::unique_ptr<ParseNode> left;
+        std::unique_ptr<ParseNode> right;
+        if (!ReadTokenRef(&token) || !ReadNode(&left) || !ReadNode(&right))
+          return false;
+        binary_op->set_op(token);
+        binary_op->set_left(std::move(left));
+        binary_op->set_right(std::move(right));
+        *node = std::move(binary_op);
+        break;
+      }
+      case NODE_BLOCK: {
+        uint64_t result_mode;
+        std::unique_ptr<EndNode> end;
+        uint64_t count;
+        if (!reader_->ReadVarint(BlockNode::DISCARDS_RESULT, &result_mode) ||
+            !ReadTokenRef(&token) || !ReadNode(NODE_END, true, &end) ||
+            !reader_->ReadVarint(&count))
+          return false;
+        std::unique_ptr<BlockNode> block(
+            new BlockNode(static_cast<BlockNode::ResultMode>(result_mode)));
+        block->set_begin_token(token);
+        block->set_end(std::move(end));
+        for (uint64_t i = 0; i < count; i++) {
+          std::unique_ptr<ParseNode> statement;
+          if (!ReadNode(&statement))
+            return false;
+          block->append_statement(std::move(statement));
+        }
+        *node = std::move(block);
+        break;
+      }
+      case NODE_BLOCK_COMMENT: {
+        std::unique_ptr<BlockCommentNode> block_comment(new BlockCommentNode);
+        if (!ReadTokenRef(&token))
+          return false;
+        block_comment->set_comment(token);
+        *node = std::move(block_comment);
+        break;
+      }
+      case NODE_CONDITION: {
+        std::unique_ptr<ConditionNode> condition(new ConditionNode);
+        std::unique_ptr<ParseNode> condition_expr;
+        std::unique_ptr<BlockNode> if_true;
+        std::unique_ptr<ParseNode> if_false;
+        if (!ReadTokenRef(&token) || !ReadNode(&condition_expr) ||
+            !ReadNode(NODE_BLOCK, false, &if_true) ||
+            !ReadOptionalNode(&if_false))
+          return false;
+        condition->set_if_token(token);
+        condition->set_condition(std::move(condition_expr));
+        condition->set_if_true(std::move(if_true));
+        condition->set_if_false(std::move(if_false));
+        *node = std::move(condition);
+        break;
+      }
+      case NODE_END: {
+        if (!ReadTokenRef(&token))
+          return false;
+        // TODO(C++14): Use std::make_unique.
+        node->reset(new EndNode(token));
+        break;
+      }
+      case NODE_FUNCTION_CALL: {
+        std::unique_ptr<FunctionCallNode> function_call(new FunctionCallNode);
+        std::unique_ptr<ListNode> args;
+        std::unique_ptr<BlockNode> block;
+        if (!ReadTokenRef(&token) || !ReadNode(NODE_LIST, false, &args) ||
+            !ReadNode(NODE_BLOCK, true, &block))
+          return false;
+        function_call->set_function(token);
+        function_call->set_args(std::move(args));
+        function_call->set_block(std::move(block));
+        *node = std::move(function_call);
+        break;
+      }
+      case NODE_IDENTIFIER: {
+        if (!ReadTokenRef(&token))
+          return false;
+        // TODO(C++14): Use std::make_unique.
+        node->reset(new IdentifierNode(token));
+        break;
+      }
+      case NODE_LIST: {
+        std::unique_ptr<ListNode> list(new ListNode);
+        uint64_t prefer_multiline;
+        std::unique_ptr<EndNode> end;
+        uint64_t count;
+        if (!ReadTokenRef(&token) || !reader_->ReadVarint(1, &prefer_multiline) ||
+            !ReadNode(NODE_END, true, &end) || !reader_->ReadVarint(&count))
+          return false;
+        list->set_begin_token(token);
+        list->set_prefer_multiline(prefer_multiline != 0);
+        list->set_end(std::move(end));
+        for (uint64_t i = 0; i < count; i++) {
+          std::unique_ptr<ParseNode> item;
+          if (!ReadNode(&item))
+            return false;
+          list->append_item(std::move(item));
+        }
+        *node = std::move(list);
+        break;
+      }
+      case NODE_LITERAL: {
+        if (!ReadTokenRef(&token))
+          return false;
+        // TODO(C++14): Use std::make_unique.
+        node->reset(new LiteralNode(token));
+        break;
+      }
+      case NODE_UNARY_OP: {
+        std::unique_ptr<UnaryOpNode> unary_op(new UnaryOpNode);
+        std::unique_ptr<ParseNode> operand;
+        if (!ReadTokenRef(&token) || !ReadNode(&operand))
+          return false;
+        unary_op->set_op(token);
+        unary_op->set_operand(std::move(operand));
+        *node = std::move(unary_op);
+        break;
+      }
+      default:
+        return false;
+    }
+
+    if (has_comments) {
+      Comments* comments = (*node)->comments_mutable();
+      for (const auto& t : before)
+        comments->append_before(t);
+      for (const auto& t : suffix)
+        comments->append_suffix(t);
+      for (const auto& t : after)
+        comments->append_after(t);
+    }
+    return true;
+  }
+
+  bool ReadToken(Token* token) {
+    uint64_t type_and_flags;
+    if (!reader_->ReadVarint(&type_and_flags))
+      return false;
+    uint64_t type = type_and_flags >> kTokenFlagBits;
+    uint64_t flags = type_and_flags & ((1 << kTokenFlagBits) - 1);
+    if (type >= Token::NUM_TYPES ||
+        ((flags & kTokenValueAtLocation) && !(flags & kTokenHasLocation)))
+      return false;
+
+    Location location;
+    if (flags & kTokenHasLocation) {
+      int column_number;
+      if (!reader_->ReadIntDelta(&last_line_number_) ||
+          !reader_->ReadInt(&column_number) ||
+          !reader_->ReadIntDelta(&last_byte_))
+        return false;
+      if (static_cast<size_t>(last_byte_) > contents_.size())
+        return false;
+      location = Location(file_, last_line_number_, column_number, last_byte_);
+    }
+
+    uint64_t size;
+    if (!reader_->ReadVarint(contents_.size(), &size))
+      return false;
+    StringPiece value;
+    if (size) {
+      uint64_t offset;
+      if (flags & kTokenValueAtLocation)
+        offset = static_cast<uint64_t>(location.byte());
+      else if (!reader_->ReadVarint(contents_.size(), &offset))
+        return false;
+      if (offset > contents_.size() || size > contents_.size() - offset)
+        return false;
+      value = StringPiece(contents_.data() + offset, static_cast<size_t>(size));
+    }
+
+    *token = Token(location, static_cast<Token::Type>(type), value);
+    return true;
+  }
+
+  bool ReadTokenRef(Token* token) {
+    uint64_t index;
+    if (!reader_->ReadVarint(tokens_.size(), &index))
+      return false;
+    if (!index)
+      return ReadToken(token);
+    *token = tokens_[static_cast<size_t>(index - 1)];
+    return true;
+  }
+
+  bool ReadTokenRefs(std::vector<Token>* tokens) {
+    uint64_t count;
+    if (!reader_->ReadVarint(&count))
+      return false;
+    for (uint64_t i = 0; i < count; i++) {
+      Token token;
+      if (!ReadTokenRef(&token))
+        return false;
+      tokens->push_back(token);
+    }
+    return true;
+  }
+
+  bool ReadComments(bool* has_comments,
+                    std::vector<Token>* before,
+                    std::vector<Token>* suffix,
+                    std::vector<Token>* after) {
+    uint64_t value;
+    if (!reader_->ReadVarint(1, &value))
+      return false;
+    *has_comments = value != 0;
+    if (!*has_comments)
+      return true;
+    return ReadTokenRefs(before) && ReadTokenRefs(suffix) &&
+           ReadTokenRefs(after);
+  }
+
+  BinaryReader* const reader_;
+  const InputFile* const file_;
+  const std::string& contents_;
+
+  // The previous location read.
+  int last_line_number_;
+  int last_byte_;
+
+  std::vector<Token> tokens_;
+};
+
+}  // namespace
+
+ParseCache::ParseCache(const std::string& dir) : dir_(dir) {}
+
+ParseCache::~ParseCache() = default;
+
+bool ParseCache::Load(InputFile* file) const {
+  std::string data;
+  return ReadFileToString(GetPath(file->contents()), &data) &&
+         Deserialize(data, file);
+}
+
+void ParseCache::Store(const InputFile& file) const {
+  std::string data;
+  if (Serialize(file, &data))
+    WriteFileAtomically(GetPath(file.contents()), data);
+}
+
+// static
+uint64_t ParseCache::HashContents(const StringPiece& contents) {
+  return HashBytes(contents);
+}
+
+// static
+bool ParseCache::Serialize(const InputFile& file, std::string* data) {
+  assert(!file.err().has_error());
+  assert(file.root_parse_node());
+
+  // Header.
+  data->clear();
+  data->append(kMagic, sizeof(kMagic));
+  WriteVarint(kFormatVersion, data);
+  // The whole contents, since the hash that names the entry may collide.
+  WriteString(file.contents(), data);
+
+  Serializer serializer(file, data);
+  if (!serializer.WriteTokens() ||
+      !serializer.WriteNode(file.root_parse_node())) {
+    data->clear();
+    return false;
+  }
+
+  AppendChecksum(data);
+  return true;
+}
+
+// static
+bool ParseCache::Deserialize(const StringPiece& data, InputFile* file) {
+  StringPiece body;
+  if (!BinaryReader::StripChecksum(data, &body))
+    return false;
+
+  BinaryReader reader(body);
+  StringPiece magic;
+  uint64_t version;
+  StringPiece contents;
+  if (!reader.ReadBytes(sizeof(kMagic), &magic) ||
+      magic != StringPiece(kMagic, sizeof(kMagic)) ||
+      !reader.ReadVarint(&version) || version != kFormatVersion ||
+      !reader.ReadString(&contents) || contents != file->contents())
+    return false;
+
+  Deserializer deserializer(&reader, file);
+  std::unique_ptr<ParseNode> root_parse_node;
+  if (!deserializer.ReadTokens() || !deserializer.ReadNode(&root_parse_node) ||
+      !reader.at_end())
+    return false;
+
+  file->SetTokens(deserializer.TakeTokens());
+  file->SetRootParseNode(std::move(root_parse_node));
+  return true;
+}
+
+std::string ParseCache::GetPath(const std::string& contents) const {
+  char name[64];
+  snprintf(name, sizeof(name), "%016llx-v%llu",
+           static_cast<unsigned long long>(HashContents(contents)),
+           static_cast<unsigned long long>(kFormatVersion));
+  return dir_ + "/" + name + kEntrySuffix;
+}
+
+}  // namespace icl
@@ -0,0 +1,72 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_PARSE_CACHE_H_
+#define ICL_PARSE_CACHE_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "icl/string_piece.h"
+
+namespace icl {
+
+class InputFile;
+
+// An on-disk cache of the results of tokenizing and parsing input files, so
+// that later runs needn't tokenize and parse files that haven't changed.
+//
+// Each entry holds a compact serialization of a file's tokens and parse tree
+// (tokens refer to the file's contents by offset), and is named by a hash of
+// the file's contents and the format version. So entries never need to be
+// invalidated (an edited file simply has a different entry), and the cache
+// directory may be shared by processes (even different versions). Entries are
+// validated when read, and invalid ones are ignored. Each entry also holds the
+// contents it was made from, which must match exactly, so files whose hashes
+// collide just overwrite each other's entry.
+//
+// Thread safety: This class is thread-safe. Entries are written to a
+// temporary file which is then renamed, so concurrent writers are safe.
+class ParseCache {
+ public:
+  // |dir| must be an existing directory.
+  explicit ParseCache(const std::string& dir);
+  ~ParseCache();
+
+  ParseCache(const ParseCache&) = delete;
+  ParseCache& operator=(const ParseCache&) = delete;
+
+  // Sets the tokens and root parse node of |file| (whose contents must be set)
+  // from the cache, and returns true. Returns false if there's no valid entry,
+  // in which case |file| isn't modified.
+  bool Load(InputFile* file) const;
+
+  // Stores the tokens and parse tree of |file|, which must have been
+  // successfully loaded. Failures (e.g., to write the entry) are ignored.
+  void Store(const InputFile& file) const;
+
+  // Returns the (64-bit FNV-1a) hash of |contents| used to name entries.
+  static uint64_t HashContents(const StringPiece& contents);
+
+  // Serializes the tokens and parse tree of |file|, which must have been
+  // successfully loaded, to |*data|. Returns false if |file| can't be
+  // serialized (which shouldn't happen for a file loaded by |LoadFile()|).
+  static bool Serialize(const InputFile& file, std::string* data);
+
+  // Does the opposite of |Serialize()|, for a |file| with the same contents
+  // (and no tokens or parse tree yet). Returns false if |data| isn't valid,
+  // in which case |file| isn't modified.
+  static bool Deserialize(const StringPiece& data, InputFile* file);
+
+ private:
+  // Gets the path of the entry for the given contents.
+  std::string GetPath(const std::string& contents) const;
+
+  const std::string dir_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_PARSE_CACHE_H_
@@ -0,0 +1,161 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/parse_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include "icl/input_file.h"
+#include "icl/load_file.h"
+#include "icl/location.h"
+#include "icl/parse_tree.h"
+#include "icl/scoped_temp_dir.h"
+#include "icl/source_file.h"
+#include "icl/test_with_scope.h"
+
+namespace icl {
+namespace {
+
+const char kInput[] =
+    "# Copyright header.\n"
+    "\n"
+    "a = 1  # Suffix comment.\n"
+    "b = [\n"
+    "  \"foo\",\n"
+    "  \"bar\",  # Another.\n"
+    "]\n"
+    "if (a == 1 && !false) {\n"
+    "  c = b[1]\n"
+    "} else if (a > 2) {\n"
+    "  c = -a\n"
+    "} else {\n"
+    "  c = \"$a\"\n"
+    "}\n"
+    "# Block comment.\n"
+    "\n"
+    "print(c)\n";
+
+bool Load(const std::string& contents,
+          const ParseCache* parse_cache,
+          InputFile* file) {
+  return LoadFile(
+      [&contents](const SourceFile&, std::string* result) {
+        *result = contents;
+        return true;
+      },
+      LocationRange(), file->name(), parse_cache, file);
+}
+
+std::string Print(const ParseNode* node) {
+  std::ostringstream out;
+  node->Print(out, 0);
+  return out.str();
+}
+
+void ExpectSameTokens(const InputFile& expected, const InputFile& actual) {
+  ASSERT_EQ(expected.tokens().size(), actual.tokens().size());
+  for (size_t i = 0; i < expected.tokens().size(); i++) {
+    const Token& e = expected.tokens()[i];
+    const Token& a = actual.tokens()[i];
+    EXPECT_EQ(e.type(), a.type());
+    EXPECT_EQ(e.value(), a.value());
+    // The value should refer to the file's contents.
+    EXPECT_EQ(e.value().data() - expected.contents().data(),
+              a.value().data() - actual.contents().data());
+    EXPECT_EQ(&actual, a.location().file());
+    EXPECT_EQ(e.location().line_number(), a.location().line_number());
+    EXPECT_EQ(e.location().column_number(), a.location().column_number());
+    EXPECT_EQ(e.location().byte(), a.location().byte());
+  }
+}
+
+TEST(ParseCache, RoundTrip) {
+  InputFile expected(SourceFile("//test.icl"));
+  ASSERT_TRUE(Load(kInput, nullptr, &expected));
+
+  std::string data;
+  ASSERT_TRUE(ParseCache::Serialize(expected, &data));
+
+  InputFile actual(SourceFile("//test.icl"));
+  actual.SetContents(kInput);
+  ASSERT_TRUE(ParseCache::Deserialize(data, &actual));
+  ExpectSameTokens(expected, actual);
+  EXPECT_EQ(Print(expected.root_parse_node()),
+            Print(actual.root_parse_node()));
+}
+
+TEST(ParseCache, RejectsInvalidData) {
+  InputFile original(SourceFile("//test.icl"));
+  ASSERT_TRUE(Load(kInput, nullptr, &original));
+  std::string data;
+  ASSERT_TRUE(ParseCache::Serialize(original, &data));
+
+  // Different contents.
+  {
+    InputFile file(SourceFile("//test.icl"));
+    file.SetContents(std::string(kInput) + "\n");
+    EXPECT_FALSE(ParseCache::Deserialize(data, &file));
+  }
+
+  // Different contents of the same size (as for an entry whose name collides).
+  {
+    std::string contents = kInput;
+    contents[contents.find("a = 1")] = 'z';
+    InputFile file(SourceFile("//test.icl"));
+    file.SetContents(std::move(contents));
+    EXPECT_FALSE(ParseCache::Deserialize(data, &file));
+  }
+
+  // Corrupted or truncated data.
+  for (size_t i = 0; i < data.size(); i += 7) {
+    std::string corrupted = data;
+    corrupted[i] ^= 0x10;
+    InputFile file(SourceFile("//test.icl"));
+    file.SetContents(kInput);
+    EXPECT_FALSE(ParseCache::Deserialize(corrupted, &file));
+    EXPECT_FALSE(ParseCache::Deserialize(data.substr(0, i), &file));
+  }
+}
+
+TEST(ParseCache, LoadFile) {
+  ScopedTempDir dir;
+  ParseCache parse_cache(dir.path());
+  const std::string contents = kInput;
+
+  {
+    InputFile file(SourceFile("//test.icl"));
+    file.SetContents(std::string(contents));
+    EXPECT_FALSE(parse_cache.Load(&file));
+  }
+
+  // Loading normally stores an entry.
+  InputFile expected(SourceFile("//test.icl"));
+  ASSERT_TRUE(Load(contents, &parse_cache, &expected));
+  {
+    InputFile file(SourceFile("//test.icl"));
+    file.SetContents(std::string(contents));
+    EXPECT_TRUE(parse_cache.Load(&file));
+  }
+
+  // Which is then used by later loads.
+  InputFile actual(SourceFile("//test.icl"));
+  ASSERT_TRUE(Load(contents, &parse_cache, &actual));
+  ExpectSameTokens(expected, actual);
+  EXPECT_EQ(Print(expected.root_parse_node()),
+            Print(actual.root_parse_node()));
+
+  // And the result can be run.
+  TestWithScope setup;
+  Err err;
+  actual.root_parse_node()->Execute(setup.scope(), &err);
+  ASSERT_FALSE(err.has_error()) << err.GetErrorMessage();
+  EXPECT_EQ("bar\n", setup.print_output());
+}
+
+}  // namespace
+}  // namespace icl
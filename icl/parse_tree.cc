@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <string>
 
+#include "icl/evaluation_budget.h"
 #include "icl/function.h"
 #include "icl/operators.h"
 #include "icl/scope.h"
@@ -291,6 +292,7 @@ Value BlockNode::Execute(Scope* enclosing_scope, Err* err) const {
     execution_scope = enclosing_scope;
   }
 
+  EvaluationBudget* budget = EvaluationBudget::current();
   for (size_t i = 0; i < statements_.size() && !err->has_error(); i++) {
     // Check for trying to execute things with no side effects in a block.
     //
@@ -308,6 +310,8 @@ Value BlockNode::Execute(Scope* enclosing_scope, Err* err) const {
           "Either delete it or do something with the result.");
       return Value();
     }
+    if (budget && !budget->Step(cur, err))
+      break;
     cur->Execute(execution_scope, err);
   }
 
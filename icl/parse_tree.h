@@ -11,6 +11,7 @@
 #include <utility>
 #include <vector>
 
+#include "icl/allocator.h"
 #include "icl/err.h"
 #include "icl/token.h"
 #include "icl/value.h"
@@ -75,6 +76,14 @@ class ParseNode {
   ParseNode(const ParseNode&) = delete;
   ParseNode& operator=(const ParseNode&) = delete;
 
+  // Allocated with the current |Allocator|.
+  static void* operator new(size_t size) {
+    return Allocator::AllocateObject(size, Allocator::PARSE_NODE);
+  }
+  static void operator delete(void* ptr, size_t size) {
+    Allocator::FreeObject(ptr, size, Allocator::PARSE_NODE);
+  }
+
   virtual const AccessorNode* AsAccessor() const;
   virtual const BinaryOpNode* AsBinaryOp() const;
   virtual const BlockCommentNode* AsBlockComment() const;
@@ -251,6 +260,7 @@ class BlockNode : public ParseNode {
       const std::string& help = std::string()) const override;
   void Print(std::ostream& out, int indent) const override;
 
+  const Token& begin_token() const { return begin_token_; }
   void set_begin_token(const Token& t) { begin_token_ = t; }
   void set_end(std::unique_ptr<EndNode> e) { end_ = std::move(e); }
   const EndNode* End() const { return end_.get(); }
@@ -293,6 +303,7 @@ class ConditionNode : public ParseNode {
       const std::string& help = std::string()) const override;
   void Print(std::ostream& out, int indent) const override;
 
+  const Token& if_token() const { return if_token_; }
   void set_if_token(const Token& token) { if_token_ = token; }
 
   const ParseNode* condition() const { return condition_.get(); }
@@ -396,6 +407,7 @@ class ListNode : public ParseNode {
       const std::string& help = std::string()) const override;
   void Print(std::ostream& out, int indent) const override;
 
+  const Token& begin_token() const { return begin_token_; }
   void set_begin_token(const Token& t) { begin_token_ = t; }
   void set_end(std::unique_ptr<EndNode> e) { end_ = std::move(e); }
   const EndNode* End() const { return end_.get(); }
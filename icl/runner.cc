@@ -6,11 +6,16 @@
 
 #include <assert.h>
 
+#include <limits>
 #include <memory>
 #include <utility>
 
+#include "icl/allocator.h"
+#include "icl/base_config.h"
 #include "icl/delegate.h"
 #include "icl/err.h"
+#include "icl/evaluation_context.h"
+#include "icl/import_manager.h"
 #include "icl/input_file.h"
 #include "icl/item.h"
 #include "icl/load_file.h"
@@ -18,7 +23,9 @@
 #include "icl/parser.h"
 #include "icl/scope.h"
 #include "icl/source_file.h"
+#include "icl/thread_pool.h"
 #include "icl/tokenizer.h"
+#include "icl/tracer.h"
 
 namespace icl {
 
@@ -27,37 +34,100 @@ Runner::RunResult::RunResult(RunResult&&) = default;
 Runner::RunResult::~RunResult() = default;
 Runner::RunResult& Runner::RunResult::operator=(RunResult&&) = default;
 
-Runner::Runner(Delegate* delegate) : delegate_(delegate) {}
+Runner::Runner(Delegate* delegate)
+    : delegate_(delegate),
+      tracer_(nullptr),
+      item_sink_(nullptr),
+      base_config_(nullptr),
+      template_cache_(nullptr) {}
 
 Runner::~Runner() = default;
 
 Runner::RunResult Runner::Run(const SourceFile& name) {
   RunResult result;
 
+  // What the run doesn't set up itself is left as the caller's.
+  EvaluationContext context = EvaluationContext::current();
+  std::unique_ptr<EvaluationBudget> budget;
+  if (!limits_.is_unlimited()) {
+    // TODO(C++14): Use std::make_unique.
+    budget.reset(new EvaluationBudget(limits_));
+    context.budget = budget.get();
+  }
+  if (Tracer* tracer = tracer_ ? tracer_ : delegate_->GetTracer())
+    context.tracer = tracer;
+  if (Allocator* allocator = delegate_->GetAllocator())
+    context.allocator = allocator;
+  if (template_cache_)
+    context.template_cache = template_cache_;
+
+  // A limit on memory needs the allocations counted.
+  std::unique_ptr<StatsRecorder> stats_recorder;
+  if (delegate_->ShouldCollectStats() ||
+      limits_.max_cumulative_allocated_bytes !=
+          std::numeric_limits<uint64_t>::max()) {
+    // TODO(C++14): Use std::make_unique.
+    stats_recorder.reset(new StatsRecorder);
+    context.stats_recorder = stats_recorder.get();
+  }
+
+  {
+    EvaluationContext::Scoped scoped_context(context);
+    DoRun(name, &result);
+  }
+  if (stats_recorder)
+    result.stats_ = stats_recorder->GetStats();
+  return result;
+}
+
+std::vector<Runner::RunResult> Runner::RunMany(
+    const std::vector<SourceFile>& names,
+    ThreadPool* pool) {
+  std::vector<RunResult> results(names.size());
+  pool->ParallelFor(names.size(),
+                    [this, &names, &results](size_t i) {
+                      results[i] = Run(names[i]);
+                    });
+  return results;
+}
+
+void Runner::DoRun(const SourceFile& name, RunResult* result) {
+  Tracer::Span span("run", name.value(), name);
+
   LocationRange no_origin;
   const InputFile* file = nullptr;
   if (!delegate_->GetInputFile(no_origin, name, &file)) {
     assert(file);
     assert(file->err().has_error());
-    result.error_message_ = file->err().GetErrorMessage();
-    return result;
+    result->error_message_ = file->err().GetErrorMessage();
+    return;
   }
   assert(file);
   assert(!file->err().has_error());
 
-  Scope scope(delegate_);
-  scope.set_source_dir(name.GetDir());
-  scope.set_item_collector(&result.items_);
+  ItemVectorSink default_item_sink(&result->items_);
+  std::unique_ptr<Scope> scope(base_config_ ? new Scope(base_config_->scope())
+                                            : new Scope(delegate_));
+  scope->set_source_dir(name.GetDir());
+  scope->set_item_collector(item_sink_ ? item_sink_ : &default_item_sink);
 
   Err err;
-  file->root_parse_node()->Execute(&scope, &err);
+  {
+    ImportManager::Recorder recorder(scope.get());
+    file->root_parse_node()->Execute(scope.get(), &err);
+    result->deps_ = recorder.deps();
+  }
+  if (base_config_) {
+    result->deps_.insert(base_config_->name());
+    result->deps_.insert(base_config_->deps().begin(),
+                         base_config_->deps().end());
+  }
   if (err.has_error()) {
-    result.error_message_ = err.GetErrorMessage();
-    return result;
+    result->error_message_ = err.GetErrorMessage();
+    return;
   }
 
-  result.is_success_ = true;
-  return result;
+  result->is_success_ = true;
 }
 
 }  // namespace icl
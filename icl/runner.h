@@ -6,14 +6,24 @@
 #define ICL_RUNNER_H_
 
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
+#include "icl/evaluation_budget.h"
+#include "icl/evaluation_stats.h"
+#include "icl/source_file.h"
+
 namespace icl {
 
+class BaseConfig;
 class Delegate;
+class IncrementalRunner;
 class Item;
-class SourceFile;
+class ItemSink;
+class TemplateCache;
+class ThreadPool;
+class Tracer;
 
 class Runner {
  public:
@@ -35,14 +45,25 @@ class Runner {
 
     bool is_success() const { return is_success_; }
     const std::string& error_message() const { return error_message_; }
+    // The items defined, unless they were passed to the runner's item sink.
     const ItemVector& items() const { return items_; }
+    // The files that were (transitively) imported, even on failure, and the
+    // base config's file and imports, if any.
+    const std::set<SourceFile>& deps() const { return deps_; }
+    // What evaluation cost, if the delegate collects stats (see
+    // |Delegate::ShouldCollectStats()|) or memory is limited. Work done for
+    // imports that were already done by earlier runs isn't included.
+    const EvaluationStats& stats() const { return stats_; }
 
    private:
+    friend class IncrementalRunner;
     friend class Runner;
 
     bool is_success_ = false;
     std::string error_message_;
     ItemVector items_;
+    std::set<SourceFile> deps_;
+    EvaluationStats stats_;
   };
 
   explicit Runner(Delegate* delegate);
@@ -51,10 +72,56 @@ class Runner {
   Runner(const Runner&) = delete;
   Runner& operator=(const Runner&) = delete;
 
+  // Limits the evaluation of each root file (and what it imports) that's run
+  // (see |EvaluationBudget|), counting from when the run starts (so the timeout
+  // covers loading the root file). The default is unlimited.
+  void set_limits(const EvaluationBudget::Limits& limits) { limits_ = limits; }
+
+  // Records each run (including loading the files) with |tracer| (see
+  // |Tracer|), which must outlive the runs. If null (the default), runs are
+  // recorded with the delegate's tracer, if any.
+  void set_tracer(Tracer* tracer) { tracer_ = tracer; }
+
+  // Passes the items of each run to |sink| as they're defined, rather than
+  // collecting them in |RunResult::items()|, so that they can be processed
+  // while the run goes on. A run that fails may already have passed some items
+  // to the sink. The sink must outlive the runs, and (for |RunMany()|) be
+  // thread-safe. If null (the default), the items are collected.
+  void set_item_sink(ItemSink* sink) { item_sink_ = sink; }
+
+  // Runs each root file in the (const) scope of |base_config|, so that the
+  // base file's values, templates and target defaults are shared rather than
+  // imported by every root. It must have been prepared with the same delegate.
+  // If null (the default), roots start from an empty scope.
+  void set_base_config(const BaseConfig* base_config) {
+    base_config_ = base_config;
+  }
+
+  // Memoizes the invocations of pure templates with |cache| (see
+  // |TemplateCache|), so that they're shared by the runs (and by later runs
+  // with the same cache). The cache must outlive the runs. If null (the
+  // default), templates are always run.
+  void set_template_cache(TemplateCache* cache) { template_cache_ = cache; }
+
   RunResult Run(const SourceFile& name);
 
+  // Runs each of the given root files (like |Run()|) in parallel on |pool|,
+  // returning their results in the same order. The delegate (and so its
+  // |InputFileManager| and |ImportManager|) is shared by all the runs, so it
+  // must be thread-safe.
+  std::vector<RunResult> RunMany(const std::vector<SourceFile>& names,
+                                 ThreadPool* pool);
+
  private:
+  // Does the work of |Run()|, with the run's |EvaluationContext| installed.
+  void DoRun(const SourceFile& name, RunResult* result);
+
   Delegate* const delegate_;
+  EvaluationBudget::Limits limits_;
+  Tracer* tracer_;
+  ItemSink* item_sink_;
+  const BaseConfig* base_config_;
+  TemplateCache* template_cache_;
 };
 
 }  // namespace icl
@@ -0,0 +1,89 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/runner.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "icl/source_file.h"
+#include "icl/test_delegate.h"
+#include "icl/thread_pool.h"
+
+namespace icl {
+namespace {
+
+const int kRootCount = 2000;
+
+// Adds generated files to |delegate|: roots that import a shared file and make
+// a number of items (varying, so that the work is uneven). Returns the roots.
+std::vector<SourceFile> AddFiles(TestDelegate* delegate) {
+  std::map<std::string, std::string>& files = delegate->files();
+  files["//common.gni"] =
+      "values = []\n"
+      "foreach(i, [0, 1, 2, 3, 4, 5, 6, 7, 8, 9]) {\n"
+      "  values += [ \"value$i\" ]\n"
+      "}\n";
+  std::vector<SourceFile> roots;
+  for (int i = 0; i < kRootCount; i++) {
+    std::string items;
+    for (int j = 0; j < 5 + i % 20; j++)
+      items += std::to_string(j) + ", ";
+    std::string name = "//root" + std::to_string(i) + ".icl";
+    files[name] =
+        "import(\"//common.gni\")\n"
+        "foreach(j, [" + items + "]) {\n"
+        "  bag(\"item$j\") {\n"
+        "    value = values\n"
+        "    other = \"$j: ${values[1]}\"\n"
+        "  }\n"
+        "}\n";
+    roots.push_back(SourceFile(std::move(name)));
+  }
+  return roots;
+}
+
+TEST(RunnerPerfTest, RunManyScaling) {
+  TestDelegate delegate;
+  const std::vector<SourceFile> roots = AddFiles(&delegate);
+  Runner runner(&delegate);
+
+  // Load (and import) everything first, so that only running is measured.
+  {
+    ThreadPool pool(0);
+    for (const auto& result : runner.RunMany(roots, &pool))
+      ASSERT_TRUE(result.is_success()) << result.error_message();
+  }
+
+  // Powers of two, up to the number of cores.
+  std::vector<int> thread_counts;
+  int max_threads = ThreadPool::GetHardwareThreadCount();
+  for (int thread_count = 1; thread_count < max_threads; thread_count *= 2)
+    thread_counts.push_back(thread_count);
+  thread_counts.push_back(max_threads);
+
+  double base_seconds = 0;
+  for (int thread_count : thread_counts) {
+    ThreadPool pool(thread_count - 1);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Runner::RunResult> results = runner.RunMany(roots, &pool);
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start).count();
+    ASSERT_EQ(roots.size(), results.size());
+    if (thread_count == 1)
+      base_seconds = seconds;
+    printf("RunMany %3d threads: %8.1f us/root, %5.2fx\n", thread_count,
+           seconds * 1e6 / kRootCount, base_seconds / seconds);
+  }
+}
+
+}  // namespace
+}  // namespace icl
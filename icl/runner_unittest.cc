@@ -0,0 +1,568 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/runner.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "icl/allocator.h"
+#include "icl/base_config.h"
+#include "icl/evaluation_budget.h"
+#include "icl/item_impls.h"
+#include "icl/scope.h"
+#include "icl/source_file.h"
+#include "icl/template_cache.h"
+#include "icl/test_delegate.h"
+#include "icl/thread_pool.h"
+#include "icl/tracer.h"
+
+namespace icl {
+namespace {
+
+// A (thread-safe) allocator that counts the objects it has allocated.
+class CountingAllocator : public Allocator {
+ public:
+  CountingAllocator() : allocations_(0), live_count_(0) {}
+  ~CountingAllocator() override {}
+
+  size_t allocations() const { return allocations_.load(); }
+  size_t live_count() const { return live_count_.load(); }
+
+  // |Allocator| methods:
+  void* Allocate(size_t size, Category category) override {
+    allocations_++;
+    live_count_++;
+    return ::operator new(size);
+  }
+  void Free(void* ptr, size_t size, Category category) override {
+    live_count_--;
+    ::operator delete(ptr);
+  }
+
+ private:
+  std::atomic<size_t> allocations_;
+  std::atomic<size_t> live_count_;
+};
+
+// A (thread-safe) sink that keeps the names of the (bag) items it's passed.
+class NameSink : public ItemSink {
+ public:
+  NameSink() {}
+  ~NameSink() override {}
+
+  std::vector<std::string> names() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return names_;
+  }
+
+  // |ItemSink| methods:
+  void AddItem(std::unique_ptr<Item> item) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    names_.push_back(static_cast<const BagItem*>(item.get())->name());
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  std::vector<std::string> names_;
+};
+
+// Returns the names of the given (bag) items.
+std::vector<std::string> GetNames(const Runner::RunResult::ItemVector& items) {
+  std::vector<std::string> names;
+  for (const auto& item : items)
+    names.push_back(static_cast<const BagItem*>(item.get())->name());
+  return names;
+}
+
+TEST(Runner, RunMany) {
+  const int kRootCount = 200;
+  TestDelegate delegate;
+  delegate.files()["//common.gni"] = "x = 1\n";
+  std::vector<SourceFile> names;
+  for (int i = 0; i < kRootCount; i++) {
+    std::string name = "//root" + std::to_string(i) + ".icl";
+    names.push_back(SourceFile(std::string(name)));
+    // Every tenth root fails.
+    delegate.files()[name] =
+        "import(\"//common.gni\")\n"
+        "bag(\"item" + std::to_string(i) + "\") {\n" +
+        (i % 10 == 9 ? "  value = undefined\n" : "  value = x\n") + "}\n";
+  }
+  names.push_back(SourceFile("//missing.icl"));
+
+  Runner runner(&delegate);
+  ThreadPool pool(3);
+  std::vector<Runner::RunResult> results = runner.RunMany(names, &pool);
+  ASSERT_EQ(names.size(), results.size());
+  for (int i = 0; i < kRootCount; i++) {
+    const Runner::RunResult& result = results[i];
+    EXPECT_EQ(std::set<SourceFile>({SourceFile("//common.gni")}),
+              result.deps());
+    if (i % 10 == 9) {
+      EXPECT_FALSE(result.is_success());
+      continue;
+    }
+    EXPECT_TRUE(result.is_success()) << result.error_message();
+    ASSERT_EQ(1u, result.items().size());
+    EXPECT_EQ("item" + std::to_string(i),
+              static_cast<const BagItem*>(result.items()[0].get())->name());
+  }
+  EXPECT_FALSE(results.back().is_success());
+  EXPECT_NE(std::string::npos,
+            results.back().error_message().find("//missing.icl"));
+}
+
+TEST(Runner, ParallelForEach) {
+  TestDelegate delegate;
+  ThreadPool pool(3);
+  delegate.set_thread_pool(&pool);
+  delegate.files()["//common.gni"] = "x = 100\n";
+  delegate.files()["//inner.gni"] = "y = 1\n";
+  std::string list;
+  std::vector<std::string> expected_names;
+  for (int i = 0; i < 50; i++) {
+    list += std::to_string(i) + ", ";
+    expected_names.push_back("item" + std::to_string(i));
+  }
+  delegate.files()["//items.icl"] =
+      "import(\"//common.gni\")\n"
+      "parallel_foreach(i, [" + list + "]) {\n"
+      "  import(\"//inner.gni\")\n"
+      "  bag(\"item$i\") {\n"
+      "    value = x + y + i\n"
+      "  }\n"
+      "}\n";
+  delegate.files()["//errors.icl"] =
+      "parallel_foreach(i, [" + list + "]) {\n"
+      "  assert(i != 35 && i != 42, \"failed $i\")\n"
+      "}\n";
+
+  Runner runner(&delegate);
+  Runner::RunResult result = runner.Run(SourceFile("//items.icl"));
+  ASSERT_TRUE(result.is_success()) << result.error_message();
+  EXPECT_EQ(expected_names, GetNames(result.items()));
+  EXPECT_EQ(std::set<SourceFile>(
+                {SourceFile("//common.gni"), SourceFile("//inner.gni")}),
+            result.deps());
+
+  // The first failing iteration's error is reported.
+  result = runner.Run(SourceFile("//errors.icl"));
+  ASSERT_FALSE(result.is_success());
+  EXPECT_NE(std::string::npos, result.error_message().find("failed 35"))
+      << result.error_message();
+}
+
+TEST(Runner, ItemSink) {
+  TestDelegate delegate;
+  ThreadPool pool(3);
+  delegate.set_thread_pool(&pool);
+  delegate.files()["//root.icl"] =
+      "template(\"my_bag\") {\n"
+      "  bag(item_name) {\n"
+      "    value = invoker.value\n"
+      "  }\n"
+      "}\n"
+      "bag(\"a\") {}\n"
+      "my_bag(\"b\") {\n"
+      "  value = 1\n"
+      "}\n"
+      "parallel_foreach(i, [\"c\", \"d\", \"e\"]) {\n"
+      "  bag(i) {}\n"
+      "}\n"
+      "bag(\"f\") {}\n";
+  delegate.files()["//failure.icl"] =
+      "bag(\"a\") {}\n"
+      "bag(\"b\") {\n"
+      "  value = undefined\n"
+      "}\n";
+
+  Runner runner(&delegate);
+  NameSink sink;
+  runner.set_item_sink(&sink);
+  Runner::RunResult result = runner.Run(SourceFile("//root.icl"));
+  ASSERT_TRUE(result.is_success()) << result.error_message();
+  EXPECT_TRUE(result.items().empty());
+  EXPECT_EQ(std::vector<std::string>({"a", "b", "c", "d", "e", "f"}),
+            sink.names());
+
+  // Items are passed on as they're defined, even if the run then fails.
+  NameSink failure_sink;
+  runner.set_item_sink(&failure_sink);
+  result = runner.Run(SourceFile("//failure.icl"));
+  EXPECT_FALSE(result.is_success());
+  EXPECT_EQ(std::vector<std::string>({"a"}), failure_sink.names());
+
+  // Without a sink, the items are collected.
+  runner.set_item_sink(nullptr);
+  result = runner.Run(SourceFile("//root.icl"));
+  ASSERT_TRUE(result.is_success()) << result.error_message();
+  EXPECT_EQ(std::vector<std::string>({"a", "b", "c", "d", "e", "f"}),
+            GetNames(result.items()));
+}
+
+TEST(Runner, BaseConfig) {
+  TestDelegate delegate;
+  delegate.files()["//build/platform.gni"] = "is_linux = true\n";
+  delegate.files()["//build/config.icl"] =
+      "import(\"//build/platform.gni\")\n"
+      "cflags = [\"-O2\"]\n"
+      "template(\"my_bag\") {\n"
+      "  bag(item_name) {\n"
+      "    value = invoker.value\n"
+      "  }\n"
+      "}\n";
+  const int kRootCount = 20;
+  std::vector<SourceFile> names;
+  for (int i = 0; i < kRootCount; i++) {
+    std::string name = "//root" + std::to_string(i) + ".icl";
+    names.push_back(SourceFile(std::string(name)));
+    delegate.files()[name] =
+        "my_bag(\"item" + std::to_string(i) + "\") {\n"
+        "  if (is_linux) {\n"
+        "    value = cflags + [\"-DROOT\"]\n"
+        "  }\n"
+        "}\n";
+  }
+
+  Err err;
+  std::unique_ptr<BaseConfig> base_config =
+      BaseConfig::Prepare(&delegate, SourceFile("//build/config.icl"), &err);
+  ASSERT_TRUE(base_config) << err.GetErrorMessage();
+  EXPECT_TRUE(base_config->scope()->is_frozen());
+  EXPECT_EQ(std::set<SourceFile>({SourceFile("//build/platform.gni")}),
+            base_config->deps());
+
+  // Without the base config, the roots can't see its values.
+  Runner runner(&delegate);
+  Runner::RunResult result = runner.Run(names[0]);
+  EXPECT_FALSE(result.is_success());
+
+  // The base config is shared by runs on several threads.
+  runner.set_base_config(base_config.get());
+  ThreadPool pool(3);
+  std::vector<Runner::RunResult> results = runner.RunMany(names, &pool);
+  for (int i = 0; i < kRootCount; i++) {
+    ASSERT_TRUE(results[i].is_success()) << results[i].error_message();
+    ASSERT_EQ(1u, results[i].items().size());
+    const BagItem* item =
+        static_cast<const BagItem*>(results[i].items()[0].get());
+    EXPECT_EQ("item" + std::to_string(i), item->name());
+    EXPECT_EQ("[\"-O2\", \"-DROOT\"]",
+              item->key_value_map().find("value")->second.ToString(true));
+    EXPECT_EQ(std::set<SourceFile>({SourceFile("//build/config.icl"),
+                                    SourceFile("//build/platform.gni")}),
+              results[i].deps());
+  }
+
+  // Base configs can't define items.
+  delegate.files()["//build/items.icl"] = "bag(\"item\") {}\n";
+  EXPECT_FALSE(
+      BaseConfig::Prepare(&delegate, SourceFile("//build/items.icl"), &err));
+  EXPECT_NE(std::string::npos, err.message().find("Can't define an item"))
+      << err.GetErrorMessage();
+}
+
+TEST(Runner, TemplateCache) {
+  TestDelegate delegate;
+  delegate.set_collect_stats(true);
+  delegate.files()["//build/configs.gni"] =
+      "template(\"platform_config\") {\n"
+      "  bag(item_name) {\n"
+      "    cflags = [\"-D${invoker.os}\"] + invoker.extra_cflags\n"
+      "  }\n"
+      "}\n";
+  const char kRoot[] =
+      "import(\"//build/configs.gni\")\n"
+      "platform_config(\"linux\") {\n"
+      "  os = \"linux\"\n"
+      "  extra_cflags = []\n"
+      "}\n"
+      "platform_config(\"win\") {\n"
+      "  os = \"win\"\n"
+      "  extra_cflags = [\"-W4\"]\n"
+      "}\n";
+  delegate.files()["//a.icl"] = kRoot;
+  delegate.files()["//b.icl"] = kRoot;
+
+  TemplateCache cache;
+  Runner runner(&delegate);
+  runner.set_template_cache(&cache);
+  Runner::RunResult a = runner.Run(SourceFile("//a.icl"));
+  ASSERT_TRUE(a.is_success()) << a.error_message();
+  EXPECT_EQ(0u, a.stats().counter(EvaluationStats::TEMPLATE_CACHE_HITS));
+  EXPECT_EQ(2u, a.stats().counter(EvaluationStats::TEMPLATE_CACHE_MISSES));
+  EXPECT_EQ(2u, cache.size());
+
+  // The second root's invocations (and items) are replayed.
+  Runner::RunResult b = runner.Run(SourceFile("//b.icl"));
+  ASSERT_TRUE(b.is_success()) << b.error_message();
+  EXPECT_EQ(2u, b.stats().counter(EvaluationStats::TEMPLATE_CACHE_HITS));
+  EXPECT_EQ(0u, b.stats().counter(EvaluationStats::TEMPLATE_CACHE_MISSES));
+  ASSERT_EQ(2u, b.items().size());
+  for (size_t i = 0; i < b.items().size(); i++)
+    EXPECT_TRUE(b.items()[i]->Equals(*a.items()[i]));
+  EXPECT_EQ("[\"-Dwin\", \"-W4\"]",
+            static_cast<const BagItem*>(b.items()[1].get())
+                ->key_value_map()
+                .find("cflags")
+                ->second.ToString(true));
+}
+
+TEST(Runner, Limits) {
+  TestDelegate delegate;
+  std::string list;
+  for (int i = 0; i < 100; i++)
+    list += std::to_string(i) + ", ";
+  // 10000 iterations of the inner loop.
+  delegate.files()["//loops.gni"] =
+      "l = [" + list + "]\n"
+      "n = 0\n"
+      "foreach(i, l) {\n"
+      "  foreach(j, l) {\n"
+      "    n = n + 1\n"
+      "  }\n"
+      "}\n";
+  delegate.files()["//root.icl"] =
+      "import(\"//loops.gni\")\n"
+      "bag(\"item\") {\n"
+      "  value = n\n"
+      "}\n";
+
+  Runner runner(&delegate);
+  EvaluationBudget::Limits limits;
+  limits.max_steps = 5000;
+  runner.set_limits(limits);
+  Runner::RunResult result = runner.Run(SourceFile("//root.icl"));
+  ASSERT_FALSE(result.is_success());
+  EXPECT_NE(std::string::npos,
+            result.error_message().find(
+                "ERROR at //loops.gni:5:5: Evaluation stopped here, since it "
+                "exceeded the limit of 5000 steps."))
+      << result.error_message();
+
+  // The import's failure wasn't kept, so it succeeds with a bigger budget.
+  limits.max_steps = 100000;
+  runner.set_limits(limits);
+  result = runner.Run(SourceFile("//root.icl"));
+  EXPECT_TRUE(result.is_success()) << result.error_message();
+
+  // Cancellation and the deadline are checked before starting.
+  CancellationToken cancellation_token;
+  cancellation_token.Cancel();
+  limits.cancellation_token = &cancellation_token;
+  runner.set_limits(limits);
+  result = runner.Run(SourceFile("//root.icl"));
+  ASSERT_FALSE(result.is_success());
+  EXPECT_NE(std::string::npos, result.error_message().find("cancelled"));
+
+  limits = EvaluationBudget::Limits();
+  limits.timeout = std::chrono::steady_clock::duration::zero();
+  runner.set_limits(limits);
+  result = runner.Run(SourceFile("//root.icl"));
+  ASSERT_FALSE(result.is_success());
+  EXPECT_NE(std::string::npos, result.error_message().find("deadline"));
+
+  // Parallel loops share the budget.
+  ThreadPool pool(2);
+  delegate.set_thread_pool(&pool);
+  delegate.files()["//parallel.icl"] =
+      "l = [" + list + "]\n"
+      "parallel_foreach(i, l) {\n"
+      "  foreach(j, l) {\n"
+      "    n = j\n"
+      "  }\n"
+      "}\n";
+  limits = EvaluationBudget::Limits();
+  limits.max_steps = 1000;
+  runner.set_limits(limits);
+  result = runner.Run(SourceFile("//parallel.icl"));
+  ASSERT_FALSE(result.is_success());
+  EXPECT_NE(std::string::npos, result.error_message().find("steps"));
+}
+
+TEST(Runner, Trace) {
+  TestDelegate delegate;
+  delegate.files()["//common.gni"] = "x = 1\n";
+  delegate.files()["//root.icl"] =
+      "import(\"//common.gni\")\n"
+      "template(\"my_bag\") {\n"
+      "  bag(item_name) {\n"
+      "    value = invoker.value\n"
+      "  }\n"
+      "}\n"
+      "my_bag(\"item\") {\n"
+      "  value = x\n"
+      "}\n";
+  delegate.files()["//other.icl"] = "import(\"//common.gni\")\n";
+  delegate.files()["//untraced.icl"] = "bag(\"item\") {}\n";
+
+  // Without a tracer, nothing is recorded.
+  Runner runner(&delegate);
+  Tracer tracer;
+  Runner::RunResult result = runner.Run(SourceFile("//untraced.icl"));
+  ASSERT_TRUE(result.is_success()) << result.error_message();
+  EXPECT_EQ(0u, tracer.event_count());
+
+  runner.set_tracer(&tracer);
+  result = runner.Run(SourceFile("//root.icl"));
+  ASSERT_TRUE(result.is_success()) << result.error_message();
+  std::string json = tracer.ToJson();
+  EXPECT_NE(std::string::npos,
+            json.find("{\"name\":\"//root.icl\",\"cat\":\"run\","))
+      << json;
+  for (const char* phase : {"read", "tokenize", "parse"}) {
+    EXPECT_NE(std::string::npos,
+              json.find(std::string("{\"name\":\"") + phase +
+                        "\",\"cat\":\"file\","))
+        << json;
+  }
+  // The import was executed, and the import, template, function and item
+  // spans are at their source locations.
+  EXPECT_NE(std::string::npos,
+            json.find("{\"name\":\"execute\",\"cat\":\"import\","))
+      << json;
+  EXPECT_NE(std::string::npos,
+            json.find("\"args\":{\"location\":\"//root.icl:1:1\","
+                      "\"cached\":\"false\"}}"))
+      << json;
+  EXPECT_NE(std::string::npos,
+            json.find("{\"name\":\"my_bag\",\"cat\":\"template\","))
+      << json;
+  EXPECT_NE(std::string::npos,
+            json.find("\"args\":{\"location\":\"//root.icl:7:1\"}}"))
+      << json;
+  EXPECT_NE(std::string::npos,
+            json.find("{\"name\":\"bag\",\"cat\":\"function\","))
+      << json;
+  EXPECT_NE(std::string::npos,
+            json.find("{\"name\":\"item\",\"cat\":\"item\","))
+      << json;
+  EXPECT_NE(std::string::npos,
+            json.find("\"args\":{\"location\":\"//root.icl:3:3\","
+                      "\"type\":\"bag\"}}"))
+      << json;
+
+  // The second time, the import is cached.
+  Tracer other_tracer;
+  runner.set_tracer(&other_tracer);
+  result = runner.Run(SourceFile("//other.icl"));
+  ASSERT_TRUE(result.is_success()) << result.error_message();
+  json = other_tracer.ToJson();
+  EXPECT_NE(std::string::npos,
+            json.find("\"args\":{\"location\":\"//other.icl:1:1\","
+                      "\"cached\":\"true\"}}"))
+      << json;
+  EXPECT_EQ(std::string::npos, json.find("\"location\":\"//common.gni\""))
+      << json;
+}
+
+TEST(Runner, Stats) {
+  TestDelegate delegate;
+  delegate.files()["//common.gni"] =
+      "l = [1, 2, 3]\n"
+      "s = {\n"
+      "  a = 1\n"
+      "}\n";
+  delegate.files()["//root.icl"] =
+      "import(\"//common.gni\")\n"
+      "bag(\"item\") {\n"
+      "  value = l\n"
+      "  value2 = \"${s.a}\"\n"
+      "}\n";
+
+  delegate.files()["//other.icl"] = "x = 1\n";
+
+  // Stats aren't collected by default.
+  Runner runner(&delegate);
+  Runner::RunResult result = runner.Run(SourceFile("//other.icl"));
+  ASSERT_TRUE(result.is_success()) << result.error_message();
+  EXPECT_EQ(0u, result.stats().counter(EvaluationStats::BYTES_TOKENIZED));
+
+  delegate.set_collect_stats(true);
+  result = runner.Run(SourceFile("//root.icl"));
+  ASSERT_TRUE(result.is_success()) << result.error_message();
+  const EvaluationStats& stats = result.stats();
+  // The files, and "s.a".
+  size_t size = delegate.files()["//common.gni"].size() +
+                delegate.files()["//root.icl"].size() + 3;
+  EXPECT_EQ(size, stats.counter(EvaluationStats::BYTES_TOKENIZED));
+  EXPECT_EQ(size, stats.counter(EvaluationStats::BYTES_PARSED));
+  EXPECT_EQ(1u, stats.counter(EvaluationStats::STRING_EXPRESSION_PARSES));
+  EXPECT_LE(3u, stats.counter(EvaluationStats::VALUE_DEEP_COPY_ELEMENTS));
+  // Looking up |l| and |s| from the item's block goes up a scope.
+  EXPECT_LE(2u, stats.lookups_at_depth(1));
+}
+
+TEST(Runner, Allocator) {
+  // The allocator must outlive the files the delegate keeps.
+  CountingAllocator allocator;
+  {
+    TestDelegate delegate;
+    delegate.files()["//root.icl"] =
+        "bag(\"item\") {\n"
+        "  value = [1, 2, 3]\n"
+        "}\n";
+    delegate.set_allocator(&allocator);
+    delegate.set_collect_stats(true);
+
+    Runner runner(&delegate);
+    Runner::RunResult result = runner.Run(SourceFile("//root.icl"));
+    ASSERT_TRUE(result.is_success()) << result.error_message();
+    EXPECT_EQ(nullptr, Allocator::current());
+    // The file and its parse nodes.
+    const EvaluationStats& stats = result.stats();
+    EXPECT_EQ(1u, stats.allocations(Allocator::INPUT_FILE));
+    EXPECT_LT(0u, stats.allocations(Allocator::PARSE_NODE));
+    EXPECT_LT(0u, stats.allocated_bytes(Allocator::INPUT_FILE_CONTENTS));
+    EXPECT_EQ(stats.allocations(Allocator::INPUT_FILE) +
+                  stats.allocations(Allocator::PARSE_NODE) +
+                  stats.allocations(Allocator::SCOPE),
+              allocator.allocations());
+  }
+  EXPECT_EQ(0u, allocator.live_count());
+}
+
+TEST(Runner, MemoryLimit) {
+  TestDelegate delegate;
+  std::string list;
+  for (int i = 0; i < 100; i++)
+    list += std::to_string(i) + ", ";
+  // Each iteration copies the list (into |copy|).
+  delegate.files()["//root.icl"] =
+      "l = [" + list + "]\n"
+      "foreach(i, l) {\n"
+      "  foreach(j, l) {\n"
+      "    copy = []\n"
+      "    copy = l\n"
+      "  }\n"
+      "}\n";
+
+  Runner runner(&delegate);
+  EvaluationBudget::Limits limits;
+  limits.max_cumulative_allocated_bytes = 1024 * 1024;
+  runner.set_limits(limits);
+  Runner::RunResult result = runner.Run(SourceFile("//root.icl"));
+  ASSERT_FALSE(result.is_success());
+  EXPECT_NE(std::string::npos,
+            result.error_message().find(
+                "Evaluation stopped here, since it exceeded the limit of "
+                "1048576 bytes allocated in total."))
+      << result.error_message();
+  // The limit needed the stats, so they're reported.
+  EXPECT_LT(1024u * 1024u, result.stats().total_allocated_bytes());
+
+  limits.max_cumulative_allocated_bytes = 1024 * 1024 * 1024;
+  runner.set_limits(limits);
+  result = runner.Run(SourceFile("//root.icl"));
+  EXPECT_TRUE(result.is_success()) << result.error_message();
+}
+
+}  // namespace
+}  // namespace icl
@@ -6,8 +6,12 @@
 
 #include <assert.h>
 
+#include <algorithm>
+#include <tuple>
 #include <utility>
 
+#include "icl/delegate.h"
+#include "icl/evaluation_stats.h"
 #include "icl/parse_tree.h"
 #include "icl/template.h"
 
@@ -15,6 +19,9 @@ namespace icl {
 
 namespace {
 
+// The number of slots reserved for a scope's first value.
+const size_t kInitialSlotCount = 8;
+
 // Returns true if this variable name should be considered private. Private
 // values start with an underscore, and are not imported from "gni" files
 // when processing an import.
@@ -22,8 +29,48 @@ bool IsPrivateVar(const StringPiece& name) {
   return name.empty() || name[0] == '_';
 }
 
+// Fills in the error for a value of |desc_for_err| (e.g., an import) that
+// would clobber a different one visible from the scope it's added to.
+void FillValueCollisionError(const ParseNode* node_for_err,
+                             const char* desc_for_err,
+                             const StringPiece& name,
+                             const Value& new_value,
+                             const Value& existing_value,
+                             Err* err) {
+  std::string desc_string(desc_for_err);
+  *err = Err(node_for_err, "Value collision.",
+      "This " + desc_string + " contains \"" + name.as_string() + "\"");
+  err->AppendSubErr(Err(new_value, "defined here.",
+      "Which would clobber the one in your current scope"));
+  err->AppendSubErr(Err(existing_value, "defined here.",
+      "Executing " + desc_string + " should not conflict with anything "
+      "in the current\nscope unless the values are identical."));
+}
+
 }  // namespace
 
+// An immutable closure of a scope made by |MakeSharedClosure()|, together with
+// the state of the scopes it was made from.
+class Scope::ClosureSnapshot : public RefCountedThreadSafe<ClosureSnapshot> {
+ public:
+  const Scope* scope() const { return scope_.get(); }
+  const ClosureKey& key() const { return key_; }
+
+ private:
+  FRIEND_REF_COUNTED_THREAD_SAFE(ClosureSnapshot);
+  FRIEND_MAKE_REF_COUNTED(ClosureSnapshot);
+
+  ClosureSnapshot(std::unique_ptr<Scope> scope, ClosureKey&& key)
+      : scope_(std::move(scope)), key_(std::move(key)) {}
+  ~ClosureSnapshot() = default;
+
+  ClosureSnapshot(const ClosureSnapshot&) = delete;
+  ClosureSnapshot& operator=(const ClosureSnapshot&) = delete;
+
+  const std::unique_ptr<Scope> scope_;
+  const ClosureKey key_;
+};
+
 // Defaults to all false, which are the things least likely to cause errors.
 Scope::MergeOptions::MergeOptions()
     : clobber_existing(false),
@@ -34,6 +81,15 @@ Scope::MergeOptions::MergeOptions()
 Scope::MergeOptions::~MergeOptions() {
 }
 
+Scope::MergeFilter::MergeFilter(const MergeOptions& options)
+    : options_(options) {
+  for (const auto& name : options_.excluded_values)
+    excluded_.insert(StringPiece(name));
+}
+
+Scope::MergeFilter::~MergeFilter() {
+}
+
 Scope::ProgrammaticProvider::~ProgrammaticProvider() {
   scope_->RemoveProvider(this);
 }
@@ -43,7 +99,11 @@ Scope::Scope(Delegate* delegate)
       mutable_containing_(nullptr),
       delegate_(delegate),
       is_processing_import_(false),
-      item_collector_(nullptr) {
+      generation_(0),
+      frozen_(false),
+      target_defaults_layer_(nullptr),
+      item_collector_(nullptr),
+      closure_reads_(nullptr) {
 }
 
 Scope::Scope(Scope* parent)
@@ -51,7 +111,11 @@ Scope::Scope(Scope* parent)
       mutable_containing_(parent),
       delegate_(parent->delegate()),
       is_processing_import_(false),
-      item_collector_(nullptr) {
+      generation_(0),
+      frozen_(false),
+      target_defaults_layer_(nullptr),
+      item_collector_(nullptr),
+      closure_reads_(nullptr) {
 }
 
 Scope::Scope(const Scope* parent)
@@ -59,22 +123,79 @@ Scope::Scope(const Scope* parent)
       mutable_containing_(nullptr),
       delegate_(parent->delegate()),
       is_processing_import_(false),
-      item_collector_(nullptr) {
+      generation_(0),
+      frozen_(false),
+      target_defaults_layer_(nullptr),
+      item_collector_(nullptr),
+      closure_reads_(nullptr) {
+}
+
+Scope::Scope(RefPtr<const ClosureSnapshot> snapshot)
+    : const_containing_(snapshot->scope()),
+      mutable_containing_(nullptr),
+      delegate_(snapshot->scope()->delegate()),
+      is_processing_import_(false),
+      generation_(0),
+      const_containing_snapshot_(std::move(snapshot)),
+      frozen_(false),
+      target_defaults_layer_(nullptr),
+      item_collector_(nullptr),
+      closure_reads_(nullptr) {
 }
 
 Scope::~Scope() = default;
 
 void Scope::DetachFromContaining() {
+  assert(!frozen_);
+  Modified();
   const_containing_ = nullptr;
   mutable_containing_ = nullptr;
 }
 
 bool Scope::HasValues(SearchNested search_nested) const {
   assert(search_nested == SEARCH_CURRENT);
-  return !values_.empty();
+  if (RecordCount())
+    return true;
+
+  if (target_defaults_layer_) {
+    bool has_public = !target_defaults_layer_->ForEachRecord(
+        [](const RecordMap::value_type& pair) {
+          return pair.second.is_private;
+        });
+    if (has_public)
+      return true;
+  }
+
+  std::vector<const Scope*> layers;
+  GetImportLayers(&layers);
+  for (const Scope* layer : layers) {
+    bool has_public = !layer->ForEachRecord(
+        [](const RecordMap::value_type& pair) {
+          return pair.second.is_private;
+        });
+    if (has_public)
+      return true;
+  }
+  return false;
 }
 
 const Value* Scope::GetValue(const StringPiece& ident, bool counts_as_used) {
+  size_t depth = 0;
+  const Value* value = GetValueInChain(ident, counts_as_used, &depth);
+  StatsRecorder::CountLookup(depth);
+  return value;
+}
+
+const Value* Scope::GetValue(const StringPiece& ident) const {
+  size_t depth = 0;
+  const Value* value = GetValueInChain(ident, &depth);
+  StatsRecorder::CountLookup(depth);
+  return value;
+}
+
+const Value* Scope::GetValueInChain(const StringPiece& ident,
+                                    bool counts_as_used,
+                                    size_t* depth) {
   // First check for programmatically-provided values.
   for (auto* provider : programmatic_providers_) {
     const Value* v = provider->GetProgrammaticValue(ident);
@@ -85,29 +206,91 @@ const Value* Scope::GetValue(const StringPiece& ident, bool counts_as_used) {
   RecordMap::iterator found = values_.find(ident);
   if (found != values_.end()) {
     if (counts_as_used)
-      found->second.used = true;
+      SetUsed(found->second, true);
     return &found->second.value;
   }
 
+  // Frozen values are always considered used.
+  if (frozen_) {
+    const RecordMap::value_type* frozen = FindFrozenRecord(ident);
+    if (frozen)
+      return &frozen->second.value;
+  }
+
+  if (target_defaults_layer_) {
+    const RecordMap::value_type* defaulted = FindTargetDefaultsRecord(ident);
+    if (defaulted) {
+      if (counts_as_used)
+        SetTargetDefaultUsed(defaulted->second, true);
+      return &defaulted->second.value;
+    }
+  }
+
+  // Imported values are always considered used.
+  if (!imports_.empty()) {
+    const RecordMap::value_type* imported = FindImportedRecord(ident);
+    if (imported)
+      return &imported->second.value;
+  }
+
   // Search in the parent scope.
-  if (const_containing_)
-    return const_containing_->GetValue(ident);
+  (*depth)++;
+  if (const_containing_) {
+    if (closure_reads_ && counts_as_used) {
+      const RecordMap::value_type* found =
+          const_containing_->FindOwnRecord(ident);
+      if (found)
+        closure_reads_->insert(found->first);
+    }
+    return const_containing_->GetValueInChain(ident, depth);
+  }
   if (mutable_containing_)
-    return mutable_containing_->GetValue(ident, counts_as_used);
+    return mutable_containing_->GetValueInChain(ident, counts_as_used, depth);
   return nullptr;
 }
 
 Value* Scope::GetMutableValue(const StringPiece& ident,
                               SearchNested search_mode,
                               bool counts_as_used) {
+  // Frozen scopes are not mutable (and have no mutable containing scope).
+  if (frozen_)
+    return nullptr;
+
   // Don't do programmatic values, which are not mutable.
   RecordMap::iterator found = values_.find(ident);
   if (found != values_.end()) {
+    // The caller may modify the value.
+    Modified();
     if (counts_as_used)
-      found->second.used = true;
+      SetUsed(found->second, true);
     return &found->second.value;
   }
 
+  // So are attached target defaults, but their values may still be unused.
+  if (target_defaults_layer_) {
+    const RecordMap::value_type* defaulted = FindTargetDefaultsRecord(ident);
+    if (defaulted) {
+      Modified();
+      Record& r = CopyTargetDefault(*defaulted)->second;
+      if (counts_as_used)
+        SetUsed(r, true);
+      return &r.value;
+    }
+  }
+
+  // Attached imports are read-only, so copy the value into this scope (just
+  // as if it had been merged in) and return that.
+  if (!imports_.empty()) {
+    const RecordMap::value_type* imported = FindImportedRecord(ident);
+    if (imported) {
+      Modified();
+      Record& r = AddRecord(imported->first)->second;
+      r.value = imported->second.value;
+      SetUsed(r, true);
+      return &r.value;
+    }
+  }
+
   // Search in the parent mutable scope if requested, but not const one.
   if (search_mode == SEARCH_NESTED && mutable_containing_) {
     return mutable_containing_->GetMutableValue(
@@ -117,8 +300,8 @@ Value* Scope::GetMutableValue(const StringPiece& ident,
 }
 
 StringPiece Scope::GetStorageKey(const StringPiece& ident) const {
-  RecordMap::const_iterator found = values_.find(ident);
-  if (found != values_.end())
+  const RecordMap::value_type* found = FindCurrentRecord(ident);
+  if (found)
     return found->first;
 
   // Search in parent scope.
@@ -127,47 +310,77 @@ StringPiece Scope::GetStorageKey(const StringPiece& ident) const {
   return StringPiece();
 }
 
-const Value* Scope::GetValue(const StringPiece& ident) const {
-  RecordMap::const_iterator found = values_.find(ident);
-  if (found != values_.end())
+const Value* Scope::GetValueInChain(const StringPiece& ident,
+                                    size_t* depth) const {
+  const RecordMap::value_type* found = FindCurrentRecord(ident);
+  if (found)
     return &found->second.value;
-  if (containing())
-    return containing()->GetValue(ident);
-  return nullptr;
+  if (!containing())
+    return nullptr;
+  (*depth)++;
+  return containing()->GetValueInChain(ident, depth);
 }
 
 Value* Scope::SetValue(const StringPiece& ident,
                        Value v,
                        const ParseNode* set_node) {
-  Record& r = values_[ident];  // Clears any existing value.
+  assert(!frozen_);
+  Modified();
+  RecordMap::iterator found = values_.find(ident);
+  if (found == values_.end()) {
+    // Overwriting a target default keeps whether it was used, as a merged one
+    // would.
+    const RecordMap::value_type* defaulted =
+        target_defaults_layer_ ? FindTargetDefaultsRecord(ident) : nullptr;
+    bool was_used = defaulted && IsTargetDefaultUsed(defaulted->second);
+    found = AddRecord(ident);
+    if (defaulted) {
+      SetUsed(found->second, was_used);
+    } else if (!imports_.empty() && FindImportedRecord(ident)) {
+      // Shadowing an imported value doesn't make it unused (a merged import
+      // would have been marked used and then overwritten).
+      SetUsed(found->second, true);
+    }
+  }
+  Record& r = found->second;
   r.value = std::move(v);
   r.value.set_origin(set_node);
   return &r.value;
 }
 
 void Scope::RemoveIdentifier(const StringPiece& ident) {
+  assert(!frozen_);
+  // Attached target defaults can't be removed, so copy them first.
+  if (target_defaults_layer_ && FindTargetDefaultsRecord(ident))
+    DetachTargetDefaults();
   RecordMap::iterator found = values_.find(ident);
-  if (found != values_.end())
-    values_.erase(found);
+  if (found != values_.end()) {
+    Modified();
+    EraseRecord(found);
+  }
 }
 
 void Scope::RemovePrivateIdentifiers() {
+  assert(!frozen_);
   // Do it in two phases to avoid mutating while iterating. Our hash map is
   // currently backed by several different vendor-specific implementations and
   // I'm not sure if all of them support mutating while iterating. Since this
   // is not perf-critical, do the safe thing.
   std::vector<StringPiece> to_remove;
   for (const auto& cur : values_) {
-    if (IsPrivateVar(cur.first))
+    if (cur.second.is_private)
       to_remove.push_back(cur.first);
   }
 
+  if (!to_remove.empty())
+    Modified();
   for (const auto& cur : to_remove)
-    values_.erase(cur);
+    EraseRecord(values_.find(cur));
 }
 
 bool Scope::AddTemplate(const std::string& name,
                         RefPtr<const Template>&& templ) {
+  assert(!frozen_);
   if (GetTemplate(name))
     return false;
   templates_[name] = std::move(templ);
@@ -175,9 +388,9 @@ bool Scope::AddTemplate(const std::string& name,
 }
 
 const Template* Scope::GetTemplate(const std::string& name) const {
-  TemplateMap::const_iterator found = templates_.find(name);
-  if (found != templates_.end())
-    return found->second.get();
+  const Template* found = FindCurrentTemplate(name);
+  if (found)
+    return found;
   if (containing())
     return containing()->GetTemplate(name);
   return nullptr;
@@ -186,61 +399,172 @@ const Template* Scope::GetTemplate(const std::string& name) const {
 void Scope::MarkUsed(const StringPiece& ident) {
   RecordMap::iterator found = values_.find(ident);
   if (found == values_.end()) {
+    const RecordMap::value_type* defaulted =
+        target_defaults_layer_ ? FindTargetDefaultsRecord(ident) : nullptr;
+    if (defaulted) {
+      SetTargetDefaultUsed(defaulted->second, true);
+      return;
+    }
     assert(false);
     return;
   }
-  found->second.used = true;
+  SetUsed(found->second, true);
 }
 
 void Scope::MarkAllUsed() {
-  for (auto& cur : values_)
-    cur.second.used = true;
+  std::fill(unused_bits_.begin(), unused_bits_.end(), 0);
+  std::fill(target_defaults_unused_bits_.begin(),
+            target_defaults_unused_bits_.end(), 0);
 }
 
 void Scope::MarkUnused(const StringPiece& ident) {
   RecordMap::iterator found = values_.find(ident);
   if (found == values_.end()) {
+    const RecordMap::value_type* defaulted =
+        target_defaults_layer_ ? FindTargetDefaultsRecord(ident) : nullptr;
+    if (defaulted) {
+      SetTargetDefaultUsed(defaulted->second, false);
+      return;
+    }
     assert(false);
     return;
   }
-  found->second.used = false;
+  SetUsed(found->second, false);
 }
 
 bool Scope::IsSetButUnused(const StringPiece& ident) const {
   RecordMap::const_iterator found = values_.find(ident);
   if (found != values_.end()) {
-    if (!found->second.used) {
+    if (!IsUsed(found->second)) {
       return true;
     }
+  } else if (target_defaults_layer_) {
+    const RecordMap::value_type* defaulted = FindTargetDefaultsRecord(ident);
+    return defaulted && !IsTargetDefaultUsed(defaulted->second);
   }
   return false;
 }
 
+bool Scope::IsSetButUnusedInChain(const StringPiece& ident) const {
+  // Programmatic values are never unused.
+  for (auto* provider : programmatic_providers_) {
+    if (provider->GetProgrammaticValue(ident))
+      return false;
+  }
+  if (FindCurrentRecord(ident))
+    return IsSetButUnused(ident);
+  // Values in const containing scopes are never marked.
+  return mutable_containing_ &&
+         mutable_containing_->IsSetButUnusedInChain(ident);
+}
+
+void Scope::MarkUsedFromClosure(
+    const std::unordered_set<StringPiece, StringPieceHash>& reads) {
+  for (const StringPiece& ident : reads) {
+    size_t depth = 0;
+    GetValueInChain(ident, true, &depth);
+  }
+}
+
 bool Scope::CheckForUnusedVars(Err* err) const {
-  for (const auto& pair : values_) {
-    if (!pair.second.used) {
-      std::string help = "You set the variable \"" + pair.first.as_string() +
-          "\" here and it was unused before it went\nout of scope.";
-
-      const BinaryOpNode* binary = pair.second.value.origin()->AsBinaryOp();
-      if (binary && binary->op().type() == Token::EQUAL) {
-        // Make a nicer error message for normal var sets.
-        *err = Err(binary->left()->GetRange(), "Assignment had no effect.",
-                   help);
-      } else {
-        // This will happen for internally-generated variables.
-        *err = Err(pair.second.value.origin(), "Assignment had no effect.",
-                   help);
+  if (delegate_ && !delegate_->ShouldCheckForUnusedVars())
+    return true;
+
+  // Returns the record in the lowest unused slot, or null.
+  auto find_unused = [](const std::vector<Word>& bits,
+                        const std::vector<const RecordMap::value_type*>& slots)
+      -> const RecordMap::value_type* {
+    for (size_t i = 0; i < bits.size(); i++) {
+      Word word = bits[i];
+      if (!word)
+        continue;
+      size_t slot = i * kBitsPerWord;
+      while (!(word & 1)) {
+        word >>= 1;
+        slot++;
       }
-      return false;
+      return slots[slot];
     }
+    return nullptr;
+  };
+
+  // Attached target defaults come first, as merged ones would have.
+  const RecordMap::value_type* unused = nullptr;
+  if (target_defaults_layer_) {
+    unused = find_unused(target_defaults_unused_bits_,
+                         target_defaults_layer_->slots_);
   }
-  return true;
+  if (!unused)
+    unused = find_unused(unused_bits_, slots_);
+  if (!unused)
+    return true;
+
+  const RecordMap::value_type& pair = *unused;
+
+  std::string help = "You set the variable \"" + pair.first.as_string() +
+      "\" here and it was unused before it went\nout of scope.";
+
+  const BinaryOpNode* binary = pair.second.value.origin()->AsBinaryOp();
+  if (binary && binary->op().type() == Token::EQUAL) {
+    // Make a nicer error message for normal var sets.
+    *err = Err(binary->left()->GetRange(), "Assignment had no effect.",
+               help);
+  } else {
+    // This will happen for internally-generated variables.
+    *err = Err(pair.second.value.origin(), "Assignment had no effect.",
+               help);
+  }
+  return false;
 }
 
 void Scope::GetCurrentScopeValues(KeyValueMap* output) const {
-  for (const auto& pair : values_)
+  ForEachRecord([output](const RecordMap::value_type& pair) {
     (*output)[pair.first] = pair.second.value;
+    return true;
+  });
+
+  std::vector<const Scope*> layers;
+  if (target_defaults_layer_)
+    layers.push_back(target_defaults_layer_);
+  GetImportLayers(&layers);
+  for (const Scope* layer : layers) {
+    layer->ForEachRecord([this, output](const RecordMap::value_type& pair) {
+      // Only include imported values that are visible from here.
+      if (FindCurrentRecord(pair.first) == &pair)
+        (*output)[pair.first] = pair.second.value;
+      return true;
+    });
+  }
+}
+
+void Scope::GetCurrentScopeTemplates(
+    std::map<std::string, const Template*>* output) const {
+  for (const auto& pair : templates_)
+    (*output)[pair.first] = pair.second.get();
+
+  std::vector<const Scope*> layers;
+  GetImportLayers(&layers);
+  for (const Scope* layer : layers) {
+    for (const auto& pair : layer->templates_) {
+      if (FindCurrentTemplate(pair.first) == pair.second.get())
+        (*output)[pair.first] = pair.second.get();
+    }
+  }
+}
+
+void Scope::GetCurrentScopeTargetDefaults(
+    std::map<std::string, const Scope*>* output) const {
+  for (const auto& pair : target_defaults_)
+    (*output)[pair.first] = pair.second.get();
+
+  std::vector<const Scope*> layers;
+  GetImportLayers(&layers);
+  for (const Scope* layer : layers) {
+    for (const auto& pair : layer->target_defaults_) {
+      if (FindCurrentTargetDefaults(pair.first) == pair.second.get())
+        (*output)[pair.first] = pair.second.get();
+    }
+  }
 }
 
 bool Scope::NonRecursiveMergeTo(Scope* dest,
@@ -248,57 +572,229 @@ bool Scope::NonRecursiveMergeTo(Scope* dest,
                                 const ParseNode* node_for_err,
                                 const char* desc_for_err,
                                 Err* err) const {
+  return MergeTo(dest, MergeFilter(options), true, node_for_err, desc_for_err,
+                 err);
+}
+
+bool Scope::NonRecursiveMergeTo(Scope* dest,
+                                const MergeFilter& filter,
+                                const ParseNode* node_for_err,
+                                const char* desc_for_err,
+                                Err* err) const {
+  return MergeTo(dest, filter, true, node_for_err, desc_for_err, err);
+}
+
+bool Scope::AttachImport(const Scope* import_scope,
+                         const ParseNode* node_for_err,
+                         const char* desc_for_err,
+                         Err* err) {
+  assert(!frozen_);
+  assert(import_scope != this);
+
+  // Check for collisions with everything visible from this scope, exactly as
+  // |NonRecursiveMergeTo()| (without |clobber_existing|) would. This applies
+  // even if the scope is already attached, since its values may have been
+  // shadowed since.
+  std::vector<const Scope*> layers(1, import_scope);
+  import_scope->GetImportLayers(&layers);
+  for (const Scope* layer : layers) {
+    bool ok = layer->ForEachRecord([&](const RecordMap::value_type& pair) {
+      const StringPiece& current_name = pair.first;
+      if (pair.second.is_private ||
+          import_scope->FindCurrentRecord(current_name) != &pair)
+        return true;  // Not visible from |import_scope|.
+
+      const Value* existing_value = GetValue(current_name);
+      if (existing_value && pair.second.value != *existing_value) {
+        FillValueCollisionError(node_for_err, desc_for_err, current_name,
+                                pair.second.value, *existing_value, err);
+        return false;
+      }
+      return true;
+    });
+    if (!ok)
+      return false;
+
+    for (const auto& pair : layer->target_defaults_) {
+      const std::string& current_name = pair.first;
+      if (import_scope->FindCurrentTargetDefaults(current_name) !=
+          pair.second.get())
+        continue;  // Not visible from |import_scope|.
+
+      const Scope* dest_defaults = GetTargetDefaults(current_name);
+      if (dest_defaults && dest_defaults != pair.second.get() &&
+          !ValuesEqual(*pair.second, *dest_defaults)) {
+        std::string desc_string(desc_for_err);
+        *err = Err(node_for_err, "Target defaults collision.",
+            "This " + desc_string + " contains target defaults for\n"
+            "\"" + current_name + "\" which would clobber one for the\n"
+            "same target type in your current scope. It's unfortunate that "
+            "I'm too stupid\nto tell you the location of where the target "
+            "defaults were set. Usually\nthis happens in the BUILDCONFIG.gn "
+            "file or in a related .gni file.\n");
+        return false;
+      }
+    }
+
+    for (const auto& pair : layer->templates_) {
+      const std::string& current_name = pair.first;
+      if (IsPrivateVar(current_name) ||
+          import_scope->FindCurrentTemplate(current_name) != pair.second.get())
+        continue;  // Not visible from |import_scope|.
+
+      const Template* existing_template = GetTemplate(current_name);
+      if (existing_template && pair.second.get() != existing_template) {
+        std::string desc_string(desc_for_err);
+        *err = Err(node_for_err, "Template collision.",
+            "This " + desc_string + " contains a template \"" +
+            current_name + "\"");
+        err->AppendSubErr(Err(pair.second->GetDefinitionRange(),
+            "defined here.",
+            "Which would clobber the one in your current scope"));
+        err->AppendSubErr(Err(existing_template->GetDefinitionRange(),
+            "defined here.",
+            "Executing " + desc_string + " should not conflict with anything "
+            "in the current\nscope."));
+        return false;
+      }
+    }
+  }
+
+  if (std::find(imports_.begin(), imports_.end(), import_scope) !=
+      imports_.end())
+    return true;  // Already attached.
+
+  Modified();
+  imports_.push_back(import_scope);
+  return true;
+}
+
+bool Scope::AttachTargetDefaults(const Scope* defaults,
+                                 const ParseNode* node_for_err,
+                                 const char* desc_for_err,
+                                 Err* err) {
+  assert(!frozen_);
+  if (target_defaults_layer_ || RecordCount() || !defaults->imports_.empty() ||
+      defaults->target_defaults_layer_ ||
+      !defaults->target_defaults_.empty() || !defaults->templates_.empty() ||
+      !defaults->programmatic_providers_.empty()) {
+    MergeOptions options;
+    options.skip_private_vars = true;
+    return defaults->NonRecursiveMergeTo(this, options, node_for_err,
+                                         desc_for_err, err);
+  }
+
+  // Check for collisions (before the layer is visible), exactly as the merge
+  // would, and note which values are unused.
+  std::vector<Word> unused_bits(defaults->unused_bits_.size(), 0);
+  bool ok = defaults->ForEachRecord([&](const RecordMap::value_type& pair) {
+    if (pair.second.is_private)
+      return true;
+    const Value* existing_value = GetValue(pair.first);
+    if (existing_value && pair.second.value != *existing_value) {
+      FillValueCollisionError(node_for_err, desc_for_err, pair.first,
+                              pair.second.value, *existing_value, err);
+      return false;
+    }
+    if (!defaults->IsUsed(pair.second)) {
+      unused_bits[pair.second.slot / kBitsPerWord] |=
+          Word(1) << (pair.second.slot % kBitsPerWord);
+    }
+    return true;
+  });
+  if (!ok)
+    return false;
+
+  Modified();
+  target_defaults_layer_ = defaults;
+  target_defaults_unused_bits_ = std::move(unused_bits);
+  return true;
+}
+
+bool Scope::MergeTo(Scope* dest,
+                    const MergeFilter& filter,
+                    bool include_imports,
+                    const ParseNode* node_for_err,
+                    const char* desc_for_err,
+                    Err* err) const {
+  const MergeOptions& options = filter.options();
+  assert(!dest->frozen_);
+  dest->Modified();
+
+  std::vector<const Scope*> layers;
+  if (include_imports)
+    GetImportLayers(&layers);
+
   // Values.
-  for (const auto& pair : values_) {
+  uint64_t merged_count = 0;
+  auto merge_value = [&](const RecordMap::value_type& pair,
+                         bool is_used) -> bool {
     const StringPiece& current_name = pair.first;
-    if (options.skip_private_vars && IsPrivateVar(current_name))
-      continue;  // Skip this private var.
-    if (!options.excluded_values.empty() &&
-        options.excluded_values.find(current_name.as_string()) !=
-            options.excluded_values.end()) {
-      continue;  // Skip this excluded value.
-    }
+    if (filter.ShouldSkip(current_name, pair.second.is_private))
+      return true;  // Skip this private or excluded var.
 
     const Value& new_value = pair.second.value;
     if (!options.clobber_existing) {
       const Value* existing_value = dest->GetValue(current_name);
       if (existing_value && new_value != *existing_value) {
         // Value present in both the source and the dest.
-        std::string desc_string(desc_for_err);
-        *err = Err(node_for_err, "Value collision.",
-            "This " + desc_string + " contains \"" + current_name.as_string() +
-            "\"");
-        err->AppendSubErr(Err(pair.second.value, "defined here.",
-            "Which would clobber the one in your current scope"));
-        err->AppendSubErr(Err(*existing_value, "defined here.",
-            "Executing " + desc_string + " should not conflict with anything "
-            "in the current\nscope unless the values are identical."));
+        FillValueCollisionError(node_for_err, desc_for_err, current_name,
+                                new_value, *existing_value, err);
         return false;
       }
     }
-    dest->values_[current_name] = pair.second;
-
-    if (options.mark_dest_used)
-      dest->MarkUsed(current_name);
+    RecordMap::iterator dest_record = dest->values_.find(current_name);
+    if (dest_record == dest->values_.end())
+      dest_record = dest->AddRecord(current_name);
+    dest_record->second.value = new_value;
+    dest->SetUsed(dest_record->second, options.mark_dest_used || is_used);
+    merged_count++;
+    return true;
+  };
+  bool ok = ForEachRecord([&](const RecordMap::value_type& pair) {
+    return merge_value(pair, IsUsed(pair.second));
+  });
+  if (!ok)
+    return false;
+  // Attached target defaults are merged even into closures, since they're
+  // tracked (and can be modified) like this scope's own values.
+  if (target_defaults_layer_) {
+    ok = target_defaults_layer_->ForEachRecord(
+        [&](const RecordMap::value_type& pair) {
+          return FindCurrentRecord(pair.first) != &pair ||
+                 merge_value(pair, IsTargetDefaultUsed(pair.second));
+        });
+    if (!ok)
+      return false;
+  }
+  for (const Scope* layer : layers) {
+    ok = layer->ForEachRecord([&](const RecordMap::value_type& pair) {
+      // Only merge imported values that are visible from here.
+      return FindCurrentRecord(pair.first) != &pair ||
+             merge_value(pair, layer->IsUsed(pair.second));
+    });
+    if (!ok)
+      return false;
   }
+  // Only |MakeClosure()| doesn't include imports.
+  StatsRecorder::Count(include_imports ? EvaluationStats::MERGED_RECORDS
+                                       : EvaluationStats::CLOSURE_RECORDS,
+                       merged_count);
 
   // Target defaults are owning pointers.
-  for (const auto& pair : target_defaults_) {
+  auto merge_target_defaults = [&](const NamedScopeMap::value_type& pair)
+      -> bool {
     const std::string& current_name = pair.first;
-    if (!options.excluded_values.empty() &&
-        options.excluded_values.find(current_name) !=
-            options.excluded_values.end()) {
-      continue;  // Skip the excluded value.
-    }
+    if (filter.ShouldSkip(current_name, false))
+      return true;  // Skip the excluded value.
 
     if (!options.clobber_existing) {
       const Scope* dest_defaults = dest->GetTargetDefaults(current_name);
       if (dest_defaults) {
-        if (RecordMapValuesEqual(pair.second->values_,
-                                 dest_defaults->values_)) {
+        if (ValuesEqual(*pair.second, *dest_defaults)) {
           // Values of the two defaults are equivalent, just ignore the
           // collision.
-          continue;
+          return true;
         } else {
           // TODO(brettw) it would be nice to know the origin of a
           // set_target_defaults so we can give locations for the colliding
@@ -318,20 +814,27 @@ bool Scope::NonRecursiveMergeTo(Scope* dest,
 
     std::unique_ptr<Scope>& dest_scope = dest->target_defaults_[current_name];
     dest_scope.reset(new Scope(delegate_));
-    pair.second->NonRecursiveMergeTo(dest_scope.get(), options, node_for_err,
+    pair.second->NonRecursiveMergeTo(dest_scope.get(), filter, node_for_err,
                                      "<SHOULDN'T HAPPEN>", err);
+    return true;
+  };
+  for (const auto& pair : target_defaults_) {
+    if (!merge_target_defaults(pair))
+      return false;
+  }
+  for (const Scope* layer : layers) {
+    for (const auto& pair : layer->target_defaults_) {
+      if (FindCurrentTargetDefaults(pair.first) == pair.second.get() &&
+          !merge_target_defaults(pair))
+        return false;
+    }
   }
 
   // Templates.
-  for (const auto& pair : templates_) {
+  auto merge_template = [&](const TemplateMap::value_type& pair) -> bool {
     const std::string& current_name = pair.first;
-    if (options.skip_private_vars && IsPrivateVar(current_name))
-      continue;  // Skip this private template.
-    if (!options.excluded_values.empty() &&
-        options.excluded_values.find(current_name) !=
-            options.excluded_values.end()) {
-      continue;  // Skip the excluded value.
-    }
+    if (filter.ShouldSkip(current_name, IsPrivateVar(current_name)))
+      return true;  // Skip this private or excluded template.
 
     if (!options.clobber_existing) {
       const Template* existing_template = dest->GetTemplate(current_name);
@@ -357,6 +860,18 @@ bool Scope::NonRecursiveMergeTo(Scope* dest,
 
     // Be careful to delete any pointer we're about to clobber.
     dest->templates_[current_name] = pair.second;
+    return true;
+  };
+  for (const auto& pair : templates_) {
+    if (!merge_template(pair))
+      return false;
+  }
+  for (const Scope* layer : layers) {
+    for (const auto& pair : layer->templates_) {
+      if (FindCurrentTemplate(pair.first) == pair.second.get() &&
+          !merge_template(pair))
+        return false;
+    }
   }
 
   return true;
@@ -376,30 +891,104 @@ std::unique_ptr<Scope> Scope::MakeClosure() const {
     // This is a standalone scope, just copy it.
     result.reset(new Scope(delegate_));
   }
+  // Count the closure once, at the top of the mutable scope stack.
+  if (!mutable_containing_)
+    StatsRecorder::Count(EvaluationStats::CLOSURES, 1);
 
   // Want to clobber since we've flattened some nested scopes, and our parent
   // scope may have a duplicate value set.
-  MergeOptions options;
-  options.clobber_existing = true;
-
-  // Add in our variables and we're done.
+  static const MergeFilter filter([]() {
+    MergeOptions options;
+    options.clobber_existing = true;
+    return options;
+  }());
+
+  // Add in our variables and we're done. Attached imports don't change, so
+  // they can just be attached to the closure.
   Err err;
-  NonRecursiveMergeTo(result.get(), options, nullptr, "<SHOULDN'T HAPPEN>",
-                      &err);
+  MergeTo(result.get(), filter, false, nullptr, "<SHOULDN'T HAPPEN>", &err);
   assert(!err.has_error());
+  for (const Scope* import : imports_) {
+    if (std::find(result->imports_.begin(), result->imports_.end(), import) ==
+        result->imports_.end())
+      result->imports_.push_back(import);
+  }
+  return result;
+}
+
+std::unique_ptr<Scope> Scope::MakeSharedClosure() const {
+  ClosureKey key;
+  GetClosureKey(&key);
+  if (!closure_snapshot_ || closure_snapshot_->key() != key) {
+    std::unique_ptr<Scope> snapshot = MakeClosure();
+    // Templates are copied into each closure instead (see below).
+    snapshot->templates_.clear();
+    snapshot->Freeze();
+    closure_snapshot_ =
+        MakeRefCounted<ClosureSnapshot>(std::move(snapshot), std::move(key));
+  }
+
+  std::unique_ptr<Scope> result(new Scope(closure_snapshot_.Clone()));
+  // As in |MakeClosure()|, inner scopes' templates take precedence (|insert()|
+  // doesn't overwrite).
+  for (const Scope* cur = this; cur; cur = cur->mutable_containing_) {
+    for (const auto& pair : cur->templates_)
+      result->templates_.insert(pair);
+  }
   return result;
 }
 
+void Scope::Freeze() {
+  assert(!frozen_);
+  assert(!mutable_containing_);
+  DetachTargetDefaults();
+  Modified();
+  frozen_ = true;
+
+  // Sort by hash (and then name, so the order is well-defined).
+  StringPieceHash hasher;
+  std::vector<std::pair<size_t, RecordMap::iterator>> sorted;
+  sorted.reserve(values_.size());
+  for (RecordMap::iterator it = values_.begin(); it != values_.end(); ++it)
+    sorted.push_back(std::make_pair(hasher(it->first), it));
+  std::sort(sorted.begin(), sorted.end(),
+            [](const std::pair<size_t, RecordMap::iterator>& a,
+               const std::pair<size_t, RecordMap::iterator>& b) {
+              if (a.first != b.first)
+                return a.first < b.first;
+              return a.second->first < b.second->first;
+            });
+
+  // Reserve first, so that the records (which |slots_| points to) don't move.
+  frozen_values_.reserve(sorted.size());
+  frozen_hashes_.reserve(sorted.size());
+  for (const auto& cur : sorted) {
+    frozen_hashes_.push_back(cur.first);
+    frozen_values_.emplace_back(cur.second->first,
+                                std::move(cur.second->second));
+    slots_[frozen_values_.back().second.slot] = &frozen_values_.back();
+  }
+  RecordMap().swap(values_);
+
+  // Frozen values can't be marked used, so they're all considered used.
+  MarkAllUsed();
+
+  for (auto& pair : target_defaults_)
+    pair.second->Freeze();
+}
+
 Scope* Scope::MakeTargetDefaults(const std::string& target_type) {
+  assert(!frozen_);
+  Modified();
   std::unique_ptr<Scope>& dest = target_defaults_[target_type];
   dest.reset(new Scope(delegate_));
   return dest.get();
 }
 
 const Scope* Scope::GetTargetDefaults(const std::string& target_type) const {
-  NamedScopeMap::const_iterator found = target_defaults_.find(target_type);
-  if (found != target_defaults_.end())
-    return found->second.get();
+  const Scope* found = FindCurrentTargetDefaults(target_type);
+  if (found)
+    return found;
   if (containing())
     return containing()->GetTargetDefaults(target_type);
   return nullptr;
@@ -428,7 +1017,7 @@ const SourceDir& Scope::GetSourceDir() const {
   return source_dir_;
 }
 
-Scope::ItemVector* Scope::GetItemCollector() {
+ItemSink* Scope::GetItemCollector() {
   if (item_collector_)
     return item_collector_;
   if (mutable_containing())
@@ -437,20 +1026,28 @@ Scope::ItemVector* Scope::GetItemCollector() {
 }
 
 void Scope::SetProperty(const void* key, void* value) {
+  PropertyMap::iterator found =
+      std::find_if(properties_.begin(), properties_.end(),
+                   [key](const PropertyMap::value_type& property) {
+                     return property.first == key;
+                   });
   if (!value) {
-    assert(properties_.find(key) != properties_.end());
-    properties_.erase(key);
+    assert(found != properties_.end());
+    properties_.erase(found);
+  } else if (found != properties_.end()) {
+    found->second = value;
   } else {
-    properties_[key] = value;
+    properties_.push_back(std::make_pair(key, value));
   }
 }
 
 void* Scope::GetProperty(const void* key, const Scope** found_on_scope) const {
-  PropertyMap::const_iterator found = properties_.find(key);
-  if (found != properties_.end()) {
-    if (found_on_scope)
-      *found_on_scope = this;
-    return found->second;
+  for (const auto& property : properties_) {
+    if (property.first == key) {
+      if (found_on_scope)
+        *found_on_scope = this;
+      return property.second;
+    }
   }
   if (containing())
     return containing()->GetProperty(key, found_on_scope);
@@ -466,18 +1063,189 @@ void Scope::RemoveProvider(ProgrammaticProvider* p) {
   programmatic_providers_.erase(p);
 }
 
+Scope::RecordMap::iterator Scope::AddRecord(const StringPiece& ident) {
+  size_t slot;
+  if (free_slots_.empty()) {
+    // Most scopes (e.g., of templates and items) only have a few values, so
+    // start with room for those rather than growing one at a time.
+    if (slots_.empty())
+      slots_.reserve(kInitialSlotCount);
+    slot = slots_.size();
+    slots_.push_back(nullptr);
+    if (slot % kBitsPerWord == 0)
+      unused_bits_.push_back(0);
+  } else {
+    slot = free_slots_.back();
+    free_slots_.pop_back();
+  }
+
+  // Construct the record in place, rather than moving a temporary (with its
+  // |Value|) into the map.
+  RecordMap::iterator it =
+      values_.emplace(std::piecewise_construct, std::forward_as_tuple(ident),
+                      std::forward_as_tuple(IsPrivateVar(ident), slot))
+          .first;
+  // The element's address is stable, even if |values_| is rehashed.
+  slots_[slot] = &*it;
+  SetUsed(it->second, false);
+  if (target_defaults_layer_) {
+    const RecordMap::value_type* defaulted = FindTargetDefaultsRecord(ident);
+    if (defaulted)
+      SetTargetDefaultUsed(defaulted->second, true);
+  }
+  return it;
+}
+
+void Scope::EraseRecord(RecordMap::iterator it) {
+  SetUsed(it->second, true);
+  slots_[it->second.slot] = nullptr;
+  free_slots_.push_back(it->second.slot);
+  values_.erase(it);
+}
+
+const Scope::RecordMap::value_type* Scope::FindTargetDefaultsRecord(
+    const StringPiece& ident) const {
+  if (IsPrivateVar(ident))
+    return nullptr;  // Private defaults are never visible.
+  return target_defaults_layer_->FindOwnRecord(ident);
+}
+
+Scope::RecordMap::iterator Scope::CopyTargetDefault(
+    const RecordMap::value_type& pair) {
+  bool was_used = IsTargetDefaultUsed(pair.second);
+  RecordMap::iterator it = AddRecord(pair.first);
+  it->second.value = pair.second.value;
+  SetUsed(it->second, was_used);
+  return it;
+}
+
+void Scope::DetachTargetDefaults() {
+  if (!target_defaults_layer_)
+    return;
+  Modified();
+  target_defaults_layer_->ForEachRecord(
+      [this](const RecordMap::value_type& pair) {
+        if (!pair.second.is_private && !FindOwnRecord(pair.first))
+          CopyTargetDefault(pair);
+        return true;
+      });
+  target_defaults_layer_ = nullptr;
+  target_defaults_unused_bits_.clear();
+}
+
+void Scope::GetImportLayers(std::vector<const Scope*>* layers) const {
+  for (const Scope* import : imports_) {
+    if (std::find(layers->begin(), layers->end(), import) != layers->end())
+      continue;  // Imported more than once (e.g., a "diamond").
+    layers->push_back(import);
+    import->GetImportLayers(layers);
+  }
+}
+
+const Scope::RecordMap::value_type* Scope::FindFrozenRecord(
+    const StringPiece& ident) const {
+  size_t hash = StringPieceHash()(ident);
+  size_t i = std::lower_bound(frozen_hashes_.begin(), frozen_hashes_.end(),
+                              hash) -
+             frozen_hashes_.begin();
+  for (; i < frozen_hashes_.size() && frozen_hashes_[i] == hash; i++) {
+    if (frozen_values_[i].first == ident)
+      return &frozen_values_[i];
+  }
+  return nullptr;
+}
+
+const Scope::RecordMap::value_type* Scope::FindCurrentRecord(
+    const StringPiece& ident) const {
+  const RecordMap::value_type* found = FindOwnRecord(ident);
+  if (found)
+    return found;
+  if (target_defaults_layer_) {
+    found = FindTargetDefaultsRecord(ident);
+    if (found)
+      return found;
+  }
+  if (imports_.empty())
+    return nullptr;
+  return FindImportedRecord(ident);
+}
+
+const Template* Scope::FindCurrentTemplate(const std::string& name) const {
+  TemplateMap::const_iterator found = templates_.find(name);
+  if (found != templates_.end())
+    return found->second.get();
+  if (imports_.empty())
+    return nullptr;
+  return FindImportedTemplate(name);
+}
+
+const Scope* Scope::FindCurrentTargetDefaults(const std::string& name) const {
+  NamedScopeMap::const_iterator found = target_defaults_.find(name);
+  if (found != target_defaults_.end())
+    return found->second.get();
+  if (imports_.empty())
+    return nullptr;
+  return FindImportedTargetDefaults(name);
+}
+
+const Scope::RecordMap::value_type* Scope::FindImportedRecord(
+    const StringPiece& ident) const {
+  if (IsPrivateVar(ident))
+    return nullptr;  // Private values are never imported.
+  for (const Scope* import : imports_) {
+    const RecordMap::value_type* found = import->FindCurrentRecord(ident);
+    if (found)
+      return found;
+  }
+  return nullptr;
+}
+
+const Template* Scope::FindImportedTemplate(const std::string& name) const {
+  if (IsPrivateVar(name))
+    return nullptr;  // Private templates are never imported.
+  for (const Scope* import : imports_) {
+    const Template* found = import->FindCurrentTemplate(name);
+    if (found)
+      return found;
+  }
+  return nullptr;
+}
+
+const Scope* Scope::FindImportedTargetDefaults(const std::string& name) const {
+  for (const Scope* import : imports_) {
+    const Scope* found = import->FindCurrentTargetDefaults(name);
+    if (found)
+      return found;
+  }
+  return nullptr;
+}
+
+void Scope::GetClosureKey(ClosureKey* key) const {
+  key->push_back(std::make_pair(this, generation_));
+  for (const auto& pair : target_defaults_)
+    key->push_back(std::make_pair(pair.second.get(), pair.second->generation_));
+  if (target_defaults_layer_) {
+    key->push_back(std::make_pair(target_defaults_layer_,
+                                  target_defaults_layer_->generation_));
+  }
+  // Like |MakeClosure()|, stop at the const containing scope (which won't
+  // change).
+  if (mutable_containing_)
+    mutable_containing_->GetClosureKey(key);
+}
+
 // static
-bool Scope::RecordMapValuesEqual(const RecordMap& a, const RecordMap& b) {
-  if (a.size() != b.size())
+bool Scope::ValuesEqual(const Scope& a, const Scope& b) {
+  if (a.RecordCount() != b.RecordCount())
     return false;
-  for (const auto& pair : a) {
-    const auto& found_b = b.find(pair.first);
-    if (found_b == b.end())
+  return a.ForEachRecord([&b](const RecordMap::value_type& pair) {
+    const RecordMap::value_type* found_b = b.FindOwnRecord(pair.first);
+    if (!found_b)
       return false;  // Item in 'a' but not 'b'.
     if (pair.second.value != found_b->second.value)
       return false;  // Values for variable in 'a' and 'b' are different.
-  }
-  return true;
+    return true;
+  });
 }
 
 }  // namespace icl
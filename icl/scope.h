@@ -5,14 +5,22 @@
 #ifndef ICL_SCOPE_H_
 #define ICL_SCOPE_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <map>
 #include <memory>
 #include <set>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
+#include "icl/allocator.h"
 #include "icl/err.h"
 #include "icl/item.h"
+#include "icl/ref_counted.h"
 #include "icl/ref_ptr.h"
 #include "icl/source_dir.h"
 #include "icl/string_piece.h"
@@ -99,6 +107,35 @@ class Scope {
     std::set<std::string> excluded_values;
   };
 
+  // A compiled form of |MergeOptions|, for doing many merges with the same
+  // options (e.g., applying target defaults to each item). Deciding whether to
+  // skip a variable doesn't allocate: the excluded names are kept in a hash set
+  // of |StringPiece|s and whether a variable is private is cached when it is
+  // set. This is immutable, so it may be shared (e.g., as a static).
+  class MergeFilter {
+   public:
+    explicit MergeFilter(const MergeOptions& options);
+    ~MergeFilter();
+
+    MergeFilter(const MergeFilter&) = delete;
+    MergeFilter& operator=(const MergeFilter&) = delete;
+
+    const MergeOptions& options() const { return options_; }
+
+    // Returns true if the variable (or template, etc.) with the given name
+    // should not be merged.
+    bool ShouldSkip(const StringPiece& name, bool is_private) const {
+      return (options_.skip_private_vars && is_private) ||
+             (!excluded_.empty() && excluded_.find(name) != excluded_.end());
+    }
+
+   private:
+    const MergeOptions options_;
+
+    // Points into |options_.excluded_values|.
+    std::unordered_set<StringPiece, StringPieceHash> excluded_;
+  };
+
   // Creates an empty toplevel scope.
   explicit Scope(Delegate* delegate);
 
@@ -111,6 +148,14 @@ class Scope {
   Scope(const Scope&) = delete;
   Scope& operator=(const Scope&) = delete;
 
+  // Allocated with the current |Allocator|.
+  static void* operator new(size_t size) {
+    return Allocator::AllocateObject(size, Allocator::SCOPE);
+  }
+  static void operator delete(void* ptr, size_t size) {
+    Allocator::FreeObject(ptr, size, Allocator::SCOPE);
+  }
+
   Delegate* delegate() const { return delegate_; }
 
   // See the const_/mutable_containing_ var declaraions below. Yes, it's a
@@ -207,14 +252,43 @@ class Scope {
   // If the identifier is present but hasnn't been used, return true.
   bool IsSetButUnused(const StringPiece& ident) const;
 
+  // Like |IsSetButUnused()|, but for the value that |GetValue()| would find,
+  // searching the containing scopes whose values it would mark used.
+  bool IsSetButUnusedInChain(const StringPiece& ident) const;
+
+  // If set, the names of the values of the const containing scope (which must
+  // be frozen) that this scope, or a mutable scope it contains, looks up
+  // counting as used are added to |*reads|. Not owned. Lookups through a
+  // frozen scope don't mark anything, so this lets the values a snapshot was
+  // made from be marked later (see |MarkUsedFromClosure()|).
+  void set_closure_reads(
+      std::unordered_set<StringPiece, StringPieceHash>* reads) {
+    closure_reads_ = reads;
+  }
+
+  // Marks used the values named in |reads| in this scope, or in whichever of
+  // its mutable containing scopes |GetValue()| would find them (so the values
+  // a closure of this scope took them from).
+  void MarkUsedFromClosure(
+      const std::unordered_set<StringPiece, StringPieceHash>& reads);
+
   // Checks the scope to see if any values were set but not used, and fills in
-  // the error and returns false if they were.
+  // the error and returns false if they were. If there are several, which one
+  // is reported doesn't depend on hashing (it's usually the one set first).
+  // Always succeeds if the delegate says not to check (see
+  // |Delegate::ShouldCheckForUnusedVars()|).
   bool CheckForUnusedVars(Err* err) const;
 
   // Returns all values set in the current scope, without going to the parent
   // scopes.
   void GetCurrentScopeValues(KeyValueMap* output) const;
 
+  // Like |GetCurrentScopeValues()|, but for templates and target defaults.
+  void GetCurrentScopeTemplates(
+      std::map<std::string, const Template*>* output) const;
+  void GetCurrentScopeTargetDefaults(
+      std::map<std::string, const Scope*>* output) const;
+
   // Copies this scope's values into the destination. Values from the
   // containing scope(s) (normally shadowed into the current one) will not be
   // copied, neither will the reference to the containing scope (this is why
@@ -230,15 +304,84 @@ class Scope {
                            const ParseNode* node_for_err,
                            const char* desc_for_err,
                            Err* err) const;
+  bool NonRecursiveMergeTo(Scope* dest,
+                           const MergeFilter& filter,
+                           const ParseNode* node_for_err,
+                           const char* desc_for_err,
+                           Err* err) const;
+
+  // Attaches |import_scope| to this scope as a read-only lookup layer. This is
+  // the zero-copy equivalent of calling |import_scope->NonRecursiveMergeTo()|
+  // with |skip_private_vars| and |mark_dest_used| set: the public values,
+  // templates, and target defaults of |import_scope| become visible in this
+  // scope (shadowed by anything set directly on it), but nothing is copied.
+  //
+  // Collisions are checked at attach time and reported exactly as the merge
+  // would report them (see |NonRecursiveMergeTo()| for |node_for_err| and
+  // |desc_for_err|). Attaching a scope that is already attached is a no-op.
+  //
+  // |import_scope| must not change and must outlive this scope (and any
+  // closures made from it); typically it is a cached import result owned by
+  // the |ImportManager|. Values read from it are never marked used (they
+  // don't need to be), and writing to one copies it into this scope first.
+  bool AttachImport(const Scope* import_scope,
+                    const ParseNode* node_for_err,
+                    const char* desc_for_err,
+                    Err* err);
+
+  // Attaches |defaults| (the target defaults for an item's type, see
+  // |GetTargetDefaults()|) to this scope as a read-only lookup layer. This is
+  // the equivalent of calling |defaults->NonRecursiveMergeTo()| with
+  // |skip_private_vars| set, without copying the values: they are searched
+  // after this scope's own values and before its attached imports, and a
+  // value is only copied into this scope when it's modified. Whether each one
+  // is used is tracked by this scope, just as if it had been merged in.
+  // Collisions are checked at attach time, as for |AttachImport()|.
+  //
+  // |defaults| must not change while it's attached. The layer is merged into
+  // this scope (and detached) if this scope is frozen, or if one of its values
+  // is removed. Only one scope of defaults can be attached; if a scope of
+  // defaults has anything besides values (or this scope already has values),
+  // it's merged instead.
+  bool AttachTargetDefaults(const Scope* defaults,
+                            const ParseNode* node_for_err,
+                            const char* desc_for_err,
+                            Err* err);
 
   // Constructs a scope that is a copy of the current one. Nested scopes will
   // be collapsed until we reach a const containing scope. Private values will
   // be included. The resulting closure will reference the const containing
   // scope as its containing scope (since we assume the const scope won't
-  // change, we don't have to copy its values).
+  // change, we don't have to copy its values). Attached imports are attached
+  // to the closure rather than copied.
   std::unique_ptr<Scope> MakeClosure() const;
 
+  // Like |MakeClosure()|, but cheap to call repeatedly (e.g., for each of many
+  // templates defined one after another). The values, target defaults, and
+  // attached imports are captured in an immutable snapshot, which is shared by
+  // all closures made (by this function, on this scope) until this scope or
+  // one of its mutable containing scopes is next modified. Only templates
+  // (which don't invalidate the snapshot) are copied into the returned scope,
+  // which refers to (and keeps alive) the snapshot as its const containing
+  // scope.
+  std::unique_ptr<Scope> MakeSharedClosure() const;
+
+  // Converts this scope to an immutable, compact representation that is
+  // faster to search: its values are moved into an array sorted by their
+  // (precomputed) hashes, and they are all considered used. Its target
+  // defaults are frozen too. A frozen scope can be shared as a const
+  // containing scope (or attached import) by many threads without locking.
+  //
+  // Call this once the scope is fully built (e.g., a finished import or
+  // closure). It must not have a mutable containing scope, and afterwards it
+  // must not be modified: values can't be set, removed, or marked unused, and
+  // templates, target defaults, and imports can't be added.
+  void Freeze();
+  bool is_frozen() const { return frozen_; }
+
   // Makes an empty scope with the given name. Overwrites any existing one.
+  // Note: The returned scope should be filled in before any closures of this
+  // scope are made.
   Scope* MakeTargetDefaults(const std::string& target_type);
 
   // Gets the scope associated with the given target name, or null if it hasn't
@@ -273,10 +416,10 @@ class Scope {
   //
   // When retrieving the collector, the non-const scopes are recursively
   // queried. The collector is not copied for closures, etc.
-  void set_item_collector(ItemVector* collector) {
+  void set_item_collector(ItemSink* collector) {
     item_collector_ = collector;
   }
-  ItemVector* GetItemCollector();
+  ItemSink* GetItemCollector();
 
   // Properties are opaque pointers that code can use to set state on a Scope
   // that it can retrieve later.
@@ -294,22 +437,150 @@ class Scope {
  private:
   friend class ProgrammaticProvider;
 
+  class ClosureSnapshot;
+
+  // Identifies the state of the scopes captured by a closure: each mutable
+  // scope (and target defaults scope) involved, and its |generation_|.
+  typedef std::vector<std::pair<const Scope*, size_t>> ClosureKey;
+
+  // Creates a scope whose const containing scope is the given snapshot.
+  explicit Scope(RefPtr<const ClosureSnapshot> snapshot);
+
   struct Record {
-    Record() : used(false) {}
-    explicit Record(const Value& v) : used(false), value(v) {}
+    Record(bool is_private, size_t slot) : is_private(is_private), slot(slot) {}
 
-    bool used;  // Set to true when the variable is used.
+    bool is_private;  // Cached result of |IsPrivateVar()| on the name.
+    size_t slot;  // Index into |slots_| and |unused_bits_|.
     Value value;
   };
 
   typedef std::unordered_map<StringPiece, Record, StringPieceHash> RecordMap;
 
+  // Adds a new (unused) record for |ident|, which must not already be set on
+  // this scope. It shadows any attached target default of the same name (which
+  // is then considered used).
+  RecordMap::iterator AddRecord(const StringPiece& ident);
+
+  // Removes the given record, freeing its slot.
+  void EraseRecord(RecordMap::iterator it);
+
+  // Looks up the public value with the given name in the attached target
+  // defaults (which may be shadowed by |values_|). Returns null if there is
+  // none.
+  const RecordMap::value_type* FindTargetDefaultsRecord(
+      const StringPiece& ident) const;
+
+  // Gets/sets whether the given record of the attached target defaults has
+  // been used in this scope.
+  bool IsTargetDefaultUsed(const Record& r) const {
+    return !(target_defaults_unused_bits_[r.slot / kBitsPerWord] &
+             (Word(1) << (r.slot % kBitsPerWord)));
+  }
+  void SetTargetDefaultUsed(const Record& r, bool used) {
+    Word bit = Word(1) << (r.slot % kBitsPerWord);
+    if (used)
+      target_defaults_unused_bits_[r.slot / kBitsPerWord] &= ~bit;
+    else
+      target_defaults_unused_bits_[r.slot / kBitsPerWord] |= bit;
+  }
+
+  // Copies the given record of the attached target defaults into this scope
+  // (keeping whether it was used), so that it can be modified.
+  RecordMap::iterator CopyTargetDefault(const RecordMap::value_type& pair);
+
+  // Copies the attached target defaults that aren't shadowed into this scope,
+  // and detaches them.
+  void DetachTargetDefaults();
+
+  // Looks up the record with the given name on this scope only (not its
+  // attached imports). Returns null if there is none.
+  const RecordMap::value_type* FindOwnRecord(const StringPiece& ident) const {
+    if (frozen_)
+      return FindFrozenRecord(ident);
+    RecordMap::const_iterator found = values_.find(ident);
+    return found != values_.end() ? &*found : nullptr;
+  }
+  const RecordMap::value_type* FindFrozenRecord(const StringPiece& ident) const;
+
+  // Calls |f| on each record on this scope (not its attached imports),
+  // stopping and returning false as soon as |f| returns false.
+  template <typename F>
+  bool ForEachRecord(F f) const {
+    for (const auto& pair : values_) {
+      if (!f(pair))
+        return false;
+    }
+    for (const auto& pair : frozen_values_) {
+      if (!f(pair))
+        return false;
+    }
+    return true;
+  }
+
+  size_t RecordCount() const { return values_.size() + frozen_values_.size(); }
+
+  // Gets/sets whether the given record (which must be in |values_|) has been
+  // used.
+  bool IsUsed(const Record& r) const {
+    return !(unused_bits_[r.slot / kBitsPerWord] &
+             (Word(1) << (r.slot % kBitsPerWord)));
+  }
+  void SetUsed(const Record& r, bool used) {
+    Word bit = Word(1) << (r.slot % kBitsPerWord);
+    if (used)
+      unused_bits_[r.slot / kBitsPerWord] &= ~bit;
+    else
+      unused_bits_[r.slot / kBitsPerWord] |= bit;
+  }
+
   void AddProvider(ProgrammaticProvider* p);
   void RemoveProvider(ProgrammaticProvider* p);
 
-  // Returns true if the two RecordMaps contain the same values (the origins
-  // of the values may be different).
-  static bool RecordMapValuesEqual(const RecordMap& a, const RecordMap& b);
+  // Appends the attached imports of this scope, recursively, to |*layers| in
+  // lookup order.
+  void GetImportLayers(std::vector<const Scope*>* layers) const;
+
+  // Look up the record/template/target defaults with the given name on this
+  // scope and its attached imports, without searching containing scopes.
+  // Returns null if there is none.
+  const RecordMap::value_type* FindCurrentRecord(
+      const StringPiece& ident) const;
+  const Template* FindCurrentTemplate(const std::string& name) const;
+  const Scope* FindCurrentTargetDefaults(const std::string& name) const;
+
+  // Like the above, but only searches attached imports (so only finds public
+  // values and templates).
+  const RecordMap::value_type* FindImportedRecord(
+      const StringPiece& ident) const;
+  const Template* FindImportedTemplate(const std::string& name) const;
+  const Scope* FindImportedTargetDefaults(const std::string& name) const;
+
+  // Implementations of |GetValue()|, which add the number of containing scopes
+  // searched to |*depth|.
+  const Value* GetValueInChain(const StringPiece& ident,
+                               bool counts_as_used,
+                               size_t* depth);
+  const Value* GetValueInChain(const StringPiece& ident, size_t* depth) const;
+
+  // Notes that the contents of this scope (may) have changed, which
+  // invalidates any closure snapshot that includes it.
+  void Modified() { generation_++; }
+
+  // Gets the |ClosureKey| for making a closure of this scope.
+  void GetClosureKey(ClosureKey* key) const;
+
+  // Implementation of |NonRecursiveMergeTo()|. If |include_imports| is false,
+  // values, etc. visible through attached imports are not merged.
+  bool MergeTo(Scope* dest,
+               const MergeFilter& filter,
+               bool include_imports,
+               const ParseNode* node_for_err,
+               const char* desc_for_err,
+               Err* err) const;
+
+  // Returns true if the two scopes contain the same values (the origins of the
+  // values may be different), not counting attached imports.
+  static bool ValuesEqual(const Scope& a, const Scope& b);
 
   // Scopes can have no containing scope (both null), a mutable containing
   // scope, or a const containing scope. The reason is that when we're doing
@@ -324,8 +595,49 @@ class Scope {
 
   bool is_processing_import_;
 
+  // Incremented whenever the values, target defaults, imports, or containing
+  // scope of this scope (may) change. See |MakeSharedClosure()|.
+  size_t generation_;
+
+  // The most recent snapshot made by |MakeSharedClosure()|, which may be
+  // reused if it's still valid.
+  mutable RefPtr<const ClosureSnapshot> closure_snapshot_;
+
+  // If |const_containing_| is a shared closure snapshot, keeps it alive.
+  RefPtr<const ClosureSnapshot> const_containing_snapshot_;
+
   RecordMap values_;
 
+  // Each record in |values_| has a slot, which indexes |slots_| (pointing back
+  // at the record) and a bit in |unused_bits_| (set while the record is
+  // unused). This makes marking cheap once a record has been found, and lets
+  // |MarkAllUsed()| and |CheckForUnusedVars()| work a word at a time. Slots of
+  // removed records are null (and their bits clear) until reused.
+  typedef uint64_t Word;
+  static const size_t kBitsPerWord = 64;
+  std::vector<const RecordMap::value_type*> slots_;
+  std::vector<Word> unused_bits_;
+  std::vector<size_t> free_slots_;
+
+  // Once the scope is frozen, |values_| is empty and the records are instead
+  // in |frozen_values_|, sorted by hash (given by the same entry of
+  // |frozen_hashes_|) and then by name. See |Freeze()|.
+  bool frozen_;
+  std::vector<RecordMap::value_type> frozen_values_;
+  std::vector<size_t> frozen_hashes_;
+
+  // Read-only lookup layers, searched (in order) after |values_| and before
+  // the containing scope. Not owned. See |AttachImport()|.
+  std::vector<const Scope*> imports_;
+
+  // A read-only lookup layer of target defaults, searched after |values_| and
+  // before |imports_|, or null. Not owned. Its public records are used or
+  // unused in this scope according to the bits (indexed by their slots) of
+  // |target_defaults_unused_bits_|, which are cleared once a record is
+  // shadowed by |values_|. See |AttachTargetDefaults()|.
+  const Scope* target_defaults_layer_;
+  std::vector<Word> target_defaults_unused_bits_;
+
   // Note that this can't use string pieces since the names are constructed from
   // Values which might be deallocated before this goes out of scope.
   typedef std::unordered_map<std::string, std::unique_ptr<Scope>> NamedScopeMap;
@@ -335,10 +647,15 @@ class Scope {
   typedef std::map<std::string, RefPtr<const Template>> TemplateMap;
   TemplateMap templates_;
 
-  ItemVector* item_collector_;
+  ItemSink* item_collector_;
+
+  // See |set_closure_reads()|. Null if not set.
+  std::unordered_set<StringPiece, StringPieceHash>* closure_reads_;
 
-  // Opaque pointers. See SetProperty() above.
-  typedef std::map<const void*, void*> PropertyMap;
+  // Opaque pointers. See SetProperty() above. There are only ever a few (and
+  // they're set and cleared for each template invocation, etc.), so a vector
+  // is cheaper than a map.
+  typedef std::vector<std::pair<const void*, void*>> PropertyMap;
   PropertyMap properties_;
 
   typedef std::set<ProgrammaticProvider*> ProviderSet;
@@ -194,6 +194,249 @@ TEST(Scope, NonRecursiveMergeTo) {
     EXPECT_TRUE(new_scope.CheckForUnusedVars(&err));
     EXPECT_FALSE(err.has_error());
   }
+
+  // Excluded values and templates, using a reusable filter.
+  {
+    Scope::MergeOptions options;
+    options.excluded_values.insert("v");
+    options.excluded_values.insert("templ");
+    const Scope::MergeFilter filter(options);
+
+    for (int i = 0; i < 2; i++) {
+      Scope new_scope(&setup);
+
+      Err err;
+      EXPECT_TRUE(setup.scope()->NonRecursiveMergeTo(
+          &new_scope, filter, &assignment, "error", &err));
+      EXPECT_FALSE(err.has_error());
+      EXPECT_FALSE(new_scope.GetValue("v"));
+      EXPECT_TRUE(new_scope.GetValue(private_var_name));
+      EXPECT_FALSE(new_scope.GetTemplate("templ"));
+      EXPECT_TRUE(new_scope.GetTemplate("_templ"));
+    }
+  }
+}
+
+TEST(Scope, AttachImport) {
+  TestWithScope setup;
+
+  // Make a pretend parse node with proper tracking that we can blame for the
+  // given value.
+  InputFile input_file(SourceFile("//foo"));
+  Token assignment_token(Location(&input_file, 1, 1, 1), Token::STRING,
+      "\"hello\"");
+  LiteralNode assignment;
+  assignment.set_value(assignment_token);
+
+  // The "imported" scope, with public and private values and templates.
+  Scope import_scope(&setup);
+  Value value(&assignment, "hello");
+  import_scope.SetValue("v", value, &assignment);
+  import_scope.SetValue("_private", value, &assignment);
+  FunctionCallNode templ_definition;
+  auto templ = MakeRefCounted<Template>(&import_scope, &templ_definition);
+  import_scope.AddTemplate("templ", templ.Clone());
+  import_scope.AddTemplate(
+      "_templ", MakeRefCounted<Template>(&import_scope, &templ_definition));
+
+  // Public values and templates are visible, but not copied.
+  {
+    Scope new_scope(&setup);
+
+    Err err;
+    EXPECT_TRUE(new_scope.AttachImport(&import_scope, &assignment, "error",
+                                       &err));
+    EXPECT_FALSE(err.has_error());
+    EXPECT_EQ(import_scope.GetValue("v"), new_scope.GetValue("v"));
+    EXPECT_FALSE(new_scope.GetValue("_private"));
+    EXPECT_EQ(templ.get(), new_scope.GetTemplate("templ"));
+    EXPECT_FALSE(new_scope.GetTemplate("_templ"));
+    EXPECT_TRUE(new_scope.HasValues(Scope::SEARCH_CURRENT));
+
+    // Imported values don't need to be used.
+    EXPECT_TRUE(new_scope.CheckForUnusedVars(&err));
+
+    // Attaching the same scope again is fine.
+    EXPECT_TRUE(new_scope.AttachImport(&import_scope, &assignment, "error",
+                                       &err));
+    EXPECT_FALSE(err.has_error());
+
+    // Setting a value shadows the imported one.
+    new_scope.SetValue("v", Value(&assignment, "goodbye"), &assignment);
+    EXPECT_TRUE(HasStringValueEqualTo(&new_scope, "v", "goodbye"));
+    EXPECT_TRUE(HasStringValueEqualTo(&import_scope, "v", "hello"));
+
+    // Attaching it again now collides with the shadowing value, as merging it
+    // again would.
+    EXPECT_FALSE(new_scope.AttachImport(&import_scope, &assignment, "error",
+                                        &err));
+    EXPECT_TRUE(err.has_error());
+  }
+
+  // Getting a mutable value copies it into the importing scope.
+  {
+    Scope new_scope(&setup);
+
+    Err err;
+    EXPECT_TRUE(new_scope.AttachImport(&import_scope, &assignment, "error",
+                                       &err));
+    Value* mutable_value =
+        new_scope.GetMutableValue("v", Scope::SEARCH_CURRENT, false);
+    ASSERT_TRUE(mutable_value);
+    EXPECT_NE(import_scope.GetValue("v"), mutable_value);
+    mutable_value->string_value() = "goodbye";
+    EXPECT_TRUE(HasStringValueEqualTo(&new_scope, "v", "goodbye"));
+    EXPECT_TRUE(HasStringValueEqualTo(&import_scope, "v", "hello"));
+  }
+
+  // Detect collisions of values' values.
+  {
+    Scope new_scope(&setup);
+    new_scope.SetValue("v", Value(&assignment, "goodbye"), &assignment);
+
+    Err err;
+    EXPECT_FALSE(new_scope.AttachImport(&import_scope, &assignment, "error",
+                                        &err));
+    EXPECT_TRUE(err.has_error());
+  }
+
+  // Template name collisions.
+  {
+    Scope new_scope(&setup);
+    new_scope.AddTemplate(
+        "templ", MakeRefCounted<Template>(&new_scope, &templ_definition));
+
+    Err err;
+    EXPECT_FALSE(new_scope.AttachImport(&import_scope, &assignment, "error",
+                                        &err));
+    EXPECT_TRUE(err.has_error());
+  }
+
+  // Imports of imports are visible, and closures keep the imports.
+  {
+    Scope outer_import_scope(&setup);
+    Err err;
+    EXPECT_TRUE(outer_import_scope.AttachImport(&import_scope, &assignment,
+                                                "error", &err));
+
+    Scope new_scope(&setup);
+    EXPECT_TRUE(new_scope.AttachImport(&outer_import_scope, &assignment,
+                                       "error", &err));
+    EXPECT_TRUE(HasStringValueEqualTo(&new_scope, "v", "hello"));
+
+    std::unique_ptr<Scope> closure = new_scope.MakeClosure();
+    EXPECT_EQ(import_scope.GetValue("v"), closure->GetValue("v"));
+    EXPECT_EQ(templ.get(), closure->GetTemplate("templ"));
+  }
+
+  // Merging a scope with imports copies the imported values.
+  {
+    Scope new_scope(&setup);
+    Err err;
+    EXPECT_TRUE(new_scope.AttachImport(&import_scope, &assignment, "error",
+                                       &err));
+
+    Scope dest_scope(&setup);
+    EXPECT_TRUE(new_scope.NonRecursiveMergeTo(
+        &dest_scope, Scope::MergeOptions(), &assignment, "error", &err));
+    EXPECT_TRUE(HasStringValueEqualTo(&dest_scope, "v", "hello"));
+    EXPECT_NE(import_scope.GetValue("v"), dest_scope.GetValue("v"));
+    EXPECT_EQ(templ.get(), dest_scope.GetTemplate("templ"));
+  }
+}
+
+TEST(Scope, AttachTargetDefaults) {
+  TestWithScope setup;
+
+  InputFile input_file(SourceFile("//foo"));
+  Token assignment_token(Location(&input_file, 1, 1, 1), Token::STRING,
+      "\"hello\"");
+  LiteralNode assignment;
+  assignment.set_value(assignment_token);
+  Value value(&assignment, "hello");
+
+  // The defaults, with an unused value "v", a used value "w", and a private
+  // value.
+  Scope defaults(&setup);
+  defaults.SetValue("v", value, &assignment);
+  defaults.SetValue("w", value, &assignment);
+  defaults.MarkUsed("w");
+  defaults.SetValue("_private", value, &assignment);
+
+  // Public values are visible, but not copied, and are used (or not) in the
+  // scope they're attached to, as if they had been merged.
+  {
+    Scope new_scope(setup.scope());
+    Err err;
+    EXPECT_TRUE(new_scope.AttachTargetDefaults(&defaults, &assignment,
+                                               "error", &err));
+    EXPECT_FALSE(err.has_error());
+    EXPECT_EQ(defaults.GetValue("v"), new_scope.GetValue("v"));
+    EXPECT_FALSE(new_scope.GetValue("_private"));
+    EXPECT_TRUE(new_scope.HasValues(Scope::SEARCH_CURRENT));
+
+    EXPECT_TRUE(new_scope.IsSetButUnused("v"));
+    EXPECT_FALSE(new_scope.IsSetButUnused("w"));
+    EXPECT_FALSE(new_scope.CheckForUnusedVars(&err));
+    EXPECT_TRUE(new_scope.GetValue("v", true));
+    err = Err();
+    EXPECT_TRUE(new_scope.CheckForUnusedVars(&err));
+    EXPECT_TRUE(defaults.IsSetButUnused("v"));
+
+    // Closures include the defaults.
+    new_scope.MarkUnused("v");
+    std::unique_ptr<Scope> closure = new_scope.MakeClosure();
+    EXPECT_TRUE(HasStringValueEqualTo(closure.get(), "v", "hello"));
+    EXPECT_NE(defaults.GetValue("v"), closure->GetValue("v"));
+    EXPECT_TRUE(closure->IsSetButUnused("v"));
+  }
+
+  // Getting a mutable value copies it into the scope, keeping whether it was
+  // used.
+  {
+    Scope new_scope(setup.scope());
+    Err err;
+    EXPECT_TRUE(new_scope.AttachTargetDefaults(&defaults, &assignment,
+                                               "error", &err));
+    Value* mutable_value =
+        new_scope.GetMutableValue("v", Scope::SEARCH_CURRENT, false);
+    ASSERT_TRUE(mutable_value);
+    EXPECT_NE(defaults.GetValue("v"), mutable_value);
+    mutable_value->string_value() = "goodbye";
+    EXPECT_TRUE(HasStringValueEqualTo(&new_scope, "v", "goodbye"));
+    EXPECT_TRUE(HasStringValueEqualTo(&defaults, "v", "hello"));
+    EXPECT_TRUE(new_scope.IsSetButUnused("v"));
+  }
+
+  // So does setting one, and removing one removes only that one.
+  {
+    Scope new_scope(setup.scope());
+    Err err;
+    EXPECT_TRUE(new_scope.AttachTargetDefaults(&defaults, &assignment,
+                                               "error", &err));
+    new_scope.SetValue("v", Value(&assignment, "goodbye"), &assignment);
+    new_scope.SetValue("w", Value(&assignment, "goodbye"), &assignment);
+    EXPECT_TRUE(new_scope.IsSetButUnused("v"));
+    EXPECT_FALSE(new_scope.IsSetButUnused("w"));
+
+    new_scope.RemoveIdentifier("w");
+    EXPECT_FALSE(new_scope.GetValue("w"));
+    EXPECT_TRUE(HasStringValueEqualTo(&new_scope, "v", "goodbye"));
+    EXPECT_TRUE(HasStringValueEqualTo(&defaults, "w", "hello"));
+  }
+
+  // Detect collisions with values in containing scopes.
+  {
+    Scope outer_scope(setup.scope());
+    outer_scope.SetValue("v", Value(&assignment, "goodbye"), &assignment);
+    Scope new_scope(&outer_scope);
+
+    Err err;
+    EXPECT_FALSE(new_scope.AttachTargetDefaults(&defaults, &assignment,
+                                                "error", &err));
+    EXPECT_TRUE(err.has_error());
+    EXPECT_EQ("Value collision.", err.message());
+  }
 }
 
 TEST(Scope, MakeClosure) {
@@ -232,6 +475,109 @@ TEST(Scope, MakeClosure) {
   EXPECT_TRUE(HasStringValueEqualTo(result.get(), "on_two", "on_two2"));
 }
 
+TEST(Scope, MakeSharedClosure) {
+  TestWithScope setup;
+
+  // Make a pretend parse node with proper tracking that we can blame for the
+  // given value.
+  InputFile input_file(SourceFile("//foo"));
+  Token assignment_token(Location(&input_file, 1, 1, 1), Token::STRING,
+      "\"hello\"");
+  LiteralNode assignment;
+  assignment.set_value(assignment_token);
+  setup.scope()->SetValue("on_root", Value(&assignment, "on_root"),
+                           &assignment);
+
+  Scope nested1(static_cast<const Scope*>(setup.scope()));
+  nested1.SetValue("on_one", Value(&assignment, "on_one"), &assignment);
+  Scope nested2(&nested1);
+  nested2.SetValue("on_two", Value(&assignment, "on_two"), &assignment);
+
+  std::unique_ptr<Scope> closure1 = nested2.MakeSharedClosure();
+  EXPECT_TRUE(HasStringValueEqualTo(closure1.get(), "on_root", "on_root"));
+  EXPECT_TRUE(HasStringValueEqualTo(closure1.get(), "on_one", "on_one"));
+  EXPECT_TRUE(HasStringValueEqualTo(closure1.get(), "on_two", "on_two"));
+
+  // Adding a template doesn't invalidate the snapshot, but the template is
+  // visible in later closures.
+  FunctionCallNode templ_definition;
+  nested2.AddTemplate(
+      "templ", MakeRefCounted<Template>(&nested2, &templ_definition));
+  std::unique_ptr<Scope> closure2 = nested2.MakeSharedClosure();
+  EXPECT_EQ(closure1->containing(), closure2->containing());
+  EXPECT_FALSE(closure1->GetTemplate("templ"));
+  EXPECT_TRUE(closure2->GetTemplate("templ"));
+
+  // Modifying any of the mutable scopes makes a new snapshot.
+  nested1.SetValue("on_one", Value(&assignment, "on_one2"), &assignment);
+  std::unique_ptr<Scope> closure3 = nested2.MakeSharedClosure();
+  EXPECT_NE(closure2->containing(), closure3->containing());
+  EXPECT_TRUE(HasStringValueEqualTo(closure2.get(), "on_one", "on_one"));
+  EXPECT_TRUE(HasStringValueEqualTo(closure3.get(), "on_one", "on_one2"));
+  EXPECT_TRUE(closure3->GetTemplate("templ"));
+
+  // Snapshots outlive the closures that share them.
+  closure3.reset();
+  EXPECT_TRUE(HasStringValueEqualTo(nested2.MakeSharedClosure().get(),
+                                    "on_one", "on_one2"));
+}
+
+TEST(Scope, Freeze) {
+  TestWithScope setup;
+
+  InputFile input_file(SourceFile("//foo"));
+  Token assignment_token(Location(&input_file, 1, 1, 1), Token::STRING,
+      "\"hello\"");
+  LiteralNode assignment;
+  assignment.set_value(assignment_token);
+  Value value(&assignment, "hello");
+
+  std::vector<std::string> names;
+  for (int i = 0; i < 100; i++)
+    names.push_back("v" + std::to_string(i));
+
+  Scope frozen(&setup);
+  for (const auto& name : names)
+    frozen.SetValue(name, Value(&assignment, name), &assignment);
+  frozen.SetValue("_private", value, &assignment);
+  frozen.MakeTargetDefaults("foo")->SetValue("a", value, &assignment);
+  EXPECT_FALSE(frozen.is_frozen());
+  frozen.Freeze();
+  EXPECT_TRUE(frozen.is_frozen());
+  EXPECT_TRUE(frozen.GetTargetDefaults("foo")->is_frozen());
+
+  // All the values can still be found, and are considered used.
+  for (const auto& name : names)
+    EXPECT_TRUE(HasStringValueEqualTo(&frozen, name.c_str(), name.c_str()));
+  EXPECT_FALSE(frozen.GetValue("v100"));
+  EXPECT_EQ("v5", frozen.GetStorageKey("v5"));
+  EXPECT_FALSE(frozen.GetMutableValue("v5", Scope::SEARCH_CURRENT, true));
+  Err err;
+  EXPECT_TRUE(frozen.CheckForUnusedVars(&err));
+  Scope::KeyValueMap values;
+  frozen.GetCurrentScopeValues(&values);
+  EXPECT_EQ(101u, values.size());
+
+  // Frozen scopes can be containing scopes, and attached or merged.
+  Scope child(static_cast<const Scope*>(&frozen));
+  EXPECT_TRUE(HasStringValueEqualTo(&child, "v42", "v42"));
+
+  Scope importer(&setup);
+  EXPECT_TRUE(importer.AttachImport(&frozen, nullptr, "import", &err));
+  EXPECT_TRUE(HasStringValueEqualTo(&importer, "v7", "v7"));
+  EXPECT_FALSE(importer.GetValue("_private"));
+
+  Scope merged(&setup);
+  Scope::MergeOptions options;
+  options.skip_private_vars = true;
+  EXPECT_TRUE(
+      frozen.NonRecursiveMergeTo(&merged, options, nullptr, "import", &err));
+  EXPECT_TRUE(HasStringValueEqualTo(&merged, "v99", "v99"));
+  EXPECT_FALSE(merged.GetValue("_private"));
+  EXPECT_TRUE(merged.GetTargetDefaults("foo"));
+  EXPECT_FALSE(merged.IsSetButUnused("v99"));
+}
+
 TEST(Scope, GetMutableValue) {
   TestWithScope setup;
 
@@ -300,5 +646,75 @@ TEST(Scope, RemovePrivateIdentifiers) {
   EXPECT_FALSE(setup.scope()->GetValue("_b"));
 }
 
+TEST(Scope, UnusedVars) {
+  // Doesn't check for unused vars.
+  class TrustingTestWithScope : public TestWithScope {
+   public:
+    bool ShouldCheckForUnusedVars() const override { return false; }
+  };
+
+  TestWithScope setup;
+
+  InputFile input_file(SourceFile("//foo"));
+  Token assignment_token(Location(&input_file, 1, 1, 1), Token::STRING,
+      "\"hello\"");
+  LiteralNode assignment;
+  assignment.set_value(assignment_token);
+  Value value(&assignment, "hello");
+
+  // Use enough variables to need several words of bits.
+  std::vector<std::string> names;
+  for (int i = 0; i < 150; i++)
+    names.push_back("v" + std::to_string(i));
+
+  Scope scope(setup.scope());
+  for (const auto& name : names)
+    scope.SetValue(name, value, &assignment);
+  Err err;
+  EXPECT_FALSE(scope.CheckForUnusedVars(&err));
+
+  for (const auto& name : names) {
+    if (name != "v130") {
+      EXPECT_TRUE(scope.GetValue(name, true));
+    }
+  }
+  err = Err();
+  EXPECT_FALSE(scope.CheckForUnusedVars(&err));
+  EXPECT_TRUE(scope.IsSetButUnused("v130"));
+  EXPECT_FALSE(scope.IsSetButUnused("v129"));
+
+  // Removing the unused var frees its slot, and a new var reusing it starts
+  // out unused.
+  scope.RemoveIdentifier("v130");
+  err = Err();
+  EXPECT_TRUE(scope.CheckForUnusedVars(&err));
+  scope.SetValue("new", value, &assignment);
+  EXPECT_TRUE(scope.IsSetButUnused("new"));
+  err = Err();
+  EXPECT_FALSE(scope.CheckForUnusedVars(&err));
+
+  scope.MarkUnused("v5");
+  scope.MarkAllUsed();
+  err = Err();
+  EXPECT_TRUE(scope.CheckForUnusedVars(&err));
+  EXPECT_FALSE(scope.IsSetButUnused("new"));
+
+  // Merging preserves whether values are used.
+  scope.MarkUnused("v5");
+  Scope merged(setup.scope());
+  EXPECT_TRUE(scope.NonRecursiveMergeTo(&merged, Scope::MergeOptions(), nullptr,
+                                        "test", &err));
+  EXPECT_TRUE(merged.IsSetButUnused("v5"));
+  EXPECT_FALSE(merged.IsSetButUnused("v6"));
+
+  // Unused vars aren't reported if the delegate says not to check.
+  TrustingTestWithScope trusting_setup;
+  Scope trusting_scope(trusting_setup.scope());
+  trusting_scope.SetValue("a", value, &assignment);
+  EXPECT_TRUE(trusting_scope.IsSetButUnused("a"));
+  err = Err();
+  EXPECT_TRUE(trusting_scope.CheckForUnusedVars(&err));
+}
+
 }  // namespace
 }  // namespace icl
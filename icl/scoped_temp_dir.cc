@@ -0,0 +1,34 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/scoped_temp_dir.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace icl {
+
+ScopedTempDir::ScopedTempDir() {
+  char path[] = "/tmp/icl_test_XXXXXX";
+  char* created = mkdtemp(path);
+  assert(created);
+  (void)created;
+  path_ = path;
+}
+
+ScopedTempDir::~ScopedTempDir() {
+  if (DIR* dir = opendir(path_.c_str())) {
+    while (dirent* entry = readdir(dir)) {
+      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+        unlink((path_ + "/" + entry->d_name).c_str());
+    }
+    closedir(dir);
+  }
+  rmdir(path_.c_str());
+}
+
+}  // namespace icl
@@ -0,0 +1,30 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_SCOPED_TEMP_DIR_H_
+#define ICL_SCOPED_TEMP_DIR_H_
+
+#include <string>
+
+namespace icl {
+
+// A new, empty directory under /tmp, for tests. It's removed (along with the
+// files in it, which mustn't include directories) when this is destroyed.
+class ScopedTempDir {
+ public:
+  ScopedTempDir();
+  ~ScopedTempDir();
+
+  ScopedTempDir(const ScopedTempDir&) = delete;
+  ScopedTempDir& operator=(const ScopedTempDir&) = delete;
+
+  const std::string& path() const { return path_; }
+
+ private:
+  std::string path_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_SCOPED_TEMP_DIR_H_
@@ -0,0 +1,25 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_SHA256_H_
+#define ICL_SHA256_H_
+
+#include <stddef.h>
+
+#include <string>
+
+#include "icl/string_piece.h"
+
+namespace icl {
+
+const size_t kSha256Length = 32;
+
+// Returns the SHA-256 digest of |data| (|kSha256Length| bytes). Unlike
+// |HashBytes()|, this is strong enough that different data can be assumed to
+// have different digests, so it can stand in for data that's been freed.
+std::string Sha256(const StringPiece& data);
+
+}  // namespace icl
+
+#endif  // ICL_SHA256_H_
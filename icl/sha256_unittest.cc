@@ -0,0 +1,40 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/sha256.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+
+#include <string>
+
+namespace icl {
+namespace {
+
+std::string Hex(const std::string& digest) {
+  std::string hex;
+  for (char c : digest) {
+    char buf[3];
+    snprintf(buf, sizeof(buf), "%02x", static_cast<unsigned char>(c));
+    hex += buf;
+  }
+  return hex;
+}
+
+TEST(Sha256, KnownDigests) {
+  EXPECT_EQ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+            Hex(Sha256("")));
+  EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+            Hex(Sha256("abc")));
+  // Padding takes a second block.
+  EXPECT_EQ("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+            Hex(Sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmno"
+                       "mnopnopq")));
+  EXPECT_EQ("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+            Hex(Sha256(std::string(1000000, 'a'))));
+}
+
+}  // namespace
+}  // namespace icl
@@ -11,6 +11,7 @@
 #include <string.h>
 
 #include "icl/err.h"
+#include "icl/evaluation_stats.h"
 #include "icl/input_file.h"
 #include "icl/parser.h"
 #include "icl/scope.h"
@@ -99,6 +100,9 @@ bool AppendInterpolatedExpression(Scope* scope,
   }
 
   // Parse.
+  StatsRecorder::Count(EvaluationStats::STRING_EXPRESSION_PARSES, 1);
+  StatsRecorder::Count(EvaluationStats::BYTES_PARSED,
+                       input_file.contents().size());
   std::unique_ptr<ParseNode> node = Parser::ParseExpression(tokens, err);
   if (err->has_error()) {
     // Rewrite error as above.
@@ -4,12 +4,23 @@
 
 #include "icl/template.h"
 
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
 #include <utility>
 
+#include "icl/binary_io.h"
+#include "icl/delegate.h"
 #include "icl/err.h"
+#include "icl/evaluation_stats.h"
 #include "icl/function.h"
+#include "icl/item.h"
 #include "icl/parse_tree.h"
 #include "icl/scope.h"
+#include "icl/template_cache.h"
+#include "icl/tokenizer.h"
+#include "icl/tracer.h"
 //FIXME
 //#include "icl/scope_per_file_provider.h"
 #include "icl/value.h"
@@ -17,12 +28,179 @@
 
 namespace icl {
 
+namespace {
+
+// Checks whether a template's code is pure (see |Template::is_pure()|),
+// collecting the names of the invoker's members that it reads.
+class PurityChecker {
+ public:
+  PurityChecker(const Scope* closure, std::vector<std::string>* invoker_members)
+      : closure_(closure), invoker_members_(invoker_members) {}
+  ~PurityChecker() = default;
+
+  PurityChecker(const PurityChecker&) = delete;
+  PurityChecker& operator=(const PurityChecker&) = delete;
+
+  bool IsPure(const ParseNode* node) {
+    if (!node)
+      return true;
+    if (const AccessorNode* accessor = node->AsAccessor()) {
+      if (accessor->base().value() != variables::kInvoker)
+        return IsPure(accessor->index());
+      if (!accessor->member())
+        return false;  // "invoker[...]".
+      AddInvokerMember(accessor->member()->value().value());
+      return true;
+    }
+    if (const BinaryOpNode* binary_op = node->AsBinaryOp())
+      return IsPure(binary_op->left()) && IsPure(binary_op->right());
+    if (const BlockNode* block = node->AsBlock()) {
+      for (const auto& statement : block->statements()) {
+        if (!IsPure(statement.get()))
+          return false;
+      }
+      return true;
+    }
+    if (const ConditionNode* condition = node->AsConditionNode()) {
+      return IsPure(condition->condition()) && IsPure(condition->if_true()) &&
+             IsPure(condition->if_false());
+    }
+    if (const FunctionCallNode* function_call = node->AsFunctionCall()) {
+      return IsPureFunction(function_call->function().value()) &&
+             IsPure(function_call->args()) && IsPure(function_call->block());
+    }
+    if (const IdentifierNode* identifier = node->AsIdentifier())
+      return identifier->value().value() != variables::kInvoker;
+    if (const ListNode* list = node->AsList()) {
+      for (const auto& item : list->contents()) {
+        if (!IsPure(item.get()))
+          return false;
+      }
+      return true;
+    }
+    if (const LiteralNode* literal = node->AsLiteral()) {
+      return literal->value().type() != Token::STRING ||
+             IsPureString(literal->value().value());
+    }
+    if (const UnaryOpNode* unary_op = node->AsUnaryOp())
+      return IsPure(unary_op->operand());
+    return true;  // Comments.
+  }
+
+ private:
+  bool IsPureFunction(const StringPiece& name) {
+    const FunctionMap& functions = closure_->delegate()->GetFunctions();
+    FunctionMap::const_iterator found = functions.find(name);
+    if (found != functions.end())
+      return found->second->IsPure();
+    const Template* templ = closure_->GetTemplate(name.as_string());
+    return templ && templ->is_pure();
+  }
+
+  // Expressions in strings are only parsed when the string is evaluated, so
+  // this just allows "invoker" in ones like "${invoker.name}".
+  bool IsPureString(const StringPiece& value) {
+    if (value.find('$') == StringPiece::npos)
+      return true;
+    const size_t invoker_size = strlen(variables::kInvoker);
+    for (size_t pos = value.find(variables::kInvoker); pos != StringPiece::npos;
+         pos = value.find(variables::kInvoker, pos)) {
+      if (pos < 2 || value.substr(pos - 2, 2) != "${" ||
+          value.substr(pos + invoker_size, 1) != ".")
+        return false;
+      size_t name_begin = pos + invoker_size + 1;
+      size_t name_end = name_begin;
+      while (name_end < value.size() &&
+             Tokenizer::IsIdentifierContinuingChar(value[name_end]))
+        name_end++;
+      if (name_end == name_begin || value.substr(name_end, 1) != "}")
+        return false;
+      AddInvokerMember(value.substr(name_begin, name_end - name_begin));
+      pos = name_end;
+    }
+    return true;
+  }
+
+  void AddInvokerMember(const StringPiece& name) {
+    if (std::find(invoker_members_->begin(), invoker_members_->end(), name) ==
+        invoker_members_->end())
+      invoker_members_->push_back(name.as_string());
+  }
+
+  const Scope* const closure_;
+  std::vector<std::string>* const invoker_members_;
+};
+
+// Passes items on to another sink, keeping copies of them for the
+// |TemplateCache|.
+class RecordingItemSink : public ItemSink {
+ public:
+  explicit RecordingItemSink(ItemSink* sink) : sink_(sink), complete_(true) {}
+  ~RecordingItemSink() override = default;
+
+  // Whether all the items could be copied.
+  bool complete() const { return complete_; }
+  std::vector<std::unique_ptr<Item>>* items() { return &items_; }
+
+  // |ItemSink| method:
+  void AddItem(std::unique_ptr<Item> item) override {
+    if (complete_) {
+      std::unique_ptr<Item> copy = item->Clone();
+      if (copy) {
+        items_.push_back(std::move(copy));
+      } else {
+        complete_ = false;
+        items_.clear();
+      }
+    }
+    sink_->AddItem(std::move(item));
+  }
+
+ private:
+  ItemSink* const sink_;
+  bool complete_;
+  std::vector<std::unique_ptr<Item>> items_;
+};
+
+// Appends |value| to a |TemplateCache| key. Returns false for scopes (which
+// can't be compared).
+bool WriteKeyValue(const Value& value, std::string* key) {
+  WriteVarint(value.type(), key);
+  switch (value.type()) {
+    case Value::NONE:
+      return true;
+    case Value::BOOLEAN:
+      WriteVarint(value.boolean_value() ? 1 : 0, key);
+      return true;
+    case Value::INTEGER:
+      WriteSignedVarint(value.int_value(), key);
+      return true;
+    case Value::STRING:
+      WriteString(value.string_value(), key);
+      return true;
+    case Value::LIST:
+      WriteVarint(value.list_value().size(), key);
+      for (const auto& item : value.list_value()) {
+        if (!WriteKeyValue(item, key))
+          return false;
+      }
+      return true;
+    case Value::SCOPE:
+      return false;
+  }
+  return false;
+}
+
+}  // namespace
+
 Value Template::Invoke(Scope* scope,
                        const FunctionCallNode* invocation,
                        const std::string& template_name,
                        const std::vector<Value>& args,
                        BlockNode* block,
                        Err* err) const {
+  Tracer::Span span("template", template_name, invocation);
+
   // Don't allow templates to be executed from imported files. Imports are for
   // simple values only.
   if (!EnsureNotProcessingImport(invocation, scope, err))
@@ -49,6 +227,40 @@ Value Template::Invoke(Scope* scope,
       return Value();
   }
 
+  // Replay the invocation if it's been memoized. (Without an item collector,
+  // defining the items would have been an error.)
+  TemplateCache* cache = is_pure_ ? TemplateCache::current() : nullptr;
+  std::string cache_key;
+  if (cache && !MakeCacheKey(scope, args, invocation_scope.get(), &cache_key))
+    cache = nullptr;
+  ItemSink* collector = scope->GetItemCollector();
+  if (cache) {
+    const TemplateCache::Entry* entry = cache->Find(cache_key);
+    if (entry && (collector || entry->items.empty())) {
+      StatsRecorder::Count(EvaluationStats::TEMPLATE_CACHE_HITS, 1);
+      span.AddArg("cache", "hit");
+      // Mark what the template marked used (possibly in the invoking scope)
+      // when it ran. The key includes whether each member was unused, so this
+      // has the same effect.
+      for (const std::string& member : entry->used_invoker_members)
+        invocation_scope->GetValue(member, true);
+      for (const auto& item : entry->items)
+        collector->AddItem(item->Clone());
+      return entry->result;
+    }
+    StatsRecorder::Count(EvaluationStats::TEMPLATE_CACHE_MISSES, 1);
+    span.AddArg("cache", "miss");
+  }
+
+  // The members of the invoker that are unused before running the template.
+  std::vector<const std::string*> unused_invoker_members;
+  if (cache) {
+    for (const std::string& member : invoker_members_) {
+      if (invocation_scope->IsSetButUnusedInChain(member))
+        unused_invoker_members.push_back(&member);
+    }
+  }
+
   // Set up the scope to run the template and set the current directory for the
   // template (which ScopePerFileProvider uses to base the target-related
   // variables target_gen_dir and target_out_dir on) to be that of the invoker.
@@ -62,21 +274,15 @@ Value Template::Invoke(Scope* scope,
 //  ScopePerFileProvider per_file_provider(&template_scope, true);
 
   // Targets defined in the template go in the collector for the invoking file.
-  template_scope.set_item_collector(scope->GetItemCollector());
+  RecordingItemSink recording_sink(collector);
+  template_scope.set_item_collector(cache && collector ? &recording_sink
+                                                       : collector);
 
-  // We jump through some hoops to avoid copying the invocation scope when
-  // setting it in the template scope (since the invocation scope may have
-  // large lists of source files in it and could be expensive to copy).
-  //
-  // Scope.SetValue will copy the value which will in turn copy the scope, but
-  // if we instead create a value and then set the scope on it, the copy can
-  // be avoided.
-  template_scope.SetValue(variables::kInvoker,
-                          Value(nullptr, std::unique_ptr<Scope>()), invocation);
-  Value* invoker_value = template_scope.GetMutableValue(
-      variables::kInvoker, Scope::SEARCH_NESTED, false);
-  invoker_value->SetScopeValue(std::move(invocation_scope));
-  template_scope.set_source_dir(scope->GetSourceDir());
+  // The invocation scope is moved (not copied, since it may have large lists
+  // of source files in it) into the template scope.
+  Value* invoker_value = template_scope.SetValue(
+      variables::kInvoker, Value(nullptr, std::move(invocation_scope)),
+      invocation);
 
   const StringPiece item_name(variables::kItemName);
   template_scope.SetValue(item_name, Value(invocation, args[0].string_value()),
@@ -111,6 +317,21 @@ Value Template::Invoke(Scope* scope,
   if (!template_scope.CheckForUnusedVars(err))
     return Value();
 
+  if (cache && recording_sink.complete()) {
+    // TODO(C++14): Use std::make_unique.
+    std::unique_ptr<TemplateCache::Entry> entry(new TemplateCache::Entry);
+    entry->templ = RefPtr<const Template>(this);
+    entry->result = result;
+    entry->items = std::move(*recording_sink.items());
+    // A pure template can't have replaced the invoker.
+    assert(invoker_value && invoker_value->type() == Value::SCOPE);
+    const Scope* invoker = invoker_value->scope_value();
+    for (const std::string* member : unused_invoker_members) {
+      if (!invoker->IsSetButUnusedInChain(*member))
+        entry->used_invoker_members.push_back(*member);
+    }
+    cache->Add(cache_key, std::move(entry));
+  }
   return result;
 }
 
@@ -118,14 +339,65 @@ LocationRange Template::GetDefinitionRange() const {
   return definition_->GetRange();
 }
 
+bool Template::MakeCacheKey(const Scope* scope,
+                            const std::vector<Value>& args,
+                            const Scope* invocation_scope,
+                            std::string* key) const {
+  WriteFixed64(reinterpret_cast<uintptr_t>(this), key);
+  WriteString(scope->GetSourceDir().value(), key);
+  WriteVarint(args.size(), key);
+  for (const Value& arg : args) {
+    if (!WriteKeyValue(arg, key))
+      return false;
+  }
+
+  // The values are sorted, so that the key doesn't depend on hashing.
+  Scope::KeyValueMap values;
+  invocation_scope->GetCurrentScopeValues(&values);
+  std::vector<std::pair<StringPiece, const Value*>> sorted_values;
+  for (const auto& pair : values)
+    sorted_values.push_back(std::make_pair(pair.first, &pair.second));
+  std::sort(sorted_values.begin(), sorted_values.end());
+  WriteVarint(sorted_values.size(), key);
+  for (const auto& pair : sorted_values) {
+    WriteString(pair.first, key);
+    WriteVarint(invocation_scope->IsSetButUnused(pair.first) ? 0 : 1, key);
+    if (!WriteKeyValue(*pair.second, key))
+      return false;
+  }
+
+  // Including whether they're unused, which determines what an invocation
+  // marks used (see |Invoke()|).
+  for (const std::string& member : invoker_members_) {
+    const Value* value = invocation_scope->GetValue(member);
+    WriteVarint(value ? 1 : 0, key);
+    if (value) {
+      WriteVarint(invocation_scope->IsSetButUnusedInChain(member) ? 0 : 1, key);
+      if (!WriteKeyValue(*value, key))
+        return false;
+    }
+  }
+  return true;
+}
+
 Template::Template(const Scope* scope, const FunctionCallNode* def)
-    : closure_(scope->MakeClosure()),
+    : closure_(scope->MakeSharedClosure()),
       definition_(def) {
+  CheckPurity();
 }
 
 Template::Template(std::unique_ptr<Scope> scope, const FunctionCallNode* def)
-    : closure_(std::move(scope)), definition_(def) {}
+    : closure_(std::move(scope)), definition_(def) {
+  CheckPurity();
+}
 
 Template::~Template() = default;
 
+void Template::CheckPurity() {
+  PurityChecker checker(closure_.get(), &invoker_members_);
+  is_pure_ = checker.IsPure(definition_->block());
+  if (!is_pure_)
+    invoker_members_.clear();
+}
+
 }  // namespace icl
@@ -6,6 +6,7 @@
 #define ICL_TEMPLATE_H_
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "icl/ref_counted.h"
@@ -25,7 +26,8 @@ class Value;
 // This class is immutable so we can reference it from multiple threads without
 // locking. Normally, this will be assocated with a .gni file and then a
 // reference will be taken by each .gn file that imports it. These files might
-// execute the template in parallel.
+// execute the template in parallel. (Invocations of pure templates may be
+// memoized, but in a separate |TemplateCache|.)
 class Template : public RefCountedThreadSafe<Template> {
  public:
   // Invoke the template. The values correspond to the state of the code
@@ -42,11 +44,25 @@ class Template : public RefCountedThreadSafe<Template> {
   // Returns the location range where this template was defined.
   LocationRange GetDefinitionRange() const;
 
+  // The scope the template is run in (see |Scope::MakeClosure()|) and the
+  // template() call that defined it.
+  const Scope* closure() const { return closure_.get(); }
+  const FunctionCallNode* definition() const { return definition_; }
+
+  // Returns true if the template is pure, so that its invocations may be
+  // memoized (see |TemplateCache|): it only calls pure functions (see
+  // |Function::IsPure()|) and pure templates, and only reads the invoker's
+  // values as "invoker.<name>" (also in strings), so what an invocation does
+  // only depends on its arguments and those values.
+  bool is_pure() const { return is_pure_; }
+
  private:
   FRIEND_REF_COUNTED_THREAD_SAFE(Template);
   FRIEND_MAKE_REF_COUNTED(Template);
 
-  // Makes a new closure based on the given scope.
+  // Makes a new closure based on the given scope. (This shares a snapshot of
+  // the scope's values with other templates defined from the same state; see
+  // |Scope::MakeSharedClosure()|.)
   Template(const Scope* scope, const FunctionCallNode* def);
 
   // Takes ownership of a previously-constructed closure.
@@ -57,8 +73,26 @@ class Template : public RefCountedThreadSafe<Template> {
   Template(const Template&) = delete;
   Template& operator=(const Template&) = delete;
 
+  // Sets |is_pure_| and |invoker_members_| from the definition.
+  void CheckPurity();
+
+  // Makes the key of an invocation for the |TemplateCache|: the invoking
+  // scope's directory, the arguments, the invocation scope's values (and
+  // whether they're used), and the invoker's members the template reads (which
+  // may come from the invoking scope, and again whether they're used). Returns
+  // false if the invocation can't be memoized (since the values include
+  // scopes).
+  bool MakeCacheKey(const Scope* scope,
+                    const std::vector<Value>& args,
+                    const Scope* invocation_scope,
+                    std::string* key) const;
+
   std::unique_ptr<Scope> closure_;
   const FunctionCallNode* definition_;
+
+  bool is_pure_;
+  // The names of the invoker's members that the template reads, if it's pure.
+  std::vector<std::string> invoker_members_;
 };
 
 }  // namespace icl
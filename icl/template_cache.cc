@@ -0,0 +1,40 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/template_cache.h"
+
+#include <utility>
+
+namespace icl {
+
+TemplateCache::Entry::Entry() = default;
+
+TemplateCache::Entry::~Entry() = default;
+
+TemplateCache::TemplateCache() = default;
+
+TemplateCache::~TemplateCache() = default;
+
+const TemplateCache::Entry* TemplateCache::Find(const std::string& key) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = entries_.find(key);
+  return found != entries_.end() ? found->second.get() : nullptr;
+}
+
+void TemplateCache::Add(const std::string& key, std::unique_ptr<Entry> entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.insert(std::make_pair(key, std::move(entry)));
+}
+
+size_t TemplateCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+void TemplateCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+}
+
+}  // namespace icl
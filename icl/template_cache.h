@@ -0,0 +1,86 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_TEMPLATE_CACHE_H_
+#define ICL_TEMPLATE_CACHE_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "icl/evaluation_context.h"
+#include "icl/item.h"
+#include "icl/ref_ptr.h"
+#include "icl/template.h"
+#include "icl/value.h"
+
+namespace icl {
+
+// Memoizes the invocations of pure templates (see |Template::is_pure()|): the
+// first invocation with the given arguments and invoker values runs the
+// template, and later ones replay its result and the items it defined.
+// Invocations on a thread use the thread's current cache (see
+// |EvaluationContext| and |Runner::set_template_cache()|), if any. Hits and
+// misses are counted by the current |StatsRecorder|.
+//
+// Replayed items are copies of the first invocation's (see |Item::Clone()|),
+// so, e.g., the origins of their values are the first invocation's. A cache
+// refers to the parse trees of the files that defined and invoked the
+// templates, so it must be cleared before any of them are unloaded.
+//
+// Thread safety: A cache may be shared by several threads.
+class TemplateCache {
+ public:
+  // What an invocation did.
+  struct Entry {
+    Entry();
+    ~Entry();
+
+    // Keeps the template alive, so that another can't take its place (and its
+    // cache keys).
+    RefPtr<const Template> templ;
+    Value result;
+    std::vector<std::unique_ptr<Item>> items;
+    // The members of the invoker (see |Template::Invoke()|) that were unused
+    // before the invocation, and that it marked used.
+    std::vector<std::string> used_invoker_members;
+  };
+
+  TemplateCache();
+  ~TemplateCache();
+
+  TemplateCache(const TemplateCache&) = delete;
+  TemplateCache& operator=(const TemplateCache&) = delete;
+
+  // The current thread's cache, or null.
+  static TemplateCache* current() {
+    return EvaluationContext::current().template_cache;
+  }
+
+  // Returns the entry for the invocation described by |key| (see
+  // |Template::Invoke()|), or null if there's none. Entries stay valid until
+  // the cache is cleared.
+  const Entry* Find(const std::string& key) const;
+
+  // Adds an entry for |key|, unless another thread added one meanwhile.
+  void Add(const std::string& key, std::unique_ptr<Entry> entry);
+
+  size_t size() const;
+
+  // Removes all the entries. Must not be called while the cache is in use.
+  void Clear();
+
+ private:
+  // Protects the following.
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, std::unique_ptr<Entry>> entries_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_TEMPLATE_CACHE_H_
@@ -8,7 +8,10 @@
 
 #include <utility>
 
+#include "icl/evaluation_context.h"
+#include "icl/evaluation_stats.h"
 #include "icl/string_number_conversions.h"
+#include "icl/template_cache.h"
 #include "icl/test_with_scope.h"
 
 namespace icl {
@@ -101,5 +104,142 @@ TEST(Template, MemoryBlowUp) {
   ASSERT_FALSE(input.has_error());
 }
 
+TEST(Template, IsPure) {
+  TestWithScope setup;
+  TestParseInput input(
+      "template(\"reads_invoker\") {\n"
+      "  assert(invoker.a == \"${invoker.b}\")\n"
+      "}\n"
+      "template(\"calls_pure\") {\n"
+      "  foreach(x, [1, 2]) {\n"
+      "    reads_invoker(item_name) {\n"
+      "      a = \"$x\"\n"
+      "      b = x\n"
+      "    }\n"
+      "  }\n"
+      "}\n"
+      "template(\"prints\") {\n"
+      "  print(item_name)\n"
+      "}\n"
+      "template(\"calls_impure\") {\n"
+      "  prints(item_name) {}\n"
+      "}\n"
+      "template(\"copies_invoker\") {\n"
+      "  x = invoker\n"
+      "}\n"
+      "template(\"interpolates_invoker\") {\n"
+      "  x = \"$invoker\"\n"
+      "}\n");
+  ASSERT_FALSE(input.has_error());
+
+  Err err;
+  input.parsed()->Execute(setup.scope(), &err);
+  ASSERT_FALSE(err.has_error()) << err.message();
+
+  EXPECT_TRUE(setup.scope()->GetTemplate("reads_invoker")->is_pure());
+  EXPECT_TRUE(setup.scope()->GetTemplate("calls_pure")->is_pure());
+  EXPECT_FALSE(setup.scope()->GetTemplate("prints")->is_pure());
+  EXPECT_FALSE(setup.scope()->GetTemplate("calls_impure")->is_pure());
+  EXPECT_FALSE(setup.scope()->GetTemplate("copies_invoker")->is_pure());
+  EXPECT_FALSE(setup.scope()->GetTemplate("interpolates_invoker")->is_pure());
+}
+
+TEST(Template, Memoized) {
+  TestWithScope setup;
+  TemplateCache cache;
+  StatsRecorder recorder;
+  EvaluationContext context = {};
+  context.template_cache = &cache;
+  context.stats_recorder = &recorder;
+  EvaluationContext::Scoped scoped_context(context);
+  TestParseInput input(
+      "template(\"foo\") {\n"
+      "  assert(item_name == invoker.bar)\n"
+      "}\n"
+      "template(\"prints\") {\n"
+      "  print(item_name, invoker.message)\n"
+      "}\n"
+      "bar = \"x\"\n"
+      // Reads "bar" from here. Whether it's unused is part of the key, so
+      // only the third invocation is replayed.
+      "foo(\"x\") {}\n"
+      "foo(\"x\") {}\n"
+      "foo(\"x\") {}\n"
+      "assert(bar == \"x\")\n"
+      "bar = \"y\"\n"
+      "foo(\"y\") {}\n"
+      "foo(\"x\") {\n"
+      "  bar = \"x\"\n"
+      "}\n"
+      "prints(\"a\") {\n"
+      "  message = \"hi\"\n"
+      "}\n"
+      "prints(\"a\") {\n"
+      "  message = \"hi\"\n"
+      "}\n");
+  ASSERT_FALSE(input.has_error());
+
+  Err err;
+  input.parsed()->Execute(setup.scope(), &err);
+  ASSERT_FALSE(err.has_error()) << err.GetErrorMessage();
+
+  EvaluationStats stats = recorder.GetStats();
+  EXPECT_EQ(1u, stats.counter(EvaluationStats::TEMPLATE_CACHE_HITS));
+  EXPECT_EQ(4u, stats.counter(EvaluationStats::TEMPLATE_CACHE_MISSES));
+  EXPECT_EQ(4u, cache.size());
+  // Impure templates always run.
+  EXPECT_EQ("a hi\na hi\n", setup.print_output());
+
+  // The invoker's values (and whether they're used) are part of the key, so
+  // unused ones are still found.
+  TestParseInput unused(
+      "foo(\"x\") {\n"
+      "  bar = \"x\"\n"
+      "  baz = 1\n"
+      "}\n");
+  ASSERT_FALSE(unused.has_error());
+  unused.parsed()->Execute(setup.scope(), &err);
+  EXPECT_TRUE(err.has_error());
+}
+
+// A memoized invocation only marks used what running the template did, so
+// values it didn't read are still found to be unused.
+TEST(Template, MemoizedUnused) {
+  TestWithScope setup;
+  TemplateCache cache;
+  EvaluationContext context = {};
+  context.template_cache = &cache;
+  EvaluationContext::Scoped scoped_context(context);
+  TestParseInput input(
+      "template(\"t\") {\n"
+      "  assert(item_name != \"\")\n"
+      "  if (invoker.flag) {\n"
+      "    assert(invoker.extra == 5)\n"
+      "  }\n"
+      "}\n"
+      "template(\"o\") {\n"
+      "  assert(item_name != \"\")\n"
+      "  extra = 5\n"
+      "  if (invoker.use) {\n"
+      "    assert(extra == 5)\n"
+      "  }\n"
+      "  t(\"z\") {\n"
+      "    flag = false\n"
+      "  }\n"
+      "}\n"
+      "o(\"x\") {\n"
+      "  use = true\n"
+      "}\n"
+      "o(\"y\") {\n"
+      "  use = false\n"
+      "}\n");
+  ASSERT_FALSE(input.has_error());
+
+  Err err;
+  input.parsed()->Execute(setup.scope(), &err);
+  ASSERT_TRUE(err.has_error());
+  EXPECT_EQ("Assignment had no effect.", err.message());
+}
+
 }  // namespace
 }  // namespace icl
@@ -0,0 +1,91 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/test_delegate.h"
+
+#include "icl/function_impls.h"
+#include "icl/item_impls.h"
+#include "icl/source_file.h"
+
+namespace icl {
+
+namespace {
+
+FunctionMap MakeFunctions() {
+  FunctionMap functions = function_impls::GetStandardFunctionsWithImport();
+  functions.insert(BagItem::Fn("bag"));
+  return functions;
+}
+
+}  // namespace
+
+TestDelegate::TestDelegate()
+    : functions_(MakeFunctions()),
+      input_file_manager_(
+          [this](const SourceFile& name, std::string* contents) {
+            return ReadFile(name, contents);
+          }) {}
+
+TestDelegate::TestDelegate(ImportManager::Mode mode,
+                           const std::string& import_cache_dir,
+                           const std::string& key_salt)
+    : functions_(MakeFunctions()),
+      input_file_manager_(
+          [this](const SourceFile& name, std::string* contents) {
+            return ReadFile(name, contents);
+          }),
+      import_manager_(mode, import_cache_dir, key_salt) {}
+
+TestDelegate::~TestDelegate() = default;
+
+std::string TestDelegate::print_output() const {
+  std::lock_guard<std::mutex> lock(print_output_mutex_);
+  return print_output_;
+}
+
+const FunctionMap& TestDelegate::GetFunctions() const {
+  return functions_;
+}
+
+ImportManager* TestDelegate::GetImportManager() {
+  return &import_manager_;
+}
+
+bool TestDelegate::GetInputFile(const LocationRange& origin,
+                                const SourceFile& name,
+                                const InputFile** file) {
+  return input_file_manager_.GetFile(origin, name, file);
+}
+
+StringPiece TestDelegate::GetSourceRoot() const {
+  return StringPiece();
+}
+
+void TestDelegate::Print(const std::string& s) {
+  std::lock_guard<std::mutex> lock(print_output_mutex_);
+  print_output_ += s;
+}
+
+bool TestDelegate::ShouldCollectStats() const {
+  return collect_stats_;
+}
+
+ThreadPool* TestDelegate::GetThreadPool() {
+  return thread_pool_;
+}
+
+Allocator* TestDelegate::GetAllocator() {
+  return allocator_;
+}
+
+bool TestDelegate::ReadFile(const SourceFile& name,
+                            std::string* contents) const {
+  auto found = files_.find(name.value());
+  if (found == files_.end())
+    return false;
+  *contents = found->second;
+  return true;
+}
+
+}  // namespace icl
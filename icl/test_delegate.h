@@ -0,0 +1,78 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_TEST_DELEGATE_H_
+#define ICL_TEST_DELEGATE_H_
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "icl/delegate.h"
+#include "icl/import_manager.h"
+#include "icl/input_file_manager.h"
+
+namespace icl {
+
+// A delegate for running files, for tests: it reads them from a map, and has
+// the standard functions (with import()) and a "bag" item (see |BagItem|).
+//
+// Thread safety: Runs may be done in parallel (e.g., with |Runner::RunMany()|),
+// but the files and settings mustn't be changed meanwhile.
+class TestDelegate : public Delegate {
+ public:
+  TestDelegate();
+  // Uses an import manager with the given mode and import cache (see
+  // |ImportManager|).
+  TestDelegate(ImportManager::Mode mode,
+               const std::string& import_cache_dir,
+               const std::string& key_salt);
+  ~TestDelegate();
+
+  TestDelegate(const TestDelegate&) = delete;
+  TestDelegate& operator=(const TestDelegate&) = delete;
+
+  // The files, by name (e.g., "//foo.icl").
+  std::map<std::string, std::string>& files() { return files_; }
+
+  InputFileManager& input_file_manager() { return input_file_manager_; }
+  ImportManager& import_manager() { return import_manager_; }
+
+  // The output of print() so far.
+  std::string print_output() const;
+
+  void set_thread_pool(ThreadPool* thread_pool) { thread_pool_ = thread_pool; }
+  void set_collect_stats(bool collect_stats) { collect_stats_ = collect_stats; }
+  void set_allocator(Allocator* allocator) { allocator_ = allocator; }
+
+  // |Delegate| methods:
+  const FunctionMap& GetFunctions() const override;
+  ImportManager* GetImportManager() override;
+  bool GetInputFile(const LocationRange& origin,
+                    const SourceFile& name,
+                    const InputFile** file) override;
+  StringPiece GetSourceRoot() const override;
+  void Print(const std::string& s) override;
+  bool ShouldCollectStats() const override;
+  ThreadPool* GetThreadPool() override;
+  Allocator* GetAllocator() override;
+
+ private:
+  bool ReadFile(const SourceFile& name, std::string* contents) const;
+
+  const FunctionMap functions_;
+  std::map<std::string, std::string> files_;
+  InputFileManager input_file_manager_;
+  ImportManager import_manager_;
+  ThreadPool* thread_pool_ = nullptr;
+  bool collect_stats_ = false;
+  Allocator* allocator_ = nullptr;
+
+  mutable std::mutex print_output_mutex_;
+  std::string print_output_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_TEST_DELEGATE_H_
@@ -15,10 +15,11 @@ namespace icl {
 
 TestWithScope::TestWithScope()
     : functions_(icl::function_impls::GetStandardFunctions()),
-      scope_(this) {
+      scope_(this),
+      item_sink_(&items_) {
 //FIXME
 //      scope_progammatic_provider_(&scope_, true) {
-  scope_.set_item_collector(&items_);
+  scope_.set_item_collector(&item_sink_);
 }
 
 TestWithScope::~TestWithScope() = default;
@@ -52,6 +52,7 @@ class TestWithScope : public Delegate {
 
   Scope scope_;
   Scope::ItemVector items_;
+  ItemVectorSink item_sink_;
 
   // Supplies the scope with built-in variables like root_out_dir.
 //FIXME
@@ -0,0 +1,161 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/thread_pool.h"
+
+#include <assert.h>
+
+#include <utility>
+
+namespace icl {
+
+namespace {
+
+// The pool (if any) that the current thread belongs to, and its queue.
+thread_local const ThreadPool* g_current_pool = nullptr;
+thread_local size_t g_current_queue = 0;
+
+}  // namespace
+
+struct ThreadPool::Loop {
+  Loop(const std::function<void(size_t)>& function, size_t count)
+      : function(function), remaining(count) {}
+
+  const std::function<void(size_t)>& function;
+
+  // Protects |remaining|. (The last task notifies |done| with it held, so that
+  // the loop may be destroyed as soon as the caller sees it's done.)
+  std::mutex mutex;
+  std::condition_variable done;
+  size_t remaining;
+};
+
+ThreadPool::ThreadPool(int thread_count) : task_count_(0), stopping_(false) {
+  assert(thread_count >= 0);
+  for (int i = 0; i <= thread_count; i++)
+    queues_.emplace_back(new Queue);
+  for (int i = 0; i < thread_count; i++)
+    threads_.emplace_back(&ThreadPool::RunThread, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stopping_ = true;
+  }
+  tasks_available_.notify_all();
+  for (std::thread& thread : threads_)
+    thread.join();
+}
+
+void ThreadPool::ParallelFor(size_t count,
+                             const std::function<void(size_t)>& function) {
+  if (count == 0)
+    return;
+  if (count == 1 || threads_.empty()) {
+    for (size_t i = 0; i < count; i++)
+      function(i);
+    return;
+  }
+
+  Loop loop(function, count);
+  // Threads in the pool push their (nested) loops onto their own queue, and
+  // take from its back, while other threads steal from the front. Otherwise,
+  // split the loop into a contiguous block per thread.
+  bool in_pool = g_current_pool == this;
+  size_t own_queue = in_pool ? g_current_queue : queues_.size() - 1;
+  task_count_ += count;
+  if (in_pool) {
+    Queue* queue = queues_[own_queue].get();
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    for (size_t i = 0; i < count; i++)
+      queue->tasks.push_back({&loop, i});
+  } else {
+    size_t queue_count = queues_.size();
+    for (size_t q = 0; q < queue_count; q++) {
+      Queue* queue = queues_[q].get();
+      std::lock_guard<std::mutex> lock(queue->mutex);
+      for (size_t i = count * q / queue_count;
+           i < count * (q + 1) / queue_count; i++)
+        queue->tasks.push_back({&loop, i});
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+  }
+  tasks_available_.notify_all();
+
+  // Help until the loop's tasks have all been taken, then wait for them.
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(loop.mutex);
+      if (loop.remaining == 0)
+        break;
+    }
+    Task task;
+    if (!TakeTask(own_queue, &task))
+      break;
+    RunTask(task);
+  }
+  std::unique_lock<std::mutex> lock(loop.mutex);
+  loop.done.wait(lock, [&loop]() { return loop.remaining == 0; });
+}
+
+// static
+int ThreadPool::GetHardwareThreadCount() {
+  unsigned count = std::thread::hardware_concurrency();
+  return count > 0 ? static_cast<int>(count) : 1;
+}
+
+bool ThreadPool::TakeTask(size_t own_queue, Task* task) {
+  {
+    Queue* queue = queues_[own_queue].get();
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (!queue->tasks.empty()) {
+      *task = queue->tasks.back();
+      queue->tasks.pop_back();
+      task_count_--;
+      return true;
+    }
+  }
+  for (size_t i = 1; i < queues_.size(); i++) {
+    Queue* queue = queues_[(own_queue + i) % queues_.size()].get();
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (!queue->tasks.empty()) {
+      *task = queue->tasks.front();
+      queue->tasks.pop_front();
+      task_count_--;
+      return true;
+    }
+  }
+  return false;
+}
+
+// static
+void ThreadPool::RunTask(const Task& task) {
+  task.loop->function(task.index);
+  Loop* loop = task.loop;
+  std::lock_guard<std::mutex> lock(loop->mutex);
+  if (--loop->remaining == 0)
+    loop->done.notify_all();
+}
+
+void ThreadPool::RunThread(size_t queue_index) {
+  g_current_pool = this;
+  g_current_queue = queue_index;
+  for (;;) {
+    Task task;
+    if (TakeTask(queue_index, &task)) {
+      RunTask(task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    tasks_available_.wait(
+        lock, [this]() { return stopping_ || task_count_.load() > 0; });
+    if (stopping_ && task_count_.load() == 0)
+      return;
+  }
+}
+
+}  // namespace icl
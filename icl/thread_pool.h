@@ -0,0 +1,86 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_THREAD_POOL_H_
+#define ICL_THREAD_POOL_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace icl {
+
+// A work-stealing thread pool for running loops in parallel (see
+// |ParallelFor()|). Each thread has its own queue of tasks, taking from one
+// end of it and, when it runs out, stealing from the other end of other
+// threads' queues, so that uneven work (e.g., some root files being much
+// bigger than others) is balanced without a shared queue.
+//
+// Thread safety: All methods may be called on any thread, including from
+// within the functions being run (i.e., loops may be nested).
+class ThreadPool {
+ public:
+  // |thread_count| is the number of threads to start, which may be zero (in
+  // which case loops run on the calling thread). Threads calling
+  // |ParallelFor()| also run iterations, so this is typically one less than
+  // the desired parallelism.
+  explicit ThreadPool(int thread_count);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  int thread_count() const { return static_cast<int>(threads_.size()); }
+
+  // Calls |function(i)| for each |i| in [0, |count|), in parallel on the
+  // pool's threads and the calling thread, and returns once all the calls are
+  // done. (While waiting, the calling thread may also run iterations of other
+  // loops.)
+  void ParallelFor(size_t count, const std::function<void(size_t)>& function);
+
+  // Returns the number of hardware threads (at least 1).
+  static int GetHardwareThreadCount();
+
+ private:
+  struct Loop;
+  struct Task {
+    Loop* loop;
+    size_t index;
+  };
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // Takes a task, from the back of |queues_[own_queue]| if it's a valid index,
+  // and otherwise from the front of another queue. Returns false if there are
+  // no tasks.
+  bool TakeTask(size_t own_queue, Task* task);
+  static void RunTask(const Task& task);
+
+  void RunThread(size_t queue_index);
+
+  // One per thread, plus one shared by threads outside the pool.
+  std::vector<std::unique_ptr<Queue>> queues_;
+  // The number of tasks in the queues (which is only a hint for sleeping).
+  std::atomic<size_t> task_count_;
+
+  // Protects the following.
+  std::mutex sleep_mutex_;
+  std::condition_variable tasks_available_;
+  bool stopping_;
+
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_THREAD_POOL_H_
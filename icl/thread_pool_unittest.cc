@@ -0,0 +1,59 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/thread_pool.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace icl {
+namespace {
+
+TEST(ThreadPool, ParallelFor) {
+  for (int thread_count : {0, 1, 3}) {
+    ThreadPool pool(thread_count);
+    EXPECT_EQ(thread_count, pool.thread_count());
+    for (size_t count : {0u, 1u, 2u, 1000u}) {
+      std::unique_ptr<std::atomic<int>[]> calls(new std::atomic<int>[count]);
+      for (size_t i = 0; i < count; i++)
+        calls[i] = 0;
+      pool.ParallelFor(count, [&calls](size_t i) { calls[i]++; });
+      for (size_t i = 0; i < count; i++)
+        EXPECT_EQ(1, calls[i].load()) << i;
+    }
+  }
+}
+
+TEST(ThreadPool, Nested) {
+  ThreadPool pool(3);
+  const size_t kOuter = 50;
+  const size_t kInner = 40;
+  std::vector<int> sums(kOuter, 0);
+  pool.ParallelFor(kOuter, [&pool, &sums](size_t i) {
+    std::vector<int> values(kInner, 0);
+    pool.ParallelFor(kInner, [&values, i](size_t j) {
+      values[j] = static_cast<int>(i * j);
+    });
+    for (int value : values)
+      sums[i] += value;
+  });
+  for (size_t i = 0; i < kOuter; i++)
+    EXPECT_EQ(static_cast<int>(i * kInner * (kInner - 1) / 2), sums[i]);
+}
+
+TEST(ThreadPool, ManyCallers) {
+  ThreadPool pool(2);
+  std::atomic<int> total(0);
+  ThreadPool callers(3);
+  callers.ParallelFor(8, [&pool, &total](size_t) {
+    pool.ParallelFor(100, [&total](size_t) { total++; });
+  });
+  EXPECT_EQ(800, total.load());
+}
+
+}  // namespace
+}  // namespace icl
@@ -6,6 +6,7 @@
 
 #include <assert.h>
 
+#include "icl/evaluation_stats.h"
 #include "icl/input_file.h"
 
 namespace icl {
@@ -92,6 +93,8 @@ Tokenizer::~Tokenizer() {
 
 // static
 std::vector<Token> Tokenizer::Tokenize(const InputFile* input_file, Err* err) {
+  StatsRecorder::Count(EvaluationStats::BYTES_TOKENIZED,
+                       input_file->contents().size());
   Tokenizer t(input_file, err);
   return t.Run();
 }
@@ -0,0 +1,139 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/tracer.h"
+
+#include <stdio.h>
+
+#include <atomic>
+
+#include "icl/location.h"
+#include "icl/parse_tree.h"
+#include "icl/source_file.h"
+#include "icl/string_number_conversions.h"
+
+namespace icl {
+
+namespace {
+
+// Returns a small number identifying the current thread (for |"tid"|).
+int GetThreadId() {
+  static std::atomic<int> next_thread_id(1);
+  thread_local int thread_id = next_thread_id.fetch_add(1);
+  return thread_id;
+}
+
+// Appends |value| to |*out| as a JSON string.
+void AppendJsonString(StringPiece value, std::string* out) {
+  out->push_back('"');
+  for (char c : value) {
+    switch (c) {
+      case '"':
+        *out += "\\\"";
+        break;
+      case '\\':
+        *out += "\\\\";
+        break;
+      case '\n':
+        *out += "\\n";
+        break;
+      case '\t':
+        *out += "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          *out += escaped;
+        } else {
+          out->push_back(c);
+        }
+        break;
+    }
+  }
+  out->push_back('"');
+}
+
+// Appends |duration| to |*out| in microseconds (the trace format's unit).
+void AppendMicroseconds(std::chrono::steady_clock::duration duration,
+                        std::string* out) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.3f",
+           std::chrono::duration<double, std::micro>(duration).count());
+  *out += buffer;
+}
+
+}  // namespace
+
+void Tracer::Span::Begin(Tracer* tracer,
+                         const char* category,
+                         StringPiece name,
+                         const ParseNode* node,
+                         const SourceFile* file) {
+  // TODO(C++14): Use std::make_unique.
+  event_.reset(new Event);
+  event_->tracer = tracer;
+  event_->category = category;
+  event_->name = name.as_string();
+  if (node)
+    event_->location = node->GetRange().begin().Describe(true);
+  else if (file)
+    event_->location = file->value();
+  event_->thread_id = GetThreadId();
+  // Take the time last, so as to not count the above.
+  event_->begin = std::chrono::steady_clock::now();
+}
+
+void Tracer::Span::End() {
+  event_->duration = std::chrono::steady_clock::now() - event_->begin;
+  Tracer* tracer = event_->tracer;
+  tracer->AddEvent(std::move(event_));
+}
+
+Tracer::Tracer() : start_(std::chrono::steady_clock::now()) {}
+
+Tracer::~Tracer() = default;
+
+size_t Tracer::event_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return events_.size();
+}
+
+std::string Tracer::ToJson() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string json = "{\"traceEvents\":[";
+  for (size_t i = 0; i < events_.size(); i++) {
+    const Event& event = *events_[i];
+    if (i > 0)
+      json += ",";
+    json += "\n{\"name\":";
+    AppendJsonString(event.name, &json);
+    json += ",\"cat\":";
+    AppendJsonString(event.category, &json);
+    json += ",\"ph\":\"X\",\"ts\":";
+    AppendMicroseconds(event.begin - start_, &json);
+    json += ",\"dur\":";
+    AppendMicroseconds(event.duration, &json);
+    json += ",\"pid\":1,\"tid\":";
+    json += NumberToString<int>(event.thread_id);
+    json += ",\"args\":{\"location\":";
+    AppendJsonString(event.location, &json);
+    for (const auto& arg : event.args) {
+      json += ",";
+      AppendJsonString(arg.first, &json);
+      json += ":";
+      AppendJsonString(arg.second, &json);
+    }
+    json += "}}";
+  }
+  json += "\n],\"displayTimeUnit\":\"ms\"}\n";
+  return json;
+}
+
+void Tracer::AddEvent(std::unique_ptr<Event> event) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  events_.push_back(std::move(event));
+}
+
+}  // namespace icl
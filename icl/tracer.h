@@ -0,0 +1,117 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ICL_TRACER_H_
+#define ICL_TRACER_H_
+
+#include <stddef.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "icl/evaluation_context.h"
+#include "icl/string_piece.h"
+
+namespace icl {
+
+class ParseNode;
+class SourceFile;
+
+// Records timed spans of evaluation (loading files, imports, template
+// invocations, function calls and item creation), each with the source
+// location it's for, as Chrome trace events (viewable in chrome://tracing or
+// Perfetto). Spans on a thread are recorded by the thread's current tracer
+// (see |EvaluationContext|), if any; when there's none, a span costs a single
+// branch.
+//
+// Thread safety: A tracer may be shared by several threads.
+class Tracer {
+ private:
+  struct Event;
+
+ public:
+  // A span, from construction to destruction, recorded by the current thread's
+  // tracer (if any). |category| must be a string literal.
+  class Span {
+   public:
+    Span(const char* category, StringPiece name, const ParseNode* node) {
+      Tracer* tracer = current();
+      if (tracer)
+        Begin(tracer, category, name, node, nullptr);
+    }
+    Span(const char* category, StringPiece name, const SourceFile& file) {
+      Tracer* tracer = current();
+      if (tracer)
+        Begin(tracer, category, name, nullptr, &file);
+    }
+    ~Span() {
+      if (event_)
+        End();
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+    // Adds an argument, shown with the span. |key| must be a string literal.
+    void AddArg(const char* key, StringPiece value) {
+      if (event_)
+        event_->args.emplace_back(key, value.as_string());
+    }
+
+   private:
+    void Begin(Tracer* tracer,
+               const char* category,
+               StringPiece name,
+               const ParseNode* node,
+               const SourceFile* file);
+    void End();
+
+    // Null if there's no tracer.
+    std::unique_ptr<Event> event_;
+  };
+
+  Tracer();
+  ~Tracer();
+
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+
+  // The current thread's tracer, or null.
+  static Tracer* current() { return EvaluationContext::current().tracer; }
+
+  // The number of spans recorded so far.
+  size_t event_count() const;
+
+  // Gets the spans recorded so far, in the Chrome trace event format.
+  std::string ToJson() const;
+
+ private:
+  struct Event {
+    Tracer* tracer;
+    const char* category;
+    std::string name;
+    std::string location;
+    std::vector<std::pair<const char*, std::string>> args;
+    int thread_id;
+    std::chrono::steady_clock::time_point begin;
+    std::chrono::steady_clock::duration duration;
+  };
+
+  void AddEvent(std::unique_ptr<Event> event);
+
+  // Timestamps are relative to this.
+  const std::chrono::steady_clock::time_point start_;
+
+  // Protects the following.
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Event>> events_;
+};
+
+}  // namespace icl
+
+#endif  // ICL_TRACER_H_
@@ -0,0 +1,90 @@
+// Copyright 2016 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "icl/tracer.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+
+#include "icl/evaluation_context.h"
+#include "icl/source_file.h"
+
+namespace icl {
+namespace {
+
+TEST(Tracer, Disabled) {
+  Tracer tracer;
+  {
+    Tracer::Span span("test", "span", SourceFile("//foo.icl"));
+    span.AddArg("key", "value");
+  }
+  EXPECT_EQ(0u, tracer.event_count());
+  EXPECT_EQ(nullptr, Tracer::current());
+}
+
+TEST(Tracer, Spans) {
+  Tracer tracer;
+  {
+    EvaluationContext context = {};
+    context.tracer = &tracer;
+    EvaluationContext::Scoped scoped_context(context);
+    EXPECT_EQ(&tracer, Tracer::current());
+
+    Tracer::Span outer("test", "outer", SourceFile("//foo.icl"));
+    {
+      Tracer::Span inner("test", "in\"ner", SourceFile("//bar.icl"));
+      inner.AddArg("key", "a\nb\\c");
+    }
+    EXPECT_EQ(1u, tracer.event_count());
+  }
+  EXPECT_EQ(nullptr, Tracer::current());
+  EXPECT_EQ(2u, tracer.event_count());
+
+  std::string json = tracer.ToJson();
+  EXPECT_EQ(0u, json.find("{\"traceEvents\":[")) << json;
+  // Spans are recorded when they end.
+  size_t inner = json.find(
+      "{\"name\":\"in\\\"ner\",\"cat\":\"test\",\"ph\":\"X\",\"ts\":");
+  size_t outer =
+      json.find("{\"name\":\"outer\",\"cat\":\"test\",\"ph\":\"X\",\"ts\":");
+  ASSERT_NE(std::string::npos, inner) << json;
+  ASSERT_NE(std::string::npos, outer) << json;
+  EXPECT_LT(inner, outer);
+  EXPECT_NE(std::string::npos,
+            json.find("\"args\":{\"location\":\"//bar.icl\","
+                      "\"key\":\"a\\nb\\\\c\"}}"))
+      << json;
+  EXPECT_NE(std::string::npos,
+            json.find("\"args\":{\"location\":\"//foo.icl\"}}"))
+      << json;
+}
+
+TEST(Tracer, Threads) {
+  Tracer tracer;
+  auto run = [&tracer]() {
+    EvaluationContext context = {};
+    context.tracer = &tracer;
+    EvaluationContext::Scoped scoped_context(context);
+    Tracer::Span span("test", "span", SourceFile("//foo.icl"));
+  };
+  std::thread thread1(run);
+  std::thread thread2(run);
+  thread1.join();
+  thread2.join();
+  ASSERT_EQ(2u, tracer.event_count());
+
+  // The spans are on different threads.
+  std::string json = tracer.ToJson();
+  size_t tid1 = json.find("\"tid\":");
+  ASSERT_NE(std::string::npos, tid1);
+  size_t tid2 = json.find("\"tid\":", tid1 + 1);
+  ASSERT_NE(std::string::npos, tid2);
+  EXPECT_NE(json.substr(tid1, json.find(',', tid1) - tid1),
+            json.substr(tid2, json.find(',', tid2) - tid2));
+}
+
+}  // namespace
+}  // namespace icl
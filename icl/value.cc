@@ -9,6 +9,7 @@
 
 #include <utility>
 
+#include "icl/evaluation_stats.h"
 #include "icl/scope.h"
 #include "icl/string_number_conversions.h"
 
@@ -47,7 +48,10 @@ Value::Value(const ParseNode* origin, std::string str_val)
       string_value_(std::move(str_val)),
       boolean_value_(false),
       int_value_(0),
-      origin_(origin) {}
+      origin_(origin) {
+  StatsRecorder::CountAllocation(Allocator::VALUE_STRING,
+                                 string_value_.size());
+}
 
 Value::Value(const ParseNode* origin, const char* str_val)
     : type_(STRING),
@@ -55,6 +59,8 @@ Value::Value(const ParseNode* origin, const char* str_val)
       boolean_value_(false),
       int_value_(0),
       origin_(origin) {
+  StatsRecorder::CountAllocation(Allocator::VALUE_STRING,
+                                 string_value_.size());
 }
 
 Value::Value(const ParseNode* origin, std::unique_ptr<Scope> scope)
@@ -65,6 +71,27 @@ Value::Value(const ParseNode* origin, std::unique_ptr<Scope> scope)
       scope_value_(std::move(scope)),
       origin_(origin) {}
 
+namespace {
+
+// Counts a copy of |value|, and the storage it allocates (see
+// |EvaluationStats|).
+void CountCopy(const Value& value) {
+  if (value.type() == Value::STRING) {
+    StatsRecorder::CountAllocation(Allocator::VALUE_STRING,
+                                   value.string_value().size());
+  } else if (value.type() == Value::LIST) {
+    StatsRecorder::Count(EvaluationStats::VALUE_DEEP_COPIES, 1);
+    StatsRecorder::Count(EvaluationStats::VALUE_DEEP_COPY_ELEMENTS,
+                         value.list_value().size());
+    StatsRecorder::CountAllocation(
+        Allocator::VALUE_LIST, value.list_value().size() * sizeof(Value));
+  } else if (value.type() == Value::SCOPE) {
+    StatsRecorder::Count(EvaluationStats::VALUE_DEEP_COPIES, 1);
+  }
+}
+
+}  // namespace
+
 Value::Value(const Value& other)
     : type_(other.type_),
       string_value_(other.string_value_),
@@ -72,6 +99,7 @@ Value::Value(const Value& other)
       int_value_(other.int_value_),
       list_value_(other.list_value_),
       origin_(other.origin_) {
+  CountCopy(other);
   if (type() == SCOPE && other.scope_value_.get())
     scope_value_ = other.scope_value_->MakeClosure();
 }
@@ -82,6 +110,7 @@ Value::~Value() {
 }
 
 Value& Value::operator=(const Value& other) {
+  CountCopy(other);
   type_ = other.type_;
   string_value_ = other.string_value_;
   boolean_value_ = other.boolean_value_;